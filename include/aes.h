@@ -44,10 +44,11 @@
 #include <openssl/err.h>
 
 typedef struct aes_context_t {
-  EVP_CIPHER_CTX      *enc_ctx;                /* openssl's reusable evp_* en/de-cryption context */
-  EVP_CIPHER_CTX      *dec_ctx;                /* openssl's reusable evp_* en/de-cryption context */
+  EVP_CIPHER_CTX      *enc_ctx;                /* openssl's evp_* encryption context, keyed once, only the iv changes */
+  EVP_CIPHER_CTX      *dec_ctx;                /* openssl's evp_* decryption context, keyed once, only the iv changes */
+  EVP_CIPHER_CTX      *ctr_ctx;                /* openssl's evp_* ctr mode context, keyed once, only the iv changes */
   const EVP_CIPHER    *cipher;                 /* cipher to use: e.g. EVP_aes_128_cbc */
-  uint8_t             key[AES256_KEY_BYTES];   /* the pure key data for payload encryption & decryption */
+  const EVP_CIPHER    *ctr_cipher;             /* ctr mode cipher to use: e.g. EVP_aes_128_ctr */
   AES_KEY             ecb_dec_key;             /* one step ecb decryption key */
 } aes_context_t;
 
@@ -72,17 +73,62 @@ typedef struct aes_context_t {
 #endif // ---------------------------------------------------------------------------------
 
 
+#define AES_GCM_NONCE_SIZE      12
+#define AES_GCM_TAG_SIZE        16
+
+#if defined (HAVE_OPENSSL_1_1) // openSSL 1.1 ---------------------------------------------
+
+typedef struct aes_gcm_context_t {
+  EVP_CIPHER_CTX      *enc_ctx;                /* openssl's evp_* encryption context, keyed once, only the nonce changes */
+  EVP_CIPHER_CTX      *dec_ctx;                /* openssl's evp_* decryption context, keyed once, only the nonce changes */
+} aes_gcm_context_t;
+
+#elif defined (__AES__) && defined (__SSE2__) && defined (__SSSE3__) && defined (__PCLMUL__) // AES-NI, PCLMULQDQ
+
+#define AES_GCM_PCLMUL
+
+typedef struct aes_gcm_context_t {
+  aes_context_t       *aes;
+  __m128i             h[4];                    /* H, H^2, H^3, H^4 of the hash key, byte-reflected */
+} aes_gcm_context_t;
+
+#else // plain C, AES-NI without PCLMULQDQ -------------------------------------------------
+
+typedef struct aes_gcm_context_t {
+  aes_context_t       *aes;
+  uint64_t            hl[16];                  /* 4-bit multiplication table of the hash key */
+  uint64_t            hh[16];
+} aes_gcm_context_t;
+
+#endif // ---------------------------------------------------------------------------------
+
+
 int aes_cbc_encrypt (unsigned char *out, const unsigned char *in, size_t in_len,
                      const unsigned char *iv, aes_context_t *ctx);
 
 int aes_cbc_decrypt (unsigned char *out, const unsigned char *in, size_t in_len,
                      const unsigned char *iv, aes_context_t *ctx);
 
+int aes_ctr_crypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                   const unsigned char *iv, aes_context_t *ctx);
+
 int aes_ecb_decrypt (unsigned char *out, const unsigned char *in, aes_context_t *ctx);
 
 int aes_init (const unsigned char *key, size_t key_size, aes_context_t **ctx);
 
 int aes_deinit (aes_context_t *ctx);
 
+int aes_gcm_encrypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                     const unsigned char *nonce, const unsigned char *aad, size_t aad_len,
+                     unsigned char *tag, aes_gcm_context_t *ctx);
+
+int aes_gcm_decrypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                     const unsigned char *nonce, const unsigned char *aad, size_t aad_len,
+                     const unsigned char *tag, aes_gcm_context_t *ctx);
+
+int aes_gcm_init (const unsigned char *key, size_t key_size, aes_gcm_context_t **ctx);
+
+int aes_gcm_deinit (aes_gcm_context_t *ctx);
+
 
 #endif // AES_H
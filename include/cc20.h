@@ -22,19 +22,22 @@
 
 #include <stdint.h>
 #include "n2n.h"               // HAVE_OPENSSL_1_1, traceEvent ...
+#include "poly1305.h"
 
 #define CC20_IV_SIZE           16
 #define CC20_KEY_BYTES       (256/8)
 
+#define CC20_POLY1305_NONCE_SIZE 12
+#define CC20_POLY1305_TAG_SIZE   POLY1305_TAG_SIZE
+
 #ifdef HAVE_OPENSSL_1_1 // openSSL 1.1 ----------------------------------------------------
 
 #include <openssl/evp.h>
 #include <openssl/err.h>
 
 typedef struct cc20_context_t {
-  EVP_CIPHER_CTX      *ctx;                    /* openssl's reusable evp_* en/de-cryption context */
+  EVP_CIPHER_CTX      *ctx;                    /* openssl's evp_* en/de-cryption context, keyed once, only the iv changes */
   const EVP_CIPHER    *cipher;                 /* cipher to use: e.g. EVP_chacha20() */
-  uint8_t             key[CC20_KEY_BYTES];     /* the pure key data for payload encryption & decryption */
 } cc20_context_t;
 
 #elif defined (__SSE2__)  // SSE ----------------------------------------------------------
@@ -61,6 +64,16 @@ int cc20_crypt (unsigned char *out, const unsigned char *in, size_t in_len,
                 const unsigned char *iv, cc20_context_t *ctx);
 
 
+int cc20_poly1305_encrypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                           const unsigned char *nonce, const unsigned char *aad, size_t aad_len,
+                           unsigned char *tag, cc20_context_t *ctx);
+
+
+int cc20_poly1305_decrypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                           const unsigned char *nonce, const unsigned char *aad, size_t aad_len,
+                           const unsigned char *tag, cc20_context_t *ctx);
+
+
 int cc20_init (const unsigned char *key, cc20_context_t **ctx);
 
 
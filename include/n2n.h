@@ -78,6 +78,7 @@
 #include <sys/socket.h>
 #include <sys/param.h>
 #include <pthread.h>
+#define N2N_HAVE_ASYNC_LOG 1 /* background log writer, see startTraceThread() */
 
 #ifdef __linux__
 #define N2N_CAN_NAME_IFACE 1
@@ -89,6 +90,37 @@
 #include <linux/if_tun.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
+#define N2N_HAVE_MMSG 1
+#include <netinet/udp.h>
+#if defined(UDP_SEGMENT) && !defined(SKIP_UDP_GSO)
+#define N2N_HAVE_UDP_GSO 1
+#endif
+#if defined(UDP_GRO) && !defined(SKIP_UDP_GRO)
+#define N2N_HAVE_UDP_GRO 1
+#endif
+#ifdef IFF_VNET_HDR
+#define N2N_HAVE_TAP_OFFLOAD 1
+#include <sys/uio.h>
+#include <linux/virtio_net.h>
+#endif
+#ifdef N2N_HAVE_IO_URING /* set by the build, see N2N_OPTION_USE_IO_URING */
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#endif
+#ifndef SKIP_EPOLL
+#define N2N_HAVE_EPOLL 1
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#ifdef IFF_MULTI_QUEUE
+#define N2N_HAVE_TAP_MQ 1 /* the multi-queue workers run epoll loops */
+#ifndef SKIP_PIPELINE
+#define N2N_HAVE_PIPELINE 1 /* shares the locking of the TAP queue workers */
+#include <sys/eventfd.h>
+#include <poll.h>
+#endif
+#endif
+#endif
 #endif /* #ifdef __linux__ */
 
 #ifdef __FreeBSD__
@@ -113,6 +145,10 @@ typedef struct ether_hdr ether_hdr_t;
 #include <zstd.h>
 #endif
 
+#ifdef N2N_HAVE_LZ4
+#include <lz4.h>
+#endif
+
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/udp.h>
@@ -172,11 +208,169 @@ typedef struct tuntap_dev {
   uint32_t        device_mask;
   uint16_t        mtu;
   char            dev_name[N2N_IFNAMSIZ];
+  uint8_t         num_queues;                     /* multi-queue TAP: fd is queue_fd[0] */
+  int             queue_fd[N2N_MAX_TAP_QUEUES];
+  uint8_t         offload;                        /* frames are preceded by a virtio-net header */
 } tuntap_dev;
 
 #define SOCKET int
 #endif /* #ifndef WIN32 */
 
+#ifdef __GNUC__
+#define N2N_CACHE_ALIGNED __attribute__((aligned(N2N_CACHE_LINE_SIZE)))
+#else
+#define N2N_CACHE_ALIGNED
+#endif
+
+/** A packet buffer: N2N_PKT_HEADROOM in front of the payload for the PACKET
+ *  header and the transform preamble, N2N_PKT_TAILROOM behind it. It goes
+ *  back to the pool when the last reference is put. */
+struct n2n_buf {
+  struct n2n_buf      *next;                   /**< Free list link. */
+  uint32_t            refcnt;
+  void                *mem;                    /**< Allocated on demand, NULL if part of the pool. */
+  uint8_t             data[N2N_PKT_ROOM_SIZE] N2N_CACHE_ALIGNED;
+} N2N_CACHE_ALIGNED;
+
+#define N2N_BUF_PAYLOAD(b)      ((b)->data + N2N_PKT_HEADROOM)
+
+/** Preallocated packet buffers shared by the threads of an edge or a
+ *  supernode. */
+typedef struct n2n_buf_pool {
+  n2n_buf_t           *free;
+  unsigned int        num_free;
+  unsigned int        num_bufs;
+  size_t              heap_allocs;             /**< Buffers allocated because the pool ran dry. */
+  void                *mem;
+#ifdef N2N_HAVE_TAP_MQ
+  pthread_mutex_t     lock;
+#endif
+} n2n_buf_pool_t;
+
+/** Free list of a single thread, refilled from and spilled to the pool in
+ *  bunches so that the pool lock is rarely taken. */
+typedef struct n2n_buf_cache {
+  n2n_buf_pool_t      *pool;
+  n2n_buf_t           *free;
+  unsigned int        num_free;
+} n2n_buf_cache_t;
+
+/** Destination of a known peer. Two entries share a cache line, so that a
+ *  lookup touches a single line for the MAC and the socket. */
+typedef struct n2n_peer_cache_entry {
+  n2n_mac_t           mac;
+  uint8_t             used;
+  uint8_t             pad;
+  n2n_sock_t          sock;
+  uint32_t            expires;                 /**< (uint32_t) time the peer must be registered again. */
+} n2n_peer_cache_entry_t;
+
+#define N2N_PEER_CACHE_WAYS     (N2N_CACHE_LINE_SIZE / sizeof(n2n_peer_cache_entry_t))
+
+/** Open-addressed table of the known peers for the TX path, see
+ *  n2n_peer_cache.c. known_peers stays the authoritative list. */
+typedef struct n2n_peer_cache {
+  n2n_peer_cache_entry_t *front[N2N_PEER_CACHE_FRONT]; /**< Last destinations, checked first. */
+  unsigned int        front_next;
+  n2n_peer_cache_entry_t *slots;               /**< N2N_PEER_CACHE_BUCKETS * N2N_PEER_CACHE_WAYS */
+  void                *mem;
+} n2n_peer_cache_t;
+
+#ifdef N2N_HAVE_UDP_GSO
+/** Control message buffer carrying the UDP_SEGMENT size. */
+typedef union n2n_udp_gso_cmsg {
+  char                buf[CMSG_SPACE(sizeof(uint16_t))];
+  struct cmsghdr      align;
+} n2n_udp_gso_cmsg_t;
+#endif
+
+#ifdef N2N_HAVE_MMSG
+/** Packet buffers for batched UDP I/O with recvmmsg()/sendmmsg(). */
+typedef struct n2n_mmsg_batch {
+  uint8_t             enabled;                 /**< TX: queue packets instead of sending them. */
+  unsigned int        count;                   /**< TX: number of queued packets. */
+  struct mmsghdr      msgs[N2N_MMSG_BATCH_SIZE];
+  struct iovec        iovs[N2N_MMSG_BATCH_SIZE];
+  struct sockaddr_in  addrs[N2N_MMSG_BATCH_SIZE];
+  uint8_t             bufs[N2N_MMSG_BATCH_SIZE][N2N_PKT_ROOM_SIZE]; /**< TX: TAP frames are read to N2N_PKT_HEADROOM. */
+#ifdef N2N_HAVE_UDP_GSO
+  struct mmsghdr      gso_msgs[N2N_MMSG_BATCH_SIZE];  /**< TX: runs of packets to the same peer. */
+  n2n_udp_gso_cmsg_t  gso_cmsgs[N2N_MMSG_BATCH_SIZE];
+#endif
+} n2n_mmsg_batch_t;
+#endif
+
+#ifdef N2N_HAVE_UDP_GSO
+/** Datagrams of one size to one destination, sent with a single UDP_SEGMENT
+ *  sendmsg(). */
+typedef struct n2n_udp_gso_queue {
+  uint8_t             enabled;                 /**< Queue datagrams instead of sending them. */
+  uint8_t             failed;                  /**< A GSO send failed, stop using it. */
+  struct sockaddr_in  dest;
+  uint16_t            seg_size;                /**< Size of all datagrams but the last one. */
+  uint16_t            num_segs;
+  size_t              len;
+  uint8_t             buf[N2N_UDP_GSO_MAX_SIZE];
+} n2n_udp_gso_queue_t;
+#endif
+
+#ifdef N2N_HAVE_UDP_GRO
+/** Receive buffers for coalesced datagrams (UDP_GRO), each carrying the
+ *  segment size in a control message. */
+typedef struct n2n_udp_gro_batch {
+  struct mmsghdr      msgs[N2N_UDP_GRO_BATCH_SIZE];
+  struct iovec        iovs[N2N_UDP_GRO_BATCH_SIZE];
+  struct sockaddr_in  addrs[N2N_UDP_GRO_BATCH_SIZE];
+  union {
+    char              buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr    align;
+  }                   cmsgs[N2N_UDP_GRO_BATCH_SIZE];
+  uint8_t             bufs[N2N_UDP_GRO_BATCH_SIZE][N2N_UDP_GRO_BUF_SIZE];
+} n2n_udp_gro_batch_t;
+#endif
+
+#ifdef N2N_HAVE_IO_URING
+/** An io_uring instance driven through the raw system calls. */
+typedef struct n2n_uring {
+  int                 fd;
+  void                *ring_ptr;               /**< Mapping of the SQ and CQ rings. */
+  size_t              ring_size;
+  struct io_uring_sqe *sqes;
+  size_t              sqes_size;
+  unsigned int        *sq_head, *sq_tail, *sq_array;
+  unsigned int        sq_mask, sq_entries;
+  unsigned int        sqe_tail;                /**< SQEs prepared, incl. the not yet submitted ones. */
+  unsigned int        *cq_head, *cq_tail;
+  unsigned int        cq_mask;
+  struct io_uring_cqe *cqes;
+} n2n_uring_t;
+
+/** State of the edge's io_uring main loop: buffers registered with the ring
+ *  for the TAP reads and writes, the buffer ring feeding the multishot UDP
+ *  receive and the TX batches being sent. */
+typedef struct n2n_edge_uring {
+  n2n_uring_t         ring;
+  uint8_t             fixed_bufs;              /**< tap_rx and tap_tx are registered buffers. */
+  unsigned int        inflight;                /**< Requests not completed yet. */
+  uint8_t             failed;                  /**< The kernel lacks a feature, fall back to epoll. */
+  int                 udp_fd;                  /**< Socket the UDP receive is armed on. */
+  int                 mgmt_fd;                 /**< Sockets polled through the ring. */
+  int                 multicast_fd;
+  uint32_t            sock_gen;                /**< n2n_edge_t.sock_gen the requests are armed for. */
+  int                 tap_fd;
+  struct msghdr       udp_msg;                 /**< Layout of the received datagrams. */
+  struct io_uring_buf_ring *udp_buf_ring;
+  uint8_t             *udp_bufs;
+  struct __kernel_timespec housekeeping;
+  n2n_mmsg_batch_t    *tx_batches[N2N_URING_TX_BATCHES]; /**< [0] is the worker's own batch. */
+  unsigned int        tx_inflight[N2N_URING_TX_BATCHES];
+  unsigned int        num_tap_tx_free;
+  uint16_t            tap_tx_free[N2N_URING_TAP_WRITES];
+  uint8_t             tap_rx[N2N_URING_TAP_READS][N2N_PKT_ROOM_SIZE];
+  uint8_t             tap_tx[N2N_URING_TAP_WRITES][N2N_PKT_BUF_SIZE];
+} n2n_edge_uring_t;
+#endif
+
 /** Uncomment this to enable the MTU check, then try to ssh to generate a fragmented packet. */
 /** NOTE: see doc/MTU.md for an explanation on the 1400 value */
 //#define MTU_ASSERT_VALUE 1400
@@ -191,6 +385,16 @@ typedef char dec_ip_str_t[N2N_NETMASK_STR_SIZE];
 typedef char dec_ip_bit_str_t[N2N_NETMASK_STR_SIZE + 4];
 
 
+/** P2P state of a known peer. It turns REVALIDATING when it has been idle
+ *  for timeout/2: the traffic keeps going to its socket while a REGISTER
+ *  probes it. If the probe is not answered within PEER_REVALIDATE_TIMEOUT
+ *  it is STALE and gets removed, the traffic then goes via the supernode. */
+typedef enum n2n_peer_state {
+  N2N_PEER_ACTIVE = 0,
+  N2N_PEER_REVALIDATING,
+  N2N_PEER_STALE
+} n2n_peer_state_t;
+
 struct peer_info {
   n2n_mac_t        mac_addr;
   n2n_ip_subnet_t  dev_addr;
@@ -200,6 +404,9 @@ struct peer_info {
   time_t           last_p2p;
   time_t           last_sent_query;
   uint64_t         last_valid_time_stamp;
+  uint32_t         zstd_dict_id;   /* zstd dictionary announced by the peer, 0 = none */
+  n2n_peer_state_t state;
+  time_t           revalidate_start; /* when the REGISTER probes started */
 
   UT_hash_handle   hh; /* makes this structure hashable */
 };
@@ -259,6 +466,7 @@ typedef struct n2n_tuntap_priv_config {
   int                 mtu;
   uint8_t             got_s;
   uint8_t             daemon;
+  uint8_t             async_log;
 #ifndef WIN32
   uid_t               userid;
   gid_t               groupid;
@@ -277,6 +485,10 @@ typedef struct n2n_edge_conf {
   he_context_t        *header_iv_ctx;         /**< Header IV ecnryption cipher context, REMOVE as soon as seperte fileds for checksum and replay protection available */
   n2n_transform_t     transop_id;             /**< The transop to use. */
   uint8_t             compression;            /**< Compress outgoing data packets before encryption */
+  uint8_t             tap_queues;             /**< Number of TAP queues, each served by its own worker thread. */
+  uint8_t             tap_offload;            /**< Read TSO super-frames from the TAP and segment them in the edge. */
+  uint8_t             io_uring;               /**< Do the TAP and UDP I/O with io_uring. */
+  uint8_t             pipeline_workers;       /**< Encode and decode in this many pipeline threads, 0 = inline. */
   uint16_t            num_routes;	            /**< Number of routes in routes */
   uint8_t             tuntap_ip_mode;         /**< Interface IP address allocated mode, eg. DHCP. */
   uint8_t             allow_routing;          /**< Accept packet no to interface address. */
@@ -286,6 +498,7 @@ typedef struct n2n_edge_conf {
   uint8_t             sn_num;                 /**< Number of supernode addresses defined. */
   uint8_t             tos;                    /** TOS for sent packets */
   char                *encrypt_key;
+  char                *zstd_dict;             /**< Path of a trained zstd dictionary. */
   int                 register_interval;      /**< Interval for supernode registration, also used for UDP NAT hole punching. */
   int                 register_ttl;           /**< TTL for registration packet when UDP NAT hole punching through supernode. */
   int                 local_port;
@@ -302,6 +515,136 @@ struct n2n_edge_stats {
   uint32_t rx_sup_broadcast;
 };
 
+#ifdef N2N_HAVE_PIPELINE
+/** A packet passing through the pipeline: read by the TAP or UDP reader,
+ *  encoded or decoded in place by a worker and written out by the writer
+ *  thread of its direction in the order of seq. */
+typedef struct n2n_pipeline_job {
+  uint32_t            seq;                     /**< Order in which the reader got the packets. */
+  uint16_t            in_len;                  /**< Input at N2N_BUF_PAYLOAD(buf). */
+  uint16_t            out_len;                 /**< 0 if nothing is to be written. */
+  uint8_t             *out;                    /**< Result, somewhere in buf. */
+  struct sockaddr_in  sender;                  /**< RX: sender of the datagram. */
+  n2n_sock_t          dest;                    /**< TX: destination of the PACKET. */
+  n2n_buf_t           *buf;                    /**< Referenced by the job from the reader to the writer. */
+} n2n_pipeline_job_t;
+
+/** Lock-free ring passing jobs from one producer to one consumer thread. */
+typedef struct n2n_spsc_ring {
+  unsigned int        head __attribute__((aligned(64))); /**< Written by the consumer only. */
+  unsigned int        tail __attribute__((aligned(64))); /**< Written by the producer only. */
+  n2n_pipeline_job_t  *slots[N2N_PIPELINE_JOBS];
+} n2n_spsc_ring_t;
+
+struct n2n_pipeline;
+#endif
+
+/** Compression estimate of a flow. */
+typedef struct n2n_comp_flow {
+  uint32_t            key;                     /**< Hash of the destination MAC and the IPv4 flow. */
+  uint16_t            ratio;                   /**< Moving average of compressed / plain size in 1/256. */
+  uint16_t            skip;                    /**< Frames left to send without trying to compress. */
+} n2n_comp_flow_t;
+
+/** Adaptive compression state of a worker. */
+typedef struct n2n_comp_ctl {
+  n2n_comp_flow_t     flows[N2N_COMP_FLOWS];
+  int                 zstd_level;              /**< Current level, tuned to the CPU time compression takes. */
+  uint64_t            win_start;               /**< Clock at the start of the measuring window. */
+  uint64_t            win_cycles;              /**< Clock spent compressing in the window. */
+  uint32_t            win_frames;
+  uint64_t            saved;                   /**< Bytes saved by compression. */
+  uint64_t            cycles;                  /**< Clock cycles spent compressing. */
+  uint64_t            skipped;                 /**< Frames not even tried. */
+} n2n_comp_ctl_t;
+
+/** Data path state of a thread: its TAP (queue), the UDP socket to send on,
+ *  the transform and the compression scratch memory. */
+typedef struct n2n_edge_worker {
+  n2n_edge_t          *eee;
+  uint8_t             idx;                     /**< TAP queue served by this worker. */
+  tuntap_dev          *device;                 /**< TAP device to read from and write to. */
+  int                 udp_sock;                /**< Socket to send data packets on. */
+  n2n_trans_op_t      *transop;                /**< Transop instance (key schedule) of this worker. */
+  lzo_align_t         *lzo_wrkmem;             /**< LZO compression work memory. */
+#ifdef N2N_HAVE_ZSTD
+  ZSTD_CCtx           *zstd_cctx;              /**< Reused for every frame, NULL unless compressing with zstd. */
+  ZSTD_DCtx           *zstd_dctx;
+#endif
+#ifdef N2N_HAVE_LZ4
+  void                *lz4_state;              /**< LZ4 compression state, NULL unless compressing with lz4. */
+#endif
+  n2n_buf_cache_t     buf_cache;               /**< Packet buffers of this thread. */
+  n2n_buf_t           *comp_buf;               /**< (De)compressed payload, TX with N2N_PKT_HEADROOM. */
+  n2n_comp_ctl_t      *comp_ctl;               /**< NULL unless compressing. */
+#ifdef N2N_HAVE_UDP_GSO
+  uint8_t             udp_gso;                 /**< The socket supports UDP_SEGMENT. */
+#endif
+#ifdef N2N_HAVE_UDP_GRO
+  n2n_udp_gro_batch_t *gro_batch;              /**< Receive buffers, NULL unless the socket does UDP_GRO. */
+#endif
+#ifdef N2N_HAVE_IO_URING
+  n2n_edge_uring_t    *uring;                  /**< Set while the io_uring main loop runs. */
+#endif
+#ifdef N2N_HAVE_PIPELINE
+  n2n_pipeline_job_t  *pipe_job;               /**< Job being processed by a pipeline worker. */
+  n2n_buf_t           *cur_buf;                /**< Holds the frame being read, a job may reference it. */
+#endif
+#ifdef N2N_HAVE_TAP_OFFLOAD
+  uint8_t             *gso_buf;                /**< Super-frame read from an offloading TAP to N2N_PKT_HEADROOM. */
+#endif
+#ifdef N2N_HAVE_MMSG
+  n2n_mmsg_batch_t    *rx_batch;               /**< Receive buffers for recvmmsg(). */
+  n2n_mmsg_batch_t    *tx_batch;               /**< Transmit buffers for sendmmsg(). */
+#endif
+#ifdef N2N_HAVE_TAP_MQ
+  tuntap_dev          queue_device;            /**< Device copy holding the queue fd of this worker. */
+  n2n_trans_op_t      queue_transop;           /**< Own transop of the additional workers. */
+  int                 *keep_running;
+  pthread_t           thread;
+#endif
+} n2n_edge_worker_t;
+
+#ifdef N2N_HAVE_PIPELINE
+enum { N2N_PIPE_TX = 0, N2N_PIPE_RX = 1 }; /* pipeline directions */
+
+/** A crypto/compression thread of the pipeline, with an input and an output
+ *  ring per direction. */
+typedef struct n2n_pipeline_worker {
+  struct n2n_pipeline *pipeline;
+  n2n_edge_worker_t   w;
+  n2n_trans_op_t      transop;
+  n2n_spsc_ring_t     in[2];
+  n2n_spsc_ring_t     out[2];
+  int                 wake_fd;                 /**< eventfd the thread sleeps on when idle. */
+  uint8_t             sleeping;
+  pthread_t           thread;
+} n2n_pipeline_worker_t;
+
+/** One direction of the pipeline: TAP -> UDP (TX) or UDP -> TAP (RX). */
+typedef struct n2n_pipeline_dir {
+  n2n_pipeline_job_t  *jobs;
+  n2n_spsc_ring_t     free;                    /**< Jobs handed back from the writer to the reader. */
+  uint32_t            read_seq;                /**< Next seq the reader assigns. */
+  uint32_t            write_seq;               /**< Next seq the writer writes. */
+  int                 wake_fd;                 /**< eventfd of the writer thread. */
+  uint8_t             sleeping;
+  n2n_buf_cache_t     buf_cache;               /**< The writer puts the job buffers here. */
+  pthread_t           writer;
+} n2n_pipeline_dir_t;
+
+/** Staged data path: the main thread reads from the TAP and the UDP socket,
+ *  the workers encode and decode, a writer per direction sends and writes
+ *  the results in the original order. */
+typedef struct n2n_pipeline {
+  n2n_edge_t          *eee;
+  uint8_t             running;                 /**< The threads are running, hand the packets over. */
+  uint8_t             num_workers;
+  n2n_pipeline_worker_t *workers;
+  n2n_pipeline_dir_t  dir[2];
+} n2n_pipeline_t;
+#endif
+
 struct n2n_edge {
   n2n_edge_conf_t     conf;
 
@@ -321,6 +664,7 @@ struct n2n_edge {
   n2n_sock_t          supernode;
   int                 udp_sock;
   int                 udp_mgmt_sock;           /**< socket for status info. */
+  uint32_t            sock_gen;                /**< Counts the (re-)openings of the sockets, fd numbers get reused. */
 
 #ifndef SKIP_MULTICAST_PEERS_DISCOVERY
   n2n_sock_t          multicast_peer;          /**< Multicast peer group (for local edges) */
@@ -337,6 +681,32 @@ struct n2n_edge {
   time_t              last_p2p;                /**< Last time p2p traffic was received. */
   time_t              last_sup;                /**< Last time a packet arrived from supernode. */
   time_t              start_time;              /**< For calculating uptime */
+  time_t              last_transop_tick;       /**< Last time the transop tick was run. */
+  time_t              last_iface_check;        /**< Last time the DHCP address was re-checked. */
+  time_t              last_purge_known;        /**< Last time known_peers was purged. */
+  time_t              last_purge_pending;      /**< Last time pending_peers was purged. */
+
+#ifdef N2N_HAVE_EPOLL
+  int                 epoll_fd;                /**< epoll instance of the main loop, -1 if not running. */
+#endif
+
+  /* Data path */
+  n2n_buf_pool_t      *buf_pool;               /**< Packet buffers of all threads. */
+  n2n_peer_cache_t    *peer_cache;             /**< Destinations of known_peers, under the edge lock. */
+#ifdef N2N_HAVE_ZSTD
+  ZSTD_CDict          *zstd_cdict;             /**< Dictionary of the community, NULL if none is loaded. */
+  ZSTD_DDict          *zstd_ddict;
+#endif
+  uint32_t            zstd_dict_id;            /**< Its ID, announced to the peers in REGISTER(_ACK). */
+  n2n_edge_worker_t   worker;                  /**< Data path state of the main thread (TAP queue 0). */
+#ifdef N2N_HAVE_TAP_MQ
+  n2n_edge_worker_t   *mq_workers;             /**< Workers of the additional TAP queues. */
+  uint8_t             num_workers;             /**< Number of running workers, including the main thread. */
+  pthread_mutex_t     lock;                    /**< Protects peers, supernode state and stats between workers. */
+#endif
+#ifdef N2N_HAVE_PIPELINE
+  n2n_pipeline_t      *pipeline;               /**< Pipeline threads, if configured. */
+#endif
 
 
   struct n2n_edge_stats stats;                 /**< Statistics */
@@ -382,6 +752,7 @@ typedef struct n2n_sn
   time_t start_time; /* Used to measure uptime. */
   sn_stats_t stats;
   int daemon;           /* If non-zero then daemonise. */
+  int async_log;        /* If non-zero then write the log from a background thread. */
   uint16_t lport;       /* Local UDP port to bind to. */
   uint16_t mport;       /* Management UDP port to bind to. */
   int sock;             /* Main socket for UDP traffic with edges. */
@@ -395,6 +766,11 @@ typedef struct n2n_sn
   int lock_communities; /* If true, only loaded and matching communities can be used. */
   struct sn_community *communities;
   struct sn_community_regular_expression *rules;
+#ifdef N2N_HAVE_UDP_GSO
+  n2n_udp_gso_queue_t *gso_queue; /* Relayed datagrams collected per wakeup, NULL if the kernel lacks UDP GSO. */
+#endif
+  n2n_buf_pool_t *buf_pool; /* Packet buffers. */
+  n2n_buf_cache_t buf_cache;
 } n2n_sn_t;
 
 /* ************************************** */
@@ -410,6 +786,17 @@ typedef struct n2n_sn
 #define TRACE_DEBUG     4, __FILE__, __LINE__
 #endif
 
+/* Trace levels above this one are compiled out, e.g. -DN2N_MIN_TRACE_LEVEL=2
+ * leaves errors, warnings and normal messages only. Release builds drop
+ * the debug messages by default. */
+#ifndef N2N_MIN_TRACE_LEVEL
+#ifdef NDEBUG
+#define N2N_MIN_TRACE_LEVEL 3
+#else
+#define N2N_MIN_TRACE_LEVEL 4
+#endif
+#endif
+
 /* ************************************** */
 
 /* Transop Init Functions */
@@ -418,6 +805,32 @@ int n2n_transop_tf_init(const n2n_edge_conf_t *conf, n2n_trans_op_t *ttt);
 int n2n_transop_aes_init(const n2n_edge_conf_t *conf, n2n_trans_op_t *ttt);
 int n2n_transop_cc20_init(const n2n_edge_conf_t *conf, n2n_trans_op_t *ttt);
 int n2n_transop_speck_init(const n2n_edge_conf_t *conf, n2n_trans_op_t *ttt);
+int n2n_transop_aes_gcm_init(const n2n_edge_conf_t *conf, n2n_trans_op_t *ttt);
+int n2n_transop_cc20_poly1305_init(const n2n_edge_conf_t *conf, n2n_trans_op_t *ttt);
+int n2n_transop_aes_ctr_init(const n2n_edge_conf_t *conf, n2n_trans_op_t *ttt);
+
+/* Old transform API on top of the in-place transforms */
+int n2n_transop_fwd_shim(n2n_trans_op_t *arg, uint8_t *outbuf, size_t out_len,
+                         const uint8_t *inbuf, size_t in_len, const n2n_mac_t peer_mac);
+int n2n_transop_rev_shim(n2n_trans_op_t *arg, uint8_t *outbuf, size_t out_len,
+                         const uint8_t *inbuf, size_t in_len, const n2n_mac_t peer_mac);
+
+/* Packet buffers */
+n2n_buf_pool_t* n2n_buf_pool_create(unsigned int num_bufs);
+void n2n_buf_pool_destroy(n2n_buf_pool_t *pool);
+void n2n_buf_cache_init(n2n_buf_cache_t *cache, n2n_buf_pool_t *pool);
+void n2n_buf_cache_flush(n2n_buf_cache_t *cache);
+n2n_buf_t* n2n_buf_get(n2n_buf_cache_t *cache);
+n2n_buf_t* n2n_buf_ref(n2n_buf_t *buf);
+void n2n_buf_put(n2n_buf_cache_t *cache, n2n_buf_t *buf);
+
+/* Destination cache */
+n2n_peer_cache_t* n2n_peer_cache_create(void);
+void n2n_peer_cache_destroy(n2n_peer_cache_t *cache);
+void n2n_peer_cache_clear(n2n_peer_cache_t *cache);
+const n2n_peer_cache_entry_t* n2n_peer_cache_find(n2n_peer_cache_t *cache, const n2n_mac_t mac);
+void n2n_peer_cache_set(n2n_peer_cache_t *cache, const n2n_mac_t mac, const n2n_sock_t *sock, uint32_t expires);
+void n2n_peer_cache_del(n2n_peer_cache_t *cache, const n2n_mac_t mac);
 
 /* Log */
 void setTraceLevel(int level);
@@ -425,11 +838,39 @@ void setUseSyslog(int use_syslog);
 void setTraceFile(FILE *f);
 int getTraceLevel();
 void closeTraceFile();
-void traceEvent(int eventTraceLevel, char* file, int line, char * format, ...);
+void _traceEvent(int eventTraceLevel, char* file, int line, char * format, ...);
+extern int traceLevel;
+#ifdef N2N_HAVE_ASYNC_LOG
+int startTraceThread();
+void stopTraceThread();
+unsigned int getTraceDrops();
+#endif
+
+/* The level is checked before the arguments get evaluated, the messages
+ * nobody sees do not cost their formatting. N2N_TRACE_EXPAND splits the
+ * TRACE_* arguments for preprocessors which pass __VA_ARGS__ as one. */
+#define N2N_TRACE_EXPAND(x)     x
+#define N2N_TRACE(lvl, file, line, ...)                                 \
+  do {                                                                  \
+    if(((lvl) <= N2N_MIN_TRACE_LEVEL) && ((lvl) <= traceLevel))         \
+      _traceEvent(lvl, file, line, __VA_ARGS__);                        \
+  } while(0)
+#define traceEvent(...)         N2N_TRACE_EXPAND(N2N_TRACE(__VA_ARGS__))
 
 /* Tuntap API */
 int tuntap_open(tuntap_dev *device, char *dev, const char *address_mode, char *device_ip,
 		char *device_mask, const char * device_mac, int mtu);
+#ifdef __linux__
+int tuntap_open_ext(tuntap_dev *device, char *dev, const char *address_mode, char *device_ip,
+		    char *device_mask, const char * device_mac, int mtu, int num_queues, int offload);
+#endif
+#ifdef N2N_HAVE_TAP_OFFLOAD
+typedef void (*tuntap_frame_cb_f)(void *arg, uint8_t *frame, size_t len);
+int tuntap_read_offload(struct tuntap_dev *tuntap, struct virtio_net_hdr *vnet_hdr,
+			unsigned char *buf, int len);
+int tuntap_offload_segment(const struct virtio_net_hdr *vnet_hdr, uint8_t *frame, size_t len,
+			   uint8_t *seg_buf, size_t seg_size, tuntap_frame_cb_f cb, void *arg);
+#endif
 int tuntap_read(struct tuntap_dev *tuntap, unsigned char *buf, int len);
 int tuntap_write(struct tuntap_dev *tuntap, unsigned char *buf, int len);
 void tuntap_close(struct tuntap_dev *tuntap);
@@ -453,10 +894,30 @@ char* sock_to_cstr( n2n_sock_str_t out,
 		    const n2n_sock_t * sock );
 char * ip_subnet_to_str(dec_ip_bit_str_t buf, const n2n_ip_subnet_t *ipaddr);
 SOCKET open_socket(int local_port, int bind_any);
+SOCKET open_reuseport_socket(int local_port, int bind_any);
+#ifdef N2N_HAVE_UDP_GSO
+int udp_gso_probe(SOCKET sock);
+void udp_gso_set_cmsg(struct msghdr *msg, n2n_udp_gso_cmsg_t *cmsg, uint16_t seg_size);
+#endif
+#ifdef N2N_HAVE_UDP_GRO
+int udp_gro_enable(SOCKET sock);
+#endif
+#ifdef N2N_HAVE_IO_URING
+int uring_init(n2n_uring_t *ring, unsigned int entries);
+void uring_exit(n2n_uring_t *ring);
+struct io_uring_sqe* uring_get_sqe(n2n_uring_t *ring);
+int uring_submit(n2n_uring_t *ring, unsigned int wait_nr);
+struct io_uring_cqe* uring_peek_cqe(n2n_uring_t *ring);
+void uring_cqe_seen(n2n_uring_t *ring);
+int uring_register(n2n_uring_t *ring, unsigned int opcode, void *arg, unsigned int nr_args);
+#endif
 int sock_equal( const n2n_sock_t * a,
 		const n2n_sock_t * b );
 
 /* Header encryption */
+time_t n2n_clock_update(void);
+time_t n2n_now(void);
+uint64_t n2n_now_usec(void);
 uint64_t time_stamp(void);
 uint64_t initial_time_stamp (void);
 int time_stamp_verify_and_update (uint64_t stamp, uint64_t * previous_stamp);
@@ -477,13 +938,13 @@ void edge_term_conf(n2n_edge_conf_t *conf);
 /* Public functions */
 n2n_edge_t* edge_init(const n2n_edge_conf_t *conf, int *rv);
 void update_supernode_reg(n2n_edge_t * eee, time_t nowTime);
-void readFromIPSocket(n2n_edge_t * eee, int in_sock);
+int readFromIPSocket(n2n_edge_t * eee, int in_sock);
 void edge_term(n2n_edge_t *eee);
 void edge_set_callbacks(n2n_edge_t *eee, const n2n_edge_callbacks_t *callbacks);
 void edge_set_userdata(n2n_edge_t *eee, void *user_data);
 void* edge_get_userdata(n2n_edge_t *eee);
 void edge_send_packet2net(n2n_edge_t *eee, uint8_t *tap_pkt, size_t len);
-void edge_read_from_tap(n2n_edge_t *eee);
+int edge_read_from_tap(n2n_edge_t *eee);
 int edge_get_n2n_socket(n2n_edge_t *eee);
 int edge_get_management_socket(n2n_edge_t *eee);
 int run_edge_loop(n2n_edge_t *eee, int *keep_running);
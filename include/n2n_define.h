@@ -34,9 +34,38 @@
 
 #define IFACE_UPDATE_INTERVAL           (30) /* sec. How long it usually takes to get an IP lease. */
 #define TRANSOP_TICK_INTERVAL           (10) /* sec */
+#define HOUSEKEEPING_INTERVAL           (1)  /* sec. Period of the main loop timer driving registration and purging */
+#define N2N_EPOLL_MAX_EVENTS            16
+#define N2N_MMSG_BATCH_SIZE             32   /* datagrams per recvmmsg()/sendmmsg() call */
+#define N2N_MAX_TAP_QUEUES              16   /* multi-queue TAP, one worker thread per queue */
+#define N2N_UDP_GSO_MAX_SEGS            64   /* datagrams per UDP_SEGMENT send (kernel UDP_MAX_SEGMENTS) */
+#define N2N_UDP_GSO_MAX_SIZE            65000 /* bytes per UDP_SEGMENT send */
+#define N2N_UDP_GRO_BATCH_SIZE          8    /* coalesced datagrams per recvmmsg() call */
+#define N2N_UDP_GRO_BUF_SIZE            65535 /* bytes of a coalesced datagram */
+#define N2N_URING_ENTRIES               256  /* SQ size of the io_uring main loop */
+#define N2N_URING_TAP_READS             16   /* TAP reads kept outstanding */
+#define N2N_URING_TAP_WRITES            64   /* TAP writes in flight */
+#define N2N_URING_UDP_BUFS              64   /* buffers for the multishot UDP receive, a power of 2 */
+#define N2N_URING_UDP_BGID              1    /* their buffer group */
+#define N2N_URING_TX_BATCHES            4    /* TX batches in flight */
+#define N2N_PIPELINE_JOBS               256  /* packets in flight per pipeline direction, a power of 2 */
+#define N2N_PIPELINE_MAX_WORKERS        16
+#define N2N_TAP_GSO_BUF_SIZE            (65536 + 64) /* TSO super-frame read from the TAP, incl. ethernet header */
+#define N2N_PKT_HEADROOM                (64 + N2N_TRANSFORM_HEADROOM) /* in front of a TAP frame: PACKET header and transform preamble */
+#define N2N_PKT_TAILROOM                N2N_TRANSFORM_TAILROOM
+#define N2N_PKT_ROOM_SIZE               (N2N_PKT_HEADROOM + N2N_PKT_BUF_SIZE + N2N_PKT_TAILROOM) /* buffer a PACKET is built in around the frame */
+#define N2N_BUF_POOL_SIZE               64   /* preallocated packet buffers, more with a pipeline */
+#define N2N_BUF_CACHE_SIZE              32   /* packet buffers a thread keeps for itself */
+#define N2N_CACHE_LINE_SIZE             64
+#define N2N_PEER_CACHE_BUCKETS          1024 /* destination cache buckets of one cache line each, power of 2 */
+#define N2N_PEER_CACHE_FRONT            4    /* last destinations looked up before hashing */
+
+#define N2N_TRACE_MSG_SIZE              1024 /* longer log messages get truncated */
+#define N2N_TRACE_RING_SIZE             256  /* messages queued for the log thread, power of 2 */
 
 #define PURGE_REGISTRATION_FREQUENCY   30
 #define REGISTRATION_TIMEOUT           60
+#define PEER_REVALIDATE_TIMEOUT         3 /* sec. an idle known peer has to answer the REGISTER probe */
 
 #define SORT_COMMUNITIES_INTERVAL      90 /* sec. until supernode sorts communities' hash list again */
 
@@ -59,8 +88,19 @@
 #define N2N_COMPRESSION_ID_NONE		1	/* default, see edge_init_conf_defaults(...) in edge_utils.c */
 #define N2N_COMPRESSION_ID_LZO		2	/* set if '-z1' or '-z' cli option is present, see setOption(...) in edge.c */
 #define N2N_COMPRESSION_ID_ZSTD		3	/* set if '-z2' cli option is present, available only if compiled with zstd lib */
+#define N2N_COMPRESSION_ID_LZ4		4	/* set if '-z3' cli option is present, available only if compiled with lz4 lib */
 #define ZSTD_COMPRESSION_LEVEL		7	/* 1 (faster) ... 22 (more compression) */
 
+/* Adaptive compression, see comp_flow_skip(...) in edge_utils.c */
+#define N2N_COMP_FLOWS			256	/* flows tracked per worker */
+#define N2N_COMP_BAD_RATIO		243	/* compressed/plain in 1/256: stop trying flows above ~95% */
+#define N2N_COMP_SKIP_FRAMES		256	/* frames sent as they are before trying such a flow again */
+#define N2N_COMP_WINDOW			1024	/* compressed frames per zstd level adjustment */
+#define N2N_COMP_CPU_HIGH		40	/* % of the time spent compressing to lower the zstd level above... */
+#define N2N_COMP_CPU_LOW		10	/* ... and to raise it below */
+#define N2N_ZSTD_LEVEL_MIN		1
+#define N2N_ZSTD_LEVEL_MAX		12
+
 /* (un)purgeable community indicator (supernode) */
 #define COMMUNITY_UNPURGEABLE		0
 #define COMMUNITY_PURGEABLE		1
@@ -25,6 +25,10 @@
 #define N2N_TRANSFORM_ID_USER_START     64
 #define N2N_TRANSFORM_ID_MAX            65535
 
+/* Room an in-place transform may use in front of and behind the payload */
+#define N2N_TRANSFORM_HEADROOM          32
+#define N2N_TRANSFORM_TAILROOM          32
+
 typedef enum n2n_transform {
   N2N_TRANSFORM_ID_INVAL = 0,
   N2N_TRANSFORM_ID_NULL = 1,
@@ -32,6 +36,9 @@ typedef enum n2n_transform {
   N2N_TRANSFORM_ID_AES = 3,
   N2N_TRANSFORM_ID_CHACHA20 = 4,
   N2N_TRANSFORM_ID_SPECK = 5,
+  N2N_TRANSFORM_ID_AES_GCM = 6,
+  N2N_TRANSFORM_ID_CHACHA20_POLY1305 = 7,
+  N2N_TRANSFORM_ID_AES_CTR = 8,
 } n2n_transform_t;
 
 struct n2n_trans_op;
@@ -44,6 +51,17 @@ typedef int             (*n2n_transform_f)( struct n2n_trans_op * arg,
                                             const uint8_t * inbuf,
                                             size_t in_len,
                                             const n2n_mac_t peer_mac);
+/* Transforms the len bytes at *buf in place and points *buf to the result.
+ * Encoding may grow the payload by up to N2N_TRANSFORM_HEADROOM bytes in
+ * front and N2N_TRANSFORM_TAILROOM bytes behind, the caller provides the
+ * room. AEAD transforms also authenticate the aad_len bytes at aad, the
+ * others ignore them. Returns the resulting length or -1. */
+typedef int             (*n2n_transform_inplace_f)( struct n2n_trans_op * arg,
+                                                    uint8_t ** buf,
+                                                    size_t len,
+                                                    const uint8_t * aad,
+                                                    size_t aad_len,
+                                                    const n2n_mac_t peer_mac);
 
 /** Holds the info associated with a data transform plugin.
  *
@@ -62,6 +80,8 @@ typedef struct n2n_trans_op {
   n2n_transtick_f    tick;   /* periodic maintenance */
   n2n_transform_f     fwd;    /* encode a payload */
   n2n_transform_f     rev;    /* decode a payload */
+  n2n_transform_inplace_f fwd_inplace; /* encode a payload in place */
+  n2n_transform_inplace_f rev_inplace; /* decode a payload in place */
 } n2n_trans_op_t;
 
 #endif /* #if !defined(N2N_TRANSFORMS_H_) */
@@ -126,6 +126,7 @@ typedef struct n2n_REGISTER
   n2n_mac_t            dstMac;         /**< MAC of target edge */
   n2n_sock_t           sock;           /**< REVISIT: unused? */
   n2n_ip_subnet_t      dev_addr;       /**< IP address of the tuntap adapter. */
+  uint32_t             zstd_dict_id;   /**< Optional: zstd dictionary of the sender, 0 = none. */
 } n2n_REGISTER_t;
 
 typedef struct n2n_REGISTER_ACK
@@ -134,6 +135,7 @@ typedef struct n2n_REGISTER_ACK
   n2n_mac_t            srcMac;         /**< MAC of acknowledging party (supernode or edge) */
   n2n_mac_t            dstMac;         /**< Reflected MAC of registering edge from REGISTER */
   n2n_sock_t           sock;           /**< Supernode's view of edge socket (IP Addr, port) */
+  uint32_t             zstd_dict_id;   /**< Optional: zstd dictionary of the sender, 0 = none. */
 } n2n_REGISTER_ACK_t;
 
 typedef struct n2n_PACKET
@@ -322,6 +324,14 @@ int encode_PACKET( uint8_t * base,
                    const n2n_common_t * common,
                    const n2n_PACKET_t * pkt );
 
+/* The PACKET fields a relaying supernode leaves untouched, authenticated
+ * by the AEAD transforms. */
+#define N2N_PACKET_AAD_SIZE     (2 * N2N_MAC_SIZE + 2)
+
+int encode_PACKET_aad( uint8_t * base,
+                       size_t * idx,
+                       const n2n_PACKET_t * pkt );
+
 int decode_PACKET( n2n_PACKET_t * pkt,
                    const n2n_common_t * cmn, /* info on how to interpret it */
                    const uint8_t * base,
@@ -0,0 +1,68 @@
+/**
+ * (C) 2007-20 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#ifndef POLY1305_H
+#define POLY1305_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define POLY1305_KEY_SIZE      32
+#define POLY1305_TAG_SIZE      16
+#define POLY1305_BLOCK_SIZE    16
+
+#if defined (__SIZEOF_INT128__) // 64-bit --------------------------------------------------
+
+#if defined (__AVX2__)
+#include <immintrin.h>
+#endif
+
+typedef struct poly1305_context {
+  uint64_t    r[3];                           /* 44/44/42-bit limbs */
+  uint64_t    h[3];
+  uint64_t    pad[2];
+#if defined (__AVX2__)
+  uint32_t    rn[4][5];                       /* r^4 .. r^1 in 26-bit limbs for the four lanes */
+  int         rn_ready;
+#endif
+  size_t      leftover;
+  uint8_t     buffer[POLY1305_BLOCK_SIZE];
+} poly1305_context_t;
+
+#else // 32-bit ---------------------------------------------------------------------------
+
+typedef struct poly1305_context {
+  uint32_t    r[5];                           /* 26-bit limbs */
+  uint32_t    h[5];
+  uint32_t    pad[4];
+  size_t      leftover;
+  uint8_t     buffer[POLY1305_BLOCK_SIZE];
+} poly1305_context_t;
+
+#endif // 64-bit, 32-bit ------------------------------------------------------------------
+
+
+void poly1305_init (poly1305_context_t *ctx, const uint8_t *key);
+
+void poly1305_update (poly1305_context_t *ctx, const uint8_t *m, size_t len);
+
+void poly1305_finish (poly1305_context_t *ctx, uint8_t *tag);
+
+
+#endif // POLY1305_H
@@ -47,30 +47,25 @@ int aes_cbc_encrypt (unsigned char *out, const unsigned char *in, size_t in_len,
   int evp_len;
   int evp_ciphertext_len;
 
-  if(1 == EVP_EncryptInit_ex(ctx->enc_ctx, ctx->cipher, NULL, ctx->key, iv)) {
-    if(1 == EVP_CIPHER_CTX_set_padding(ctx->enc_ctx, 0)) {
-      if(1 == EVP_EncryptUpdate(ctx->enc_ctx, out, &evp_len, in, in_len)) {
-        evp_ciphertext_len = evp_len;
-        if(1 == EVP_EncryptFinal_ex(ctx->enc_ctx, out + evp_len, &evp_len)) {
-          evp_ciphertext_len += evp_len;
-          if(evp_ciphertext_len != in_len)
-            traceEvent(TRACE_ERROR, "aes_cbc_encrypt openssl encryption: encrypted %u bytes where %u were expected",
-                                    evp_ciphertext_len, in_len);
-        } else
-          traceEvent(TRACE_ERROR, "aes_cbc_encrypt openssl final encryption: %s",
-                                  openssl_err_as_string());
+  // the context already holds the key schedule, just set the iv
+  if(1 == EVP_EncryptInit_ex(ctx->enc_ctx, NULL, NULL, NULL, iv)) {
+    if(1 == EVP_EncryptUpdate(ctx->enc_ctx, out, &evp_len, in, in_len)) {
+      evp_ciphertext_len = evp_len;
+      if(1 == EVP_EncryptFinal_ex(ctx->enc_ctx, out + evp_len, &evp_len)) {
+        evp_ciphertext_len += evp_len;
+        if(evp_ciphertext_len != in_len)
+          traceEvent(TRACE_ERROR, "aes_cbc_encrypt openssl encryption: encrypted %u bytes where %u were expected",
+                                  evp_ciphertext_len, in_len);
       } else
-        traceEvent(TRACE_ERROR, "aes_cbc_encrypt openssl encrpytion: %s",
+        traceEvent(TRACE_ERROR, "aes_cbc_encrypt openssl final encryption: %s",
                                 openssl_err_as_string());
     } else
-      traceEvent(TRACE_ERROR, "aes_cbc_encrypt openssl padding setup: %s",
+      traceEvent(TRACE_ERROR, "aes_cbc_encrypt openssl encrpytion: %s",
                               openssl_err_as_string());
   } else
     traceEvent(TRACE_ERROR, "aes_cbc_encrypt openssl init: %s",
                             openssl_err_as_string());
 
-  EVP_CIPHER_CTX_reset(ctx->enc_ctx);
-
   return 0;
 }
 
@@ -81,34 +76,59 @@ int aes_cbc_decrypt (unsigned char *out, const unsigned char *in, size_t in_len,
   int evp_len;
   int evp_plaintext_len;
 
-  if(1 == EVP_DecryptInit_ex(ctx->dec_ctx, ctx->cipher, NULL, ctx->key, iv)) {
-    if(1 == EVP_CIPHER_CTX_set_padding(ctx->dec_ctx, 0)) {
-      if(1 == EVP_DecryptUpdate(ctx->dec_ctx, out, &evp_len, in, in_len)) {
-        evp_plaintext_len = evp_len;
-        if(1 == EVP_DecryptFinal_ex(ctx->dec_ctx, out + evp_len, &evp_len)) {
-          evp_plaintext_len += evp_len;
-          if(evp_plaintext_len != in_len)
-            traceEvent(TRACE_ERROR, "aes_cbc_decrypt openssl decryption: decrypted %u bytes where %u were expected",
-                                    evp_plaintext_len, in_len);
-        } else
-          traceEvent(TRACE_ERROR, "aes_cbc_decrypt openssl final decryption: %s",
-                                  openssl_err_as_string());
+  // the context already holds the key schedule, just set the iv
+  if(1 == EVP_DecryptInit_ex(ctx->dec_ctx, NULL, NULL, NULL, iv)) {
+    if(1 == EVP_DecryptUpdate(ctx->dec_ctx, out, &evp_len, in, in_len)) {
+      evp_plaintext_len = evp_len;
+      if(1 == EVP_DecryptFinal_ex(ctx->dec_ctx, out + evp_len, &evp_len)) {
+        evp_plaintext_len += evp_len;
+        if(evp_plaintext_len != in_len)
+          traceEvent(TRACE_ERROR, "aes_cbc_decrypt openssl decryption: decrypted %u bytes where %u were expected",
+                                  evp_plaintext_len, in_len);
       } else
-        traceEvent(TRACE_ERROR, "aes_cbc_decrypt openssl decrpytion: %s",
+        traceEvent(TRACE_ERROR, "aes_cbc_decrypt openssl final decryption: %s",
                                 openssl_err_as_string());
     } else
-      traceEvent(TRACE_ERROR, "aes_cbc_decrypt openssl padding setup: %s",
+      traceEvent(TRACE_ERROR, "aes_cbc_decrypt openssl decrpytion: %s",
                               openssl_err_as_string());
   } else
     traceEvent(TRACE_ERROR, "aes_cbc_decrypt openssl init: %s",
                             openssl_err_as_string());
 
-  EVP_CIPHER_CTX_reset(ctx->dec_ctx);
-
   return 0;
 }
 
 
+int aes_ctr_crypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                   const unsigned char *iv, aes_context_t *ctx) {
+
+  int evp_len;
+  int evp_ciphertext_len;
+
+  // the context already holds the key schedule, just set the iv (initial counter)
+  if(1 == EVP_EncryptInit_ex(ctx->ctr_ctx, NULL, NULL, NULL, iv)) {
+    if(1 == EVP_EncryptUpdate(ctx->ctr_ctx, out, &evp_len, in, in_len)) {
+      evp_ciphertext_len = evp_len;
+      if(1 == EVP_EncryptFinal_ex(ctx->ctr_ctx, out + evp_len, &evp_len)) {
+        evp_ciphertext_len += evp_len;
+        if(evp_ciphertext_len == in_len)
+          return in_len;
+        traceEvent(TRACE_ERROR, "aes_ctr_crypt openssl encryption: encrypted %u bytes where %u were expected",
+                                evp_ciphertext_len, in_len);
+      } else
+        traceEvent(TRACE_ERROR, "aes_ctr_crypt openssl final encryption: %s",
+                                openssl_err_as_string());
+    } else
+      traceEvent(TRACE_ERROR, "aes_ctr_crypt openssl encryption: %s",
+                              openssl_err_as_string());
+  } else
+    traceEvent(TRACE_ERROR, "aes_ctr_crypt openssl init: %s",
+                            openssl_err_as_string());
+
+  return -1;
+}
+
+
 int aes_ecb_decrypt (unsigned char *out, const unsigned char *in, aes_context_t *ctx) {
 
   AES_ecb_encrypt(in, out, &(ctx->ecb_dec_key), AES_DECRYPT);
@@ -136,25 +156,50 @@ int aes_init (const unsigned char *key, size_t key_size, aes_context_t **ctx) {
                             openssl_err_as_string());
     return -1;
   }
+  if(!((*ctx)->ctr_ctx = EVP_CIPHER_CTX_new())) {
+    traceEvent(TRACE_ERROR, "aes_init openssl's evp_* ctr context creation failed: %s",
+                            openssl_err_as_string());
+    return -1;
+  }
 
   // check key size and make key size (given in bytes) dependant settings
   switch(key_size) {
     case AES128_KEY_BYTES:    // 128 bit key size
       (*ctx)->cipher = EVP_aes_128_cbc();
+      (*ctx)->ctr_cipher = EVP_aes_128_ctr();
       break;
     case AES192_KEY_BYTES:    // 192 bit key size
       (*ctx)->cipher = EVP_aes_192_cbc();
+      (*ctx)->ctr_cipher = EVP_aes_192_ctr();
       break;
     case AES256_KEY_BYTES:    // 256 bit key size
       (*ctx)->cipher = EVP_aes_256_cbc();
+      (*ctx)->ctr_cipher = EVP_aes_256_ctr();
       break;
     default:
        traceEvent(TRACE_ERROR, "aes_init invalid key size %u\n", key_size);
        return -1;
   }
 
-  // key materiel handling
-  memcpy((*ctx)->key, key, key_size);
+  // key materiel handling: the key schedule is set up once here, the packets
+  // only set the iv
+  if((1 != EVP_EncryptInit_ex((*ctx)->enc_ctx, (*ctx)->cipher, NULL, key, NULL))
+     || (1 != EVP_CIPHER_CTX_set_padding((*ctx)->enc_ctx, 0))) {
+    traceEvent(TRACE_ERROR, "aes_init openssl encryption key setup: %s",
+                            openssl_err_as_string());
+    return -1;
+  }
+  if((1 != EVP_DecryptInit_ex((*ctx)->dec_ctx, (*ctx)->cipher, NULL, key, NULL))
+     || (1 != EVP_CIPHER_CTX_set_padding((*ctx)->dec_ctx, 0))) {
+    traceEvent(TRACE_ERROR, "aes_init openssl decryption key setup: %s",
+                            openssl_err_as_string());
+    return -1;
+  }
+  if(1 != EVP_EncryptInit_ex((*ctx)->ctr_ctx, (*ctx)->ctr_cipher, NULL, key, NULL)) {
+    traceEvent(TRACE_ERROR, "aes_init openssl ctr key setup: %s",
+                            openssl_err_as_string());
+    return -1;
+  }
   AES_set_decrypt_key(key, key_size * 8, &((*ctx)->ecb_dec_key));
 
   return 0;
@@ -345,6 +390,37 @@ static void aes_internal_decrypt (aes_context_t *ctx, const uint8_t ct[16], uint
 }
 
 
+// eight independent blocks in flight to cover the latency of the aes instructions
+
+#define AES_ROUND8(OP,B,K)                                                            \
+  B[0] = OP(B[0], K); B[1] = OP(B[1], K); B[2] = OP(B[2], K); B[3] = OP(B[3], K);   \
+  B[4] = OP(B[4], K); B[5] = OP(B[5], K); B[6] = OP(B[6], K); B[7] = OP(B[7], K)
+
+
+static inline void aes_internal_encrypt8 (const aes_context_t *ctx, __m128i *b) {
+
+  int r;
+
+  AES_ROUND8(_mm_xor_si128, b, ctx->rk_enc[0]);
+  for(r = 1; r < ctx->Nr; r++) {
+    AES_ROUND8(_mm_aesenc_si128, b, ctx->rk_enc[r]);
+  }
+  AES_ROUND8(_mm_aesenclast_si128, b, ctx->rk_enc[ctx->Nr]);
+}
+
+
+static inline void aes_internal_decrypt8 (const aes_context_t *ctx, __m128i *b) {
+
+  int r;
+
+  AES_ROUND8(_mm_xor_si128, b, ctx->rk_dec[0]);
+  for(r = 1; r < ctx->Nr; r++) {
+    AES_ROUND8(_mm_aesdec_si128, b, ctx->rk_dec[r]);
+  }
+  AES_ROUND8(_mm_aesdeclast_si128, b, ctx->rk_enc[0]);
+}
+
+
 // public API
 
 
@@ -388,28 +464,79 @@ int aes_cbc_encrypt (unsigned char *out, const unsigned char *in, size_t in_len,
 }
 
 
+// unlike encryption, cbc decryption does not depend on the previous block's result,
+// so eight blocks are decrypted at once
 int aes_cbc_decrypt (unsigned char *out, const unsigned char *in, size_t in_len,
                      const unsigned char *iv, aes_context_t *ctx) {
 
-  uint8_t tmp[AES_BLOCK_SIZE];
-  uint8_t old[AES_BLOCK_SIZE];
-  size_t i;
+  __m128i b[8], c[8], prev;
+  size_t i, j;
   size_t n;
 
-  memcpy(tmp, iv, AES_BLOCK_SIZE);
+  prev = _mm_loadu_si128((__m128i*)iv);
 
   n = in_len / AES_BLOCK_SIZE;
-  for(i=0; i < n; i++) {
-    memcpy(old, &in[i * AES_BLOCK_SIZE], AES_BLOCK_SIZE);
+  for(i = 0; i + 8 <= n; i += 8) {
+    for(j = 0; j < 8; j++)
+      b[j] = c[j] = _mm_loadu_si128((__m128i*)&in[(i + j) * AES_BLOCK_SIZE]);
+    aes_internal_decrypt8(ctx, b);
+    _mm_storeu_si128((__m128i*)&out[i * AES_BLOCK_SIZE], _mm_xor_si128(b[0], prev));
+    for(j = 1; j < 8; j++)
+      _mm_storeu_si128((__m128i*)&out[(i + j) * AES_BLOCK_SIZE], _mm_xor_si128(b[j], c[j - 1]));
+    prev = c[7];
+  }
+
+  for(; i < n; i++) {
+    c[0] = _mm_loadu_si128((__m128i*)&in[i * AES_BLOCK_SIZE]);
     aes_internal_decrypt(ctx, &in[i * AES_BLOCK_SIZE], &out[i * AES_BLOCK_SIZE]);
-    fix_xor(&out[i * AES_BLOCK_SIZE], tmp);
-    memcpy(tmp, old, AES_BLOCK_SIZE);
+    _mm_storeu_si128((__m128i*)&out[i * AES_BLOCK_SIZE],
+                     _mm_xor_si128(_mm_loadu_si128((__m128i*)&out[i * AES_BLOCK_SIZE]), prev));
+    prev = c[0];
   }
 
   return n * AES_BLOCK_SIZE;
 }
 
 
+// the counter blocks are independent, so eight of them are encrypted at once
+int aes_ctr_crypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                   const unsigned char *iv, aes_context_t *ctx) {
+
+  __m128i b[8];
+  uint8_t ks[8 * AES_BLOCK_SIZE];
+  uint64_t hi, lo;
+  size_t i, j;
+
+  memcpy(&hi, iv, sizeof(hi)); hi = be64toh(hi);
+  memcpy(&lo, iv + 8, sizeof(lo)); lo = be64toh(lo);
+
+  for(i = 0; i < in_len; i += 8 * AES_BLOCK_SIZE) {
+    for(j = 0; j < 8; j++) {
+      b[j] = _mm_set_epi64x(htobe64(lo), htobe64(hi));
+      if(!++lo) hi++;
+    }
+    aes_internal_encrypt8(ctx, b);
+
+    if(i + 8 * AES_BLOCK_SIZE <= in_len) {
+      for(j = 0; j < 8; j++)
+        _mm_storeu_si128((__m128i*)&out[i + j * AES_BLOCK_SIZE],
+                         _mm_xor_si128(b[j], _mm_loadu_si128((__m128i*)&in[i + j * AES_BLOCK_SIZE])));
+    } else {
+      // the remainder, the surplus keystream is dropped
+      for(j = 0; j < 8; j++)
+        _mm_storeu_si128((__m128i*)&ks[j * AES_BLOCK_SIZE], b[j]);
+      for(j = 0; i + j + AES_BLOCK_SIZE <= in_len; j += AES_BLOCK_SIZE)
+        _mm_storeu_si128((__m128i*)&out[i + j],
+                         _mm_xor_si128(_mm_loadu_si128((__m128i*)&ks[j]), _mm_loadu_si128((__m128i*)&in[i + j])));
+      for(; i + j < in_len; j++)
+        out[i + j] = in[i + j] ^ ks[j];
+    }
+  }
+
+  return in_len;
+}
+
+
 int aes_init (const unsigned char *key, size_t key_size, aes_context_t **ctx) {
 
   // allocate context...
@@ -1106,6 +1233,29 @@ int aes_cbc_decrypt (unsigned char *out, const unsigned char *in, size_t in_len,
   return n * AES_BLOCK_SIZE;
 }
 
+
+int aes_ctr_crypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                   const unsigned char *iv, aes_context_t *ctx) {
+
+  uint8_t ks[AES_BLOCK_SIZE];
+  uint64_t hi, lo, be;
+  size_t i, j;
+
+  memcpy(&hi, iv, sizeof(hi)); hi = be64toh(hi);
+  memcpy(&lo, iv + 8, sizeof(lo)); lo = be64toh(lo);
+
+  for(i = 0; i < in_len; i += AES_BLOCK_SIZE) {
+    be = htobe64(hi); memcpy(ks, &be, sizeof(be));
+    be = htobe64(lo); memcpy(ks + 8, &be, sizeof(be));
+    if(!++lo) hi++;
+    aes_internal_encrypt(ctx->enc_rk, ctx->Nr, ks, ks);
+    for(j = 0; (j < AES_BLOCK_SIZE) && (i + j < in_len); j++)
+      out[i + j] = in[i + j] ^ ks[j];
+  }
+
+  return in_len;
+}
+
 int aes_init (const unsigned char *key, size_t key_size, aes_context_t **ctx) {
 
   // allocate context...
@@ -1140,12 +1290,568 @@ int aes_init (const unsigned char *key, size_t key_size, aes_context_t **ctx) {
 
 int aes_deinit (aes_context_t *ctx) {
 
-  if (ctx) free (ctx);
+  if (ctx) {
+#if defined (HAVE_OPENSSL_1_1)
+    if (ctx->enc_ctx) EVP_CIPHER_CTX_free(ctx->enc_ctx);
+    if (ctx->dec_ctx) EVP_CIPHER_CTX_free(ctx->dec_ctx);
+    if (ctx->ctr_ctx) EVP_CIPHER_CTX_free(ctx->ctr_ctx);
+#endif
+    free (ctx);
+  }
+
+  return 0;
+}
+
+
+// --- AES-GCM ----------------------------------------------------------------------------
+//
+// aes_gcm_encrypt() and aes_gcm_decrypt() en/de-crypt in_len bytes (in and out may be
+// the same buffer) and compute the 128-bit tag over aad and the ciphertext, the nonce
+// is 96 bits. aes_gcm_decrypt() returns -1 if the tag does not match.
+
+
+#if defined (HAVE_OPENSSL_1_1) // openSSL 1.1 ---------------------------------------------
+
+
+int aes_gcm_encrypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                     const unsigned char *nonce, const unsigned char *aad, size_t aad_len,
+                     unsigned char *tag, aes_gcm_context_t *ctx) {
+
+  int evp_len;
+
+  // the context already holds the key schedule, just set the nonce
+  if((1 != EVP_EncryptInit_ex(ctx->enc_ctx, NULL, NULL, NULL, nonce))
+     || (aad_len && (1 != EVP_EncryptUpdate(ctx->enc_ctx, NULL, &evp_len, aad, aad_len)))
+     || (1 != EVP_EncryptUpdate(ctx->enc_ctx, out, &evp_len, in, in_len))
+     || (1 != EVP_EncryptFinal_ex(ctx->enc_ctx, out + evp_len, &evp_len))
+     || (1 != EVP_CIPHER_CTX_ctrl(ctx->enc_ctx, EVP_CTRL_GCM_GET_TAG, AES_GCM_TAG_SIZE, tag))) {
+    traceEvent(TRACE_ERROR, "aes_gcm_encrypt openssl encryption: %s",
+                            openssl_err_as_string());
+    return -1;
+  }
+
+  return in_len;
+}
+
+
+int aes_gcm_decrypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                     const unsigned char *nonce, const unsigned char *aad, size_t aad_len,
+                     const unsigned char *tag, aes_gcm_context_t *ctx) {
+
+  int evp_len;
+
+  if((1 != EVP_DecryptInit_ex(ctx->dec_ctx, NULL, NULL, NULL, nonce))
+     || (aad_len && (1 != EVP_DecryptUpdate(ctx->dec_ctx, NULL, &evp_len, aad, aad_len)))
+     || (1 != EVP_DecryptUpdate(ctx->dec_ctx, out, &evp_len, in, in_len))
+     || (1 != EVP_CIPHER_CTX_ctrl(ctx->dec_ctx, EVP_CTRL_GCM_SET_TAG, AES_GCM_TAG_SIZE, (void*)tag)))
+    return -1;
+
+  // fails on tag mismatch
+  if(1 != EVP_DecryptFinal_ex(ctx->dec_ctx, out + evp_len, &evp_len))
+    return -1;
+
+  return in_len;
+}
+
+
+int aes_gcm_init (const unsigned char *key, size_t key_size, aes_gcm_context_t **ctx) {
+
+  const EVP_CIPHER *cipher;
+
+  switch(key_size) {
+    case AES128_KEY_BYTES:
+      cipher = EVP_aes_128_gcm();
+      break;
+    case AES192_KEY_BYTES:
+      cipher = EVP_aes_192_gcm();
+      break;
+    case AES256_KEY_BYTES:
+      cipher = EVP_aes_256_gcm();
+      break;
+    default:
+      traceEvent(TRACE_ERROR, "aes_gcm_init invalid key size %u\n", key_size);
+      return -1;
+  }
+
+  *ctx = (aes_gcm_context_t*) calloc(1, sizeof(aes_gcm_context_t));
+  if (!(*ctx))
+    return -1;
+
+  if(!((*ctx)->enc_ctx = EVP_CIPHER_CTX_new()) || !((*ctx)->dec_ctx = EVP_CIPHER_CTX_new())) {
+    traceEvent(TRACE_ERROR, "aes_gcm_init openssl's evp_* context creation failed: %s",
+                            openssl_err_as_string());
+    return -1;
+  }
+
+  // the default nonce length is 96 bits, the key schedule is set up once here
+  if((1 != EVP_EncryptInit_ex((*ctx)->enc_ctx, cipher, NULL, key, NULL))
+     || (1 != EVP_DecryptInit_ex((*ctx)->dec_ctx, cipher, NULL, key, NULL))) {
+    traceEvent(TRACE_ERROR, "aes_gcm_init openssl key setup: %s",
+                            openssl_err_as_string());
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int aes_gcm_deinit (aes_gcm_context_t *ctx) {
+
+  if (ctx) {
+    if (ctx->enc_ctx) EVP_CIPHER_CTX_free(ctx->enc_ctx);
+    if (ctx->dec_ctx) EVP_CIPHER_CTX_free(ctx->dec_ctx);
+    free (ctx);
+  }
+
+  return 0;
+}
+
+
+#else // AES-NI with PCLMULQDQ, plain C ---------------------------------------------------
+
+
+// the counter block is the nonce followed by the 32-bit big endian block counter, the
+// first one (1) encrypts the tag, the payload starts with 2
+static void gcm_ctr_block (uint8_t block[AES_BLOCK_SIZE], const unsigned char *nonce, uint32_t n) {
+
+  memcpy(block, nonce, AES_GCM_NONCE_SIZE);
+  block[12] = n >> 24;
+  block[13] = n >> 16;
+  block[14] = n >>  8;
+  block[15] = n;
+}
+
+
+#if defined (AES_GCM_PCLMUL) // AES-NI with PCLMULQDQ -------------------------------------
+
+
+// GHASH along Intel's white paper on carry-less multiplication and its use for GCM
+// https://www.intel.com/content/dam/develop/external/us/en/documents/clmul-wp-rev-2-02-2014-04-20.pdf
+// the values are kept byte-reflected, the products of four blocks get accumulated and
+// then reduced only once
+
+
+#define BSWAP_MASK _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+
+
+static inline void gcm_clmul (__m128i a, __m128i b, __m128i *lo, __m128i *hi) {
+
+  __m128i t0 = _mm_clmulepi64_si128(a, b, 0x00);
+  __m128i t1 = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+  __m128i t2 = _mm_clmulepi64_si128(a, b, 0x11);
+
+  *lo = _mm_xor_si128(*lo, _mm_xor_si128(t0, _mm_slli_si128(t1, 8)));
+  *hi = _mm_xor_si128(*hi, _mm_xor_si128(t2, _mm_srli_si128(t1, 8)));
+}
+
+
+// shifts the 256-bit product left by one (bit-reflection) and reduces it modulo
+// x^128 + x^7 + x^2 + x + 1
+static inline __m128i gcm_reduce (__m128i lo, __m128i hi) {
+
+  __m128i t7, t8, t9, t2, t4, t5;
+
+  t7 = _mm_srli_epi32(lo, 31);
+  t8 = _mm_srli_epi32(hi, 31);
+  lo = _mm_slli_epi32(lo, 1);
+  hi = _mm_slli_epi32(hi, 1);
+  t9 = _mm_srli_si128(t7, 12);
+  t8 = _mm_slli_si128(t8, 4);
+  t7 = _mm_slli_si128(t7, 4);
+  lo = _mm_or_si128(lo, t7);
+  hi = _mm_or_si128(hi, t8);
+  hi = _mm_or_si128(hi, t9);
+
+  t7 = _mm_slli_epi32(lo, 31);
+  t8 = _mm_slli_epi32(lo, 30);
+  t9 = _mm_slli_epi32(lo, 25);
+  t7 = _mm_xor_si128(t7, t8);
+  t7 = _mm_xor_si128(t7, t9);
+  t8 = _mm_srli_si128(t7, 4);
+  t7 = _mm_slli_si128(t7, 12);
+  lo = _mm_xor_si128(lo, t7);
+
+  t2 = _mm_srli_epi32(lo, 1);
+  t4 = _mm_srli_epi32(lo, 2);
+  t5 = _mm_srli_epi32(lo, 7);
+  t2 = _mm_xor_si128(t2, t4);
+  t2 = _mm_xor_si128(t2, t5);
+  t2 = _mm_xor_si128(t2, t8);
+  lo = _mm_xor_si128(lo, t2);
+
+  return _mm_xor_si128(hi, lo);
+}
+
+
+static inline __m128i gcm_mul (__m128i a, __m128i b) {
+
+  __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+
+  gcm_clmul(a, b, &lo, &hi);
+
+  return gcm_reduce(lo, hi);
+}
+
+
+// x = (x + c0) * H^4 + c1 * H^3 + c2 * H^2 + c3 * H
+static inline __m128i gcm_ghash4 (aes_gcm_context_t *ctx, __m128i x,
+                                  __m128i c0, __m128i c1, __m128i c2, __m128i c3) {
+
+  __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+
+  gcm_clmul(_mm_xor_si128(x, _mm_shuffle_epi8(c0, BSWAP_MASK)), ctx->h[3], &lo, &hi);
+  gcm_clmul(_mm_shuffle_epi8(c1, BSWAP_MASK), ctx->h[2], &lo, &hi);
+  gcm_clmul(_mm_shuffle_epi8(c2, BSWAP_MASK), ctx->h[1], &lo, &hi);
+  gcm_clmul(_mm_shuffle_epi8(c3, BSWAP_MASK), ctx->h[0], &lo, &hi);
+
+  return gcm_reduce(lo, hi);
+}
+
+
+// hashes a zero-padded partial block
+static inline __m128i gcm_ghash_tail (aes_gcm_context_t *ctx, __m128i x, const uint8_t *data, size_t len) {
+
+  uint8_t block[AES_BLOCK_SIZE] = { 0 };
+
+  memcpy(block, data, len);
+
+  return gcm_mul(_mm_xor_si128(x, _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)block), BSWAP_MASK)), ctx->h[0]);
+}
+
+
+static __m128i gcm_ghash (aes_gcm_context_t *ctx, __m128i x, const uint8_t *data, size_t len) {
+
+  for(; len >= AES_BLOCK_SIZE; len -= AES_BLOCK_SIZE, data += AES_BLOCK_SIZE)
+    x = gcm_mul(_mm_xor_si128(x, _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)data), BSWAP_MASK)), ctx->h[0]);
+
+  if(len)
+    x = gcm_ghash_tail(ctx, x, data, len);
+
+  return x;
+}
+
+
+// four counter blocks in parallel to keep the AES units busy
+static inline void gcm_aes4 (const aes_context_t *aes, __m128i *b0, __m128i *b1, __m128i *b2, __m128i *b3) {
+
+  int r;
+
+  *b0 = _mm_xor_si128(*b0, aes->rk_enc[0]);
+  *b1 = _mm_xor_si128(*b1, aes->rk_enc[0]);
+  *b2 = _mm_xor_si128(*b2, aes->rk_enc[0]);
+  *b3 = _mm_xor_si128(*b3, aes->rk_enc[0]);
+  for(r = 1; r < aes->Nr; r++) {
+    *b0 = _mm_aesenc_si128(*b0, aes->rk_enc[r]);
+    *b1 = _mm_aesenc_si128(*b1, aes->rk_enc[r]);
+    *b2 = _mm_aesenc_si128(*b2, aes->rk_enc[r]);
+    *b3 = _mm_aesenc_si128(*b3, aes->rk_enc[r]);
+  }
+  *b0 = _mm_aesenclast_si128(*b0, aes->rk_enc[aes->Nr]);
+  *b1 = _mm_aesenclast_si128(*b1, aes->rk_enc[aes->Nr]);
+  *b2 = _mm_aesenclast_si128(*b2, aes->rk_enc[aes->Nr]);
+  *b3 = _mm_aesenclast_si128(*b3, aes->rk_enc[aes->Nr]);
+}
+
+
+static inline __m128i gcm_aes1 (const aes_context_t *aes, __m128i b) {
+
+  int r;
+
+  b = _mm_xor_si128(b, aes->rk_enc[0]);
+  for(r = 1; r < aes->Nr; r++)
+    b = _mm_aesenc_si128(b, aes->rk_enc[r]);
+
+  return _mm_aesenclast_si128(b, aes->rk_enc[aes->Nr]);
+}
+
+
+// the counter is kept byte-reflected so that it can be incremented as 32-bit lane
+static int gcm_crypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                      const unsigned char *nonce, const unsigned char *aad, size_t aad_len,
+                      unsigned char *tag, aes_gcm_context_t *ctx, int decrypt) {
+
+  const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+  uint8_t block[AES_BLOCK_SIZE];
+  __m128i ctr, j0, x, b0, b1, b2, b3, c0, c1, c2, c3;
+  size_t i = 0;
+
+  gcm_ctr_block(block, nonce, 1);
+  j0 = _mm_loadu_si128((__m128i*)block);
+  ctr = _mm_shuffle_epi8(j0, BSWAP_MASK);
+
+  x = gcm_ghash(ctx, _mm_setzero_si128(), aad, aad_len);
+
+  for(; i + 4 * AES_BLOCK_SIZE <= in_len; i += 4 * AES_BLOCK_SIZE) {
+    b0 = _mm_shuffle_epi8(ctr = _mm_add_epi32(ctr, one), BSWAP_MASK);
+    b1 = _mm_shuffle_epi8(ctr = _mm_add_epi32(ctr, one), BSWAP_MASK);
+    b2 = _mm_shuffle_epi8(ctr = _mm_add_epi32(ctr, one), BSWAP_MASK);
+    b3 = _mm_shuffle_epi8(ctr = _mm_add_epi32(ctr, one), BSWAP_MASK);
+    gcm_aes4(ctx->aes, &b0, &b1, &b2, &b3);
+
+    c0 = _mm_loadu_si128((__m128i*)(in + i));
+    c1 = _mm_loadu_si128((__m128i*)(in + i + 16));
+    c2 = _mm_loadu_si128((__m128i*)(in + i + 32));
+    c3 = _mm_loadu_si128((__m128i*)(in + i + 48));
+    b0 = _mm_xor_si128(b0, c0);
+    b1 = _mm_xor_si128(b1, c1);
+    b2 = _mm_xor_si128(b2, c2);
+    b3 = _mm_xor_si128(b3, c3);
+    _mm_storeu_si128((__m128i*)(out + i), b0);
+    _mm_storeu_si128((__m128i*)(out + i + 16), b1);
+    _mm_storeu_si128((__m128i*)(out + i + 32), b2);
+    _mm_storeu_si128((__m128i*)(out + i + 48), b3);
+
+    // the hash always runs over the ciphertext
+    if(decrypt)
+      x = gcm_ghash4(ctx, x, c0, c1, c2, c3);
+    else
+      x = gcm_ghash4(ctx, x, b0, b1, b2, b3);
+  }
+
+  for(; i < in_len; i += AES_BLOCK_SIZE) {
+    size_t n = (in_len - i < AES_BLOCK_SIZE) ? in_len - i : AES_BLOCK_SIZE;
+
+    b0 = gcm_aes1(ctx->aes, _mm_shuffle_epi8(ctr = _mm_add_epi32(ctr, one), BSWAP_MASK));
+    memset(block, 0, AES_BLOCK_SIZE);
+    memcpy(block, in + i, n);
+    c0 = _mm_loadu_si128((__m128i*)block);
+    _mm_storeu_si128((__m128i*)block, _mm_xor_si128(b0, c0));
+    memcpy(out + i, block, n);
+    // only the n bytes of the partial block get hashed
+    x = gcm_ghash_tail(ctx, x, decrypt ? (uint8_t*)&c0 : block, n);
+  }
+
+  // lengths in bits, byte-reflected
+  x = gcm_mul(_mm_xor_si128(x, _mm_set_epi64x((uint64_t)aad_len * 8, (uint64_t)in_len * 8)), ctx->h[0]);
+
+  x = _mm_xor_si128(_mm_shuffle_epi8(x, BSWAP_MASK), gcm_aes1(ctx->aes, j0));
+  _mm_storeu_si128((__m128i*)tag, x);
+
+  return in_len;
+}
+
+
+static void gcm_hash_key_setup (aes_gcm_context_t *ctx) {
+
+  __m128i h = _mm_shuffle_epi8(gcm_aes1(ctx->aes, _mm_setzero_si128()), BSWAP_MASK);
+
+  ctx->h[0] = h;
+  ctx->h[1] = gcm_mul(ctx->h[0], h);
+  ctx->h[2] = gcm_mul(ctx->h[1], h);
+  ctx->h[3] = gcm_mul(ctx->h[2], h);
+}
+
+
+#else // plain C, AES-NI without PCLMULQDQ -------------------------------------------------
+
+
+// GHASH using 4-bit tables (Shoup's method), as found in many C implementations,
+// e.g. mbed TLS
+
+
+static const uint64_t gcm_last4[16] = {
+  0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+  0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0 };
+
+
+static uint64_t gcm_get_be64 (const uint8_t *b) {
+
+  return ((uint64_t)b[0] << 56) | ((uint64_t)b[1] << 48) | ((uint64_t)b[2] << 40) | ((uint64_t)b[3] << 32)
+       | ((uint64_t)b[4] << 24) | ((uint64_t)b[5] << 16) | ((uint64_t)b[6] <<  8) |  (uint64_t)b[7];
+}
+
+
+static void gcm_put_be64 (uint8_t *b, uint64_t v) {
+
+  int i;
+
+  for(i = 7; i >= 0; i--, v >>= 8)
+    b[i] = v;
+}
+
+
+// x = x * H
+static void gcm_mul (aes_gcm_context_t *ctx, uint8_t x[AES_BLOCK_SIZE]) {
+
+  uint64_t zh, zl;
+  uint8_t lo, hi, rem;
+  int i;
+
+  lo = x[15] & 0x0f;
+  zh = ctx->hh[lo];
+  zl = ctx->hl[lo];
+
+  for(i = 15; i >= 0; i--) {
+    lo = x[i] & 0x0f;
+    hi = (x[i] >> 4) & 0x0f;
+
+    if(i != 15) {
+      rem = zl & 0x0f;
+      zl = (zh << 60) | (zl >> 4);
+      zh = (zh >> 4) ^ (gcm_last4[rem] << 48);
+      zh ^= ctx->hh[lo];
+      zl ^= ctx->hl[lo];
+    }
+
+    rem = zl & 0x0f;
+    zl = (zh << 60) | (zl >> 4);
+    zh = (zh >> 4) ^ (gcm_last4[rem] << 48);
+    zh ^= ctx->hh[hi];
+    zl ^= ctx->hl[hi];
+  }
+
+  gcm_put_be64(x, zh);
+  gcm_put_be64(x + 8, zl);
+}
+
+
+static void gcm_ghash (aes_gcm_context_t *ctx, uint8_t x[AES_BLOCK_SIZE], const uint8_t *data, size_t len) {
+
+  size_t i, n;
+
+  for(; len > 0; len -= n, data += n) {
+    n = (len < AES_BLOCK_SIZE) ? len : AES_BLOCK_SIZE;
+    for(i = 0; i < n; i++)
+      x[i] ^= data[i];
+    gcm_mul(ctx, x);
+  }
+}
+
+
+static int gcm_crypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                      const unsigned char *nonce, const unsigned char *aad, size_t aad_len,
+                      unsigned char *tag, aes_gcm_context_t *ctx, int decrypt) {
+
+  uint8_t x[AES_BLOCK_SIZE] = { 0 };
+  uint8_t ctr[AES_BLOCK_SIZE];
+  uint8_t ks[AES_BLOCK_SIZE];
+  uint8_t lens[AES_BLOCK_SIZE];
+  uint32_t n = 2;
+  size_t i, j, len;
+
+  gcm_ghash(ctx, x, aad, aad_len);
+
+  for(i = 0; i < in_len; i += len, n++) {
+    len = (in_len - i < AES_BLOCK_SIZE) ? in_len - i : AES_BLOCK_SIZE;
+    gcm_ctr_block(ctr, nonce, n);
+    aes_ecb_encrypt(ks, ctr, ctx->aes);
+
+    // the hash always runs over the ciphertext
+    if(decrypt)
+      gcm_ghash(ctx, x, in + i, len);
+    for(j = 0; j < len; j++)
+      out[i + j] = in[i + j] ^ ks[j];
+    if(!decrypt)
+      gcm_ghash(ctx, x, out + i, len);
+  }
+
+  // lengths in bits
+  gcm_put_be64(lens, (uint64_t)aad_len * 8);
+  gcm_put_be64(lens + 8, (uint64_t)in_len * 8);
+  gcm_ghash(ctx, x, lens, AES_BLOCK_SIZE);
+
+  gcm_ctr_block(ctr, nonce, 1);
+  aes_ecb_encrypt(ks, ctr, ctx->aes);
+  for(j = 0; j < AES_BLOCK_SIZE; j++)
+    tag[j] = x[j] ^ ks[j];
+
+  return in_len;
+}
+
+
+static void gcm_hash_key_setup (aes_gcm_context_t *ctx) {
+
+  uint8_t h[AES_BLOCK_SIZE] = { 0 };
+  uint64_t vh, vl;
+  int i, j;
+
+  aes_ecb_encrypt(h, h, ctx->aes);
+  vh = gcm_get_be64(h);
+  vl = gcm_get_be64(h + 8);
+
+  // 8 = 1000 corresponds to 1 in GF(2^128)
+  ctx->hl[8] = vl;
+  ctx->hh[8] = vh;
+  ctx->hl[0] = 0;
+  ctx->hh[0] = 0;
+
+  for(i = 4; i > 0; i >>= 1) {
+    uint32_t t = (vl & 1) * 0xe1000000U;
+    vl = (vh << 63) | (vl >> 1);
+    vh = (vh >> 1) ^ ((uint64_t)t << 32);
+    ctx->hl[i] = vl;
+    ctx->hh[i] = vh;
+  }
+
+  for(i = 2; i <= 8; i *= 2) {
+    vh = ctx->hh[i];
+    vl = ctx->hl[i];
+    for(j = 1; j < i; j++) {
+      ctx->hh[i + j] = vh ^ ctx->hh[j];
+      ctx->hl[i + j] = vl ^ ctx->hl[j];
+    }
+  }
+}
+
+
+#endif // AES-NI with PCLMULQDQ, plain C --------------------------------------------------
+
+
+int aes_gcm_encrypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                     const unsigned char *nonce, const unsigned char *aad, size_t aad_len,
+                     unsigned char *tag, aes_gcm_context_t *ctx) {
+
+  return gcm_crypt(out, in, in_len, nonce, aad, aad_len, tag, ctx, 0);
+}
+
+
+int aes_gcm_decrypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                     const unsigned char *nonce, const unsigned char *aad, size_t aad_len,
+                     const unsigned char *tag, aes_gcm_context_t *ctx) {
+
+  uint8_t computed[AES_GCM_TAG_SIZE];
+  uint8_t diff = 0;
+  int i;
+
+  gcm_crypt(out, in, in_len, nonce, aad, aad_len, computed, ctx, 1);
+
+  // constant time comparison
+  for(i = 0; i < AES_GCM_TAG_SIZE; i++)
+    diff |= computed[i] ^ tag[i];
+
+  return diff ? -1 : (int)in_len;
+}
+
+
+int aes_gcm_init (const unsigned char *key, size_t key_size, aes_gcm_context_t **ctx) {
+
+  *ctx = (aes_gcm_context_t*) calloc(1, sizeof(aes_gcm_context_t));
+  if (!(*ctx))
+    return -1;
+
+  if(aes_init(key, key_size, &((*ctx)->aes)))
+    return -1;
+
+  gcm_hash_key_setup(*ctx);
 
   return 0;
 }
 
 
+int aes_gcm_deinit (aes_gcm_context_t *ctx) {
+
+  if (ctx) {
+    aes_deinit(ctx->aes);
+    free (ctx);
+  }
+
+  return 0;
+}
+
+
+#endif // openSSL 1.1, AES-NI with PCLMULQDQ, plain C -------------------------------------
+
+
 // --- for testing ------------------------------------------------------------------------
 // --- remove when done ---
 
@@ -47,30 +47,25 @@ int cc20_crypt (unsigned char *out, const unsigned char *in, size_t in_len,
   int evp_len;
   int evp_ciphertext_len;
 
-  if(1 == EVP_EncryptInit_ex(ctx->ctx, ctx->cipher, NULL, ctx->key, iv)) {
-    if(1 == EVP_CIPHER_CTX_set_padding(ctx->ctx, 0)) {
-      if(1 == EVP_EncryptUpdate(ctx->ctx, out, &evp_len, in, in_len)) {
-        evp_ciphertext_len = evp_len;
-        if(1 == EVP_EncryptFinal_ex(ctx->ctx, out + evp_len, &evp_len)) {
-          evp_ciphertext_len += evp_len;
-          if(evp_ciphertext_len != in_len)
-            traceEvent(TRACE_ERROR, "cc20_crypt openssl encryption: encrypted %u bytes where %u were expected",
-                                    evp_ciphertext_len, in_len);
-        } else
-          traceEvent(TRACE_ERROR, "cc20_crypt openssl final encryption: %s",
-                                  openssl_err_as_string());
+  // the context already holds the key, just set the iv (counter and nonce)
+  if(1 == EVP_EncryptInit_ex(ctx->ctx, NULL, NULL, NULL, iv)) {
+    if(1 == EVP_EncryptUpdate(ctx->ctx, out, &evp_len, in, in_len)) {
+      evp_ciphertext_len = evp_len;
+      if(1 == EVP_EncryptFinal_ex(ctx->ctx, out + evp_len, &evp_len)) {
+        evp_ciphertext_len += evp_len;
+        if(evp_ciphertext_len != in_len)
+          traceEvent(TRACE_ERROR, "cc20_crypt openssl encryption: encrypted %u bytes where %u were expected",
+                                  evp_ciphertext_len, in_len);
       } else
-        traceEvent(TRACE_ERROR, "cc20_encrypt openssl encrpytion: %s",
+        traceEvent(TRACE_ERROR, "cc20_crypt openssl final encryption: %s",
                                 openssl_err_as_string());
     } else
-      traceEvent(TRACE_ERROR, "cc20_encrypt openssl padding setup: %s",
+      traceEvent(TRACE_ERROR, "cc20_encrypt openssl encrpytion: %s",
                               openssl_err_as_string());
   } else
     traceEvent(TRACE_ERROR, "cc20_encrypt openssl init: %s",
                             openssl_err_as_string());
 
-  EVP_CIPHER_CTX_reset(ctx->ctx);
-
   return 0;
 }
 
@@ -133,10 +128,139 @@ int cc20_crypt (unsigned char *out, const unsigned char *in, size_t in_len,
                     _mm_xor_si128 (_mm_loadu_si128((__m128i*)I), X)); \
   I += 16; O += 16                                                    \
 
+// the multi-block kernels keep the blocks in the vector lanes, x[i] holding word i of
+// the state of each block; so, a round works on whole columns or diagonals of vectors
+// without any shuffling, but the keystream needs to be transposed before output
+
+#define CC20_COLUMN_DIAGONAL_ROUNDS(X)                                                      \
+  CC20_ODD_ROUND(X[0], X[4], X[ 8], X[12]); CC20_ODD_ROUND(X[1], X[5], X[ 9], X[13]);      \
+  CC20_ODD_ROUND(X[2], X[6], X[10], X[14]); CC20_ODD_ROUND(X[3], X[7], X[11], X[15]);      \
+  CC20_ODD_ROUND(X[0], X[5], X[10], X[15]); CC20_ODD_ROUND(X[1], X[6], X[11], X[12]);      \
+  CC20_ODD_ROUND(X[2], X[7], X[ 8], X[13]); CC20_ODD_ROUND(X[3], X[4], X[ 9], X[14])
+
+// 4x4 transpose of 32-bit words (inside each 128-bit lane)
+#define CC20_TRANSPOSE(T,UNPACKLO32,UNPACKHI32,UNPACKLO64,UNPACKHI64,A,B,C,D) \
+  T##0 = UNPACKLO32(A, B); T##1 = UNPACKHI32(A, B);                          \
+  T##2 = UNPACKLO32(C, D); T##3 = UNPACKHI32(C, D);                          \
+  A = UNPACKLO64(T##0, T##2); B = UNPACKHI64(T##0, T##2);                    \
+  C = UNPACKLO64(T##1, T##3); D = UNPACKHI64(T##1, T##3)
+
+
+// four blocks (256 bytes) per iteration, returns the number of bytes processed
+// and advances the block counter s[12] accordingly
+static size_t cc20_crypt_4x (unsigned char *out, const unsigned char *in, size_t in_len, uint32_t *s) {
+
+  __m128i x[16], t0, t1, t2, t3;
+  size_t done = 0;
+  int i, j;
+
+  while(in_len - done >= 256) {
+    for(i = 0; i < 16; i++)
+      x[i] = _mm_set1_epi32(s[i]);
+    x[12] = ADD(x[12], _mm_setr_epi32(0, 1, 2, 3));
+
+    // 10 double rounds
+    for(i = 0; i < 10; i++) {
+      CC20_COLUMN_DIAGONAL_ROUNDS(x);
+    }
+
+    for(i = 0; i < 16; i++)
+      x[i] = ADD(x[i], _mm_set1_epi32(s[i]));
+    x[12] = ADD(x[12], _mm_setr_epi32(0, 1, 2, 3));
+
+    // x[i + j] now holds word i of each block j (i = 0, 4, 8, 12)
+    for(i = 0; i < 16; i += 4) {
+      CC20_TRANSPOSE(t, _mm_unpacklo_epi32, _mm_unpackhi_epi32, _mm_unpacklo_epi64, _mm_unpackhi_epi64,
+                     x[i], x[i + 1], x[i + 2], x[i + 3]);
+      for(j = 0; j < 4; j++)
+        _mm_storeu_si128((__m128i*)(out + 64 * j + 4 * i),
+                         XOR(_mm_loadu_si128((__m128i*)(in + 64 * j + 4 * i)), x[i + j]));
+    }
+
+    s[12] += 4;
+    in += 256; out += 256; done += 256;
+  }
+
+  return done;
+}
+
+
+#if defined (__AVX2__) // --- AVX2
+
+#define ADD8  _mm256_add_epi32
+#define XOR8  _mm256_xor_si256
+#define ROL8X(X,r)  (XOR8(_mm256_slli_epi32(X,r),_mm256_srli_epi32(X,(32-r))))
+#define ROL8X8(X)   (_mm256_shuffle_epi8(X, _mm256_set_epi32(0x0e0d0c0fL, 0x0a09080bL, 0x06050407L, 0x02010003L, \
+                                                            0x0e0d0c0fL, 0x0a09080bL, 0x06050407L, 0x02010003L)))
+#define ROL8X16(X)  (_mm256_shuffle_epi8(X, _mm256_set_epi32(0x0d0c0f0eL, 0x09080b0aL, 0x05040706L, 0x01000302L, \
+                                                            0x0d0c0f0eL, 0x09080b0aL, 0x05040706L, 0x01000302L)))
+
+#define CC20_ODD_ROUND8(A,B,C,D)              \
+  A = ADD8(A, B); D = ROL8X16(XOR8(D, A));    \
+  C = ADD8(C, D); B = ROL8X(XOR8(B, C), 12);  \
+  A = ADD8(A, B); D = ROL8X8(XOR8(D, A));     \
+  C = ADD8(C, D); B = ROL8X(XOR8(B, C),  7)
+
+#define CC20_COLUMN_DIAGONAL_ROUNDS8(X)                                                     \
+  CC20_ODD_ROUND8(X[0], X[4], X[ 8], X[12]); CC20_ODD_ROUND8(X[1], X[5], X[ 9], X[13]);    \
+  CC20_ODD_ROUND8(X[2], X[6], X[10], X[14]); CC20_ODD_ROUND8(X[3], X[7], X[11], X[15]);    \
+  CC20_ODD_ROUND8(X[0], X[5], X[10], X[15]); CC20_ODD_ROUND8(X[1], X[6], X[11], X[12]);    \
+  CC20_ODD_ROUND8(X[2], X[7], X[ 8], X[13]); CC20_ODD_ROUND8(X[3], X[4], X[ 9], X[14])
+
+#define STOREXOR8(O,I,X) \
+  _mm256_storeu_si256((__m256i*)(O), XOR8(_mm256_loadu_si256((__m256i*)(I)), X))
+
+
+// eight blocks (512 bytes) per iteration, see cc20_crypt_4x
+static size_t cc20_crypt_8x (unsigned char *out, const unsigned char *in, size_t in_len, uint32_t *s) {
+
+  __m256i x[16], t0, t1, t2, t3;
+  size_t done = 0;
+  int i, j;
+
+  while(in_len - done >= 512) {
+    for(i = 0; i < 16; i++)
+      x[i] = _mm256_set1_epi32(s[i]);
+    x[12] = ADD8(x[12], _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+    // 10 double rounds
+    for(i = 0; i < 10; i++) {
+      CC20_COLUMN_DIAGONAL_ROUNDS8(x);
+    }
+
+    for(i = 0; i < 16; i++)
+      x[i] = ADD8(x[i], _mm256_set1_epi32(s[i]));
+    x[12] = ADD8(x[12], _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+    // x[i + j] now holds words i..i+3 of block j in its lower and of block j + 4
+    // in its upper 128-bit lane (i = 0, 4, 8, 12)
+    for(i = 0; i < 16; i += 4) {
+      CC20_TRANSPOSE(t, _mm256_unpacklo_epi32, _mm256_unpackhi_epi32, _mm256_unpacklo_epi64, _mm256_unpackhi_epi64,
+                     x[i], x[i + 1], x[i + 2], x[i + 3]);
+    }
+    for(j = 0; j < 4; j++) {
+      STOREXOR8(out + 64 * j,            in + 64 * j,            _mm256_permute2x128_si256(x[j],     x[4 + j],  0x20));
+      STOREXOR8(out + 64 * j + 32,       in + 64 * j + 32,       _mm256_permute2x128_si256(x[8 + j], x[12 + j], 0x20));
+      STOREXOR8(out + 64 * (j + 4),      in + 64 * (j + 4),      _mm256_permute2x128_si256(x[j],     x[4 + j],  0x31));
+      STOREXOR8(out + 64 * (j + 4) + 32, in + 64 * (j + 4) + 32, _mm256_permute2x128_si256(x[8 + j], x[12 + j], 0x31));
+    }
+
+    s[12] += 8;
+    in += 512; out += 512; done += 512;
+  }
+
+  return done;
+}
+
+#endif // --- AVX2
+
+
 int cc20_crypt (unsigned char *out, const unsigned char *in, size_t in_len,
                 const unsigned char *iv, cc20_context_t *ctx) {
 
   __m128i a, b, c, d, k0, k1, k2, k3, k4, k5, k6, k7;
+  uint32_t s[16];
+  size_t n;
 
   uint8_t   *keystream8 = (uint8_t*)ctx->keystream32;
 
@@ -147,6 +271,22 @@ int cc20_crypt (unsigned char *out, const unsigned char *in, size_t in_len,
   c = _mm_loadu_si128 ( (__m128i*)((ctx->key)+16));
   d = _mm_loadu_si128 ((__m128i*)iv);
 
+  // full state for the multi-block kernels, x86 is little endian
+  _mm_storeu_si128((__m128i*)&s[ 0], a);
+  _mm_storeu_si128((__m128i*)&s[ 4], b);
+  _mm_storeu_si128((__m128i*)&s[ 8], c);
+  _mm_storeu_si128((__m128i*)&s[12], d);
+
+#if defined (__AVX2__)
+  n = cc20_crypt_8x(out, in, in_len, s);
+  out += n; in += n; in_len -= n;
+#endif
+  n = cc20_crypt_4x(out, in, in_len, s);
+  out += n; in += n; in_len -= n;
+
+  // continue with the updated block counter
+  d = _mm_loadu_si128((__m128i*)&s[12]);
+
   while (in_len >= 128) {
 
     k0 = a; k1 = b; k2 = c; k3 = d;
@@ -233,6 +373,8 @@ int cc20_crypt (unsigned char *out, const unsigned char *in, size_t in_len,
     }
 
   }
+
+  return 0;
 }
 
 
@@ -375,12 +517,92 @@ int cc20_crypt (unsigned char *out, const unsigned char *in, size_t in_len,
       in_len--;
     }
   }
+
+  return 0;
 }
 
 
 #endif // openSSL 1.1, plain C ------------------------------------------------------------
 
 
+// ChaCha20-Poly1305 (RFC 8439) on top of any of the cc20_crypt flavors above: the iv
+// is the 32-bit little endian block counter followed by the 96-bit nonce, block 0
+// yields the one-time poly1305 key, the payload is en/de-crypted from block 1 on
+
+
+static void cc20_poly1305_iv (unsigned char *iv, uint32_t counter, const unsigned char *nonce) {
+
+  iv[0] = counter; iv[1] = counter >> 8; iv[2] = counter >> 16; iv[3] = counter >> 24;
+  memcpy(iv + 4, nonce, CC20_POLY1305_NONCE_SIZE);
+}
+
+
+static void cc20_poly1305_tag (unsigned char *tag, const unsigned char *ct, size_t ct_len,
+                               const unsigned char *nonce, const unsigned char *aad, size_t aad_len,
+                               cc20_context_t *ctx) {
+
+  static const uint8_t zeros[POLY1305_KEY_SIZE] = { 0 };
+  uint8_t iv[CC20_IV_SIZE];
+  uint8_t otk[POLY1305_KEY_SIZE];
+  uint64_t lens[2];
+  poly1305_context_t poly;
+
+  cc20_poly1305_iv(iv, 0, nonce);
+  cc20_crypt(otk, zeros, POLY1305_KEY_SIZE, iv, ctx);
+
+  // aad | pad16 | ciphertext | pad16 | le64(aad_len) | le64(ct_len)
+  poly1305_init(&poly, otk);
+  poly1305_update(&poly, aad, aad_len);
+  poly1305_update(&poly, zeros, (0 - aad_len) % POLY1305_BLOCK_SIZE);
+  poly1305_update(&poly, ct, ct_len);
+  poly1305_update(&poly, zeros, (0 - ct_len) % POLY1305_BLOCK_SIZE);
+  lens[0] = htole64((uint64_t)aad_len);
+  lens[1] = htole64((uint64_t)ct_len);
+  poly1305_update(&poly, (uint8_t*)lens, sizeof(lens));
+  poly1305_finish(&poly, tag);
+
+  memset(otk, 0, sizeof(otk));
+}
+
+
+int cc20_poly1305_encrypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                           const unsigned char *nonce, const unsigned char *aad, size_t aad_len,
+                           unsigned char *tag, cc20_context_t *ctx) {
+
+  uint8_t iv[CC20_IV_SIZE];
+
+  cc20_poly1305_iv(iv, 1, nonce);
+  if(cc20_crypt(out, in, in_len, iv, ctx))
+    return -1;
+
+  cc20_poly1305_tag(tag, out, in_len, nonce, aad, aad_len, ctx);
+
+  return 0;
+}
+
+
+// returns -1 and leaves out untouched if the tag does not match
+int cc20_poly1305_decrypt (unsigned char *out, const unsigned char *in, size_t in_len,
+                           const unsigned char *nonce, const unsigned char *aad, size_t aad_len,
+                           const unsigned char *tag, cc20_context_t *ctx) {
+
+  uint8_t iv[CC20_IV_SIZE];
+  uint8_t computed[CC20_POLY1305_TAG_SIZE];
+  uint8_t diff = 0;
+  int i;
+
+  cc20_poly1305_tag(computed, in, in_len, nonce, aad, aad_len, ctx);
+  for(i = 0; i < CC20_POLY1305_TAG_SIZE; i++)
+    diff |= computed[i] ^ tag[i];
+  if(diff)
+    return -1;
+
+  cc20_poly1305_iv(iv, 1, nonce);
+
+  return cc20_crypt(out, in, in_len, iv, ctx);
+}
+
+
 int cc20_init (const unsigned char *key, cc20_context_t **ctx) {
 
  // allocate context...
@@ -395,8 +617,17 @@ int cc20_init (const unsigned char *key, cc20_context_t **ctx) {
   }
 
   (*ctx)->cipher = EVP_chacha20();
-#endif
+
+  // the key is set up once here, the packets only set the iv
+  if((1 != EVP_EncryptInit_ex((*ctx)->ctx, (*ctx)->cipher, NULL, key, NULL))
+     || (1 != EVP_CIPHER_CTX_set_padding((*ctx)->ctx, 0))) {
+    traceEvent(TRACE_ERROR, "cc20_init openssl key setup: %s",
+                            openssl_err_as_string());
+    return -1;
+  }
+#else
   memcpy((*ctx)->key, key, CC20_KEY_BYTES);
+#endif
 
   return 0;
 }
@@ -404,8 +635,124 @@ int cc20_init (const unsigned char *key, cc20_context_t **ctx) {
 
 int cc20_deinit (cc20_context_t *ctx) {
 
+  if (ctx) {
 #if defined (HAVE_OPENSSL_1_1)
-  if (ctx->ctx) EVP_CIPHER_CTX_free(ctx->ctx);
+    if (ctx->ctx) EVP_CIPHER_CTX_free(ctx->ctx);
 #endif
+    free (ctx);
+  }
+
+  return 0;
+}
+
+
+#ifdef TEST_CC20
+// self test, e.g. from a cmake build in build/:
+//   gcc -DCMAKE_BUILD -D_GNU_SOURCE -DTEST_CC20 -march=native -Iinclude src/cc20.c src/poly1305.c -o cc20_test -Lbuild -ln2n -lpthread
+//
+// checks the RFC 8439 (2.4.2) test vector and, for the SSE implementation,
+// compares the multi-block kernels to the one- and two-block code for all
+// lengths up to 1500 bytes, also with a wrapping block counter
+
+#define TEST_CC20_MAX_LEN  1500
+#define TEST_CC20_CHUNK     192 /* three blocks, below the multi-block kernels */
+
+
+static int test_cc20_compare (const char *what, const uint8_t *a, const uint8_t *b, size_t len, uint32_t counter) {
+
+  if(memcmp(a, b, len)) {
+    printf("FAILED: %s, %u bytes, block counter %08x\n", what, (unsigned int)len, counter);
+    return 1;
+  }
+
   return 0;
 }
+
+
+int main () {
+
+  const uint8_t kat_key[CC20_KEY_BYTES] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f };
+  const uint8_t kat_iv[CC20_IV_SIZE] = {
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4a, 0x00, 0x00, 0x00, 0x00 };
+  const char *kat_pt = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+  const uint8_t kat_ct[] = {
+    0x6e, 0x2e, 0x35, 0x9a, 0x25, 0x68, 0xf9, 0x80, 0x41, 0xba, 0x07, 0x28, 0xdd, 0x0d, 0x69, 0x81,
+    0xe9, 0x7e, 0x7a, 0xec, 0x1d, 0x43, 0x60, 0xc2, 0x0a, 0x27, 0xaf, 0xcc, 0xfd, 0x9f, 0xae, 0x0b,
+    0xf9, 0x1b, 0x65, 0xc5, 0x52, 0x47, 0x33, 0xab, 0x8f, 0x59, 0x3d, 0xab, 0xcd, 0x62, 0xb3, 0x57,
+    0x16, 0x39, 0xd6, 0x24, 0xe6, 0x51, 0x52, 0xab, 0x8f, 0x53, 0x0c, 0x35, 0x9f, 0x08, 0x61, 0xd8,
+    0x07, 0xca, 0x0d, 0xbf, 0x50, 0x0d, 0x6a, 0x61, 0x56, 0xa3, 0x8e, 0x08, 0x8a, 0x22, 0xb6, 0x5e,
+    0x52, 0xbc, 0x51, 0x4d, 0x16, 0xcc, 0xf8, 0x06, 0x81, 0x8c, 0xe9, 0x1a, 0xb7, 0x79, 0x37, 0x36,
+    0x5a, 0xf9, 0x0b, 0xbf, 0x74, 0xa3, 0x5b, 0xe6, 0xb4, 0x0b, 0x8e, 0xed, 0xf2, 0x78, 0x5e, 0x42,
+    0x87, 0x4d };
+
+  cc20_context_t *ctx;
+  uint8_t out[TEST_CC20_MAX_LEN];
+  int failed = 0;
+
+  if(cc20_init(kat_key, &ctx))
+    return 1;
+
+  cc20_crypt(out, (const uint8_t*)kat_pt, sizeof(kat_ct), kat_iv, ctx);
+  failed += test_cc20_compare("RFC 8439 test vector", out, kat_ct, sizeof(kat_ct), 1);
+
+  cc20_deinit(ctx);
+
+#if !defined (HAVE_OPENSSL_1_1) && defined (__SSE2__)
+  {
+    const uint32_t counters[] = { 0, 1, 0xfffffff0 /* wraps */ };
+    uint8_t key[CC20_KEY_BYTES], iv[CC20_IV_SIZE], in[TEST_CC20_MAX_LEN], ref[TEST_CC20_MAX_LEN];
+    uint32_t s[16], counter;
+    size_t len, off, n;
+    int c, i;
+
+    srand(8439);
+    for(i = 0; i < CC20_KEY_BYTES; i++)
+      key[i] = rand();
+    for(i = 0; i < CC20_IV_SIZE; i++)
+      iv[i] = rand();
+    for(i = 0; i < TEST_CC20_MAX_LEN; i++)
+      in[i] = rand();
+
+    if(cc20_init(key, &ctx))
+      return 1;
+
+    for(c = 0; c < sizeof(counters) / sizeof(counters[0]); c++) {
+      for(len = 1; len <= TEST_CC20_MAX_LEN; len++) {
+        // reference: chunks short enough for the one- and two-block code only
+        for(off = 0; off < len; off += TEST_CC20_CHUNK) {
+          counter = counters[c] + off / 64;
+          memcpy(iv, &counter, sizeof(counter));
+          cc20_crypt(ref + off, in + off, min(TEST_CC20_CHUNK, len - off), iv, ctx);
+        }
+
+        memcpy(iv, &counters[c], sizeof(counters[c]));
+        cc20_crypt(out, in, len, iv, ctx);
+        failed += test_cc20_compare("cc20_crypt", out, ref, len, counters[c]);
+
+        memcpy(&s[0], "expand 32-byte k", 16);
+        memcpy(&s[4], key, CC20_KEY_BYTES);
+        memcpy(&s[12], iv, CC20_IV_SIZE);
+        n = cc20_crypt_4x(out, in, len, s);
+        failed += test_cc20_compare("cc20_crypt_4x", out, ref, n, counters[c]);
+        failed += (s[12] != (uint32_t)(counters[c] + n / 64));
+
+#if defined (__AVX2__)
+        memcpy(&s[12], iv, CC20_IV_SIZE);
+        n = cc20_crypt_8x(out, in, len, s);
+        failed += test_cc20_compare("cc20_crypt_8x", out, ref, n, counters[c]);
+        failed += (s[12] != (uint32_t)(counters[c] + n / 64));
+#endif
+      }
+    }
+
+    cc20_deinit(ctx);
+  }
+#endif
+
+  printf("cc20 self test %s\n", failed ? "FAILED" : "passed");
+
+  return failed ? 1 : 0;
+}
+#endif
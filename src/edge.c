@@ -124,6 +124,24 @@ static void help() {
 #endif /* #ifndef WIN32 */
 #ifdef __linux__
 	 "[-T <tos>]"
+#endif
+#ifdef N2N_HAVE_TAP_MQ
+	 "[-Q <queues>]"
+#endif
+#ifdef N2N_HAVE_TAP_OFFLOAD
+	 "[-O]"
+#endif
+#ifdef N2N_HAVE_IO_URING
+	 "[-U]"
+#endif
+#ifdef N2N_HAVE_PIPELINE
+	 "[-P <workers>]"
+#endif
+#ifdef N2N_HAVE_ZSTD
+	 "[-Z <dictionary>]"
+#endif
+#ifdef N2N_HAVE_ASYNC_LOG
+	 "[-Y]"
 #endif
 	 "[-n cidr:gateway] "
 	 "[-m <MAC address>] "
@@ -163,23 +181,48 @@ static void help() {
 #endif
   printf("-r                       | Enable packet forwarding through n2n community.\n");
   printf("-A1                      | Disable payload encryption. Do not use with key (defaulting to Twofish then).\n");
-  printf("-A2 ... -A5 or -A        | Choose a cipher for payload encryption, requires a key: -A2 = Twofish (default),\n");
+  printf("-A2 ... -A8 or -A        | Choose a cipher for payload encryption, requires a key: -A2 = Twofish (default),\n");
   printf("                         | -A3 or -A (deprecated) = AES, "
   "-A4 = ChaCha20, "
-  "-A5 = Speck-CTR.\n");
+  "-A5 = Speck-CTR, "
+  "-A6 = AES-GCM,\n");
+  printf("                         | -A7 = ChaCha20-Poly1305 (both authenticated), -A8 = AES-CTR.\n");
   printf("-H                       | Enable full header encryption. Requires supernode with fixed community.\n");
-  printf("-z1 ... -z2 or -z        | Enable compression for outgoing data packets: -z1 or -z = lzo1x"
+  printf("-z1 ... -z3 or -z        | Enable compression for outgoing data packets: -z1 or -z = lzo1x"
 #ifdef N2N_HAVE_ZSTD
   ", -z2 = zstd"
+#endif
+#ifdef N2N_HAVE_LZ4
+  ", -z3 = lz4"
 #endif
   " (default=disabled).\n");
+#ifdef N2N_HAVE_ZSTD
+  printf("-Z <dictionary>          | zstd dictionary of the community (see n2n-zstd-train), used with -z2 towards\n"
+         "                         | peers which loaded the same one.\n");
+#endif
   printf("-E                       | Accept multicast MAC addresses (default=drop).\n");
   printf("-S                       | Do not connect P2P. Always use the supernode.\n");
 #ifdef __linux__
   printf("-T <tos>                 | TOS for packets (e.g. 0x48 for SSH like priority)\n");
+#endif
+#ifdef N2N_HAVE_TAP_MQ
+  printf("-Q <queues>              | Number of TAP queues (1..%d), each served by its own thread (default 1).\n", N2N_MAX_TAP_QUEUES);
+#endif
+#ifdef N2N_HAVE_TAP_OFFLOAD
+  printf("-O                       | Enable TAP offloads: read TCP super-frames (TSO) and segment them in the edge.\n");
+#endif
+#ifdef N2N_HAVE_IO_URING
+  printf("-U                       | Do the TAP and UDP I/O with io_uring.\n");
+#endif
+#ifdef N2N_HAVE_PIPELINE
+  printf("-P <workers>             | Encrypt and decrypt in a pipeline of this many threads (1..%d).\n", N2N_PIPELINE_MAX_WORKERS);
 #endif
   printf("-n <cidr:gateway>        | Route an IPv4 network via the gw. Use 0.0.0.0/0 for the default gw. Can be set multiple times.\n");
   printf("-v                       | Make more verbose. Repeat as required.\n");
+#ifdef N2N_HAVE_ASYNC_LOG
+  printf("-Y                       | Write the log from a background thread, dropping messages rather than\n"
+         "                         | slowing down the packet processing.\n");
+#endif
   printf("-t <port>                | Management UDP Port (for multiple edges on a machine).\n");
 
   printf("\nEnvironment variables:\n");
@@ -211,12 +254,19 @@ static void setPayloadCompression(n2n_edge_conf_t *conf, int compression) {
       conf->compression = N2N_COMPRESSION_ID_ZSTD;
       break;
     }
+#endif
+#ifdef N2N_HAVE_LZ4
+  case 3:
+    {
+      conf->compression = N2N_COMPRESSION_ID_LZ4;
+      break;
+    }
 #endif
   default:
     {
       conf->compression = N2N_COMPRESSION_ID_NONE;
       // internal comrpession scheme numbering differs from cli counting by one, hence plus one
-      // (internal: 0 == invalid, 1 == none, 2 == lzo, 3 == zstd)
+      // (internal: 0 == invalid, 1 == none, 2 == lzo, 3 == zstd, 4 == lz4)
       traceEvent(TRACE_NORMAL, "the %s compression given by -z_ option is not supported in this version.", compression_str(compression + 1));
       exit(1); // to make the user aware
     }
@@ -255,6 +305,21 @@ static void setPayloadEncryption( n2n_edge_conf_t *conf, int cipher) {
       conf->transop_id = N2N_TRANSFORM_ID_SPECK;
       break;
     }
+  case 6:
+    {
+      conf->transop_id = N2N_TRANSFORM_ID_AES_GCM;
+      break;
+    }
+  case 7:
+    {
+      conf->transop_id = N2N_TRANSFORM_ID_CHACHA20_POLY1305;
+      break;
+    }
+  case 8:
+    {
+      conf->transop_id = N2N_TRANSFORM_ID_AES_CTR;
+      break;
+    }
   default:
     {
       conf->transop_id = N2N_TRANSFORM_ID_INVAL;
@@ -388,6 +453,13 @@ static int setOption(int optkey, char *optargument, n2n_tuntap_priv_config_t *ec
       break;
     }
 
+#ifdef N2N_HAVE_ZSTD
+  case 'Z': /* zstd dictionary */
+    if(conf->zstd_dict) free(conf->zstd_dict);
+    conf->zstd_dict = strdup(optargument);
+    break;
+#endif
+
   case 'l': /* supernode-list */
     if(optargument) {
       if(edge_conf_add_supernode(conf, optargument) != 0) {
@@ -438,6 +510,52 @@ static int setOption(int optkey, char *optargument, n2n_tuntap_priv_config_t *ec
     }
 #endif
 
+#ifdef N2N_HAVE_TAP_MQ
+  case 'Q':
+    {
+      int queues = atoi(optargument);
+
+      if((queues < 1) || (queues > N2N_MAX_TAP_QUEUES)) {
+        traceEvent(TRACE_WARNING, "Bad number of TAP queues '%s', must be 1..%u", optargument, N2N_MAX_TAP_QUEUES);
+        exit(1);
+      }
+
+      conf->tap_queues = queues;
+      break;
+    }
+#endif
+
+#ifdef N2N_HAVE_TAP_OFFLOAD
+  case 'O':
+    {
+      conf->tap_offload = 1;
+      break;
+    }
+#endif
+
+#ifdef N2N_HAVE_IO_URING
+  case 'U':
+    {
+      conf->io_uring = 1;
+      break;
+    }
+#endif
+
+#ifdef N2N_HAVE_PIPELINE
+  case 'P':
+    {
+      int workers = atoi(optargument);
+
+      if((workers < 1) || (workers > N2N_PIPELINE_MAX_WORKERS)) {
+        traceEvent(TRACE_WARNING, "Bad number of pipeline workers '%s', must be 1..%u", optargument, N2N_PIPELINE_MAX_WORKERS);
+        exit(1);
+      }
+
+      conf->pipeline_workers = workers;
+      break;
+    }
+#endif
+
   case 'n':
     {
       char cidr_net[64], gateway[64];
@@ -502,6 +620,12 @@ static int setOption(int optkey, char *optargument, n2n_tuntap_priv_config_t *ec
     setTraceLevel(getTraceLevel() + 1);
     break;
 
+#ifdef N2N_HAVE_ASYNC_LOG
+  case 'Y': /* asynchronous logging */
+    ec->async_log = 1;
+    break;
+#endif
+
   default:
     {
       traceEvent(TRACE_WARNING, "Unknown option -%c: Ignored", (char)optkey);
@@ -523,6 +647,9 @@ static const struct option long_options[] =
    { "egid",            required_argument, NULL, 'g' },
    { "help"   ,         no_argument,       NULL, 'h' },
    { "verbose",         no_argument,       NULL, 'v' },
+#ifdef N2N_HAVE_ASYNC_LOG
+   { "async-log",       no_argument,       NULL, 'Y' },
+#endif
    { NULL,              0,                 NULL,  0  }
 };
 
@@ -536,6 +663,24 @@ static int loadFromCLI(int argc, char *argv[], n2n_edge_conf_t *conf, n2n_tuntap
                           "k:a:bc:Eu:g:m:M:s:d:l:p:fvhrt:i:SDL:z::A::Hn:"
 #ifdef __linux__
                           "T:"
+#endif
+#ifdef N2N_HAVE_TAP_MQ
+                          "Q:"
+#endif
+#ifdef N2N_HAVE_TAP_OFFLOAD
+                          "O"
+#endif
+#ifdef N2N_HAVE_IO_URING
+                          "U"
+#endif
+#ifdef N2N_HAVE_PIPELINE
+                          "P:"
+#endif
+#ifdef N2N_HAVE_ZSTD
+                          "Z:"
+#endif
+#ifdef N2N_HAVE_ASYNC_LOG
+                          "Y"
 #endif
                           ,
                           long_options, NULL)) != '?') {
@@ -898,9 +1043,16 @@ int main(int argc, char* argv[]) {
 		eee->last_register_req = 0;
 	}
 
+#ifdef __linux__
+	if (tuntap_open_ext(&tuntap, eee->tuntap_priv_conf.tuntap_dev_name, eee->tuntap_priv_conf.ip_mode,
+	                    eee->tuntap_priv_conf.ip_addr, eee->tuntap_priv_conf.netmask,
+	                    eee->tuntap_priv_conf.device_mac, eee->tuntap_priv_conf.mtu,
+	                    max(eee->conf.tap_queues, 1), eee->conf.tap_offload) < 0) exit(1);
+#else
 	if (tuntap_open(&tuntap, eee->tuntap_priv_conf.tuntap_dev_name, eee->tuntap_priv_conf.ip_mode,
 	                eee->tuntap_priv_conf.ip_addr, eee->tuntap_priv_conf.netmask,
 	                eee->tuntap_priv_conf.device_mac, eee->tuntap_priv_conf.mtu) < 0) exit(1);
+#endif
 	traceEvent(TRACE_NORMAL, "Local tuntap IP: %s, Mask: %s",
 	           eee->tuntap_priv_conf.ip_addr, eee->tuntap_priv_conf.netmask);
 	memcpy(&eee->device, &tuntap, sizeof(tuntap));
@@ -913,6 +1065,12 @@ int main(int argc, char* argv[]) {
   }
 #endif /* #ifndef WIN32 */
 
+#ifdef N2N_HAVE_ASYNC_LOG
+  /* after daemonizing which leaves the thread behind */
+  if(eee->tuntap_priv_conf.async_log && (startTraceThread() != 0))
+    traceEvent(TRACE_WARNING, "Cannot start the log thread, logging synchronously");
+#endif
+
 #ifndef WIN32
 
 #ifdef HAVE_LIBCAP
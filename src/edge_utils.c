@@ -19,9 +19,16 @@
 #include "n2n.h"
 #include "edge_utils_win32.h"
 
-/* heap allocation for compression as per lzo example doc */
-#define HEAP_ALLOC(var,size) lzo_align_t __LZO_MMODEL var [ ((size) + (sizeof(lzo_align_t) - 1)) / sizeof(lzo_align_t) ]
-static HEAP_ALLOC(wrkmem, LZO1X_1_MEM_COMPRESS);
+/* Peers, supernode state and stats are shared by the TAP queue workers and
+ * the pipeline threads: they are only locked while more than one worker is
+ * running. */
+#ifdef N2N_HAVE_TAP_MQ
+#define EDGE_LOCK(eee)   do { if((eee)->num_workers > 1) pthread_mutex_lock(&(eee)->lock); } while(0)
+#define EDGE_UNLOCK(eee) do { if((eee)->num_workers > 1) pthread_mutex_unlock(&(eee)->lock); } while(0)
+#else
+#define EDGE_LOCK(eee)
+#define EDGE_UNLOCK(eee)
+#endif
 
 /* ************************************** */
 
@@ -35,6 +42,26 @@ static void check_peer_registration_needed(n2n_edge_t *eee,
                                            const n2n_sock_t *peer);
 
 static int edge_init_sockets(n2n_edge_t *eee, int udp_local_port, int mgmt_port, uint8_t tos);
+static void edge_set_socket_options(n2n_edge_t *eee, int sock, uint8_t tos);
+static void edge_worker_set_offloads(n2n_edge_worker_t *w);
+#ifdef N2N_HAVE_IO_URING
+static int edge_uring_send_batch(n2n_edge_worker_t *w);
+static int edge_uring_tap_write(n2n_edge_worker_t *w, uint8_t *frame, size_t len);
+#endif
+#ifdef N2N_HAVE_TAP_MQ
+static int edge_init_mq_workers(n2n_edge_t *eee);
+static void edge_term_mq_workers(n2n_edge_t *eee);
+#endif
+#ifdef N2N_HAVE_PIPELINE
+static void pipeline_submit(n2n_edge_worker_t *w, int d, const uint8_t *data, size_t len,
+			    const struct sockaddr_in *sender);
+static int edge_init_pipeline(n2n_edge_t *eee);
+static void edge_term_pipeline(n2n_edge_t *eee);
+#endif
+#ifdef N2N_HAVE_EPOLL
+static void edge_epoll_register_sockets(n2n_edge_t *eee);
+static void edge_epoll_register_tap(n2n_edge_t *eee);
+#endif
 static int edge_init_routes(n2n_edge_t *eee, n2n_route_t *routes, uint16_t num_routes);
 static void edge_cleanup_routes(n2n_edge_t *eee);
 static int supernode2addr(n2n_sock_t * sn, const n2n_sn_name_t addrIn);
@@ -62,6 +89,34 @@ int edge_verify_conf(const n2n_edge_conf_t *conf) {
      ((conf->encrypt_key != NULL) && (conf->transop_id == N2N_TRANSFORM_ID_NULL)))
     return(-4);
 
+#ifdef N2N_HAVE_TAP_MQ
+  if(conf->tap_queues > N2N_MAX_TAP_QUEUES)
+#else
+  if(conf->tap_queues > 1)
+#endif
+    return(-5);
+
+#ifndef N2N_HAVE_TAP_OFFLOAD
+  if(conf->tap_offload)
+    return(-6);
+#endif
+
+  if(conf->io_uring) {
+#ifdef N2N_HAVE_IO_URING
+    /* the io_uring loop serves the main TAP queue with plain frames */
+    if((conf->tap_queues > 1) || conf->tap_offload)
+#endif
+      return(-7);
+  }
+
+  if(conf->pipeline_workers) {
+#ifdef N2N_HAVE_PIPELINE
+    /* the pipeline takes over the data path of the epoll loop */
+    if((conf->pipeline_workers > N2N_PIPELINE_MAX_WORKERS) || (conf->tap_queues > 1) || conf->io_uring)
+#endif
+      return(-8);
+  }
+
   return(0);
 }
 
@@ -105,6 +160,9 @@ const char* transop_str(enum n2n_transform tr) {
   case N2N_TRANSFORM_ID_AES:     return("AES");
   case N2N_TRANSFORM_ID_CHACHA20:return("ChaCha20");
   case N2N_TRANSFORM_ID_SPECK   :return("Speck");
+  case N2N_TRANSFORM_ID_AES_GCM :return("AES-GCM");
+  case N2N_TRANSFORM_ID_CHACHA20_POLY1305:return("ChaCha20-Poly1305");
+  case N2N_TRANSFORM_ID_AES_CTR :return("AES-CTR");
   default:                       return("invalid");
   };
 }
@@ -116,6 +174,7 @@ const char* compression_str(uint8_t cmpr) {
   case N2N_COMPRESSION_ID_NONE:  return("none");
   case N2N_COMPRESSION_ID_LZO:   return("lzo1x");
   case N2N_COMPRESSION_ID_ZSTD:  return("zstd");
+  case N2N_COMPRESSION_ID_LZ4:   return("lz4");
   default:                       return("invalid");
   };
 }
@@ -165,12 +224,315 @@ static int is_ip6_discovery(const void * buf, size_t bufsize) {
 
 /* ************************************** */
 
+#ifdef N2N_HAVE_MMSG
+/** Allocate a set of packet buffers for recvmmsg()/sendmmsg(), each message
+ *  pointing to its own buffer and address. */
+static n2n_mmsg_batch_t* mmsg_batch_alloc(void) {
+  n2n_mmsg_batch_t *batch = calloc(1, sizeof(n2n_mmsg_batch_t));
+  int i;
+
+  if(!batch)
+    return(NULL);
+
+  for(i=0; i<N2N_MMSG_BATCH_SIZE; i++) {
+    batch->iovs[i].iov_base = batch->bufs[i];
+    batch->iovs[i].iov_len = N2N_PKT_BUF_SIZE;
+    batch->msgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+    batch->msgs[i].msg_hdr.msg_iovlen = 1;
+    batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+    batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+  }
+
+  return(batch);
+}
+
+/* ************************************** */
+#endif
+
+#ifdef N2N_HAVE_UDP_GRO
+/** Allocate the buffers receiving coalesced datagrams, each with room for
+ *  the control message carrying the segment size. */
+static n2n_udp_gro_batch_t* udp_gro_batch_alloc(void) {
+  n2n_udp_gro_batch_t *batch = calloc(1, sizeof(n2n_udp_gro_batch_t));
+  int i;
+
+  if(!batch)
+    return(NULL);
+
+  for(i=0; i<N2N_UDP_GRO_BATCH_SIZE; i++) {
+    batch->iovs[i].iov_base = batch->bufs[i];
+    batch->iovs[i].iov_len = N2N_UDP_GRO_BUF_SIZE;
+    batch->msgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+    batch->msgs[i].msg_hdr.msg_iovlen = 1;
+    batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+  }
+
+  return(batch);
+}
+
+/* ************************************** */
+#endif
+
+/** Initialise a transop of the configured type, e.g. for each worker. */
+static int edge_init_transop(const n2n_edge_conf_t *conf, n2n_trans_op_t *transop) {
+  int rc;
+
+  switch(conf->transop_id) {
+  case N2N_TRANSFORM_ID_TWOFISH:
+    rc = n2n_transop_tf_init(conf, transop);
+    break;
+  case N2N_TRANSFORM_ID_AES:
+    rc = n2n_transop_aes_init(conf, transop);
+    break;
+  case N2N_TRANSFORM_ID_CHACHA20:
+    rc = n2n_transop_cc20_init(conf, transop);
+    break;
+  case N2N_TRANSFORM_ID_SPECK:
+    rc = n2n_transop_speck_init(conf, transop);
+    break;
+  case N2N_TRANSFORM_ID_AES_GCM:
+    rc = n2n_transop_aes_gcm_init(conf, transop);
+    break;
+  case N2N_TRANSFORM_ID_CHACHA20_POLY1305:
+    rc = n2n_transop_cc20_poly1305_init(conf, transop);
+    break;
+  case N2N_TRANSFORM_ID_AES_CTR:
+    rc = n2n_transop_aes_ctr_init(conf, transop);
+    break;
+  default:
+    rc = n2n_transop_null_init(conf, transop);
+  }
+
+  if((rc < 0) || (transop->fwd_inplace == NULL) || (transop->rev_inplace == NULL)
+     || (transop->transform_id != conf->transop_id))
+    return(-1);
+
+  return(0);
+}
+
+/* ************************************** */
+
+/** Clock for the compression statistics and level control. The unit does
+ *  not matter as only ratios of it are used. */
+static uint64_t comp_clock(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  return(__builtin_ia32_rdtsc());
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return((uint64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+#endif
+}
+
+/* ************************************** */
+
+/** Set up the data path state of a worker. The UDP socket is assigned by the
+ *  caller. */
+static int edge_worker_init(n2n_edge_t *eee, n2n_edge_worker_t *w, uint8_t idx,
+                            tuntap_dev *device, n2n_trans_op_t *transop) {
+  w->eee = eee;
+  w->idx = idx;
+  w->device = device;
+  w->transop = transop;
+  w->udp_sock = -1;
+  n2n_buf_cache_init(&w->buf_cache, eee->buf_pool);
+
+  if(((w->lzo_wrkmem = malloc(LZO1X_1_MEM_COMPRESS)) == NULL)
+     || ((w->comp_buf = n2n_buf_get(&w->buf_cache)) == NULL))
+    return(-1);
+
+  if(eee->conf.compression > N2N_COMPRESSION_ID_NONE) {
+    if((w->comp_ctl = calloc(1, sizeof(n2n_comp_ctl_t))) == NULL)
+      return(-1);
+    w->comp_ctl->zstd_level = ZSTD_COMPRESSION_LEVEL;
+    w->comp_ctl->win_start = comp_clock();
+  }
+
+#ifdef N2N_HAVE_ZSTD
+  /* kept for all packets: setting up a context costs more than compressing
+   * a MTU-sized frame. Peers may send zstd regardless of our own setting. */
+  if((w->zstd_dctx = ZSTD_createDCtx()) == NULL)
+    return(-1);
+  if((eee->conf.compression == N2N_COMPRESSION_ID_ZSTD) && ((w->zstd_cctx = ZSTD_createCCtx()) == NULL))
+    return(-1);
+#endif
+
+#ifdef N2N_HAVE_LZ4
+  if((eee->conf.compression == N2N_COMPRESSION_ID_LZ4) && ((w->lz4_state = malloc(LZ4_sizeofState())) == NULL))
+    return(-1);
+#endif
+
+#ifdef N2N_HAVE_TAP_OFFLOAD
+  /* a frame passed on unsegmented gets its PACKET built in place as well */
+  if(eee->conf.tap_offload
+     && ((w->gso_buf = malloc(N2N_PKT_HEADROOM + N2N_TAP_GSO_BUF_SIZE + N2N_PKT_TAILROOM)) == NULL))
+    return(-1);
+#endif
+
+#ifdef N2N_HAVE_MMSG
+  if(((w->rx_batch = mmsg_batch_alloc()) == NULL)
+     || ((w->tx_batch = mmsg_batch_alloc()) == NULL))
+    return(-1);
+#endif
+
+  return(0);
+}
+
+/* ************************************** */
+
+static void edge_worker_free(n2n_edge_worker_t *w) {
+  if(w->lzo_wrkmem) {
+    free(w->lzo_wrkmem);
+    w->lzo_wrkmem = NULL;
+  }
+
+  if(w->comp_buf) {
+    n2n_buf_put(&w->buf_cache, w->comp_buf);
+    w->comp_buf = NULL;
+  }
+
+  if(w->comp_ctl) {
+    free(w->comp_ctl);
+    w->comp_ctl = NULL;
+  }
+
+#ifdef N2N_HAVE_ZSTD
+  if(w->zstd_cctx) {
+    ZSTD_freeCCtx(w->zstd_cctx);
+    w->zstd_cctx = NULL;
+  }
+
+  if(w->zstd_dctx) {
+    ZSTD_freeDCtx(w->zstd_dctx);
+    w->zstd_dctx = NULL;
+  }
+#endif
+
+#ifdef N2N_HAVE_LZ4
+  if(w->lz4_state) {
+    free(w->lz4_state);
+    w->lz4_state = NULL;
+  }
+#endif
+
+#ifdef N2N_HAVE_TAP_OFFLOAD
+  if(w->gso_buf) {
+    free(w->gso_buf);
+    w->gso_buf = NULL;
+  }
+#endif
+
+#ifdef N2N_HAVE_UDP_GRO
+  if(w->gro_batch) {
+    free(w->gro_batch);
+    w->gro_batch = NULL;
+  }
+#endif
+
+#ifdef N2N_HAVE_MMSG
+  if(w->rx_batch) {
+    free(w->rx_batch);
+    w->rx_batch = NULL;
+  }
+
+  if(w->tx_batch) {
+    free(w->tx_batch);
+    w->tx_batch = NULL;
+  }
+#endif
+
+  n2n_buf_cache_flush(&w->buf_cache);
+}
+
+/* ************************************** */
+
+/** Packet buffers needed by the threads of the configuration: each may keep
+ *  a cache full, plus one for its compression and those of the jobs in
+ *  flight in the pipeline. */
+static unsigned int edge_buf_pool_size(const n2n_edge_conf_t *conf) {
+  unsigned int threads = 1, bufs = N2N_BUF_POOL_SIZE;
+
+#ifdef N2N_HAVE_TAP_MQ
+  if(conf->tap_queues > 1)
+    threads = conf->tap_queues;
+#endif
+#ifdef N2N_HAVE_PIPELINE
+  if(conf->pipeline_workers) {
+    threads += conf->pipeline_workers + 2 /* writers */;
+    bufs += 2 * N2N_PIPELINE_JOBS;
+  }
+#endif
+
+  return(bufs + threads * (N2N_BUF_CACHE_SIZE + 1));
+}
+
+/* ************************************** */
+
+#ifdef N2N_HAVE_ZSTD
+/** Load the trained zstd dictionary of the community, see tools/n2n-zstd-train.
+ *  Its ID tells peers whether they can use it for what they send us. */
+static int edge_load_zstd_dict(n2n_edge_t *eee, const char *path) {
+  FILE *fd;
+  long size;
+  void *dict = NULL;
+  int rc = -1;
+
+  if((fd = fopen(path, "rb")) == NULL) {
+    traceEvent(TRACE_ERROR, "Cannot open zstd dictionary %s: %s", path, strerror(errno));
+    return(-1);
+  }
+
+  if((fseek(fd, 0, SEEK_END) != 0) || ((size = ftell(fd)) <= 0) || (fseek(fd, 0, SEEK_SET) != 0)
+     || ((dict = malloc(size)) == NULL) || (fread(dict, 1, size, fd) != (size_t)size)) {
+    traceEvent(TRACE_ERROR, "Cannot read zstd dictionary %s", path);
+    goto out;
+  }
+
+  if((eee->zstd_dict_id = ZSTD_getDictID_fromDict(dict, size)) == 0) {
+    traceEvent(TRACE_ERROR, "%s is not a trained zstd dictionary", path);
+    goto out;
+  }
+
+  /* both copy the dictionary content */
+  if(((eee->zstd_cdict = ZSTD_createCDict(dict, size, ZSTD_COMPRESSION_LEVEL)) == NULL)
+     || ((eee->zstd_ddict = ZSTD_createDDict(dict, size)) == NULL)) {
+    traceEvent(TRACE_ERROR, "Cannot load zstd dictionary %s", path);
+    goto out;
+  }
+
+  traceEvent(TRACE_NORMAL, "Loaded zstd dictionary %s [id %u, %ld bytes]",
+             path, eee->zstd_dict_id, size);
+  rc = 0;
+
+ out:
+  free(dict);
+  fclose(fd);
+
+  return(rc);
+}
+
+/* ************************************** */
+
+static void edge_free_zstd_dict(n2n_edge_t *eee) {
+  if(eee->zstd_cdict)
+    ZSTD_freeCDict(eee->zstd_cdict);
+  if(eee->zstd_ddict)
+    ZSTD_freeDDict(eee->zstd_ddict);
+
+  eee->zstd_cdict = NULL;
+  eee->zstd_ddict = NULL;
+  eee->zstd_dict_id = 0;
+}
+
+/* ************************************** */
+#endif
+
 /** Initialise an edge to defaults.
  *
  *  This also initialises the NULL transform operation opstruct.
  */
 n2n_edge_t* edge_init(const n2n_edge_conf_t *conf, int *rv) {
-  n2n_transform_t transop_id = conf->transop_id;
   n2n_edge_t *eee = calloc(1, sizeof(n2n_edge_t));
   int rc = -1, i;
 
@@ -204,7 +566,12 @@ n2n_edge_t* edge_init(const n2n_edge_conf_t *conf, int *rv) {
       goto edge_init_error;
     }
 #ifdef N2N_HAVE_ZSTD
-  // zstd does not require initialization. if it were required, this would be a good place
+  // zstd does not require initialization, its contexts are set up per worker
+  if(eee->conf.zstd_dict && (edge_load_zstd_dict(eee, eee->conf.zstd_dict) < 0))
+    goto edge_init_error;
+#else
+  if(eee->conf.zstd_dict)
+    traceEvent(TRACE_WARNING, "zstd is not supported, ignoring dictionary %s", eee->conf.zstd_dict);
 #endif
 
   for(i=0; i<eee->conf.sn_num; ++i)
@@ -214,25 +581,24 @@ n2n_edge_t* edge_init(const n2n_edge_conf_t *conf, int *rv) {
   supernode2addr(&(eee->supernode), eee->conf.sn_ip_array[eee->sn_idx]);
 
   /* Set active transop */
-  switch(transop_id) {
-  case N2N_TRANSFORM_ID_TWOFISH:
-    rc = n2n_transop_tf_init(&eee->conf, &eee->transop);
-    break;
-  case N2N_TRANSFORM_ID_AES:
-    rc = n2n_transop_aes_init(&eee->conf, &eee->transop);
-    break;
-  case N2N_TRANSFORM_ID_CHACHA20:
-    rc = n2n_transop_cc20_init(&eee->conf, &eee->transop);
-    break;
-  case N2N_TRANSFORM_ID_SPECK:
-    rc = n2n_transop_speck_init(&eee->conf, &eee->transop);
-    break;
-  default:
-    rc = n2n_transop_null_init(&eee->conf, &eee->transop);
+  if((rc = edge_init_transop(&eee->conf, &eee->transop)) < 0) {
+    traceEvent(TRACE_ERROR, "Transop init failed");
+    goto edge_init_error;
   }
 
-  if((rc < 0) || (eee->transop.fwd == NULL) || (eee->transop.transform_id != transop_id)) {
-    traceEvent(TRACE_ERROR, "Transop init failed");
+  if((eee->buf_pool = n2n_buf_pool_create(edge_buf_pool_size(&eee->conf))) == NULL) {
+    traceEvent(TRACE_ERROR, "Cannot allocate packet buffers");
+    goto edge_init_error;
+  }
+
+  if((eee->peer_cache = n2n_peer_cache_create()) == NULL) {
+    traceEvent(TRACE_ERROR, "Cannot allocate the destination cache");
+    goto edge_init_error;
+  }
+
+  /* The main thread serves TAP queue 0 */
+  if((rc = edge_worker_init(eee, &eee->worker, 0, &eee->device, &eee->transop)) < 0) {
+    traceEvent(TRACE_ERROR, "Cannot allocate packet buffers");
     goto edge_init_error;
   }
 
@@ -252,12 +618,34 @@ n2n_edge_t* edge_init(const n2n_edge_conf_t *conf, int *rv) {
   eee->udp_mgmt_sock = -1;
 #ifndef SKIP_MULTICAST_PEERS_DISCOVERY
   eee->udp_multicast_sock = -1;
+#endif
+#ifdef N2N_HAVE_EPOLL
+  eee->epoll_fd = -1;
 #endif
   if(edge_init_sockets(eee, eee->conf.local_port, eee->conf.mgmt_port, eee->conf.tos) < 0) {
     traceEvent(TRACE_ERROR, "socket setup failed");
     goto edge_init_error;
   }
 
+#ifdef N2N_HAVE_TAP_MQ
+  pthread_mutex_init(&eee->lock, NULL);
+  eee->num_workers = 1;
+
+  /* the worker sockets join the port of the main socket: open them now, while
+   * still running with the privileges of the process which opened it */
+  if(edge_init_mq_workers(eee) < 0) {
+    traceEvent(TRACE_ERROR, "TAP queue worker setup failed");
+    goto edge_init_error;
+  }
+#endif
+
+#ifdef N2N_HAVE_PIPELINE
+  if(edge_init_pipeline(eee) < 0) {
+    traceEvent(TRACE_ERROR, "pipeline setup failed");
+    goto edge_init_error;
+  }
+#endif
+
   if(edge_init_routes(eee, eee->conf.routes, eee->conf.num_routes) < 0) {
     traceEvent(TRACE_ERROR, "routes setup failed");
     goto edge_init_error;
@@ -268,14 +656,48 @@ n2n_edge_t* edge_init(const n2n_edge_conf_t *conf, int *rv) {
   return(eee);
 
  edge_init_error:
-  if(eee)
+  if(eee) {
+    edge_worker_free(&eee->worker);
+#ifdef N2N_HAVE_TAP_MQ
+    edge_term_mq_workers(eee);
+#endif
+#ifdef N2N_HAVE_PIPELINE
+    edge_term_pipeline(eee);
+#endif
+    n2n_buf_pool_destroy(eee->buf_pool);
+    n2n_peer_cache_destroy(eee->peer_cache);
+#ifdef N2N_HAVE_ZSTD
+    edge_free_zstd_dict(eee);
+#endif
     free(eee);
+  }
   *rv = rc;
   return(NULL);
 }
 
 /* ************************************** */
 
+/** Mirror the destination of a known peer into the destination cache. */
+static void peer_cache_update(n2n_edge_t *eee, const struct peer_info *peer) {
+  n2n_peer_cache_set(eee->peer_cache, peer->mac_addr, &peer->sock,
+                     (uint32_t)(peer->last_p2p + peer->timeout / 2));
+}
+
+/* ************************************** */
+
+/** Re-populate the destination cache from known_peers, e.g. after a purge. */
+static void peer_cache_rebuild(n2n_edge_t *eee) {
+  struct peer_info *peer, *tmp;
+
+  n2n_peer_cache_clear(eee->peer_cache);
+  HASH_ITER(hh, eee->known_peers, peer, tmp) {
+    if(peer->last_seen > 0)
+      peer_cache_update(eee, peer);
+  }
+}
+
+/* ************************************** */
+
 static int find_and_remove_peer(struct peer_info **head, const n2n_mac_t mac) {
   struct peer_info *peer;
 
@@ -526,7 +948,7 @@ static void register_with_new_peer(n2n_edge_t *eee,
 	} else{
 		scan->sock = *peer;
 	}
-	scan->last_seen = time(NULL);
+	scan->last_seen = n2n_now();
 	if(dev_addr != NULL){
 		memcpy(&(scan->dev_addr), dev_addr, sizeof(n2n_ip_subnet_t));
 	}
@@ -550,10 +972,13 @@ static void check_peer_registration_needed(n2n_edge_t *eee,
 		register_with_new_peer(eee, from_supernode, mac, dev_addr, peer);
 	} else {
 		/* Already in known_peers. */
-		time_t now = time(NULL);
+		time_t now = n2n_now();
 
-		if (!from_supernode)
+		if (!from_supernode && (scan->last_p2p != now)) {
 			scan->last_p2p = now;
+			scan->state = N2N_PEER_ACTIVE;
+			peer_cache_update(eee, scan);
+		}
 
 		if ((now - scan->last_seen) > 0 /* >= 1 sec */) {
 			/* Don't register too often */
@@ -564,9 +989,8 @@ static void check_peer_registration_needed(n2n_edge_t *eee,
 /* ************************************** */
 
 
-/* Confirm that a pending peer is reachable directly via P2P.
- *
- * peer must be a pointer to an element of the pending_peers list.
+/* Confirm that a pending peer is reachable directly via P2P, or that a
+ * revalidating known peer still is.
  */
 static void peer_set_p2p_confirmed(n2n_edge_t * eee,
 				   const n2n_mac_t mac,
@@ -602,11 +1026,60 @@ static void peer_set_p2p_confirmed(n2n_edge_t * eee,
 	       HASH_COUNT(eee->known_peers));
 
     scan->last_seen = now;
+    peer_cache_update(eee, scan);
+    return;
+  }
+
+  HASH_FIND_PEER(eee->known_peers, mac, scan);
+
+  if(scan) {
+    /* Answer to the probe of a revalidating peer */
+    if(scan->state != N2N_PEER_ACTIVE)
+      traceEvent(TRACE_DEBUG, "P2P connection revalidated: %s [%s]",
+                 macaddr_str(mac_buf, mac),
+                 sock_to_cstr(sockbuf, peer));
+
+    scan->sock = *peer;
+    scan->state = N2N_PEER_ACTIVE;
+    scan->last_p2p = scan->last_seen = now;
+    peer_cache_update(eee, scan);
   } else
-    traceEvent(TRACE_DEBUG, "Failed to find sender in pending_peers.");
+    traceEvent(TRACE_DEBUG, "Failed to find sender in pending_peers or known_peers.");
+}
+
+/* ************************************** */
+
+/** Remember the zstd dictionary a peer announced in its REGISTER(_ACK). */
+static void peer_set_zstd_dict(n2n_edge_t *eee, const n2n_mac_t mac, uint32_t dict_id) {
+  struct peer_info *scan;
+
+  HASH_FIND_PEER(eee->known_peers, mac, scan);
+  if(!scan)
+    HASH_FIND_PEER(eee->pending_peers, mac, scan);
+
+  if(scan)
+    scan->zstd_dict_id = dict_id;
+}
+
+/* ************************************** */
+
+#ifdef N2N_HAVE_ZSTD
+/** The zstd dictionary of a known peer, 0 if none or the peer is not known. */
+static uint32_t peer_zstd_dict_id(n2n_edge_t *eee, const n2n_mac_t mac) {
+  struct peer_info *scan;
+  uint32_t dict_id = 0;
+
+  EDGE_LOCK(eee);
+  HASH_FIND_PEER(eee->known_peers, mac, scan);
+  if(scan)
+    dict_id = scan->zstd_dict_id;
+  EDGE_UNLOCK(eee);
+
+  return(dict_id);
 }
 
 /* ************************************** */
+#endif
 
 int is_empty_ip_address(const n2n_sock_t * sock) {
   const uint8_t * ptr=NULL;
@@ -677,6 +1150,7 @@ static void check_known_peer_sock_change(n2n_edge_t *eee,
 			/* The peer has changed public socket. It can no longer be assumed to be reachable. */
 			HASH_DEL(eee->known_peers, scan);
 			free(scan);
+			n2n_peer_cache_del(eee->peer_cache, mac);
 
 			register_with_new_peer(eee, from_supernode, mac, dev_addr, peer);
 		} else {
@@ -855,6 +1329,7 @@ static void send_register(n2n_edge_t * eee,
   }
 	reg.dev_addr.net_addr = ntohl(eee->device.ip_addr);
 	reg.dev_addr.net_bitlen = mask2bitlen(ntohl(eee->device.device_mask));
+  reg.zstd_dict_id = eee->zstd_dict_id;
 
 
 	idx=0;
@@ -900,6 +1375,7 @@ static void send_register_ack(n2n_edge_t * eee,
   memcpy(ack.cookie, reg->cookie, N2N_COOKIE_SIZE);
   memcpy(ack.srcMac, eee->device.mac_addr, N2N_MAC_SIZE);
   memcpy(ack.dstMac, reg->srcMac, N2N_MAC_SIZE);
+  ack.zstd_dict_id = eee->zstd_dict_id;
 
   idx=0;
   encode_REGISTER_ACK(pktbuf, &idx, &cmn, &ack);
@@ -950,7 +1426,9 @@ void update_supernode_reg(n2n_edge_t * eee, time_t nowTime) {
     // this can only be done, if working on som eunprivileged port and/or having sufficent
     // privileges. as we are not able to check for sufficent privileges here, we only do it
     // if port is sufficently high or unset. uncovered: privileged port and sufficent privileges
-    if( (eee->conf.local_port == 0) || (eee->conf.local_port > 1024) ) {
+    // the sockets of the TAP queue workers share the port and cannot follow, neither can the pipeline
+    if( ((eee->conf.local_port == 0) || (eee->conf.local_port > 1024)) && (eee->conf.tap_queues <= 1)
+        && (eee->conf.pipeline_workers == 0) ) {
       if(edge_init_sockets(eee, eee->conf.local_port, eee->conf.mgmt_port, eee->conf.tos) < 0) {
         traceEvent(TRACE_ERROR, "socket re-initiliaization failed");
       }
@@ -1003,7 +1481,7 @@ static const char * supernode_ip(const n2n_edge_t * eee) {
 
 /** A PACKET has arrived containing an encapsulated ethernet datagram - usually
  *  encrypted. */
-static int handle_PACKET(n2n_edge_t * eee,
+static int handle_PACKET(n2n_edge_worker_t * w,
 			 const uint8_t from_supernode,
 			 const n2n_PACKET_t * pkt,
 			 const n2n_sock_t * orig_sender,
@@ -1017,13 +1495,15 @@ static int handle_PACKET(n2n_edge_t * eee,
   ipstr_t             ip_buf;
   macstr_t            mac_buf;
   n2n_sock_str_t      sockbuf;
+  n2n_edge_t *        eee = w->eee;
 
-  now = time(NULL);
+  now = n2n_now();
 
   traceEvent(TRACE_DEBUG, "handle_PACKET size %u transform %u",
 	     (unsigned int)psize, (unsigned int)pkt->transform);
   /* hexdump(payload, psize); */
 
+  EDGE_LOCK(eee);
   if(from_supernode)
     {
       if(!memcmp(pkt->dstMac, broadcast_mac, N2N_MAC_SIZE))
@@ -1037,10 +1517,11 @@ static int handle_PACKET(n2n_edge_t * eee,
       ++(eee->stats.rx_p2p);
       eee->last_p2p=now;
     }
+  EDGE_UNLOCK(eee);
 
   /* Handle transform. */
   {
-    uint8_t decodebuf[N2N_PKT_BUF_SIZE];
+    int decoded_len;
     size_t eth_size;
     n2n_transform_t rx_transop_id;
     uint8_t rx_compression_id;
@@ -1050,36 +1531,63 @@ static int handle_PACKET(n2n_edge_t * eee,
 
     if(rx_transop_id == eee->conf.transop_id) {
       uint8_t is_multicast;
-      eth_payload = decodebuf;
-      eh = (ether_hdr_t*)eth_payload;
-      eth_size = eee->transop.rev(&eee->transop,
-				  eth_payload, N2N_PKT_BUF_SIZE,
-				  payload, psize, pkt->srcMac);
-      ++(eee->transop.rx_cnt); /* stats */
+      uint8_t aad[N2N_PACKET_AAD_SIZE];
+      size_t aad_len = 0;
+
+      encode_PACKET_aad(aad, &aad_len, pkt);
+
+      /* decrypted in place, the datagram is not needed anymore */
+      eth_payload = payload;
+      decoded_len = w->transop->rev_inplace(w->transop, &eth_payload, psize, aad, aad_len, pkt->srcMac);
+      ++(w->transop->rx_cnt); /* stats */
+
+      if(decoded_len < 0)
+	return(-1);
+      eth_size = decoded_len;
 
       /* decompress if necessary */
-      uint8_t * deflation_buffer = 0;
-      int32_t deflated_len;
+      uint8_t * deflation_buffer = w->comp_buf->data;
+      lzo_uint deflated_len;
       switch (rx_compression_id) {
       case N2N_COMPRESSION_ID_NONE:
 	break; // continue afterwards
 
       case N2N_COMPRESSION_ID_LZO:
-	deflation_buffer = malloc (N2N_PKT_BUF_SIZE);
-	lzo1x_decompress (eth_payload, eth_size, deflation_buffer, (lzo_uint*)&deflated_len, NULL);
+	lzo1x_decompress (eth_payload, eth_size, deflation_buffer, &deflated_len, NULL);
 	break;
 #ifdef N2N_HAVE_ZSTD
       case N2N_COMPRESSION_ID_ZSTD:
-	deflated_len = N2N_PKT_BUF_SIZE;
-	deflation_buffer = malloc (deflated_len);
-	deflated_len = (int32_t)ZSTD_decompress (deflation_buffer, deflated_len, eth_payload, eth_size);
+	{
+	  /* frames compressed with a dictionary carry its ID */
+	  unsigned dict_id = ZSTD_getDictID_fromFrame(eth_payload, eth_size);
+
+	  if(dict_id == 0)
+	    deflated_len = ZSTD_decompressDCtx (w->zstd_dctx, deflation_buffer, N2N_PKT_BUF_SIZE, eth_payload, eth_size);
+	  else if(dict_id == eee->zstd_dict_id)
+	    deflated_len = ZSTD_decompress_usingDDict (w->zstd_dctx, deflation_buffer, N2N_PKT_BUF_SIZE, eth_payload, eth_size, eee->zstd_ddict);
+	  else {
+	    traceEvent (TRACE_WARNING, "payload compressed with unknown zstd dictionary %u, dropped.", dict_id);
+	    return (-1);
+	  }
+	}
 	if(ZSTD_isError(deflated_len)) {
 	  traceEvent (TRACE_ERROR, "payload decompression failed with zstd error '%s'.",
 		      ZSTD_getErrorName(deflated_len));
-	  free (deflation_buffer);
 	  return (-1); // cannot help it
 	}
 	break;
+#endif
+#ifdef N2N_HAVE_LZ4
+      case N2N_COMPRESSION_ID_LZ4:
+	{
+	  int lz4_len = LZ4_decompress_safe ((const char *)eth_payload, (char *)deflation_buffer, eth_size, N2N_PKT_BUF_SIZE);
+	  if(lz4_len < 0) {
+	    traceEvent (TRACE_ERROR, "payload decompression failed with lz4 error %d.", lz4_len);
+	    return (-1); // cannot help it
+	  }
+	  deflated_len = lz4_len;
+	}
+	break;
 #endif
       default:
 	traceEvent (TRACE_ERROR, "payload decompression failed: received packet indicating unsupported %s compression.",
@@ -1090,11 +1598,12 @@ static int handle_PACKET(n2n_edge_t * eee,
       if(rx_compression_id != N2N_COMPRESSION_ID_NONE) {
 	traceEvent (TRACE_DEBUG, "payload decompression [%s]: deflated %u bytes to %u bytes",
 		    compression_str(rx_compression_id), eth_size, (int)deflated_len);
-	memcpy(eth_payload ,deflation_buffer, deflated_len );
+	eth_payload = deflation_buffer;
 	eth_size = deflated_len;
-	free (deflation_buffer);
       }
 
+      eh = (ether_hdr_t*)eth_payload;
+
       is_multicast = (is_ip6_discovery(eth_payload, eth_size) || is_ethMulticast(eth_payload, eth_size));
 
       if(eee->conf.drop_multicast && is_multicast) {
@@ -1134,7 +1643,25 @@ static int handle_PACKET(n2n_edge_t * eee,
 
       /* Write ethernet packet to tap device. */
       traceEvent(TRACE_DEBUG, "sending to TAP %u", (unsigned int)eth_size);
-      data_sent_len = tuntap_write(&(eee->device), eth_payload, eth_size);
+#ifdef N2N_HAVE_PIPELINE
+      if(w->pipe_job) {
+	/* the RX writer of the pipeline does the write, in order */
+	n2n_pipeline_job_t *job = w->pipe_job;
+
+	if((eth_payload < job->buf->data) || (eth_payload >= job->buf->data + sizeof(job->buf->data))) {
+	  memcpy(job->buf->data, eth_payload, eth_size);
+	  eth_payload = job->buf->data;
+	}
+	job->out = eth_payload;
+	job->out_len = data_sent_len = eth_size;
+      } else
+#endif
+#ifdef N2N_HAVE_IO_URING
+      if(w->uring)
+	data_sent_len = edge_uring_tap_write(w, eth_payload, eth_size);
+      else
+#endif
+	data_sent_len = tuntap_write(w->device, eth_payload, eth_size);
 
       if(data_sent_len == eth_size)
 	{
@@ -1193,16 +1720,81 @@ static char *get_ip_from_arp(dec_ip_str_t buf, const n2n_mac_t req_mac) {
 #endif
 
 
-/** Read a datagram from the management UDP socket and take appropriate
- *  action. */
-static void readFromMgmtSocket(n2n_edge_t *eee, int *keep_running) {
-	char udp_buf[N2N_PKT_BUF_SIZE];      /* Compete UDP packet */
-	ssize_t recvlen;
-	/* ssize_t             sendlen; */
-	struct sockaddr_in sender_sock;
-	socklen_t i;
-	size_t msg_len;
-	time_t now;
+/** Sum up the transop counters of all workers. */
+static void edge_transop_counters(const n2n_edge_t *eee, size_t *tx_cnt, size_t *rx_cnt) {
+  *tx_cnt = eee->transop.tx_cnt;
+  *rx_cnt = eee->transop.rx_cnt;
+
+#ifdef N2N_HAVE_TAP_MQ
+  if(eee->mq_workers) {
+    int i;
+
+    for(i = 0; i < eee->conf.tap_queues - 1; i++) {
+      *tx_cnt += eee->mq_workers[i].queue_transop.tx_cnt;
+      *rx_cnt += eee->mq_workers[i].queue_transop.rx_cnt;
+    }
+  }
+#endif
+
+#ifdef N2N_HAVE_PIPELINE
+  if(eee->pipeline) {
+    int i;
+
+    for(i = 0; i < eee->pipeline->num_workers; i++) {
+      *tx_cnt += eee->pipeline->workers[i].transop.tx_cnt;
+      *rx_cnt += eee->pipeline->workers[i].transop.rx_cnt;
+    }
+  }
+#endif
+}
+
+/* ************************************** */
+
+static void comp_ctl_add(const n2n_comp_ctl_t *ctl, n2n_comp_ctl_t *sum) {
+  if(ctl) {
+    sum->saved += ctl->saved;
+    sum->cycles += ctl->cycles;
+    sum->skipped += ctl->skipped;
+  }
+}
+
+/** Sum of the compression statistics of all workers. */
+static void edge_comp_counters(const n2n_edge_t *eee, n2n_comp_ctl_t *sum) {
+  sum->saved = sum->cycles = sum->skipped = 0;
+
+  comp_ctl_add(eee->worker.comp_ctl, sum);
+
+#ifdef N2N_HAVE_TAP_MQ
+  if(eee->mq_workers) {
+    int i;
+
+    for(i = 0; i < eee->conf.tap_queues - 1; i++)
+      comp_ctl_add(eee->mq_workers[i].comp_ctl, sum);
+  }
+#endif
+
+#ifdef N2N_HAVE_PIPELINE
+  if(eee->pipeline) {
+    int i;
+
+    for(i = 0; i < eee->pipeline->num_workers; i++)
+      comp_ctl_add(eee->pipeline->workers[i].w.comp_ctl, sum);
+  }
+#endif
+}
+
+/* ************************************** */
+
+/** Read a datagram from the management UDP socket and take appropriate
+ *  action. */
+static void readFromMgmtSocket(n2n_edge_t *eee, int *keep_running) {
+	char udp_buf[N2N_PKT_BUF_SIZE];      /* Compete UDP packet */
+	ssize_t recvlen;
+	/* ssize_t             sendlen; */
+	struct sockaddr_in sender_sock;
+	socklen_t i;
+	size_t msg_len;
+	time_t now;
 	struct peer_info *peer, *tmpPeer;
 	macstr_t mac_buf;
 	/* dec_ip_bit_str_t ip_bit_str = {'\0'}; */
@@ -1211,6 +1803,8 @@ static void readFromMgmtSocket(n2n_edge_t *eee, int *keep_running) {
 	n2n_sock_str_t sockbuf;
 	uint32_t num_pending_peers = 0;
 	uint32_t num_known_peers = 0;
+	size_t transop_tx_cnt, transop_rx_cnt;
+	n2n_comp_ctl_t comp;
 	uint32_t num = 0;
 
 
@@ -1342,10 +1936,11 @@ static void readFromMgmtSocket(n2n_edge_t *eee, int *keep_running) {
 	                    "known_peers %u | ",
 	                    num_known_peers);
 
+	edge_transop_counters(eee, &transop_tx_cnt, &transop_rx_cnt);
 	msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
 	                    "transop %u,%u\n",
-	                    (unsigned int) eee->transop.tx_cnt,
-	                    (unsigned int) eee->transop.rx_cnt);
+	                    (unsigned int) transop_tx_cnt,
+	                    (unsigned int) transop_rx_cnt);
 
 	msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
 	                    "super %u,%u | ",
@@ -1365,6 +1960,18 @@ static void readFromMgmtSocket(n2n_edge_t *eee, int *keep_running) {
 	                    "last_p2p  %ld sec ago\n",
 	                    (now - eee->last_p2p));
 
+	msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
+	                    "buffers %u | heap_allocs %u\n",
+	                    eee->buf_pool->num_bufs,
+	                    (unsigned int) eee->buf_pool->heap_allocs);
+
+	edge_comp_counters(eee, &comp);
+	msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
+	                    "comp_saved %llu | comp_cycles %llu | comp_skipped %llu\n",
+	                    (unsigned long long) comp.saved,
+	                    (unsigned long long) comp.cycles,
+	                    (unsigned long long) comp.skipped);
+
 	msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
 	                    "\nType \"help\" to see more commands.\n\n");
 
@@ -1403,15 +2010,41 @@ static int check_query_peer_info(n2n_edge_t *eee, time_t now, n2n_mac_t mac) {
 
 /* ************************************** */
 
+/** Keep an idle known peer while a REGISTER probe checks that its socket
+ *  still works. Returns 0 if the probe went unanswered, the peer is then
+ *  stale. */
+static int peer_revalidate(n2n_edge_t *eee, struct peer_info *peer, time_t now) {
+  macstr_t mac_buf;
+
+  if(peer->state == N2N_PEER_ACTIVE) {
+    traceEvent(TRACE_DEBUG, "Revalidating idle known peer %s", macaddr_str(mac_buf, peer->mac_addr));
+    peer->state = N2N_PEER_REVALIDATING;
+    peer->revalidate_start = now;
+  } else if((now - peer->revalidate_start) >= PEER_REVALIDATE_TIMEOUT) {
+    peer->state = N2N_PEER_STALE;
+    return(0);
+  }
+
+  send_register(eee, &peer->sock, peer->mac_addr);
+
+  /* Let the fast path send to the peer until the next probe is due */
+  n2n_peer_cache_set(eee->peer_cache, peer->mac_addr, &peer->sock, (uint32_t)(now + 1));
+
+  return(1);
+}
+
+/* ************************************** */
+
 /* @return 1 if destination is a peer, 0 if destination is supernode */
 static int find_peer_destination(n2n_edge_t * eee,
                                  n2n_mac_t mac_address,
                                  n2n_sock_t * destination) {
+  const n2n_peer_cache_entry_t *hit;
   struct peer_info *scan;
   macstr_t mac_buf;
   n2n_sock_str_t sockbuf;
   int retval=0;
-  time_t now = time(NULL);
+  time_t now = n2n_now();
 
   if(!memcmp(mac_address, broadcast_mac, N2N_MAC_SIZE)) {
     traceEvent(TRACE_DEBUG, "Broadcast destination peer, using supernode");
@@ -1423,20 +2056,33 @@ static int find_peer_destination(n2n_edge_t * eee,
 	     mac_address[0] & 0xFF, mac_address[1] & 0xFF, mac_address[2] & 0xFF,
 	     mac_address[3] & 0xFF, mac_address[4] & 0xFF, mac_address[5] & 0xFF);
 
-  HASH_FIND_PEER(eee->known_peers, mac_address, scan);
-
-  if(scan && (scan->last_seen > 0)) {
-    if((now - scan->last_p2p) >= (scan->timeout / 2)) {
-      /* Too much time passed since we saw the peer, need to register again
-       * since the peer address may have changed. */
-      traceEvent(TRACE_DEBUG, "Refreshing idle known peer");
-      HASH_DEL(eee->known_peers, scan);
-      free(scan);
-      /* NOTE: registration will be performed upon the receival of the next response packet */
-    } else {
-      /* Valid known peer found */
-      memcpy(destination, &scan->sock, sizeof(n2n_sock_t));
-      retval=1;
+  /* Fast path: the destination cache holds the socket of every known peer
+   * which does not need to be registered again */
+  hit = n2n_peer_cache_find(eee->peer_cache, mac_address);
+  if(hit && ((int32_t)(hit->expires - (uint32_t)now) > 0)) {
+    memcpy(destination, &hit->sock, sizeof(n2n_sock_t));
+    retval=1;
+  } else {
+    HASH_FIND_PEER(eee->known_peers, mac_address, scan);
+
+    if(scan && (scan->last_seen > 0)) {
+      if((now - scan->last_p2p) < (scan->timeout / 2)) {
+        /* Valid known peer found, it had been pushed out of the cache */
+        memcpy(destination, &scan->sock, sizeof(n2n_sock_t));
+        peer_cache_update(eee, scan);
+        retval=1;
+      } else if(peer_revalidate(eee, scan, now)) {
+        /* Too much time passed since we saw the peer, its address may have
+         * changed: keep using it while it is probed */
+        memcpy(destination, &scan->sock, sizeof(n2n_sock_t));
+        retval=1;
+      } else {
+        traceEvent(TRACE_DEBUG, "Removing stale known peer");
+        HASH_DEL(eee->known_peers, scan);
+        free(scan);
+        n2n_peer_cache_del(eee->peer_cache, mac_address);
+        /* NOTE: registration will be performed upon the receival of the next response packet */
+      }
     }
   }
 
@@ -1458,9 +2104,196 @@ static int find_peer_destination(n2n_edge_t * eee,
 
 /* ***************************************************** */
 
+#ifdef N2N_HAVE_MMSG
+
+/** Send the queued packets from index sent on with as few sendmmsg() calls
+ *  as possible. Every message carries its own destination, so a single call
+ *  covers all peers while keeping the per-peer packet order. */
+static void tx_batch_send(n2n_edge_worker_t * w, unsigned int sent) {
+  n2n_mmsg_batch_t *batch = w->tx_batch;
+  int rc;
+
+  while(sent < batch->count) {
+    rc = sendmmsg(w->udp_sock, &batch->msgs[sent], batch->count - sent, 0);
+
+    if(rc < 0) {
+      if(errno == EINTR)
+        continue;
+
+      traceEvent(TRACE_ERROR, "sendmmsg failed (%d) %s", errno, strerror(errno));
+      /* skip the offending packet and carry on with the rest */
+      rc = 1;
+    } else
+      traceEvent(TRACE_DEBUG, "sendmmsg sent %d packets", rc);
+
+    sent += rc;
+  }
+}
+
+/* ************************************** */
+
+#ifdef N2N_HAVE_UDP_GSO
+
+/** Group consecutive packets to the same peer into runs the kernel segments
+ *  again (UDP_SEGMENT): all but the last packet of a run must have the same
+ *  size and the last one may not be larger. Returns the number of runs. */
+static unsigned int tx_batch_gso_runs(n2n_mmsg_batch_t * batch) {
+  unsigned int i = 0, num_runs = 0;
+
+  while(i < batch->count) {
+    struct msghdr *hdr = &batch->gso_msgs[num_runs].msg_hdr;
+    size_t seg_size = batch->iovs[i].iov_len;
+    size_t total = seg_size;
+    unsigned int run = 1;
+
+    while((i + run < batch->count)
+          && (run < N2N_UDP_GSO_MAX_SEGS)
+          && (batch->iovs[i + run - 1].iov_len == seg_size)
+          && (batch->iovs[i + run].iov_len <= seg_size)
+          && (total + batch->iovs[i + run].iov_len <= N2N_UDP_GSO_MAX_SIZE)
+          && (batch->addrs[i + run].sin_addr.s_addr == batch->addrs[i].sin_addr.s_addr)
+          && (batch->addrs[i + run].sin_port == batch->addrs[i].sin_port)) {
+      total += batch->iovs[i + run].iov_len;
+      run++;
+    }
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->msg_name = &batch->addrs[i];
+    hdr->msg_namelen = sizeof(struct sockaddr_in);
+    hdr->msg_iov = &batch->iovs[i];
+    hdr->msg_iovlen = run;
+
+    if(run > 1)
+      udp_gso_set_cmsg(hdr, &batch->gso_cmsgs[num_runs], (uint16_t)seg_size);
+
+    i += run;
+    num_runs++;
+  }
+
+  return(num_runs);
+}
+
+/* ************************************** */
+
+/** Send the TX batch as runs of UDP_SEGMENT datagrams. Returns the number of
+ *  packets which have been sent before an error made GSO unusable. */
+static unsigned int tx_batch_send_gso(n2n_edge_worker_t * w) {
+  n2n_mmsg_batch_t *batch = w->tx_batch;
+  unsigned int num_runs = tx_batch_gso_runs(batch);
+  unsigned int run = 0, sent = 0;
+  int rc;
+
+  while(run < num_runs) {
+    rc = sendmmsg(w->udp_sock, &batch->gso_msgs[run], num_runs - run, 0);
+
+    if(rc < 0) {
+      if(errno == EINTR)
+        continue;
+
+      if((errno == EIO) || (errno == EINVAL) || (errno == EOPNOTSUPP) || (errno == ENOPROTOOPT)) {
+        /* e.g. the route's device cannot checksum: send them one by one */
+        traceEvent(TRACE_WARNING, "UDP GSO send failed (%d) %s, disabling it", errno, strerror(errno));
+        w->udp_gso = 0;
+        break;
+      }
+
+      traceEvent(TRACE_ERROR, "sendmmsg failed (%d) %s", errno, strerror(errno));
+      /* skip the offending run and carry on with the rest */
+      rc = 1;
+    } else
+      traceEvent(TRACE_DEBUG, "sendmmsg sent %d GSO runs", rc);
+
+    for(; rc > 0; rc--, run++)
+      sent += batch->gso_msgs[run].msg_hdr.msg_iovlen;
+  }
+
+  return(sent);
+}
+
+#endif /* N2N_HAVE_UDP_GSO */
+
+/* ************************************** */
+
+/** Send all packets queued in the TX batch. */
+static void tx_batch_flush(n2n_edge_worker_t * w) {
+  n2n_mmsg_batch_t *batch = w->tx_batch;
+  unsigned int sent = 0;
+
+  if(batch->count == 0)
+    return;
+
+#ifdef N2N_HAVE_IO_URING
+  if(w->uring && (edge_uring_send_batch(w) == 0)) {
+    batch->count = 0;
+    return;
+  }
+#endif
+
+#ifdef N2N_HAVE_UDP_GSO
+  if(w->udp_gso && (batch->count > 1))
+    sent = tx_batch_send_gso(w);
+#endif
+
+  tx_batch_send(w, sent);
+
+  batch->count = 0;
+}
+
+/* ************************************** */
+
+/** Queue a packet in the next free slot of the TX batch, flushing the batch
+ *  once it is full. A packet built around a frame read into the slot stays
+ *  where it is, others are copied. */
+static void tx_batch_queue(n2n_edge_worker_t * w, const uint8_t * pktbuf, size_t pktlen,
+                           const n2n_sock_t * dest) {
+  n2n_mmsg_batch_t *batch = w->tx_batch;
+  unsigned int slot = batch->count;
+  uint8_t *slot_buf = batch->bufs[slot];
+
+  if(fill_sockaddr((struct sockaddr *)&batch->addrs[slot], sizeof(struct sockaddr_in), dest) != 0) {
+    traceEvent(TRACE_DEBUG, "Dropping %u B PACKET: invalid destination [family %u]",
+	       (unsigned int)pktlen, (unsigned int)dest->family);
+    return;
+  }
+
+  if((pktbuf < slot_buf) || (pktbuf >= slot_buf + sizeof(batch->bufs[slot]))) {
+    memcpy(slot_buf, pktbuf, pktlen);
+    pktbuf = slot_buf;
+  }
+
+  batch->iovs[slot].iov_base = (uint8_t *)pktbuf;
+  batch->iovs[slot].iov_len = pktlen;
+  batch->msgs[slot].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+  batch->count++;
+
+  if(batch->count == N2N_MMSG_BATCH_SIZE)
+    tx_batch_flush(w);
+}
+
+/* ************************************** */
+
+/** Start collecting the PACKETs produced by edge_send_packet2net() instead of
+ *  sending them one by one. */
+static void tx_batch_start(n2n_edge_worker_t * w) {
+  w->tx_batch->count = 0;
+  w->tx_batch->enabled = 1;
+}
+
+/* ************************************** */
+
+/** Send what has been collected and return to per-packet sending. */
+static void tx_batch_stop(n2n_edge_worker_t * w) {
+  tx_batch_flush(w);
+  w->tx_batch->enabled = 0;
+}
+
+/* ************************************** */
+
+#endif /* N2N_HAVE_MMSG */
+
 /** Send an ecapsulated ethernet PACKET to a destination edge or broadcast MAC
  *  address. */
-static int send_packet(n2n_edge_t * eee,
+static int send_packet(n2n_edge_worker_t * w,
 		       n2n_mac_t dstMac,
 		       const uint8_t * pktbuf,
 		       size_t pktlen) {
@@ -1469,9 +2302,11 @@ static int send_packet(n2n_edge_t * eee,
   n2n_sock_str_t sockbuf;
   n2n_sock_t destination;
   macstr_t mac_buf;
+  n2n_edge_t * eee = w->eee;
 
   /* hexdump(pktbuf, pktlen); */
 
+  EDGE_LOCK(eee);
   is_p2p = find_peer_destination(eee, dstMac, &destination);
 
   if(is_p2p)
@@ -1482,33 +2317,166 @@ static int send_packet(n2n_edge_t * eee,
     if(!memcmp(dstMac, broadcast_mac, N2N_MAC_SIZE))
       ++(eee->stats.tx_sup_broadcast);
   }
+  EDGE_UNLOCK(eee);
 
   traceEvent(TRACE_INFO, "Tx PACKET to %s (dest=%s) [%u B]",
 	     sock_to_cstr(sockbuf, &destination),
 	     macaddr_str(mac_buf, dstMac), pktlen);
 
-  /* s = */ sendto_sock(eee->udp_sock, pktbuf, pktlen, &destination);
+#ifdef N2N_HAVE_PIPELINE
+  if(w->pipe_job) {
+    /* left to the TX writer of the pipeline */
+    n2n_pipeline_job_t *job = w->pipe_job;
+
+    if((pktbuf < job->buf->data) || (pktbuf >= job->buf->data + sizeof(job->buf->data))) {
+      memcpy(job->buf->data, pktbuf, pktlen);
+      pktbuf = job->buf->data;
+    }
+    job->out = (uint8_t *)pktbuf;
+    job->dest = destination;
+    job->out_len = pktlen;
+    return 0;
+  }
+#endif
+
+#ifdef N2N_HAVE_MMSG
+  if(w->tx_batch->enabled) {
+    tx_batch_queue(w, pktbuf, pktlen, &destination);
+    return 0;
+  }
+#endif
+
+  /* s = */ sendto_sock(w->udp_sock, pktbuf, pktlen, &destination);
 
   return 0;
 }
 
 /* ************************************** */
 
-/** A layer-2 packet was received at the tunnel and needs to be sent via UDP. */
-void edge_send_packet2net(n2n_edge_t * eee,
-			  uint8_t *tap_pkt, size_t len) {
+/** The compression estimate of the flow of a frame: its destination MAC
+ *  and, for IPv4, protocol, addresses and ports. */
+static n2n_comp_flow_t* comp_flow_find(n2n_comp_ctl_t *ctl, const uint8_t *frame, size_t len) {
+  n2n_comp_flow_t *flow;
+  uint32_t key = 2166136261u; /* FNV-1a */
+  size_t i, ihl;
+
+#define COMP_FLOW_HASH(b)  key = (key ^ (b)) * 16777619u
+  for(i = 0; i < N2N_MAC_SIZE; i++)
+    COMP_FLOW_HASH(frame[i]);
+
+  if((len >= ETH_FRAMESIZE + 20) && (frame[12] == 0x08) && (frame[13] == 0x00)) {
+    const uint8_t *ip = frame + ETH_FRAMESIZE;
+
+    COMP_FLOW_HASH(ip[9]);
+    for(i = 12; i < 20; i++)
+      COMP_FLOW_HASH(ip[i]);
+
+    /* TCP and UDP ports, unless a fragment */
+    ihl = (ip[0] & 0x0f) * 4;
+    if(((ip[9] == IPPROTO_TCP) || (ip[9] == IPPROTO_UDP)) && !(ip[6] & 0x1f) && !ip[7]
+       && (len >= ETH_FRAMESIZE + ihl + 4))
+      for(i = ihl; i < ihl + 4; i++)
+        COMP_FLOW_HASH(ip[i]);
+  }
+#undef COMP_FLOW_HASH
+
+  flow = &ctl->flows[(key ^ (key >> 16)) % N2N_COMP_FLOWS];
+  if(flow->key != key) {
+    /* new or colliding flow, start over */
+    flow->key = key;
+    flow->ratio = 0xffff;
+    flow->skip = 0;
+  }
+
+  return(flow);
+}
+
+/* ************************************** */
+
+/** Whether not to try compressing a frame: flows which recently did not
+ *  compress, e.g. TLS or video, are sent as they are for a while. */
+static int comp_flow_skip(n2n_comp_ctl_t *ctl, n2n_comp_flow_t *flow) {
+  if(!flow->skip)
+    return(0);
+
+  flow->skip--;
+  ctl->skipped++;
+
+  return(1);
+}
+
+/* ************************************** */
+
+/** Account a compressed frame, len to out_len bytes (out_len >= len if it
+ *  did not compress), and adjust the zstd level: it is lowered if the
+ *  worker spends too much of its time compressing at the current rate,
+ *  and raised if there is time left. */
+static void comp_flow_update(n2n_comp_ctl_t *ctl, n2n_comp_flow_t *flow,
+                             size_t len, size_t out_len, uint64_t start) {
+  uint64_t now = comp_clock(), elapsed;
+  uint32_t sample = (out_len >= len) ? 256 : (out_len * 256 / len);
+
+  flow->ratio = (flow->ratio == 0xffff) ? sample : ((flow->ratio * 7 + sample) / 8);
+  if(flow->ratio > N2N_COMP_BAD_RATIO)
+    flow->skip = N2N_COMP_SKIP_FRAMES;
+
+  if(out_len < len)
+    ctl->saved += len - out_len;
+  ctl->cycles += now - start;
+  ctl->win_cycles += now - start;
+
+  if(++ctl->win_frames < N2N_COMP_WINDOW)
+    return;
+
+  elapsed = now - ctl->win_start;
+  if(elapsed && (ctl->win_cycles * 100 / elapsed > N2N_COMP_CPU_HIGH)) {
+    if(ctl->zstd_level > N2N_ZSTD_LEVEL_MIN)
+      ctl->zstd_level--;
+  } else if(elapsed && (ctl->win_cycles * 100 / elapsed < N2N_COMP_CPU_LOW)) {
+    if(ctl->zstd_level < N2N_ZSTD_LEVEL_MAX)
+      ctl->zstd_level++;
+  }
+
+  ctl->win_start = now;
+  ctl->win_cycles = 0;
+  ctl->win_frames = 0;
+}
+
+/* ************************************** */
+
+/** A layer-2 packet was received at the tunnel and needs to be sent via UDP.
+ *
+ *  The PACKET is built around the frame: tap_pkt must be preceded by
+ *  N2N_PKT_HEADROOM and followed by N2N_PKT_TAILROOM bytes of buffer, the
+ *  frame itself gets overwritten.
+ */
+static void worker_send_packet2net(n2n_edge_worker_t * w,
+				   uint8_t *tap_pkt, size_t len) {
+  n2n_edge_t * eee = w->eee;
   ipstr_t ip_buf;
   n2n_mac_t destMac;
 
   n2n_common_t cmn;
   n2n_PACKET_t pkt;
 
-  uint8_t pktbuf[N2N_PKT_BUF_SIZE];
+  uint8_t header[N2N_PKT_HEADROOM];
+  uint8_t aad[N2N_PACKET_AAD_SIZE];
+  uint8_t *payload = tap_pkt;
+  uint8_t *pktbuf;
+  int payload_len;
   size_t idx=0;
-  n2n_transform_t tx_transop_idx = eee->transop.transform_id;
+  n2n_transform_t tx_transop_idx = w->transop->transform_id;
+  n2n_comp_flow_t *flow;
 
   ether_hdr_t eh;
 
+#ifdef N2N_HAVE_PIPELINE
+  if(eee->pipeline && eee->pipeline->running && !w->pipe_job) {
+    pipeline_submit(w, N2N_PIPE_TX, tap_pkt, len, NULL);
+    return;
+  }
+#endif
+
   /* tap_pkt is not aligned so we have to copy to aligned memory */
   memcpy(&eh, tap_pkt, sizeof(ether_hdr_t));
 
@@ -1553,14 +2521,18 @@ void edge_send_packet2net(n2n_edge_t * eee,
   // compression needs to be tried before encode_PACKET is called for compression indication gets encoded there
   pkt.compression = N2N_COMPRESSION_ID_NONE;
 
-  if(eee->conf.compression) {
-    uint8_t * compression_buffer = NULL;
-    int32_t  compression_len;
+  if(w->comp_ctl && !comp_flow_skip(w->comp_ctl, (flow = comp_flow_find(w->comp_ctl, tap_pkt, len)))) {
+    /* compressed into the worker's buffer which has the same headroom */
+    uint8_t * compression_buffer = N2N_BUF_PAYLOAD(w->comp_buf);
+    lzo_uint compression_len = len;
+    uint64_t comp_start = comp_clock();
 
     switch (eee->conf.compression) {
     case N2N_COMPRESSION_ID_LZO:
-      compression_buffer = malloc (len + len / 16 + 64 + 3);
-      if(lzo1x_1_compress(tap_pkt, len, compression_buffer, (lzo_uint*)&compression_len, wrkmem) == LZO_E_OK) {
+      /* lzo1x_1_compress() does not take an output size: skip frames whose
+       * worst case expansion would not fit, they are sent uncompressed */
+      if((len + len / 16 + 64 + 3 <= N2N_PKT_BUF_SIZE)
+         && (lzo1x_1_compress(tap_pkt, len, compression_buffer, &compression_len, w->lzo_wrkmem) == LZO_E_OK)) {
 	if(compression_len < len) {
 	  pkt.compression = N2N_COMPRESSION_ID_LZO;
 	}
@@ -1568,9 +2540,10 @@ void edge_send_packet2net(n2n_edge_t * eee,
       break;
 #ifdef N2N_HAVE_ZSTD
     case N2N_COMPRESSION_ID_ZSTD:
-      compression_len = N2N_PKT_BUF_SIZE + 128;
-      compression_buffer = malloc (compression_len); // leaves enough room, for exact size call compression_len = ZSTD_compressBound (len); (slower)
-      compression_len = (int32_t)ZSTD_compress(compression_buffer, compression_len, tap_pkt, len, ZSTD_COMPRESSION_LEVEL) ;
+      if(eee->zstd_cdict && (peer_zstd_dict_id(eee, destMac) == eee->zstd_dict_id))
+	compression_len = ZSTD_compress_usingCDict(w->zstd_cctx, compression_buffer, N2N_PKT_BUF_SIZE, tap_pkt, len, eee->zstd_cdict);
+      else
+	compression_len = ZSTD_compressCCtx(w->zstd_cctx, compression_buffer, N2N_PKT_BUF_SIZE, tap_pkt, len, w->comp_ctl->zstd_level) ;
       if(!ZSTD_isError(compression_len)) {
 	if(compression_len < len) {
 	  pkt.compression = N2N_COMPRESSION_ID_ZSTD;
@@ -1578,8 +2551,21 @@ void edge_send_packet2net(n2n_edge_t * eee,
       } else {
 	traceEvent (TRACE_ERROR, "payload compression failed with zstd error '%s'.",
 		    ZSTD_getErrorName(compression_len));
-	free (compression_buffer);
 	// continue with unset without pkt.compression --> will send uncompressed
+	compression_len = len;
+      }
+      break;
+#endif
+#ifdef N2N_HAVE_LZ4
+    case N2N_COMPRESSION_ID_LZ4:
+      {
+	/* 0 if it does not fit, i.e. the frame does not compress */
+	int lz4_len = LZ4_compress_fast_extState(w->lz4_state, (const char *)tap_pkt, (char *)compression_buffer,
+						 len, N2N_PKT_BUF_SIZE, 1 /* acceleration */);
+	if((lz4_len > 0) && (lz4_len < len)) {
+	  compression_len = lz4_len;
+	  pkt.compression = N2N_COMPRESSION_ID_LZ4;
+	}
       }
       break;
 #endif
@@ -1587,27 +2573,33 @@ void edge_send_packet2net(n2n_edge_t * eee,
       break;
     }
 
+    comp_flow_update(w->comp_ctl, flow, len,
+                     (pkt.compression != N2N_COMPRESSION_ID_NONE) ? compression_len : len, comp_start);
+
     if(pkt.compression != N2N_COMPRESSION_ID_NONE) {
       traceEvent (TRACE_DEBUG, "payload compression [%s]: compressed %u bytes to %u bytes\n",
-		  compression_str(pkt.compression), len, compression_len);
+		  compression_str(pkt.compression), len, (u_int)compression_len);
 
-      memcpy (tap_pkt, compression_buffer, compression_len);
+      payload = compression_buffer;
       len = compression_len;
     }
-
-    if(compression_buffer) {
-      free (compression_buffer);
-    }
   }
 
+  /* encrypt in place, then put the header in front */
   idx=0;
-  encode_PACKET(pktbuf, &idx, &cmn, &pkt);
+  encode_PACKET_aad(aad, &idx, &pkt);
+  payload_len = w->transop->fwd_inplace(w->transop, &payload, len, aad, idx, pkt.dstMac);
+  if(payload_len < 0)
+    return;
+
+  idx=0;
+  encode_PACKET(header, &idx, &cmn, &pkt);
 
   uint16_t headerIdx = idx;
 
-  idx += eee->transop.fwd(&eee->transop,
-			  pktbuf+idx, N2N_PKT_BUF_SIZE-idx,
-			  tap_pkt, len, pkt.dstMac);
+  pktbuf = payload - headerIdx;
+  memcpy(pktbuf, header, headerIdx);
+  idx += payload_len;
 
   traceEvent(TRACE_DEBUG, "Encode %u B PACKET [%u B data, %u B overhead] transform %u",
 	     (u_int)idx, (u_int)len, (u_int)(idx-len), tx_transop_idx);
@@ -1626,62 +2618,170 @@ void edge_send_packet2net(n2n_edge_t * eee,
   }
 #endif
 
-  eee->transop.tx_cnt++; /* stats */
+  w->transop->tx_cnt++; /* stats */
+
+  send_packet(w, destMac, pktbuf, idx); /* to peer or supernode */
+}
+
+/* ************************************** */
+
+void edge_send_packet2net(n2n_edge_t * eee,
+			  uint8_t *tap_pkt, size_t len) {
+  n2n_edge_worker_t *w = &eee->worker;
+  n2n_buf_t *buf;
+
+  if((len > N2N_PKT_BUF_SIZE) || ((buf = n2n_buf_get(&w->buf_cache)) == NULL))
+    return;
+
+  /* the caller's buffer may not have room around the frame */
+  memcpy(N2N_BUF_PAYLOAD(buf), tap_pkt, len);
+#ifdef N2N_HAVE_PIPELINE
+  w->cur_buf = buf;
+#endif
+  worker_send_packet2net(w, N2N_BUF_PAYLOAD(buf), len);
+#ifdef N2N_HAVE_PIPELINE
+  w->cur_buf = NULL;
+#endif
+  n2n_buf_put(&w->buf_cache, buf);
+}
+
+/* ************************************** */
+
+/** Process an ethernet frame read from the TAP and send it out via UDP. */
+static void worker_tap_frame(n2n_edge_worker_t * w, uint8_t * eth_pkt, size_t len) {
+  n2n_edge_t *        eee = w->eee;
+  macstr_t            mac_buf;
+  const uint8_t *     mac = eth_pkt;
+
+  traceEvent(TRACE_DEBUG, "### Rx TAP packet (%4d) for %s",
+	     (signed int)len, macaddr_str(mac_buf, mac));
+
+  if(eee->conf.drop_multicast &&
+     (is_ip6_discovery(eth_pkt, len) ||
+      is_ethMulticast(eth_pkt, len)
+      )
+     )
+    {
+      traceEvent(TRACE_INFO, "Dropping TX multicast");
+    }
+  else
+    {
+      if(eee->cb.packet_from_tap) {
+	uint16_t tmp_len = len;
+	if(eee->cb.packet_from_tap(eee, eth_pkt, &tmp_len) == N2N_DROP) {
+	  traceEvent(TRACE_DEBUG, "DROP packet %u", (unsigned int)len);
+
+	  return;
+	}
+	len = tmp_len;
+      }
+
+      worker_send_packet2net(w, eth_pkt, len);
+    }
+}
+
+/* ************************************** */
 
-  send_packet(eee, destMac, pktbuf, idx); /* to peer or supernode */
+#ifdef N2N_HAVE_TAP_OFFLOAD
+static void worker_tap_segment(void *arg, uint8_t *frame, size_t len) {
+  worker_tap_frame((n2n_edge_worker_t *)arg, frame, len);
 }
+#endif
 
 /* ************************************** */
 
 /** Read a single packet from the TAP interface, process it and write out the
- *  corresponding packet to the cooked socket.
+ *  corresponding packet to the cooked socket. A super-frame read from an
+ *  offloading TAP is segmented first.
+ *
+ *  Returns the frame length, or -1 with errno set to EAGAIN once a
+ *  non-blocking TAP has been drained.
  */
-void edge_read_from_tap(n2n_edge_t * eee) {
+static int worker_read_from_tap(n2n_edge_worker_t * w) {
   /* tun -> remote */
-  uint8_t             eth_pkt[N2N_PKT_BUF_SIZE];
-  macstr_t            mac_buf;
+  n2n_buf_t *         buf;
+  uint8_t *           eth_pkt;
   ssize_t             len;
+  ssize_t             max_len = N2N_PKT_BUF_SIZE;
+  n2n_edge_t *        eee = w->eee;
+#ifdef N2N_HAVE_TAP_OFFLOAD
+  struct virtio_net_hdr vnet_hdr;
+#endif
+
+  if((buf = n2n_buf_get(&w->buf_cache)) == NULL)
+    return(-1);
+  eth_pkt = N2N_BUF_PAYLOAD(buf);
 
-  len = tuntap_read( &(eee->device), eth_pkt, N2N_PKT_BUF_SIZE );
-  if((len <= 0) || (len > N2N_PKT_BUF_SIZE))
+#ifdef N2N_HAVE_MMSG
+  /* read straight into the next TX batch slot, the PACKET is built around
+   * the frame and queued without copying */
+  if(w->tx_batch->enabled)
+    eth_pkt = w->tx_batch->bufs[w->tx_batch->count] + N2N_PKT_HEADROOM;
+#endif
+
+#ifdef N2N_HAVE_TAP_OFFLOAD
+  if(w->device->offload) {
+    max_len = N2N_TAP_GSO_BUF_SIZE;
+    len = tuntap_read_offload(w->device, &vnet_hdr, w->gso_buf + N2N_PKT_HEADROOM, max_len);
+  } else
+#endif
+    len = tuntap_read( w->device, eth_pkt, N2N_PKT_BUF_SIZE );
+  if((len == 0) || ((len < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))) {
+    /* an empty read is transient as well: back to the poll loop, no pause */
+    n2n_buf_put(&w->buf_cache, buf);
+    errno = EAGAIN;
+    return(-1); /* nothing left to read */
+  }
+
+  if((len < 0) || (len > max_len))
     {
       traceEvent(TRACE_WARNING, "read()=%d [%d/%s]",
 		 (signed int)len, errno, strerror(errno));
       traceEvent(TRACE_WARNING, "TAP I/O operation aborted, restart later.");
       sleep(3);
-      tuntap_close(&(eee->device));
-      tuntap_open(&(eee->device), eee->tuntap_priv_conf.tuntap_dev_name, eee->tuntap_priv_conf.ip_mode, eee->tuntap_priv_conf.ip_addr,
-		  eee->tuntap_priv_conf.netmask, eee->tuntap_priv_conf.device_mac, eee->tuntap_priv_conf.mtu);
+      /* the queues of a multi-queue TAP cannot be re-opened one by one, an
+       * offloading TAP only by its owner */
+      if((eee->device.num_queues <= 1) && !eee->device.offload) {
+	tuntap_close(&(eee->device));
+	tuntap_open(&(eee->device), eee->tuntap_priv_conf.tuntap_dev_name, eee->tuntap_priv_conf.ip_mode, eee->tuntap_priv_conf.ip_addr,
+		    eee->tuntap_priv_conf.netmask, eee->tuntap_priv_conf.device_mac, eee->tuntap_priv_conf.mtu);
+#ifdef N2N_HAVE_EPOLL
+	if(eee->epoll_fd >= 0)
+	  edge_epoll_register_tap(eee);
+#endif
+      }
     }
-  else
+#ifdef N2N_HAVE_TAP_OFFLOAD
+  else if(w->device->offload)
     {
-      const uint8_t * mac = eth_pkt;
-      traceEvent(TRACE_DEBUG, "### Rx TAP packet (%4d) for %s",
-		 (signed int)len, macaddr_str(mac_buf, mac));
-
-      if(eee->conf.drop_multicast &&
-	 (is_ip6_discovery(eth_pkt, len) ||
-	  is_ethMulticast(eth_pkt, len)
-	  )
-	 )
-        {
-	  traceEvent(TRACE_INFO, "Dropping TX multicast");
-        }
-      else
-        {
-	  if(eee->cb.packet_from_tap) {
-	    uint16_t tmp_len = len;
-	    if(eee->cb.packet_from_tap(eee, eth_pkt, &tmp_len) == N2N_DROP) {
-	      traceEvent(TRACE_DEBUG, "DROP packet %u", (unsigned int)len);
-
-	      return;
-	    }
-	    len = tmp_len;
-	  }
-
-	  edge_send_packet2net(eee, eth_pkt, len);
-        }
+      /* segments go to the local buffer, the batch slot changes with each */
+      if(tuntap_offload_segment(&vnet_hdr, w->gso_buf + N2N_PKT_HEADROOM, len, N2N_BUF_PAYLOAD(buf), N2N_PKT_BUF_SIZE,
+				worker_tap_segment, w) < 0)
+	traceEvent(TRACE_WARNING, "Dropping TAP frame with unsupported offload [gso_type %u, %u B]",
+		   vnet_hdr.gso_type, (unsigned int)len);
     }
+#endif
+  else {
+#ifdef N2N_HAVE_PIPELINE
+    /* the buffer is not reused: a pipeline job may reference it rather
+     * than copying the frame */
+    w->cur_buf = buf;
+#endif
+    worker_tap_frame(w, eth_pkt, len);
+#ifdef N2N_HAVE_PIPELINE
+    w->cur_buf = NULL;
+#endif
+  }
+
+  n2n_buf_put(&w->buf_cache, buf);
+
+  return(len);
+}
+
+/* ************************************** */
+
+int edge_read_from_tap(n2n_edge_t * eee) {
+  return(worker_read_from_tap(&eee->worker));
 }
 
 /* ************************************** */
@@ -1689,52 +2789,41 @@ void edge_read_from_tap(n2n_edge_t * eee) {
 
 /* ************************************** */
 
-/** Read a datagram from the main UDP socket to the internet. */
-void readFromIPSocket(n2n_edge_t * eee, int in_sock) {
+/** Process a single datagram received from the UDP socket to the internet. */
+static void process_udp(n2n_edge_worker_t * w, const struct sockaddr_in * sender_sock,
+			uint8_t * udp_buf, size_t udp_size) {
+  n2n_edge_t *        eee = w->eee;
   n2n_common_t        cmn; /* common fields in the packet header */
+  n2n_PACKET_t        pkt;
+  uint8_t             deliver = 0; /* PACKET to be written to the TAP */
 
   n2n_sock_str_t      sockbuf1;
   n2n_sock_str_t      sockbuf2; /* don't clobber sockbuf1 if writing two addresses to trace */
   macstr_t            mac_buf1;
   macstr_t            mac_buf2;
 
-  uint8_t             udp_buf[N2N_PKT_BUF_SIZE];      /* Compete UDP packet */
-  ssize_t             recvlen;
+  ssize_t             recvlen = udp_size;
   size_t              rem;
   size_t              idx;
   size_t              msg_type;
   uint8_t             from_supernode;
-  struct sockaddr_in  sender_sock;
   n2n_sock_t          sender;
   n2n_sock_t *        orig_sender=NULL;
   time_t              now=0;
   uint64_t 	      stamp = 0;
 
-  size_t              i;
+#ifdef N2N_HAVE_PIPELINE
+  if(eee->pipeline && eee->pipeline->running && !w->pipe_job) {
+    pipeline_submit(w, N2N_PIPE_RX, udp_buf, udp_size, sender_sock);
+    return;
+  }
+#endif
 
-  i = sizeof(sender_sock);
-  recvlen = recvfrom(in_sock, udp_buf, N2N_PKT_BUF_SIZE, 0/*flags*/,
-		     (struct sockaddr *)&sender_sock, (socklen_t*)&i);
-
-  if(recvlen < 0) {
-#ifdef WIN32
-    if(WSAGetLastError() != WSAECONNRESET)
-#endif
-      {
-	traceEvent(TRACE_ERROR, "recvfrom() failed %d errno %d (%s)", recvlen, errno, strerror(errno));
-#ifdef WIN32
-	traceEvent(TRACE_ERROR, "WSAGetLastError(): %u", WSAGetLastError());
-#endif
-      }
-
-    return; /* failed to receive data from UDP */
-  }
-
-  /* REVISIT: when UDP/IPv6 is supported we will need a flag to indicate which
-   * IP transport version the packet arrived on. May need to UDP sockets. */
-  sender.family = AF_INET; /* UDP socket was opened PF_INET v4 */
-  sender.port = ntohs(sender_sock.sin_port);
-  memcpy(&(sender.addr.v4), &(sender_sock.sin_addr.s_addr), IPV4_SIZE);
+  /* REVISIT: when UDP/IPv6 is supported we will need a flag to indicate which
+   * IP transport version the packet arrived on. May need to UDP sockets. */
+  sender.family = AF_INET; /* UDP socket was opened PF_INET v4 */
+  sender.port = ntohs(sender_sock->sin_port);
+  memcpy(&(sender.addr.v4), &(sender_sock->sin_addr.s_addr), IPV4_SIZE);
 
   /* The packet may not have an orig_sender socket spec. So default to last
    * hop as sender. */
@@ -1772,24 +2861,23 @@ void readFromIPSocket(n2n_edge_t * eee, int in_sock) {
       return; /* failed to decode packet */
     }
 
-  now = time(NULL);
+  now = n2n_now();
 
   msg_type = cmn.pc; /* packet code */
   from_supernode= cmn.flags & N2N_FLAGS_FROM_SUPERNODE;
 
   if(0 == memcmp(cmn.community, eee->conf.community_name, N2N_COMMUNITY_SIZE)) {
+    EDGE_LOCK(eee);
     switch(msg_type) {
     case MSG_TYPE_PACKET:
       {
 	  /* process PACKET - most frequent so first in list. */
-	  n2n_PACKET_t pkt;
-
 	  decode_PACKET(&pkt, &cmn, udp_buf, &rem, &idx);
 
           if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
             if(!find_peer_time_stamp_and_verify (eee, from_supernode, pkt.srcMac, stamp)) {
               traceEvent(TRACE_DEBUG, "readFromIPSocket dropped PACKET due to time stamp error.");
-              return;
+              break;
             }
           }
 
@@ -1815,7 +2903,8 @@ void readFromIPSocket(n2n_edge_t * eee, int in_sock) {
 	      /* Update the sender in peer table entry */
 	      check_peer_registration_needed(eee, from_supernode, pkt.srcMac, NULL, orig_sender);
 
-	      handle_PACKET(eee, from_supernode, &pkt, orig_sender, udp_buf+idx, recvlen-idx);
+	      /* decode and write to the TAP below, outside of the lock */
+	      deliver = 1;
 	break;
       }
     case MSG_TYPE_REGISTER:
@@ -1829,7 +2918,7 @@ void readFromIPSocket(n2n_edge_t * eee, int in_sock) {
           if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
             if(!find_peer_time_stamp_and_verify (eee, from_supernode, reg.srcMac, stamp)) {
               traceEvent(TRACE_DEBUG, "readFromIPSocket dropped REGISTER due to time stamp error.");
-              return;
+              break;
             }
           }
 
@@ -1868,6 +2957,7 @@ void readFromIPSocket(n2n_edge_t * eee, int in_sock) {
   }
 
 	check_peer_registration_needed(eee, from_supernode, reg.srcMac, &reg.dev_addr, orig_sender);
+	peer_set_zstd_dict(eee, reg.srcMac, reg.zstd_dict_id);
 	break;
       }
     case MSG_TYPE_REGISTER_ACK:
@@ -1880,7 +2970,7 @@ void readFromIPSocket(n2n_edge_t * eee, int in_sock) {
           if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
             if(!find_peer_time_stamp_and_verify (eee, !definitely_from_supernode, ra.srcMac, stamp)) {
               traceEvent(TRACE_DEBUG, "readFromIPSocket dropped REGISTER_ACK due to time stamp error.");
-              return;
+              break;
             }
           }
 
@@ -1894,6 +2984,7 @@ void readFromIPSocket(n2n_edge_t * eee, int in_sock) {
 		   sock_to_cstr(sockbuf2, orig_sender));
 
 	peer_set_p2p_confirmed(eee, ra.srcMac, &sender, now);
+	peer_set_zstd_dict(eee, ra.srcMac, ra.zstd_dict_id);
 	break;
       }
     case MSG_TYPE_REGISTER_SUPER_ACK:
@@ -1920,7 +3011,7 @@ void readFromIPSocket(n2n_edge_t * eee, int in_sock) {
               if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
                 if(!find_peer_time_stamp_and_verify (eee, definitely_from_supernode, null_mac, stamp)) {
                   traceEvent(TRACE_DEBUG, "readFromIPSocket dropped REGISTER_SUPER_ACK due to time stamp error.");
-                  return;
+                  break;
                 }
               }
 
@@ -1935,7 +3026,7 @@ void readFromIPSocket(n2n_edge_t * eee, int in_sock) {
 
              if(memcmp(ra.edgeMac, eee->device.mac_addr, N2N_MAC_SIZE)) {
                traceEvent(TRACE_INFO, "readFromIPSocket dropped REGISTER_SUPER_ACK due to wrong addressing.");
-	       return;
+	       break;
              }
 
 	      if(0 == memcmp(ra.cookie, eee->last_cookie, N2N_COOKIE_SIZE))
@@ -1990,7 +3081,7 @@ void readFromIPSocket(n2n_edge_t * eee, int in_sock) {
         if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
           if(!find_peer_time_stamp_and_verify (eee, definitely_from_supernode, null_mac, stamp)) {
             traceEvent(TRACE_DEBUG, "readFromIPSocket dropped PEER_INFO due to time stamp error.");
-            return;
+            break;
           }
         }
 
@@ -2018,8 +3109,12 @@ void readFromIPSocket(n2n_edge_t * eee, int in_sock) {
     default:
       /* Not a known message type */
       traceEvent(TRACE_WARNING, "Unable to handle packet type %d: ignored", (signed int)msg_type);
-      return;
+      break;
     } /* switch(msg_type) */
+    EDGE_UNLOCK(eee);
+
+    if(deliver)
+      handle_PACKET(w, from_supernode, &pkt, orig_sender, udp_buf+idx, recvlen-idx);
   } else if(from_supernode) /* if(community match) */
     traceEvent(TRACE_WARNING, "Received packet with unknown community");
   else
@@ -2028,8 +3123,158 @@ void readFromIPSocket(n2n_edge_t * eee, int in_sock) {
 
 /* ************************************** */
 
+#ifdef N2N_HAVE_UDP_GRO
+
+/** Read coalesced datagrams (UDP_GRO) and process them split up into the
+ *  datagrams the peers have sent. All but the last one of a run have the
+ *  segment size found in the control message.
+ *
+ *  Returns the number of bytes read, or -1 on error.
+ */
+static int worker_read_gro(n2n_edge_worker_t * w, int in_sock) {
+  n2n_udp_gro_batch_t *batch = w->gro_batch;
+  int                 i, num_msgs;
+  ssize_t             recvlen = 0;
+
+  for(i=0; i<N2N_UDP_GRO_BATCH_SIZE; i++) {
+    batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    batch->msgs[i].msg_hdr.msg_control = batch->cmsgs[i].buf;
+    batch->msgs[i].msg_hdr.msg_controllen = sizeof(batch->cmsgs[i].buf);
+  }
+
+  num_msgs = recvmmsg(in_sock, batch->msgs, N2N_UDP_GRO_BATCH_SIZE, MSG_DONTWAIT, NULL);
+
+  if(num_msgs < 0) {
+    if((errno != EAGAIN) && (errno != EWOULDBLOCK))
+      traceEvent(TRACE_ERROR, "recvmmsg() failed %d errno %d (%s)", num_msgs, errno, strerror(errno));
+
+    return(-1); /* failed to receive data from UDP */
+  }
+
+  for(i=0; i<num_msgs; i++) {
+    struct msghdr *hdr = &batch->msgs[i].msg_hdr;
+    struct cmsghdr *cm;
+    size_t len = batch->msgs[i].msg_len;
+    size_t seg_size = len, off;
+    int gso_size;
+
+    if(hdr->msg_flags & MSG_TRUNC)
+      traceEvent(TRACE_WARNING, "Coalesced datagram truncated to %u bytes", (unsigned int)len);
+
+    for(cm = CMSG_FIRSTHDR(hdr); cm != NULL; cm = CMSG_NXTHDR(hdr, cm)) {
+      if((cm->cmsg_level == SOL_UDP) && (cm->cmsg_type == UDP_GRO)) {
+        memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+        if(gso_size > 0)
+          seg_size = gso_size;
+      }
+    }
+
+    for(off = 0; off < len; off += seg_size)
+      process_udp(w, &batch->addrs[i], batch->bufs[i] + off, MIN(seg_size, len - off));
+
+    recvlen += len;
+  }
+
+  return(recvlen);
+}
+
+/* ************************************** */
+
+#endif /* N2N_HAVE_UDP_GRO */
+
+/** Read datagrams from the main UDP socket to the internet.
+ *
+ *  On Linux up to N2N_MMSG_BATCH_SIZE datagrams are pulled with a single
+ *  recvmmsg() call and processed one after the other. With UDP GRO the
+ *  kernel may even have coalesced several of them into one.
+ *
+ *  Returns the number of bytes read, or -1 on error. errno is left at EAGAIN
+ *  once the socket has been drained.
+ */
+static int worker_read_from_ip_socket(n2n_edge_worker_t * w, int in_sock) {
+#ifdef N2N_HAVE_MMSG
+  n2n_mmsg_batch_t    *batch = w->rx_batch;
+  int                 i, num_msgs;
+  ssize_t             recvlen = 0;
+
+#ifdef N2N_HAVE_UDP_GRO
+  if(w->gro_batch && (in_sock == w->udp_sock))
+    return(worker_read_gro(w, in_sock));
+#endif
+
+  for(i=0; i<N2N_MMSG_BATCH_SIZE; i++)
+    batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+
+  /* MSG_DONTWAIT: return what is queued rather than waiting for a full batch */
+  num_msgs = recvmmsg(in_sock, batch->msgs, N2N_MMSG_BATCH_SIZE, MSG_DONTWAIT, NULL);
+
+  if(num_msgs < 0) {
+    if((errno != EAGAIN) && (errno != EWOULDBLOCK))
+      traceEvent(TRACE_ERROR, "recvmmsg() failed %d errno %d (%s)", num_msgs, errno, strerror(errno));
+
+    return(-1); /* failed to receive data from UDP */
+  }
+
+  for(i=0; i<num_msgs; i++) {
+    process_udp(w, &batch->addrs[i], batch->bufs[i], batch->msgs[i].msg_len);
+    recvlen += batch->msgs[i].msg_len;
+  }
+
+  return(recvlen);
+#else
+  n2n_buf_t *         buf;                            /* Compete UDP packet */
+  ssize_t             recvlen;
+  struct sockaddr_in  sender_sock;
+  socklen_t           i;
+
+  if((buf = n2n_buf_get(&w->buf_cache)) == NULL)
+    return(-1);
+
+  i = sizeof(sender_sock);
+  recvlen = recvfrom(in_sock, N2N_BUF_PAYLOAD(buf), N2N_PKT_BUF_SIZE, 0/*flags*/,
+		     (struct sockaddr *)&sender_sock, &i);
+
+  if(recvlen < 0) {
+    n2n_buf_put(&w->buf_cache, buf);
+
+#ifndef WIN32
+    if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      return(-1); /* nothing left to read */
+#endif
+
+#ifdef WIN32
+    if(WSAGetLastError() != WSAECONNRESET)
+#endif
+      {
+	traceEvent(TRACE_ERROR, "recvfrom() failed %d errno %d (%s)", recvlen, errno, strerror(errno));
+#ifdef WIN32
+	traceEvent(TRACE_ERROR, "WSAGetLastError(): %u", WSAGetLastError());
+#endif
+      }
+
+    return(-1); /* failed to receive data from UDP */
+  }
+
+  process_udp(w, &sender_sock, N2N_BUF_PAYLOAD(buf), recvlen);
+  n2n_buf_put(&w->buf_cache, buf);
+
+  return(recvlen);
+#endif /* N2N_HAVE_MMSG */
+}
+
+/* ************************************** */
+
+int readFromIPSocket(n2n_edge_t * eee, int in_sock) {
+  return(worker_read_from_ip_socket(&eee->worker, in_sock));
+}
+
+/* ************************************** */
+
 void print_edge_stats(const n2n_edge_t *eee) {
   const struct n2n_edge_stats *s = &eee->stats;
+  n2n_comp_ctl_t comp;
+
+  edge_comp_counters(eee, &comp);
 
   traceEvent(TRACE_NORMAL, "**********************************");
   traceEvent(TRACE_NORMAL, "Packet stats:");
@@ -2037,222 +3282,1483 @@ void print_edge_stats(const n2n_edge_t *eee) {
   traceEvent(TRACE_NORMAL, "    RX P2P: %u pkts", s->rx_p2p);
   traceEvent(TRACE_NORMAL, "    TX Supernode: %u pkts (%u broadcast)", s->tx_sup, s->tx_sup_broadcast);
   traceEvent(TRACE_NORMAL, "    RX Supernode: %u pkts (%u broadcast)", s->rx_sup, s->rx_sup_broadcast);
+  traceEvent(TRACE_NORMAL, "    Packet buffers: %u (%u allocated on demand)",
+	     eee->buf_pool->num_bufs, (unsigned int)eee->buf_pool->heap_allocs);
+  traceEvent(TRACE_NORMAL, "    Compression: %llu bytes saved in %llu cycles (%llu frames skipped)",
+	     (unsigned long long)comp.saved, (unsigned long long)comp.cycles, (unsigned long long)comp.skipped);
   traceEvent(TRACE_NORMAL, "**********************************");
 }
 
 /* ************************************** */
 
-int run_edge_loop(n2n_edge_t * eee, int *keep_running) {
-  size_t numPurged;
-  time_t lastIfaceCheck=0;
-  time_t lastTransop=0;
-  time_t last_purge_known = 0;
-  time_t last_purge_pending = 0;
+/** Periodic maintenance of the edge: transop tick, supernode registration,
+ *  peer list purging and DHCP address re-check.
+ *
+ *  Every step is rate limited by its own interval, so calling this more often
+ *  than needed is harmless.
+ */
+static void edge_housekeeping(n2n_edge_t * eee, time_t nowTime) {
+  size_t numPurged, numKnown;
 
-#ifdef WIN32
-  struct tunread_arg arg;
-  arg.eee = eee;
-  arg.keep_running = keep_running;
-  HANDLE tun_read_thread = startTunReadThread(&arg);
-#endif
+  if((nowTime - eee->last_transop_tick) > TRANSOP_TICK_INTERVAL) {
+    eee->last_transop_tick = nowTime;
 
-  *keep_running = 1;
-  update_supernode_reg(eee, time(NULL));
+    eee->transop.tick(&eee->transop, nowTime);
+  }
 
-  /* Main loop
-   *
-   * select() is used to wait for input on either the TAP fd or the UDP/TCP
-   * socket. When input is present the data is read and processed by either
-   * readFromIPSocket() or edge_read_from_tap()
-   */
+  EDGE_LOCK(eee);
+  update_supernode_reg(eee, nowTime);
 
-  while(*keep_running) {
-    int rc, max_sock = 0;
-    fd_set socket_mask;
-    struct timeval wait_time;
-    time_t nowTime;
+  numPurged =  numKnown = purge_expired_registrations(&eee->known_peers, &eee->last_purge_known);
+  numPurged += purge_expired_registrations(&eee->pending_peers, &eee->last_purge_pending);
 
-    FD_ZERO(&socket_mask);
-    FD_SET(eee->udp_sock, &socket_mask);
-    FD_SET(eee->udp_mgmt_sock, &socket_mask);
-    max_sock = max(eee->udp_sock, eee->udp_mgmt_sock);
+  if(numKnown > 0)
+    peer_cache_rebuild(eee);
 
-#ifndef SKIP_MULTICAST_PEERS_DISCOVERY
-    FD_SET(eee->udp_multicast_sock, &socket_mask);
-    max_sock = max(eee->udp_sock, eee->udp_multicast_sock);
-#endif
+  if(numPurged > 0) {
+    traceEvent(TRACE_INFO, "%u peers removed. now: pending=%u, operational=%u",
+	       numPurged,
+	       HASH_COUNT(eee->pending_peers),
+	       HASH_COUNT(eee->known_peers));
+  }
+  EDGE_UNLOCK(eee);
 
-#ifndef WIN32
-    FD_SET(eee->device.fd, &socket_mask);
-    max_sock = max(max_sock, eee->device.fd);
-#endif
+  if((eee->conf.tuntap_ip_mode == TUNTAP_IP_MODE_DHCP) &&
+     ((nowTime - eee->last_iface_check) > IFACE_UPDATE_INTERVAL)) {
+    uint32_t old_ip = eee->device.ip_addr;
 
-    wait_time.tv_sec = SOCKET_TIMEOUT_INTERVAL_SECS; wait_time.tv_usec = 0;
+    traceEvent(TRACE_NORMAL, "Re-checking dynamic IP address.");
+    tuntap_get_address(&(eee->device));
+    eee->last_iface_check = nowTime;
 
-    rc = select(max_sock+1, &socket_mask, NULL, NULL, &wait_time);
-    nowTime=time(NULL);
+    if((old_ip != eee->device.ip_addr) && eee->cb.ip_address_changed)
+      eee->cb.ip_address_changed(eee, old_ip, eee->device.ip_addr);
+  }
 
-    /* Make sure ciphers are updated before the packet is treated. */
-    if((nowTime - lastTransop) > TRANSOP_TICK_INTERVAL) {
-      lastTransop = nowTime;
+  if (eee->cb.main_loop_period)
+    eee->cb.main_loop_period(eee, nowTime);
+}
 
-      eee->transop.tick(&eee->transop, nowTime);
-    }
+/* ************************************** */
 
-    if(rc > 0) {
-      /* Any or all of the FDs could have input; check them all. */
+#ifdef N2N_HAVE_EPOLL
 
-      if(FD_ISSET(eee->udp_sock, &socket_mask)) {
-	/* Read a cooked socket from the internet socket (unicast). Writes on the TAP
-	 * socket. */
-	readFromIPSocket(eee, eee->udp_sock);
-      }
+/** Add (or re-add) a file descriptor to an epoll set. Edge triggered
+ *  descriptors are drained until EAGAIN: the TAP is switched to
+ *  non-blocking, the UDP sockets are read with MSG_DONTWAIT instead so
+ *  that sending on them still blocks on a full send buffer. */
+static int edge_epoll_add(int epoll_fd, int fd, uint32_t events, int nonblock) {
+  struct epoll_event ev;
 
+  if(fd < 0)
+    return(-1);
 
-#ifndef SKIP_MULTICAST_PEERS_DISCOVERY
-      if(FD_ISSET(eee->udp_multicast_sock, &socket_mask)) {
-	/* Read a cooked socket from the internet socket (multicast). Writes on the TAP
-	 * socket. */
-	traceEvent(TRACE_DEBUG, "Received packet from multicast socket");
-	readFromIPSocket(eee, eee->udp_multicast_sock);
-      }
-#endif
+  if(nonblock) {
+    int flags = fcntl(fd, F_GETFL, 0);
 
-      if(FD_ISSET(eee->udp_mgmt_sock, &socket_mask)) {
-	/* Read a cooked socket from the internet socket. Writes on the TAP
-	 * socket. */
-	readFromMgmtSocket(eee, keep_running);
+    if((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+      traceEvent(TRACE_ERROR, "Could not set fd %d non-blocking [%d]: %s", fd, errno, strerror(errno));
+      return(-1);
+    }
+  }
 
-	if(!(*keep_running))
-	  break;
-      }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.fd = fd;
 
-#ifndef WIN32
-      if(FD_ISSET(eee->device.fd, &socket_mask)) {
-	/* Read an ethernet frame from the TAP socket. Write on the IP
-	 * socket. */
-	edge_read_from_tap(eee);
-      }
-#endif
+  if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    if((errno != EEXIST) || (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0)) {
+      traceEvent(TRACE_ERROR, "epoll_ctl(%d) failed [%d]: %s", fd, errno, strerror(errno));
+      return(-1);
     }
+  }
 
-    /* Finished processing select data. */
-    update_supernode_reg(eee, nowTime);
-
-    numPurged =  purge_expired_registrations(&eee->known_peers, &last_purge_known);
-    numPurged += purge_expired_registrations(&eee->pending_peers, &last_purge_pending);
+  return(0);
+}
 
-    if(numPurged > 0) {
-      traceEvent(TRACE_INFO, "%u peers removed. now: pending=%u, operational=%u",
-		 numPurged,
-		 HASH_COUNT(eee->pending_peers),
-		 HASH_COUNT(eee->known_peers));
-    }
+/* ************************************** */
 
-    if((eee->conf.tuntap_ip_mode == TUNTAP_IP_MODE_DHCP) &&
-       ((nowTime - lastIfaceCheck) > IFACE_UPDATE_INTERVAL)) {
-      uint32_t old_ip = eee->device.ip_addr;
+/** (Re-)register the UDP sockets, e.g. after edge_init_sockets() re-opened
+ *  them. Closed descriptors drop out of the epoll set by themselves. */
+static void edge_epoll_register_sockets(n2n_edge_t * eee) {
+  edge_epoll_add(eee->epoll_fd, eee->udp_sock, EPOLLIN | EPOLLET, 0);
+  /* management traffic is rare: keep it level triggered and blocking */
+  edge_epoll_add(eee->epoll_fd, eee->udp_mgmt_sock, EPOLLIN, 0);
+#ifndef SKIP_MULTICAST_PEERS_DISCOVERY
+  edge_epoll_add(eee->epoll_fd, eee->udp_multicast_sock, EPOLLIN | EPOLLET, 0);
+#endif
+}
 
-      traceEvent(TRACE_NORMAL, "Re-checking dynamic IP address.");
-      tuntap_get_address(&(eee->device));
-      lastIfaceCheck = nowTime;
+/* ************************************** */
 
-      if((old_ip != eee->device.ip_addr) && eee->cb.ip_address_changed)
-	eee->cb.ip_address_changed(eee, old_ip, eee->device.ip_addr);
-    }
+/** (Re-)register the TAP device, e.g. after it has been re-opened. */
+static void edge_epoll_register_tap(n2n_edge_t * eee) {
+  edge_epoll_add(eee->epoll_fd, eee->device.fd, EPOLLIN | EPOLLET, 1);
+}
 
-    if (eee->cb.main_loop_period)
-      eee->cb.main_loop_period(eee, nowTime);
+/* ************************************** */
 
-  } /* while */
+/** Read datagrams from a socket until it is drained. */
+static void worker_drain_ip_socket(n2n_edge_worker_t * w, int fd) {
+  while((worker_read_from_ip_socket(w, fd) >= 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
+    ;
+}
 
-#ifdef WIN32
-  WaitForSingleObject(tun_read_thread, INFINITE);
-#endif
+/* ************************************** */
 
-  send_deregister(eee, &(eee->supernode));
+/** Read ethernet frames from the non-blocking TAP (queue) until drained,
+ *  sending them in batches of up to N2N_MMSG_BATCH_SIZE packets. */
+static void worker_drain_tap(n2n_edge_worker_t * w) {
+  int fd = w->device->fd;
+  int more = 1;
 
-  closesocket(eee->udp_sock);
+  while(more) {
+    int budget = N2N_MMSG_BATCH_SIZE;
 
-  return(0);
+#ifdef N2N_HAVE_PIPELINE
+    /* the pipeline does the sending: keep the frames in their own buffers
+     * so that the jobs can take them over */
+    if(!(w->eee->pipeline && w->eee->pipeline->running))
+#endif
+      tx_batch_start(w);
+    /* stop if the TAP had to be re-opened */
+    while((more = ((worker_read_from_tap(w) >= 0) && (fd == w->device->fd))) && (--budget > 0))
+      ;
+    tx_batch_stop(w);
+  }
 }
 
 /* ************************************** */
 
-/** Deinitialise the edge and deallocate any owned memory. */
-void edge_term(n2n_edge_t * eee) {
-  if(eee->udp_sock >= 0)
-    closesocket(eee->udp_sock);
+#ifdef N2N_HAVE_TAP_MQ
+
+/** Thread serving one additional TAP queue: frames read from the queue are
+ *  sent on the worker's own UDP socket, datagrams the kernel steers to that
+ *  socket (SO_REUSEPORT) are written to the queue. */
+static void* edge_worker_thread(void *arg) {
+  n2n_edge_worker_t *w = (n2n_edge_worker_t*)arg;
+  struct epoll_event events[N2N_EPOLL_MAX_EVENTS];
+  time_t last_tick = 0;
+  int epoll_fd, nfds, i;
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if(epoll_fd < 0) {
+    traceEvent(TRACE_ERROR, "Worker %u: epoll_create1() failed [%d]: %s", w->idx, errno, strerror(errno));
+    return(NULL);
+  }
 
-  if(eee->udp_mgmt_sock >= 0)
-    closesocket(eee->udp_mgmt_sock);
+  edge_epoll_add(epoll_fd, w->udp_sock, EPOLLIN | EPOLLET, 0);
+  edge_epoll_add(epoll_fd, w->device->fd, EPOLLIN | EPOLLET, 1);
 
-#ifndef SKIP_MULTICAST_PEERS_DISCOVERY
-  if(eee->udp_multicast_sock >= 0)
-    closesocket(eee->udp_multicast_sock);
-#endif
+  traceEvent(TRACE_INFO, "Worker %u serving TAP queue fd %d", w->idx, w->device->fd);
 
-  clear_peer_list(&eee->pending_peers);
-  clear_peer_list(&eee->known_peers);
+  while(*(w->keep_running)) {
+    time_t now;
 
-  eee->transop.deinit(&eee->transop);
+    /* wake up regularly to notice the end of the main loop */
+    nfds = epoll_wait(epoll_fd, events, N2N_EPOLL_MAX_EVENTS, HOUSEKEEPING_INTERVAL * 1000);
 
-  edge_cleanup_routes(eee);
+    if(nfds < 0) {
+      if(errno == EINTR)
+	continue;
 
-  closeTraceFile();
+      traceEvent(TRACE_ERROR, "Worker %u: epoll_wait() failed [%d]: %s", w->idx, errno, strerror(errno));
+      break;
+    }
 
-  free(eee);
+    now = n2n_clock_update();
+
+    for(i = 0; i < nfds; i++) {
+      if(events[i].data.fd == w->udp_sock)
+	worker_drain_ip_socket(w, w->udp_sock);
+      else
+	worker_drain_tap(w);
+    }
+
+    if((now - last_tick) > TRANSOP_TICK_INTERVAL) {
+      last_tick = now;
+      w->transop->tick(w->transop, now);
+    }
+  }
+
+  close(epoll_fd);
+
+  return(NULL);
 }
 
 /* ************************************** */
 
-static int edge_init_sockets(n2n_edge_t *eee, int udp_local_port, int mgmt_port, uint8_t tos) {
-  int sockopt;
+/** Detach the TAP queues from first on and close the UDP sockets of their
+ *  workers: the kernel would keep hashing flows onto them otherwise, with no
+ *  one to read them. */
+static void edge_detach_mq_queues(n2n_edge_t * eee, int first) {
+  int num_queues = min(eee->conf.tap_queues, eee->device.num_queues);
+  int i;
 
- if(eee->udp_sock >= 0)
-    closesocket(eee->udp_sock);
+  if(!eee->mq_workers)
+    return;
 
-  if(eee->udp_mgmt_sock >= 0)
-    closesocket(eee->udp_mgmt_sock);
+  for(i = first; i < eee->conf.tap_queues; i++) {
+    n2n_edge_worker_t *w = &eee->mq_workers[i-1];
 
-#ifndef SKIP_MULTICAST_PEERS_DISCOVERY
-  if(eee->udp_multicast_sock >= 0)
-    closesocket(eee->udp_multicast_sock);
-#endif
+    if(i < num_queues) {
+      struct ifreq ifr;
 
-  if(udp_local_port > 0)
-    traceEvent(TRACE_NORMAL, "Binding to local port %d", udp_local_port);
+      memset(&ifr, 0, sizeof(ifr));
+      ifr.ifr_flags = IFF_DETACH_QUEUE;
+      ioctl(eee->device.queue_fd[i], TUNSETQUEUE, (void *)&ifr);
+    }
 
-  eee->udp_sock = open_socket(udp_local_port, 1 /* bind ANY */);
-  if(eee->udp_sock < 0) {
-    traceEvent(TRACE_ERROR, "Failed to bind main UDP port %u", udp_local_port);
-    return(-1);
+    if(w->udp_sock >= 0) {
+      closesocket(w->udp_sock);
+      w->udp_sock = -1;
+    }
   }
+}
 
-  if(tos) {
-    /* https://www.tucny.com/Home/dscp-tos */
-    sockopt = tos;
+/* ************************************** */
 
-    if(setsockopt(eee->udp_sock, IPPROTO_IP, IP_TOS, (char *)&sockopt, sizeof(sockopt)) == 0)
-      traceEvent(TRACE_NORMAL, "TOS set to 0x%x", tos);
-    else
-      traceEvent(TRACE_ERROR, "Could not set TOS 0x%x[%d]: %s", tos, errno, strerror(errno));
-  }
+/** Start a worker thread for each TAP queue beyond the first one. */
+static void edge_start_mq_workers(n2n_edge_t * eee, int *keep_running) {
+  int num_queues = min(eee->conf.tap_queues, eee->device.num_queues);
+  int i;
 
-#ifdef IP_PMTUDISC_DO
-  sockopt = (eee->conf.disable_pmtu_discovery) ? IP_PMTUDISC_DONT : IP_PMTUDISC_DO;
+  if(!eee->mq_workers)
+    return;
 
-  if(setsockopt(eee->udp_sock, IPPROTO_IP, IP_MTU_DISCOVER, &sockopt, sizeof(sockopt)) < 0)
-    traceEvent(TRACE_WARNING, "Could not %s PMTU discovery[%d]: %s",
-	       (eee->conf.disable_pmtu_discovery) ? "disable" : "enable", errno, strerror(errno));
-  else
-    traceEvent(TRACE_DEBUG, "PMTU discovery %s", (eee->conf.disable_pmtu_discovery) ? "disabled" : "enabled");
-#endif
+  if(num_queues < eee->conf.tap_queues)
+    traceEvent(TRACE_WARNING, "Only %d of %u TAP queues available", num_queues, eee->conf.tap_queues);
 
-  eee->udp_mgmt_sock = open_socket(mgmt_port, 0 /* bind LOOPBACK */);
-  if(eee->udp_mgmt_sock < 0) {
-    traceEvent(TRACE_ERROR, "Failed to bind management UDP port %u", mgmt_port);
-    return(-2);
+  for(i = 1; i < num_queues; i++) {
+    n2n_edge_worker_t *w = &eee->mq_workers[i-1];
+
+    memcpy(&w->queue_device, &eee->device, sizeof(tuntap_dev));
+    w->queue_device.fd = eee->device.queue_fd[i];
+    w->keep_running = keep_running;
+  }
+
+  /* lock the shared state before the first worker starts */
+  eee->num_workers = num_queues;
+
+  for(i = 1; i < num_queues; i++) {
+    if(pthread_create(&eee->mq_workers[i-1].thread, NULL, edge_worker_thread, &eee->mq_workers[i-1]) != 0) {
+      traceEvent(TRACE_ERROR, "Cannot start worker %d [%d]: %s", i, errno, strerror(errno));
+      break;
+    }
+  }
+
+  /* the queues without a worker must not receive any traffic, the port is
+   * left to the running workers */
+  edge_detach_mq_queues(eee, i);
+
+  eee->num_workers = i;
+}
+
+/* ************************************** */
+
+/** Wait for the workers to notice the end of the main loop. */
+static void edge_stop_mq_workers(n2n_edge_t * eee) {
+  int i;
+
+  for(i = 1; i < eee->num_workers; i++)
+    pthread_join(eee->mq_workers[i-1].thread, NULL);
+
+  eee->num_workers = 1;
+}
+
+#endif /* N2N_HAVE_TAP_MQ */
+
+/* ************************************** */
+
+#ifdef N2N_HAVE_PIPELINE
+
+/* Rings hold up to N2N_PIPELINE_JOBS jobs, as many as there are per
+ * direction: pushing can never fail. */
+static void ring_push(n2n_spsc_ring_t *ring, n2n_pipeline_job_t *job) {
+  unsigned int tail = ring->tail;
+
+  ring->slots[tail & (N2N_PIPELINE_JOBS - 1)] = job;
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* ************************************** */
+
+static n2n_pipeline_job_t* ring_pop(n2n_spsc_ring_t *ring) {
+  unsigned int head = ring->head;
+  n2n_pipeline_job_t *job;
+
+  if(head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+    return(NULL);
+
+  job = ring->slots[head & (N2N_PIPELINE_JOBS - 1)];
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+  return(job);
+}
+
+/* ************************************** */
+
+static int ring_empty(n2n_spsc_ring_t *ring) {
+  return(ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE));
+}
+
+/* ************************************** */
+
+/** Wake a thread sleeping on its eventfd, called after pushing to one of
+ *  its rings. */
+static void pipeline_wake(int wake_fd, uint8_t *sleeping) {
+  uint64_t one = 1;
+
+  /* pairs with the fence in pipeline_sleep(): either the sleeper sees the
+   * pushed job or we see it sleeping */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(__atomic_load_n(sleeping, __ATOMIC_RELAXED)) {
+    if(write(wake_fd, &one, sizeof(one)) < 0)
+      traceEvent(TRACE_DEBUG, "pipeline wake-up failed [%d]: %s", errno, strerror(errno));
+  }
+}
+
+/* ************************************** */
+
+/** Sleep until pipeline_wake() or a timeout, unless work shows up in the
+ *  rings meanwhile. */
+static void pipeline_sleep(int wake_fd, uint8_t *sleeping, n2n_spsc_ring_t *ring1, n2n_spsc_ring_t *ring2) {
+  struct pollfd pfd;
+  uint64_t cnt;
+
+  __atomic_store_n(sleeping, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  if(ring_empty(ring1) && (!ring2 || ring_empty(ring2))) {
+    pfd.fd = wake_fd;
+    pfd.events = POLLIN;
+
+    /* wake up regularly to notice the end of the pipeline */
+    if(poll(&pfd, 1, HOUSEKEEPING_INTERVAL * 1000) > 0)
+      if(read(wake_fd, &cnt, sizeof(cnt)) < 0)
+        traceEvent(TRACE_DEBUG, "pipeline wake-up read failed [%d]: %s", errno, strerror(errno));
+  }
+
+  __atomic_store_n(sleeping, 0, __ATOMIC_RELAXED);
+}
+
+/* ************************************** */
+
+/** Reader stage: hand a frame from the TAP (TX) or a datagram from the UDP
+ *  socket (RX) over to the worker next in turn. The job takes a reference
+ *  to the reader's buffer if the data is its payload, a copy otherwise.
+ *  Waits for a free job if the pipeline is full. */
+static void pipeline_submit(n2n_edge_worker_t *w, int d, const uint8_t *data, size_t len,
+			    const struct sockaddr_in *sender) {
+  n2n_pipeline_t *p = w->eee->pipeline;
+  n2n_pipeline_dir_t *dir = &p->dir[d];
+  n2n_pipeline_worker_t *pw;
+  n2n_pipeline_job_t *job;
+  n2n_buf_t *buf;
+
+  if(len > N2N_PKT_BUF_SIZE)
+    return;
+
+  if(w->cur_buf && (data == N2N_BUF_PAYLOAD(w->cur_buf)))
+    buf = n2n_buf_ref(w->cur_buf);
+  else if((buf = n2n_buf_get(&w->buf_cache)) != NULL)
+    memcpy(N2N_BUF_PAYLOAD(buf), data, len);
+  else
+    return;
+
+  while((job = ring_pop(&dir->free)) == NULL) {
+    if(!p->running) {
+      n2n_buf_put(&w->buf_cache, buf);
+      return;
+    }
+    sched_yield();
+  }
+
+  job->seq = dir->read_seq;
+  job->in_len = len;
+  job->out_len = 0;
+  job->buf = buf;
+  if(sender)
+    job->sender = *sender;
+
+  /* round robin: each worker gets every num_workers-th job, so that the
+   * writer finds the next one in sequence at the head of a known ring */
+  pw = &p->workers[dir->read_seq % p->num_workers];
+  dir->read_seq++;
+
+  ring_push(&pw->in[d], job);
+  pipeline_wake(pw->wake_fd, &pw->sleeping);
+}
+
+/* ************************************** */
+
+/** Worker stage: encode frames and decode datagrams. The results stay in
+ *  the job, see send_packet() and handle_PACKET(). */
+static void* pipeline_worker_thread(void *arg) {
+  n2n_pipeline_worker_t *pw = (n2n_pipeline_worker_t*)arg;
+  n2n_pipeline_t *p = pw->pipeline;
+  n2n_edge_worker_t *w = &pw->w;
+  time_t last_tick = 0, now;
+  int d;
+
+  while(p->running) {
+    int busy = 0;
+
+    for(d = N2N_PIPE_TX; d <= N2N_PIPE_RX; d++) {
+      n2n_pipeline_job_t *job = ring_pop(&pw->in[d]);
+
+      if(!job)
+	continue;
+
+      w->pipe_job = job;
+      if(d == N2N_PIPE_TX)
+	worker_send_packet2net(w, N2N_BUF_PAYLOAD(job->buf), job->in_len);
+      else
+	process_udp(w, &job->sender, N2N_BUF_PAYLOAD(job->buf), job->in_len);
+      w->pipe_job = NULL;
+
+      ring_push(&pw->out[d], job);
+      pipeline_wake(p->dir[d].wake_fd, &p->dir[d].sleeping);
+      busy = 1;
+    }
+
+    if(!busy) {
+      pipeline_sleep(pw->wake_fd, &pw->sleeping, &pw->in[N2N_PIPE_TX], &pw->in[N2N_PIPE_RX]);
+
+      now = n2n_now();
+      if((now - last_tick) > TRANSOP_TICK_INTERVAL) {
+	last_tick = now;
+	w->transop->tick(w->transop, now);
+      }
+    }
+  }
+
+  return(NULL);
+}
+
+/* ************************************** */
+
+/** Next job of a direction in reader order, if it has been processed. */
+static n2n_pipeline_job_t* pipeline_next_result(n2n_pipeline_t *p, n2n_pipeline_dir_t *dir, int d) {
+  n2n_spsc_ring_t *out = &p->workers[dir->write_seq % p->num_workers].out[d];
+  n2n_pipeline_job_t *job = ring_pop(out);
+
+  if(!job)
+    return(NULL);
+
+  if(job->seq != dir->write_seq)
+    traceEvent(TRACE_ERROR, "pipeline out of order: got %u, expected %u", job->seq, dir->write_seq);
+
+  dir->write_seq++;
+
+  return(job);
+}
+
+/* ************************************** */
+
+/** Hand a job written out back to the reader, its buffer to the pool. */
+static void pipeline_job_done(n2n_pipeline_dir_t *dir, n2n_pipeline_job_t *job) {
+  n2n_buf_put(&dir->buf_cache, job->buf);
+  job->buf = NULL;
+  ring_push(&dir->free, job);
+}
+
+/* ************************************** */
+
+/** Writer stage of TX: send the encoded PACKETs in order, batched with
+ *  sendmmsg(). */
+static void* pipeline_tx_writer_thread(void *arg) {
+  n2n_pipeline_t *p = (n2n_pipeline_t*)arg;
+  n2n_pipeline_dir_t *dir = &p->dir[N2N_PIPE_TX];
+  n2n_pipeline_job_t *jobs[N2N_MMSG_BATCH_SIZE], *job;
+  struct mmsghdr msgs[N2N_MMSG_BATCH_SIZE];
+  struct iovec iovs[N2N_MMSG_BATCH_SIZE];
+  struct sockaddr_in addrs[N2N_MMSG_BATCH_SIZE];
+  unsigned int num_msgs, sent;
+  int rc;
+
+  memset(msgs, 0, sizeof(msgs));
+
+  while(p->running) {
+    num_msgs = 0;
+
+    while((num_msgs < N2N_MMSG_BATCH_SIZE) && ((job = pipeline_next_result(p, dir, N2N_PIPE_TX)) != NULL)) {
+      if(!job->out_len
+	 || (fill_sockaddr((struct sockaddr *)&addrs[num_msgs], sizeof(struct sockaddr_in), &job->dest) != 0)) {
+	pipeline_job_done(dir, job);
+	continue;
+      }
+
+      iovs[num_msgs].iov_base = job->out;
+      iovs[num_msgs].iov_len = job->out_len;
+      msgs[num_msgs].msg_hdr.msg_iov = &iovs[num_msgs];
+      msgs[num_msgs].msg_hdr.msg_iovlen = 1;
+      msgs[num_msgs].msg_hdr.msg_name = &addrs[num_msgs];
+      msgs[num_msgs].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      jobs[num_msgs++] = job;
+    }
+
+    if(num_msgs == 0) {
+      pipeline_sleep(dir->wake_fd, &dir->sleeping,
+		     &p->workers[dir->write_seq % p->num_workers].out[N2N_PIPE_TX], NULL);
+      continue;
+    }
+
+    for(sent = 0; sent < num_msgs; sent += rc) {
+      rc = sendmmsg(p->eee->udp_sock, &msgs[sent], num_msgs - sent, 0);
+
+      if(rc < 0) {
+	if(errno == EINTR) {
+	  rc = 0;
+	  continue;
+	}
+
+	traceEvent(TRACE_ERROR, "sendmmsg failed (%d) %s", errno, strerror(errno));
+	/* skip the offending packet and carry on with the rest */
+	rc = 1;
+      }
+    }
+
+    for(sent = 0; sent < num_msgs; sent++)
+      pipeline_job_done(dir, jobs[sent]);
+  }
+
+  return(NULL);
+}
+
+/* ************************************** */
+
+/** Writer stage of RX: write the decoded frames to the TAP in order. */
+static void* pipeline_rx_writer_thread(void *arg) {
+  n2n_pipeline_t *p = (n2n_pipeline_t*)arg;
+  n2n_pipeline_dir_t *dir = &p->dir[N2N_PIPE_RX];
+  n2n_pipeline_job_t *job;
+
+  while(p->running) {
+    if((job = pipeline_next_result(p, dir, N2N_PIPE_RX)) == NULL) {
+      pipeline_sleep(dir->wake_fd, &dir->sleeping,
+		     &p->workers[dir->write_seq % p->num_workers].out[N2N_PIPE_RX], NULL);
+      continue;
+    }
+
+    if(job->out_len)
+      tuntap_write(&p->eee->device, job->out, job->out_len);
+
+    pipeline_job_done(dir, job);
+  }
+
+  return(NULL);
+}
+
+/* ************************************** */
+
+/** Start the pipeline threads: the workers first, then the writers. */
+static void edge_start_pipeline(n2n_edge_t * eee) {
+  n2n_pipeline_t *p = eee->pipeline;
+  int i, started = 0;
+
+  if(!p)
+    return;
+
+  /* lock the shared state before the first thread starts */
+  eee->num_workers = 1 + p->num_workers;
+  p->running = 1;
+
+  for(i = 0; i < p->num_workers; i++) {
+    if(pthread_create(&p->workers[i].thread, NULL, pipeline_worker_thread, &p->workers[i]) != 0)
+      break;
+  }
+  started = i;
+
+  if((started < p->num_workers)
+     || (pthread_create(&p->dir[N2N_PIPE_TX].writer, NULL, pipeline_tx_writer_thread, p) != 0)) {
+    traceEvent(TRACE_ERROR, "Cannot start the pipeline threads [%d]: %s", errno, strerror(errno));
+    p->running = 0;
+  } else if(pthread_create(&p->dir[N2N_PIPE_RX].writer, NULL, pipeline_rx_writer_thread, p) != 0) {
+    traceEvent(TRACE_ERROR, "Cannot start the pipeline threads [%d]: %s", errno, strerror(errno));
+    p->running = 0;
+    pthread_join(p->dir[N2N_PIPE_TX].writer, NULL);
+  } else {
+    traceEvent(TRACE_NORMAL, "Pipeline running with %u workers", p->num_workers);
+    return;
+  }
+
+  for(i = 0; i < started; i++)
+    pthread_join(p->workers[i].thread, NULL);
+  eee->num_workers = 1;
+}
+
+/* ************************************** */
+
+/** Stop the pipeline threads, dropping what is still in flight. */
+static void edge_stop_pipeline(n2n_edge_t * eee) {
+  n2n_pipeline_t *p = eee->pipeline;
+  int i;
+
+  if(!p || !p->running)
+    return;
+
+  p->running = 0;
+
+  for(i = 0; i < p->num_workers; i++)
+    pthread_join(p->workers[i].thread, NULL);
+  pthread_join(p->dir[N2N_PIPE_TX].writer, NULL);
+  pthread_join(p->dir[N2N_PIPE_RX].writer, NULL);
+
+  eee->num_workers = 1;
+}
+
+#endif /* N2N_HAVE_PIPELINE */
+
+/* ************************************** */
+
+/** Main loop based on edge triggered epoll.
+ *
+ *  Ready descriptors are drained until EAGAIN, periodic work is driven by a
+ *  timerfd firing every HOUSEKEEPING_INTERVAL instead of running after each
+ *  wakeup. Returns -1 if epoll could not be set up, so that the caller can
+ *  fall back to select().
+ */
+static int run_edge_loop_epoll(n2n_edge_t * eee, int *keep_running) {
+  struct epoll_event events[N2N_EPOLL_MAX_EVENTS];
+  struct itimerspec its;
+  int timer_fd, nfds, i;
+
+  eee->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if(eee->epoll_fd < 0) {
+    traceEvent(TRACE_WARNING, "epoll_create1() failed [%d]: %s", errno, strerror(errno));
+    return(-1);
+  }
+
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if(timer_fd < 0) {
+    traceEvent(TRACE_WARNING, "timerfd_create() failed [%d]: %s", errno, strerror(errno));
+    close(eee->epoll_fd);
+    eee->epoll_fd = -1;
+    return(-1);
+  }
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = HOUSEKEEPING_INTERVAL;
+  its.it_interval.tv_sec = HOUSEKEEPING_INTERVAL;
+  timerfd_settime(timer_fd, 0, &its, NULL);
+
+  edge_epoll_add(eee->epoll_fd, timer_fd, EPOLLIN, 0);
+  edge_epoll_register_sockets(eee);
+  edge_epoll_register_tap(eee);
+
+#ifdef N2N_HAVE_TAP_MQ
+  edge_start_mq_workers(eee, keep_running);
+#endif
+#ifdef N2N_HAVE_PIPELINE
+  edge_start_pipeline(eee);
+#endif
+
+  while(*keep_running) {
+    nfds = epoll_wait(eee->epoll_fd, events, N2N_EPOLL_MAX_EVENTS, SOCKET_TIMEOUT_INTERVAL_SECS * 1000);
+
+    if(nfds < 0) {
+      if(errno == EINTR)
+	continue;
+
+      traceEvent(TRACE_ERROR, "epoll_wait() failed [%d]: %s", errno, strerror(errno));
+      *keep_running = 0; /* also ends the workers */
+      break;
+    }
+
+    n2n_clock_update();
+
+    for(i = 0; i < nfds; i++) {
+      int fd = events[i].data.fd;
+
+      if(fd == timer_fd) {
+	uint64_t expirations;
+
+	if(read(timer_fd, &expirations, sizeof(expirations)) > 0)
+	  edge_housekeeping(eee, n2n_now());
+      } else if(fd == eee->udp_sock) {
+	/* Read cooked sockets from the internet socket (unicast) until drained.
+	 * Writes on the TAP socket. */
+	worker_drain_ip_socket(&eee->worker, fd);
+      }
+#ifndef SKIP_MULTICAST_PEERS_DISCOVERY
+      else if(fd == eee->udp_multicast_sock) {
+	traceEvent(TRACE_DEBUG, "Received packet from multicast socket");
+	worker_drain_ip_socket(&eee->worker, fd);
+      }
+#endif
+      else if(fd == eee->udp_mgmt_sock) {
+	EDGE_LOCK(eee);
+	readFromMgmtSocket(eee, keep_running);
+	EDGE_UNLOCK(eee);
+
+	if(!(*keep_running))
+	  break;
+      } else if(fd == eee->device.fd) {
+	/* Read ethernet frames from the TAP socket until drained. Write on the
+	 * IP socket. */
+	worker_drain_tap(&eee->worker);
+      }
+    }
+  } /* while */
+
+#ifdef N2N_HAVE_PIPELINE
+  edge_stop_pipeline(eee);
+#endif
+#ifdef N2N_HAVE_TAP_MQ
+  edge_stop_mq_workers(eee);
+#endif
+
+  close(timer_fd);
+  close(eee->epoll_fd);
+  eee->epoll_fd = -1;
+
+  return(0);
+}
+
+#endif /* N2N_HAVE_EPOLL */
+
+/* ************************************** */
+
+#ifdef N2N_HAVE_IO_URING
+
+/* The user_data of a request tells what completed: the type in the upper
+ * half, a slot, batch message or fd in the lower one. */
+enum edge_uring_op {
+  URING_TAP_READ = 1,
+  URING_TAP_WRITE,
+  URING_UDP_RECV,
+  URING_UDP_SEND,
+  URING_POLL,
+  URING_TIMEOUT,
+  URING_CANCEL
+};
+
+#define URING_USER_DATA(op, idx)        (((uint64_t)(op) << 32) | (uint32_t)(idx))
+#define URING_UDP_SEND_IDX(b, gso, i)   (((b) << 16) | ((gso) << 15) | (i))
+#define URING_UDP_BUF_SIZE              (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + N2N_PKT_BUF_SIZE)
+
+/* ************************************** */
+
+static struct io_uring_sqe* edge_uring_sqe(n2n_edge_uring_t *u, uint8_t opcode, int fd, uint64_t user_data) {
+  struct io_uring_sqe *sqe = uring_get_sqe(&u->ring);
+
+  if(!sqe) {
+    traceEvent(TRACE_ERROR, "io_uring submission failed [%d]: %s", errno, strerror(errno));
+    return(NULL);
+  }
+
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->user_data = user_data;
+  u->inflight++;
+
+  return(sqe);
+}
+
+/* ************************************** */
+
+static void edge_uring_arm_tap_read(n2n_edge_uring_t *u, unsigned int slot) {
+  struct io_uring_sqe *sqe = edge_uring_sqe(u, u->fixed_bufs ? IORING_OP_READ_FIXED : IORING_OP_READ,
+					    u->tap_fd, URING_USER_DATA(URING_TAP_READ, slot));
+
+  if(sqe) {
+    /* leave room for building the PACKET around the frame */
+    sqe->addr = (uintptr_t)(u->tap_rx[slot] + N2N_PKT_HEADROOM);
+    sqe->len = N2N_PKT_BUF_SIZE;
+    sqe->off = (uint64_t)-1; /* current position, the TAP is not seekable anyway */
+    sqe->buf_index = 0;
+  }
+}
+
+/* ************************************** */
+
+/** Arm a multishot receive: it keeps completing with datagrams picked up in
+ *  buffers from the buffer ring until it runs out of them. */
+static void edge_uring_arm_udp_recv(n2n_edge_uring_t *u, int fd) {
+  struct io_uring_sqe *sqe = edge_uring_sqe(u, IORING_OP_RECVMSG, fd, URING_USER_DATA(URING_UDP_RECV, fd));
+
+  u->udp_fd = fd;
+
+  if(sqe) {
+    sqe->addr = (uintptr_t)&u->udp_msg;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = N2N_URING_UDP_BGID;
+  }
+}
+
+/* ************************************** */
+
+static void edge_uring_arm_poll(n2n_edge_uring_t *u, int fd) {
+  struct io_uring_sqe *sqe;
+
+  if(fd < 0)
+    return;
+
+  sqe = edge_uring_sqe(u, IORING_OP_POLL_ADD, fd, URING_USER_DATA(URING_POLL, fd));
+  if(sqe)
+    sqe->poll32_events = POLLIN;
+}
+
+/* ************************************** */
+
+static void edge_uring_arm_timeout(n2n_edge_uring_t *u) {
+  struct io_uring_sqe *sqe = edge_uring_sqe(u, IORING_OP_TIMEOUT, -1, URING_USER_DATA(URING_TIMEOUT, 0));
+
+  if(sqe) {
+    sqe->addr = (uintptr_t)&u->housekeeping;
+    sqe->len = 1;
+  }
+}
+
+/* ************************************** */
+
+/** Cancel the request with the given user_data, or all of them if 0. */
+static void edge_uring_cancel(n2n_edge_uring_t *u, uint64_t user_data) {
+  struct io_uring_sqe *sqe = edge_uring_sqe(u, IORING_OP_ASYNC_CANCEL, -1, URING_USER_DATA(URING_CANCEL, 0));
+
+  if(sqe) {
+    sqe->addr = user_data;
+    if(!user_data)
+      sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+  }
+}
+
+/* ************************************** */
+
+/** Hand a buffer (back) to the kernel for the multishot UDP receive. */
+static void edge_uring_recycle_udp_buf(n2n_edge_uring_t *u, uint16_t bid) {
+  struct io_uring_buf_ring *br = u->udp_buf_ring;
+  uint16_t tail = br->tail;
+  struct io_uring_buf *buf = &br->bufs[tail & (N2N_URING_UDP_BUFS - 1)];
+
+  buf->addr = (uintptr_t)(u->udp_bufs + bid * URING_UDP_BUF_SIZE);
+  buf->len = URING_UDP_BUF_SIZE;
+  buf->bid = bid;
+
+  __atomic_store_n(&br->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* ************************************** */
+
+/** Send the TX batch through the ring and let the worker continue with a
+ *  batch which is not in flight. Returns -1 if all of them are, the batch
+ *  has to be sent right away then. */
+static int edge_uring_send_batch(n2n_edge_worker_t *w) {
+  n2n_edge_uring_t *u = w->uring;
+  n2n_mmsg_batch_t *batch = w->tx_batch;
+  struct mmsghdr *msgs = batch->msgs;
+  unsigned int b, next, i, num_msgs = batch->count;
+  unsigned int gso = 0;
+  struct io_uring_sqe *sqe;
+
+  for(b = 0; u->tx_batches[b] != batch; b++)
+    ;
+
+  for(next = 0; next < N2N_URING_TX_BATCHES; next++)
+    if((next != b) && (u->tx_inflight[next] == 0))
+      break;
+
+  if(next == N2N_URING_TX_BATCHES)
+    return(-1);
+
+#ifdef N2N_HAVE_UDP_GSO
+  if(w->udp_gso && (num_msgs > 1)) {
+    num_msgs = tx_batch_gso_runs(batch);
+    msgs = batch->gso_msgs;
+    gso = 1;
+  }
+#endif
+
+  for(i = 0; i < num_msgs; i++) {
+    sqe = edge_uring_sqe(u, IORING_OP_SENDMSG, w->udp_sock,
+			 URING_USER_DATA(URING_UDP_SEND, URING_UDP_SEND_IDX(b, gso, i)));
+    if(sqe) {
+      sqe->addr = (uintptr_t)&msgs[i].msg_hdr;
+      u->tx_inflight[b]++;
+    } else
+      sendmsg(w->udp_sock, &msgs[i].msg_hdr, 0);
+  }
+
+  w->tx_batch = u->tx_batches[next];
+  w->tx_batch->enabled = batch->enabled;
+  w->tx_batch->count = 0;
+
+  return(0);
+}
+
+/* ************************************** */
+
+/** Write a frame to the TAP through the ring, or right away if all the
+ *  write buffers are in flight. */
+static int edge_uring_tap_write(n2n_edge_worker_t *w, uint8_t *frame, size_t len) {
+  n2n_edge_uring_t *u = w->uring;
+  struct io_uring_sqe *sqe;
+  uint16_t slot;
+
+  if((u->num_tap_tx_free == 0) || (len > N2N_PKT_BUF_SIZE))
+    return(tuntap_write(w->device, frame, len));
+
+  slot = u->tap_tx_free[--u->num_tap_tx_free];
+  memcpy(u->tap_tx[slot], frame, len);
+
+  sqe = edge_uring_sqe(u, u->fixed_bufs ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE,
+		       u->tap_fd, URING_USER_DATA(URING_TAP_WRITE, slot));
+  if(!sqe) {
+    u->tap_tx_free[u->num_tap_tx_free++] = slot;
+    return(tuntap_write(w->device, frame, len));
+  }
+
+  sqe->addr = (uintptr_t)u->tap_tx[slot];
+  sqe->len = len;
+  sqe->off = (uint64_t)-1;
+  sqe->buf_index = 1;
+
+  return(len);
+}
+
+/* ************************************** */
+
+/** Process a datagram picked up by the multishot receive. The buffer holds
+ *  a struct io_uring_recvmsg_out, the sender address and the payload. */
+static void edge_uring_udp_datagram(n2n_edge_worker_t *w, uint16_t bid, size_t len) {
+  n2n_edge_uring_t *u = w->uring;
+  uint8_t *buf = u->udp_bufs + bid * URING_UDP_BUF_SIZE;
+  struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+  size_t hdr_len = sizeof(*out) + u->udp_msg.msg_namelen + u->udp_msg.msg_controllen;
+
+  if((len < hdr_len) || (out->namelen > u->udp_msg.msg_namelen))
+    return;
+
+  if(out->flags & MSG_TRUNC)
+    traceEvent(TRACE_WARNING, "Datagram of %u bytes truncated", out->payloadlen);
+
+  process_udp(w, (struct sockaddr_in *)(buf + sizeof(*out)), buf + hdr_len, min(out->payloadlen, len - hdr_len));
+}
+
+/* ************************************** */
+
+/** Resend the datagrams of a UDP_SEGMENT send the kernel refused one by
+ *  one, and stop using GSO. */
+static void edge_uring_gso_failed(n2n_edge_worker_t *w, struct msghdr *hdr, int err) {
+  size_t i;
+
+  traceEvent(TRACE_WARNING, "UDP GSO send failed (%d) %s, disabling it", err, strerror(err));
+#ifdef N2N_HAVE_UDP_GSO
+  w->udp_gso = 0;
+#endif
+
+  for(i = 0; i < hdr->msg_iovlen; i++)
+    sendto(w->udp_sock, hdr->msg_iov[i].iov_base, hdr->msg_iov[i].iov_len, 0,
+	   (struct sockaddr *)hdr->msg_name, hdr->msg_namelen);
+}
+
+/* ************************************** */
+
+static void edge_uring_complete(n2n_edge_worker_t *w, const struct io_uring_cqe *cqe, int *keep_running) {
+  n2n_edge_uring_t *u = w->uring;
+  n2n_edge_t *eee = w->eee;
+  uint32_t idx = (uint32_t)cqe->user_data;
+  int res = cqe->res;
+
+  if(!(cqe->flags & IORING_CQE_F_MORE))
+    u->inflight--;
+
+  switch(cqe->user_data >> 32) {
+  case URING_TAP_READ:
+    if(res > 0)
+      worker_tap_frame(w, u->tap_rx[idx] + N2N_PKT_HEADROOM, res);
+    else if((res != -EAGAIN) && (res != -EINTR) && (res != -ECANCELED)) {
+      traceEvent(TRACE_WARNING, "read()=%d [%d/%s]", res, -res, strerror(-res));
+      traceEvent(TRACE_WARNING, "TAP I/O operation aborted, restart later.");
+      sleep(3);
+    }
+
+    if(*keep_running && (res != -ECANCELED))
+      edge_uring_arm_tap_read(u, idx);
+    break;
+
+  case URING_TAP_WRITE:
+    u->tap_tx_free[u->num_tap_tx_free++] = idx;
+    if(res < 0)
+      traceEvent(TRACE_WARNING, "TAP write failed [%d]: %s", -res, strerror(-res));
+    break;
+
+  case URING_UDP_RECV:
+    if(cqe->flags & IORING_CQE_F_BUFFER) {
+      uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+      if(res > 0)
+	edge_uring_udp_datagram(w, bid, res);
+      edge_uring_recycle_udp_buf(u, bid);
+    } else if(res == -EINVAL) {
+      traceEvent(TRACE_WARNING, "io_uring: kernel lacks multishot receive");
+      u->failed = 1;
+      break;
+    } else if((res < 0) && (res != -ENOBUFS) && (res != -ECANCELED))
+      traceEvent(TRACE_ERROR, "io_uring receive failed [%d]: %s", -res, strerror(-res));
+
+    /* re-arm once it has ended, e.g. because all buffers were in use */
+    if(!(cqe->flags & IORING_CQE_F_MORE) && *keep_running && (res != -ECANCELED) && ((int)idx == u->udp_fd))
+      edge_uring_arm_udp_recv(u, idx);
+    break;
+
+  case URING_UDP_SEND: {
+    n2n_mmsg_batch_t *batch = u->tx_batches[idx >> 16];
+    unsigned int i = idx & 0x7fff;
+
+    u->tx_inflight[idx >> 16]--;
+
+    if(res >= 0)
+      break;
+
+    if((idx & 0x8000) && ((res == -EIO) || (res == -EINVAL) || (res == -EOPNOTSUPP) || (res == -ENOPROTOOPT)))
+      edge_uring_gso_failed(w, &batch->gso_msgs[i].msg_hdr, -res);
+    else
+      traceEvent(TRACE_ERROR, "sendmsg failed (%d) %s", -res, strerror(-res));
+    break;
+  }
+
+  case URING_POLL:
+    if(res > 0) {
+      if((int)idx == eee->udp_mgmt_sock) {
+	EDGE_LOCK(eee);
+	readFromMgmtSocket(eee, keep_running);
+	EDGE_UNLOCK(eee);
+      }
+#ifndef SKIP_MULTICAST_PEERS_DISCOVERY
+      else if((int)idx == eee->udp_multicast_sock) {
+	traceEvent(TRACE_DEBUG, "Received packet from multicast socket");
+	worker_read_from_ip_socket(w, idx);
+      }
+#endif
+    }
+
+    if(*keep_running && (res != -ECANCELED)
+       && (((int)idx == u->mgmt_fd) || ((int)idx == u->multicast_fd)))
+      edge_uring_arm_poll(u, idx);
+    break;
+
+  case URING_TIMEOUT:
+    edge_housekeeping(eee, n2n_now());
+
+    if(*keep_running && (res != -ECANCELED))
+      edge_uring_arm_timeout(u);
+    break;
+
+  default: /* URING_CANCEL */
+    break;
+  }
+}
+
+/* ************************************** */
+
+/** Move the requests over to sockets edge_init_sockets() has re-opened.
+ *  A re-opened socket usually gets the same fd number, so this goes by the
+ *  socket generation. The old requests are cancelled before the new ones
+ *  are issued, their user data may well be the same. */
+static void edge_uring_check_sockets(n2n_edge_t *eee) {
+  n2n_edge_uring_t *u = eee->worker.uring;
+
+  if((u->udp_fd >= 0) && (u->sock_gen == eee->sock_gen))
+    return;
+
+  u->sock_gen = eee->sock_gen;
+
+  if(u->udp_fd >= 0)
+    edge_uring_cancel(u, URING_USER_DATA(URING_UDP_RECV, u->udp_fd));
+  edge_uring_arm_udp_recv(u, eee->udp_sock);
+
+  if(u->mgmt_fd >= 0)
+    edge_uring_cancel(u, URING_USER_DATA(URING_POLL, u->mgmt_fd));
+  u->mgmt_fd = eee->udp_mgmt_sock;
+  edge_uring_arm_poll(u, u->mgmt_fd);
+
+#ifndef SKIP_MULTICAST_PEERS_DISCOVERY
+  if(u->multicast_fd >= 0)
+    edge_uring_cancel(u, URING_USER_DATA(URING_POLL, u->multicast_fd));
+  u->multicast_fd = eee->udp_multicast_sock;
+  edge_uring_arm_poll(u, u->multicast_fd);
+#endif
+}
+
+/* ************************************** */
+
+static void edge_uring_free(n2n_edge_worker_t *w) {
+  n2n_edge_uring_t *u = w->uring;
+  int i;
+
+  if(!u)
+    return;
+
+  if(u->ring.fd >= 0) {
+    /* wait for everything in flight to end, the buffers are still in use */
+    int keep_running = 0;
+    struct io_uring_cqe *cqe;
+
+    edge_uring_cancel(u, 0);
+
+    while(u->inflight > 0) {
+      if((uring_submit(&u->ring, 1) < 0) && (errno != EINTR))
+	break;
+
+      while((cqe = uring_peek_cqe(&u->ring)) != NULL) {
+	struct io_uring_cqe c = *cqe;
+
+	uring_cqe_seen(&u->ring);
+	edge_uring_complete(w, &c, &keep_running);
+      }
+    }
+
+    uring_exit(&u->ring);
+  }
+
+  w->tx_batch = u->tx_batches[0];
+  for(i = 1; i < N2N_URING_TX_BATCHES; i++)
+    if(u->tx_batches[i])
+      free(u->tx_batches[i]);
+
+  if(u->udp_buf_ring && (u->udp_buf_ring != MAP_FAILED))
+    munmap(u->udp_buf_ring, N2N_URING_UDP_BUFS * sizeof(struct io_uring_buf));
+
+  if(u->udp_bufs)
+    free(u->udp_bufs);
+
+  free(u);
+  w->uring = NULL;
+}
+
+/* ************************************** */
+
+static int edge_uring_init(n2n_edge_worker_t *w) {
+  n2n_edge_uring_t *u;
+  struct io_uring_buf_reg reg;
+  struct iovec iov[2];
+  int i;
+
+  if((u = calloc(1, sizeof(n2n_edge_uring_t))) == NULL)
+    return(-1);
+
+  w->uring = u;
+  u->tx_batches[0] = w->tx_batch;
+
+  if(uring_init(&u->ring, N2N_URING_ENTRIES) < 0) {
+    u->ring.fd = -1;
+    goto uring_init_failed;
+  }
+
+  /* pinning the buffers counts against RLIMIT_MEMLOCK: do without if need be */
+  iov[0].iov_base = u->tap_rx;
+  iov[0].iov_len = sizeof(u->tap_rx);
+  iov[1].iov_base = u->tap_tx;
+  iov[1].iov_len = sizeof(u->tap_tx);
+  u->fixed_bufs = (uring_register(&u->ring, IORING_REGISTER_BUFFERS, iov, 2) == 0);
+
+  u->udp_buf_ring = mmap(NULL, N2N_URING_UDP_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  u->udp_bufs = malloc(N2N_URING_UDP_BUFS * URING_UDP_BUF_SIZE);
+  if((u->udp_buf_ring == MAP_FAILED) || !u->udp_bufs)
+    goto uring_init_failed;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uintptr_t)u->udp_buf_ring;
+  reg.ring_entries = N2N_URING_UDP_BUFS;
+  reg.bgid = N2N_URING_UDP_BGID;
+  if(uring_register(&u->ring, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    traceEvent(TRACE_WARNING, "io_uring: kernel lacks buffer rings [%d]: %s", errno, strerror(errno));
+    goto uring_init_failed;
+  }
+
+  for(i = 0; i < N2N_URING_UDP_BUFS; i++)
+    edge_uring_recycle_udp_buf(u, i);
+
+  for(i = 1; i < N2N_URING_TX_BATCHES; i++)
+    if((u->tx_batches[i] = mmsg_batch_alloc()) == NULL)
+      goto uring_init_failed;
+
+  for(i = 0; i < N2N_URING_TAP_WRITES; i++)
+    u->tap_tx_free[u->num_tap_tx_free++] = i;
+
+  u->udp_msg.msg_namelen = sizeof(struct sockaddr_in);
+  u->housekeeping.tv_sec = HOUSEKEEPING_INTERVAL;
+  u->udp_fd = u->mgmt_fd = u->multicast_fd = -1;
+  u->tap_fd = w->device->fd;
+
+  return(0);
+
+ uring_init_failed:
+  edge_uring_free(w);
+  return(-1);
+}
+
+/* ************************************** */
+
+/** Main loop doing the TAP and UDP I/O with io_uring: reads from the TAP
+ *  and a multishot receive on the UDP socket are kept outstanding, the
+ *  resulting writes and sends are queued and all of it is submitted and
+ *  reaped with one io_uring_enter() per iteration. Management and
+ *  multicast traffic is polled through the ring. Returns -1 if the kernel
+ *  lacks what is needed, so that the caller can fall back to epoll. */
+static int run_edge_loop_uring(n2n_edge_t * eee, int *keep_running) {
+  n2n_edge_worker_t *w = &eee->worker;
+  n2n_edge_uring_t *u;
+  struct io_uring_cqe *cqe;
+  int i, rc;
+
+  if(edge_uring_init(w) < 0)
+    return(-1);
+
+  u = w->uring;
+
+  for(i = 0; i < N2N_URING_TAP_READS; i++)
+    edge_uring_arm_tap_read(u, i);
+  edge_uring_check_sockets(eee);
+  edge_uring_arm_timeout(u);
+
+  traceEvent(TRACE_NORMAL, "Using io_uring%s", u->fixed_bufs ? " with registered buffers" : "");
+
+  while(*keep_running && !u->failed) {
+    if((uring_submit(&u->ring, 1) < 0) && (errno != EINTR) && (errno != EBUSY)) {
+      traceEvent(TRACE_ERROR, "io_uring_enter() failed [%d]: %s", errno, strerror(errno));
+      *keep_running = 0;
+      break;
+    }
+
+    n2n_clock_update();
+
+    tx_batch_start(w);
+    while((cqe = uring_peek_cqe(&u->ring)) != NULL) {
+      struct io_uring_cqe c = *cqe;
+
+      uring_cqe_seen(&u->ring);
+      edge_uring_complete(w, &c, keep_running);
+    }
+    tx_batch_stop(w);
+
+    edge_uring_check_sockets(eee);
+  }
+
+  rc = u->failed ? -1 : 0;
+  edge_uring_free(w);
+
+  return(rc);
+}
+
+#endif /* N2N_HAVE_IO_URING */
+
+/* ************************************** */
+
+int run_edge_loop(n2n_edge_t * eee, int *keep_running) {
+#ifdef WIN32
+  struct tunread_arg arg;
+  arg.eee = eee;
+  arg.keep_running = keep_running;
+  HANDLE tun_read_thread = startTunReadThread(&arg);
+#endif
+
+  *keep_running = 1;
+  update_supernode_reg(eee, time(NULL));
+
+#ifdef N2N_HAVE_IO_URING
+  if(eee->conf.io_uring) {
+    if(run_edge_loop_uring(eee, keep_running) == 0)
+      goto run_edge_loop_done;
+
+    traceEvent(TRACE_WARNING, "io_uring not usable");
+  }
+#endif
+
+#ifdef N2N_HAVE_EPOLL
+  if(run_edge_loop_epoll(eee, keep_running) == 0)
+    goto run_edge_loop_done;
+
+  traceEvent(TRACE_WARNING, "Falling back to select() main loop");
+#endif
+
+#ifdef N2N_HAVE_TAP_MQ
+  /* the select() loop only serves the main TAP queue */
+  edge_detach_mq_queues(eee, 1);
+#endif
+
+  /* Main loop
+   *
+   * select() is used to wait for input on either the TAP fd or the UDP/TCP
+   * socket. When input is present the data is read and processed by either
+   * readFromIPSocket() or edge_read_from_tap()
+   */
+
+  while(*keep_running) {
+    int rc, max_sock = 0;
+    fd_set socket_mask;
+    struct timeval wait_time;
+    time_t nowTime;
+
+    FD_ZERO(&socket_mask);
+    FD_SET(eee->udp_sock, &socket_mask);
+    FD_SET(eee->udp_mgmt_sock, &socket_mask);
+    max_sock = max(eee->udp_sock, eee->udp_mgmt_sock);
+
+#ifndef SKIP_MULTICAST_PEERS_DISCOVERY
+    FD_SET(eee->udp_multicast_sock, &socket_mask);
+    max_sock = max(eee->udp_sock, eee->udp_multicast_sock);
+#endif
+
+#ifndef WIN32
+    FD_SET(eee->device.fd, &socket_mask);
+    max_sock = max(max_sock, eee->device.fd);
+#endif
+
+    wait_time.tv_sec = SOCKET_TIMEOUT_INTERVAL_SECS; wait_time.tv_usec = 0;
+
+    rc = select(max_sock+1, &socket_mask, NULL, NULL, &wait_time);
+    nowTime=n2n_clock_update();
+
+    /* Make sure ciphers are updated before the packet is treated. */
+    if((nowTime - eee->last_transop_tick) > TRANSOP_TICK_INTERVAL) {
+      eee->last_transop_tick = nowTime;
+
+      eee->transop.tick(&eee->transop, nowTime);
+    }
+
+    if(rc > 0) {
+      /* Any or all of the FDs could have input; check them all. */
+
+      if(FD_ISSET(eee->udp_sock, &socket_mask)) {
+	/* Read a cooked socket from the internet socket (unicast). Writes on the TAP
+	 * socket. */
+	readFromIPSocket(eee, eee->udp_sock);
+      }
+
+
+#ifndef SKIP_MULTICAST_PEERS_DISCOVERY
+      if(FD_ISSET(eee->udp_multicast_sock, &socket_mask)) {
+	/* Read a cooked socket from the internet socket (multicast). Writes on the TAP
+	 * socket. */
+	traceEvent(TRACE_DEBUG, "Received packet from multicast socket");
+	readFromIPSocket(eee, eee->udp_multicast_sock);
+      }
+#endif
+
+      if(FD_ISSET(eee->udp_mgmt_sock, &socket_mask)) {
+	/* Read a cooked socket from the internet socket. Writes on the TAP
+	 * socket. */
+	readFromMgmtSocket(eee, keep_running);
+
+	if(!(*keep_running))
+	  break;
+      }
+
+#ifndef WIN32
+      if(FD_ISSET(eee->device.fd, &socket_mask)) {
+	/* Read an ethernet frame from the TAP socket. Write on the IP
+	 * socket. */
+	edge_read_from_tap(eee);
+      }
+#endif
+    }
+
+    /* Finished processing select data. */
+    edge_housekeeping(eee, nowTime);
+  } /* while */
+
+#ifdef N2N_HAVE_EPOLL
+ run_edge_loop_done:
+#endif
+
+#ifdef WIN32
+  WaitForSingleObject(tun_read_thread, INFINITE);
+#endif
+
+  send_deregister(eee, &(eee->supernode));
+
+  closesocket(eee->udp_sock);
+
+  return(0);
+}
+
+/* ************************************** */
+
+/** Deinitialise the edge and deallocate any owned memory. */
+void edge_term(n2n_edge_t * eee) {
+  if(eee->udp_sock >= 0)
+    closesocket(eee->udp_sock);
+
+  if(eee->udp_mgmt_sock >= 0)
+    closesocket(eee->udp_mgmt_sock);
+
+#ifndef SKIP_MULTICAST_PEERS_DISCOVERY
+  if(eee->udp_multicast_sock >= 0)
+    closesocket(eee->udp_multicast_sock);
+#endif
+
+  clear_peer_list(&eee->pending_peers);
+  clear_peer_list(&eee->known_peers);
+
+  eee->transop.deinit(&eee->transop);
+
+  edge_cleanup_routes(eee);
+
+  edge_worker_free(&eee->worker);
+
+#ifdef N2N_HAVE_TAP_MQ
+#ifdef N2N_HAVE_PIPELINE
+  edge_term_pipeline(eee);
+#endif
+  edge_term_mq_workers(eee);
+  pthread_mutex_destroy(&eee->lock);
+#endif
+
+  n2n_buf_pool_destroy(eee->buf_pool);
+  n2n_peer_cache_destroy(eee->peer_cache);
+
+#ifdef N2N_HAVE_ZSTD
+  edge_free_zstd_dict(eee);
+#endif
+
+  closeTraceFile();
+
+  free(eee);
+}
+
+/* ************************************** */
+
+static int edge_init_sockets(n2n_edge_t *eee, int udp_local_port, int mgmt_port, uint8_t tos) {
+
+ if(eee->udp_sock >= 0)
+    closesocket(eee->udp_sock);
+
+  if(eee->udp_mgmt_sock >= 0)
+    closesocket(eee->udp_mgmt_sock);
+
+#ifndef SKIP_MULTICAST_PEERS_DISCOVERY
+  if(eee->udp_multicast_sock >= 0)
+    closesocket(eee->udp_multicast_sock);
+#endif
+
+  eee->sock_gen++;
+
+  if(udp_local_port > 0)
+    traceEvent(TRACE_NORMAL, "Binding to local port %d", udp_local_port);
+
+  if(eee->conf.tap_queues > 1)
+    /* the TAP queue workers will bind their sockets to the same port */
+    eee->udp_sock = open_reuseport_socket(udp_local_port, 1 /* bind ANY */);
+  else
+    eee->udp_sock = open_socket(udp_local_port, 1 /* bind ANY */);
+  if(eee->udp_sock < 0) {
+    traceEvent(TRACE_ERROR, "Failed to bind main UDP port %u", udp_local_port);
+    return(-1);
+  }
+
+  eee->worker.udp_sock = eee->udp_sock;
+  edge_set_socket_options(eee, eee->udp_sock, tos);
+  edge_worker_set_offloads(&eee->worker);
+
+  eee->udp_mgmt_sock = open_socket(mgmt_port, 0 /* bind LOOPBACK */);
+  if(eee->udp_mgmt_sock < 0) {
+    traceEvent(TRACE_ERROR, "Failed to bind management UDP port %u", mgmt_port);
+    return(-2);
   }
 
 #ifndef SKIP_MULTICAST_PEERS_DISCOVERY
@@ -2278,11 +4784,248 @@ static int edge_init_sockets(n2n_edge_t *eee, int udp_local_port, int mgmt_port,
   }
 #endif
 
+#ifdef N2N_HAVE_EPOLL
+  /* sockets re-opened while the main loop is running */
+  if(eee->epoll_fd >= 0)
+    edge_epoll_register_sockets(eee);
+#endif
+
+  return(0);
+}
+
+/* ************************************** */
+
+/** Apply TOS and PMTU discovery settings to a socket sending data packets. */
+static void edge_set_socket_options(n2n_edge_t *eee, int sock, uint8_t tos) {
+  int sockopt;
+
+  if(tos) {
+    /* https://www.tucny.com/Home/dscp-tos */
+    sockopt = tos;
+
+    if(setsockopt(sock, IPPROTO_IP, IP_TOS, (char *)&sockopt, sizeof(sockopt)) == 0)
+      traceEvent(TRACE_NORMAL, "TOS set to 0x%x", tos);
+    else
+      traceEvent(TRACE_ERROR, "Could not set TOS 0x%x[%d]: %s", tos, errno, strerror(errno));
+  }
+
+#ifdef IP_PMTUDISC_DO
+  sockopt = (eee->conf.disable_pmtu_discovery) ? IP_PMTUDISC_DONT : IP_PMTUDISC_DO;
+
+  if(setsockopt(sock, IPPROTO_IP, IP_MTU_DISCOVER, &sockopt, sizeof(sockopt)) < 0)
+    traceEvent(TRACE_WARNING, "Could not %s PMTU discovery[%d]: %s",
+	       (eee->conf.disable_pmtu_discovery) ? "disable" : "enable", errno, strerror(errno));
+  else
+    traceEvent(TRACE_DEBUG, "PMTU discovery %s", (eee->conf.disable_pmtu_discovery) ? "disabled" : "enabled");
+#endif
+}
+
+/* ************************************** */
+
+/** Use the segmentation offloads of the kernel on the UDP socket of a worker
+ *  where available: UDP GSO to send and UDP GRO to receive. */
+static void edge_worker_set_offloads(n2n_edge_worker_t *w) {
+#ifdef N2N_HAVE_UDP_GSO
+  w->udp_gso = udp_gso_probe(w->udp_sock);
+  traceEvent(TRACE_INFO, "UDP GSO %s", w->udp_gso ? "enabled" : "not supported");
+#endif
+
+#ifdef N2N_HAVE_UDP_GRO
+  /* the io_uring receive buffers only hold single datagrams */
+  if(w->eee->conf.io_uring)
+    return;
+
+  /* the buffers must be there before the kernel may hand over coalesced datagrams */
+  if(!w->gro_batch && ((w->gro_batch = udp_gro_batch_alloc()) == NULL))
+    return;
+
+  if(!udp_gro_enable(w->udp_sock)) {
+    free(w->gro_batch);
+    w->gro_batch = NULL;
+  }
+  traceEvent(TRACE_INFO, "UDP GRO %s", w->gro_batch ? "enabled" : "not supported");
+#endif
+}
+
+/* ************************************** */
+
+#ifdef N2N_HAVE_TAP_MQ
+
+/** Set up a worker for each TAP queue beyond the first one: its own transop,
+ *  buffers and a UDP socket bound to the port of the main socket. The queues
+ *  are only assigned once the TAP is open, see edge_start_mq_workers(). */
+static int edge_init_mq_workers(n2n_edge_t *eee) {
+  struct sockaddr_in local_sock;
+  socklen_t sock_len = sizeof(local_sock);
+  int i;
+
+  if(eee->conf.tap_queues <= 1)
+    return(0);
+
+  if(getsockname(eee->udp_sock, (struct sockaddr *)&local_sock, &sock_len) < 0) {
+    traceEvent(TRACE_ERROR, "getsockname() failed [%d]: %s", errno, strerror(errno));
+    return(-1);
+  }
+
+  eee->mq_workers = calloc(eee->conf.tap_queues - 1, sizeof(n2n_edge_worker_t));
+  if(!eee->mq_workers)
+    return(-1);
+
+  for(i = 1; i < eee->conf.tap_queues; i++)
+    eee->mq_workers[i-1].udp_sock = -1;
+
+  for(i = 1; i < eee->conf.tap_queues; i++) {
+    n2n_edge_worker_t *w = &eee->mq_workers[i-1];
+
+    if((edge_worker_init(eee, w, i, &w->queue_device, &w->queue_transop) < 0)
+       || (edge_init_transop(&eee->conf, &w->queue_transop) < 0)) {
+      traceEvent(TRACE_ERROR, "Cannot set up worker %d", i);
+      return(-1);
+    }
+
+    w->udp_sock = open_reuseport_socket(ntohs(local_sock.sin_port), 1 /* bind ANY */);
+    if(w->udp_sock < 0) {
+      traceEvent(TRACE_ERROR, "Failed to bind UDP port %u for worker %d", ntohs(local_sock.sin_port), i);
+      return(-1);
+    }
+
+    edge_set_socket_options(eee, w->udp_sock, eee->conf.tos);
+    edge_worker_set_offloads(w);
+  }
+
+  traceEvent(TRACE_NORMAL, "Using %u TAP queues", eee->conf.tap_queues);
+
+  return(0);
+}
+
+/* ************************************** */
+
+static void edge_term_mq_workers(n2n_edge_t *eee) {
+  int i;
+
+  if(!eee->mq_workers)
+    return;
+
+  for(i = 1; i < eee->conf.tap_queues; i++) {
+    n2n_edge_worker_t *w = &eee->mq_workers[i-1];
+
+    if(w->udp_sock >= 0)
+      closesocket(w->udp_sock);
+
+    if(w->queue_transop.deinit)
+      w->queue_transop.deinit(&w->queue_transop);
+
+    edge_worker_free(w);
+  }
+
+  free(eee->mq_workers);
+  eee->mq_workers = NULL;
+}
+
+#endif /* N2N_HAVE_TAP_MQ */
+
+/* ************************************** */
+
+#ifdef N2N_HAVE_PIPELINE
+
+/** Set up the pipeline workers, each with its own transop and buffers, and
+ *  the jobs and rings of both directions. The threads are only started by
+ *  the main loop, see edge_start_pipeline(). */
+static int edge_init_pipeline(n2n_edge_t *eee) {
+  n2n_pipeline_t *p;
+  int i, d;
+
+  if(eee->conf.pipeline_workers == 0)
+    return(0);
+
+  if((p = calloc(1, sizeof(n2n_pipeline_t))) == NULL)
+    return(-1);
+
+  eee->pipeline = p;
+  p->eee = eee;
+  p->num_workers = eee->conf.pipeline_workers;
+  p->dir[N2N_PIPE_TX].wake_fd = p->dir[N2N_PIPE_RX].wake_fd = -1;
+
+  for(d = N2N_PIPE_TX; d <= N2N_PIPE_RX; d++) {
+    n2n_pipeline_dir_t *dir = &p->dir[d];
+
+    if(((dir->jobs = calloc(N2N_PIPELINE_JOBS, sizeof(n2n_pipeline_job_t))) == NULL)
+       || ((dir->wake_fd = eventfd(0, EFD_CLOEXEC)) < 0))
+      return(-1);
+
+    n2n_buf_cache_init(&dir->buf_cache, eee->buf_pool);
+    for(i = 0; i < N2N_PIPELINE_JOBS; i++)
+      ring_push(&dir->free, &dir->jobs[i]);
+  }
+
+  if((p->workers = calloc(p->num_workers, sizeof(n2n_pipeline_worker_t))) == NULL)
+    return(-1);
+
+  for(i = 0; i < p->num_workers; i++)
+    p->workers[i].wake_fd = -1;
+
+  for(i = 0; i < p->num_workers; i++) {
+    n2n_pipeline_worker_t *pw = &p->workers[i];
+
+    pw->pipeline = p;
+
+    if((edge_worker_init(eee, &pw->w, 0, &eee->device, &pw->transop) < 0)
+       || (edge_init_transop(&eee->conf, &pw->transop) < 0)
+       || ((pw->wake_fd = eventfd(0, EFD_CLOEXEC)) < 0)) {
+      traceEvent(TRACE_ERROR, "Cannot set up pipeline worker %d", i);
+      return(-1);
+    }
+
+    /* control messages answered while decoding go out on the main socket */
+    pw->w.udp_sock = eee->udp_sock;
+  }
+
   return(0);
 }
 
 /* ************************************** */
 
+static void edge_term_pipeline(n2n_edge_t *eee) {
+  n2n_pipeline_t *p = eee->pipeline;
+  int i, d;
+
+  if(!p)
+    return;
+
+  if(p->workers) {
+    for(i = 0; i < p->num_workers; i++) {
+      n2n_pipeline_worker_t *pw = &p->workers[i];
+
+      if(pw->transop.deinit)
+	pw->transop.deinit(&pw->transop);
+      edge_worker_free(&pw->w);
+      if(pw->wake_fd >= 0)
+	close(pw->wake_fd);
+    }
+
+    free(p->workers);
+  }
+
+  for(d = N2N_PIPE_TX; d <= N2N_PIPE_RX; d++) {
+    if(p->dir[d].jobs) {
+      /* jobs dropped in flight still hold their buffers */
+      for(i = 0; i < N2N_PIPELINE_JOBS; i++)
+	n2n_buf_put(&p->dir[d].buf_cache, p->dir[d].jobs[i].buf);
+      n2n_buf_cache_flush(&p->dir[d].buf_cache);
+      free(p->dir[d].jobs);
+    }
+    if(p->dir[d].wake_fd >= 0)
+      close(p->dir[d].wake_fd);
+  }
+
+  free(p);
+  eee->pipeline = NULL;
+}
+
+#endif /* N2N_HAVE_PIPELINE */
+
+/* ************************************** */
+
 #ifdef __linux__
 
 static uint32_t get_gateway_ip() {
@@ -2678,6 +5421,7 @@ void edge_init_conf_defaults(n2n_edge_conf_t *conf) {
 	conf->transop_id = N2N_TRANSFORM_ID_NULL;
 	conf->header_encryption = HEADER_ENCRYPTION_NONE;
 	conf->compression = N2N_COMPRESSION_ID_NONE;
+	conf->tap_queues = 1;
 	conf->drop_multicast = 1;
 	conf->allow_p2p = 1;
 	conf->disable_pmtu_discovery = 1;
@@ -2695,6 +5439,7 @@ void edge_init_conf_defaults(n2n_edge_conf_t *conf) {
 void edge_term_conf(n2n_edge_conf_t *conf) {
 	if (conf->routes) free(conf->routes);
 	if (conf->encrypt_key) free(conf->encrypt_key);
+	if (conf->zstd_dict) free(conf->zstd_dict);
 }
 
 /* ************************************** */
@@ -29,7 +29,7 @@ static const uint8_t ipv6_multicast_addr[6] = { 0x33, 0x33, 0x00, 0x00, 0x00, 0x
 
 /* ************************************** */
 
-SOCKET open_socket(int local_port, int bind_any) {
+static SOCKET open_socket_opts(int local_port, int bind_any, int reuse_port) {
   SOCKET sock_fd;
   struct sockaddr_in local_address;
   int sockopt;
@@ -47,6 +47,11 @@ SOCKET open_socket(int local_port, int bind_any) {
   sockopt = 1;
   setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, (char *)&sockopt, sizeof(sockopt));
 
+#ifdef SO_REUSEPORT
+  if(reuse_port && (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, (char *)&sockopt, sizeof(sockopt)) < 0))
+    traceEvent(TRACE_WARNING, "Unable to set SO_REUSEPORT [%s]", strerror(errno));
+#endif
+
   memset(&local_address, 0, sizeof(local_address));
   local_address.sin_family = AF_INET;
   local_address.sin_port = htons(local_port);
@@ -60,10 +65,76 @@ SOCKET open_socket(int local_port, int bind_any) {
   return(sock_fd);
 }
 
-static int traceLevel = 2 /* NORMAL */;
+SOCKET open_socket(int local_port, int bind_any) {
+  return(open_socket_opts(local_port, bind_any, 0));
+}
+
+/* Same as open_socket() but allows further sockets to bind the same port, the
+ * kernel then spreads incoming datagrams among them by flow. */
+SOCKET open_reuseport_socket(int local_port, int bind_any) {
+  return(open_socket_opts(local_port, bind_any, 1));
+}
+
+#ifdef N2N_HAVE_UDP_GSO
+/* Check whether the kernel segments UDP sends (UDP_SEGMENT, Linux 4.18+).
+ * Without it the control message would be ignored and the datagrams sent
+ * as one, so this must be known before using udp_gso_set_cmsg(). */
+int udp_gso_probe(SOCKET sock) {
+  int seg_size = 0;
+
+  return(setsockopt(sock, SOL_UDP, UDP_SEGMENT, &seg_size, sizeof(seg_size)) == 0);
+}
+
+/* Have the datagram described by msg split into seg_size sized datagrams. */
+void udp_gso_set_cmsg(struct msghdr *msg, n2n_udp_gso_cmsg_t *cmsg, uint16_t seg_size) {
+  struct cmsghdr *cm;
+
+  msg->msg_control = cmsg->buf;
+  msg->msg_controllen = sizeof(cmsg->buf);
+
+  cm = CMSG_FIRSTHDR(msg);
+  cm->cmsg_level = SOL_UDP;
+  cm->cmsg_type = UDP_SEGMENT;
+  cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+  memcpy(CMSG_DATA(cm), &seg_size, sizeof(uint16_t));
+}
+#endif
+
+#ifdef N2N_HAVE_UDP_GRO
+/* Let the kernel hand over runs of datagrams of the same flow as one
+ * (UDP_GRO, Linux 5.0+). The segment size comes with a control message. */
+int udp_gro_enable(SOCKET sock) {
+  int on = 1;
+
+  return(setsockopt(sock, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0);
+}
+#endif
+
+int traceLevel = 2 /* NORMAL */;
 static int useSyslog = 0, syslog_opened = 0;
 static FILE *traceFile = NULL;
 
+#ifdef N2N_HAVE_ASYNC_LOG
+/* Asynchronous logging: the tracing threads format the message only and
+ * queue it in a lock-free ring, a background thread adds the time stamp and
+ * writes the messages in batches. If the ring is full the message is
+ * dropped and counted. */
+typedef struct trace_record {
+  unsigned int        seq;                     /* turn of the slot, see trace_push() */
+  int                 level;
+  int                 line;
+  const char          *file;
+  time_t              time;
+  char                msg[N2N_TRACE_MSG_SIZE];
+} trace_record_t;
+
+static trace_record_t *traceRing = NULL;
+static unsigned int traceHead, traceTail;
+static unsigned int traceDrops;
+static int traceRunning = 0;
+static pthread_t traceThread;
+#endif
+
 int getTraceLevel() {
   return(traceLevel);
 }
@@ -81,6 +152,9 @@ void setTraceFile(FILE *f) {
 }
 
 void closeTraceFile() {
+#ifdef N2N_HAVE_ASYNC_LOG
+  stopTraceThread();
+#endif
   if (traceFile != NULL && traceFile != stdout) {
     fclose(traceFile);
   }
@@ -93,64 +167,207 @@ void closeTraceFile() {
 }
 
 #define N2N_TRACE_DATESIZE 32
-void traceEvent(int eventTraceLevel, char* file, int line, char * format, ...) {
-  va_list va_ap;
+/* Write a formatted message, flushing is up to the caller. */
+static void trace_write(int eventTraceLevel, const char* file, int line, time_t theTime, char *buf) {
+  char out_buf[N2N_TRACE_MSG_SIZE + 256];
+  char theDate[N2N_TRACE_DATESIZE];
+  char *extra_msg = "";
+  struct tm theTm;
+  int i;
 
   if(traceFile == NULL)
     traceFile = stdout;
 
-  if(eventTraceLevel <= traceLevel) {
-    char buf[1024];
-    char out_buf[1280];
-    char theDate[N2N_TRACE_DATESIZE];
-    char *extra_msg = "";
-    time_t theTime = time(NULL);
-    int i;
-
-    /* We have two paths - one if we're logging, one if we aren't
-     *   Note that the no-log case is those systems which don't support it(WIN32),
-     *                                those without the headers !defined(USE_SYSLOG)
-     *                                those where it's parametrically off...
-     */
-
-    memset(buf, 0, sizeof(buf));
-    strftime(theDate, N2N_TRACE_DATESIZE, "%d/%b/%Y %H:%M:%S", localtime(&theTime));
+  /* We have two paths - one if we're logging, one if we aren't
+   *   Note that the no-log case is those systems which don't support it(WIN32),
+   *                                those without the headers !defined(USE_SYSLOG)
+   *                                those where it's parametrically off...
+   */
 
-    va_start(va_ap, format);
-    vsnprintf(buf, sizeof(buf)-1, format, va_ap);
-    va_end(va_ap);
+  /* called from several threads */
+#ifndef WIN32
+  localtime_r(&theTime, &theTm);
+#else
+  theTm = *localtime(&theTime); /* thread local in the Windows CRT */
+#endif
+  strftime(theDate, N2N_TRACE_DATESIZE, "%d/%b/%Y %H:%M:%S", &theTm);
 
-    if(eventTraceLevel == 0 /* TRACE_ERROR */)
-      extra_msg = "ERROR: ";
-    else if(eventTraceLevel == 1 /* TRACE_WARNING */)
-      extra_msg = "WARNING: ";
+  if(eventTraceLevel == 0 /* TRACE_ERROR */)
+    extra_msg = "ERROR: ";
+  else if(eventTraceLevel == 1 /* TRACE_WARNING */)
+    extra_msg = "WARNING: ";
 
-    while(buf[strlen(buf)-1] == '\n') buf[strlen(buf)-1] = '\0';
+  while((buf[0] != '\0') && (buf[strlen(buf)-1] == '\n')) buf[strlen(buf)-1] = '\0';
 
 #ifndef WIN32
-    if(useSyslog) {
-      if(!syslog_opened) {
-        openlog("n2n", LOG_PID, LOG_DAEMON);
-        syslog_opened = 1;
-      }
-
-      snprintf(out_buf, sizeof(out_buf), "%s%s", extra_msg, buf);
-      syslog(LOG_INFO, "%s", out_buf);
-    } else {
-		for(i=strlen(file)-1; i>0; i--) if(file[i] == '/') { i++; break; };
-		snprintf(out_buf, sizeof(out_buf), "%s [%s:%d] %s%s", theDate, &file[i], line, extra_msg, buf);
-      fprintf(traceFile, "%s\n", out_buf);
-      fflush(traceFile);
+  if(useSyslog) {
+    if(!syslog_opened) {
+      openlog("n2n", LOG_PID, LOG_DAEMON);
+      syslog_opened = 1;
     }
-#else
-    /* this is the WIN32 code */
-    for(i=strlen(file)-1; i>0; i--) if(file[i] == '\\') { i++; break; };
+
+    snprintf(out_buf, sizeof(out_buf), "%s%s", extra_msg, buf);
+    syslog(LOG_INFO, "%s", out_buf);
+  } else {
+    for(i=strlen(file)-1; i>0; i--) if(file[i] == '/') { i++; break; };
     snprintf(out_buf, sizeof(out_buf), "%s [%s:%d] %s%s", theDate, &file[i], line, extra_msg, buf);
     fprintf(traceFile, "%s\n", out_buf);
-    fflush(traceFile);
+  }
+#else
+  /* this is the WIN32 code */
+  for(i=strlen(file)-1; i>0; i--) if(file[i] == '\\') { i++; break; };
+  snprintf(out_buf, sizeof(out_buf), "%s [%s:%d] %s%s", theDate, &file[i], line, extra_msg, buf);
+  fprintf(traceFile, "%s\n", out_buf);
 #endif
+}
+
+#ifdef N2N_HAVE_ASYNC_LOG
+/* Multi-producer ring: a slot whose seq equals the position is free to be
+ * claimed by moving the tail, seq = position + 1 marks it written. The
+ * writer thread hands it back for the next round with seq = position +
+ * N2N_TRACE_RING_SIZE. */
+static void trace_push(int eventTraceLevel, char* file, int line, char *format, va_list va_ap) {
+  unsigned int pos = __atomic_load_n(&traceTail, __ATOMIC_RELAXED);
+  trace_record_t *rec;
+  int diff;
+
+  while(1) {
+    rec = &traceRing[pos & (N2N_TRACE_RING_SIZE - 1)];
+    diff = (int)(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) - pos);
+
+    if(diff == 0) {
+      if(__atomic_compare_exchange_n(&traceTail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if(diff < 0) {
+      /* full, the writer is behind: do not wait for it */
+      __atomic_add_fetch(&traceDrops, 1, __ATOMIC_RELAXED);
+      return;
+    } else
+      pos = __atomic_load_n(&traceTail, __ATOMIC_RELAXED);
   }
 
+  rec->level = eventTraceLevel;
+  rec->file = file;
+  rec->line = line;
+  rec->time = time(NULL);
+  vsnprintf(rec->msg, sizeof(rec->msg), format, va_ap);
+
+  __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* Write the queued messages, returns their number. */
+static unsigned int trace_drain(unsigned int *reported_drops) {
+  unsigned int num = 0, drops;
+  trace_record_t *rec;
+  char buf[64];
+
+  while(1) {
+    rec = &traceRing[traceHead & (N2N_TRACE_RING_SIZE - 1)];
+    if(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != traceHead + 1)
+      break;
+
+    trace_write(rec->level, rec->file, rec->line, rec->time, rec->msg);
+    __atomic_store_n(&rec->seq, traceHead + N2N_TRACE_RING_SIZE, __ATOMIC_RELEASE);
+    traceHead++;
+    num++;
+  }
+
+  drops = __atomic_load_n(&traceDrops, __ATOMIC_RELAXED);
+  if(drops != *reported_drops) {
+    snprintf(buf, sizeof(buf), "%u log messages dropped", drops - *reported_drops);
+    trace_write(1 /* TRACE_WARNING */, __FILE__, __LINE__, time(NULL), buf);
+    *reported_drops = drops;
+    num++;
+  }
+
+  if(num && !useSyslog)
+    fflush(traceFile);
+
+  return(num);
+}
+
+static void* trace_thread(void *arg) {
+  struct timespec idle = { 0, 10 * 1000 * 1000 };
+  unsigned int reported_drops = 0;
+
+  while(__atomic_load_n(&traceRunning, __ATOMIC_ACQUIRE)) {
+    if(!trace_drain(&reported_drops))
+      nanosleep(&idle, NULL);
+  }
+
+  trace_drain(&reported_drops);
+
+  return(NULL);
+}
+
+/** Write the log from a background thread from now on. Must be called
+ *  after daemonizing, as fork() does not take the thread along. */
+int startTraceThread() {
+  unsigned int i;
+
+  if(traceRunning)
+    return(0);
+
+  /* allocated once and kept, see stopTraceThread() */
+  if((traceRing == NULL)
+     && ((traceRing = (trace_record_t*)calloc(N2N_TRACE_RING_SIZE, sizeof(trace_record_t))) == NULL))
+    return(-1);
+
+  for(i = 0; i < N2N_TRACE_RING_SIZE; i++)
+    traceRing[i].seq = i;
+  traceHead = traceTail = traceDrops = 0;
+
+  traceRunning = 1;
+  if(pthread_create(&traceThread, NULL, trace_thread, NULL) != 0) {
+    traceRunning = 0;
+    return(-1);
+  }
+
+  return(0);
+}
+
+/** Write out the queued messages and log synchronously again. The ring is
+ *  not freed: threads still running may have seen traceRunning set and be
+ *  about to push, their messages are lost but the memory stays valid. */
+void stopTraceThread() {
+  if(!traceRunning)
+    return;
+
+  __atomic_store_n(&traceRunning, 0, __ATOMIC_RELEASE);
+  pthread_join(traceThread, NULL);
+}
+
+/** Number of messages dropped as the background thread fell behind. */
+unsigned int getTraceDrops() {
+  return(__atomic_load_n(&traceDrops, __ATOMIC_RELAXED));
+}
+#endif
+
+void _traceEvent(int eventTraceLevel, char* file, int line, char * format, ...) {
+  va_list va_ap;
+
+  if(eventTraceLevel <= traceLevel) {
+    char buf[N2N_TRACE_MSG_SIZE];
+
+#ifdef N2N_HAVE_ASYNC_LOG
+    if(__atomic_load_n(&traceRunning, __ATOMIC_ACQUIRE)) {
+      va_start(va_ap, format);
+      trace_push(eventTraceLevel, file, line, format, va_ap);
+      va_end(va_ap);
+      return;
+    }
+#endif
+
+    va_start(va_ap, format);
+    vsnprintf(buf, sizeof(buf), format, va_ap);
+    va_end(va_ap);
+
+    trace_write(eventTraceLevel, file, line, time(NULL), buf);
+#ifndef WIN32
+    if(!useSyslog)
+#endif
+      fflush(traceFile);
+  }
 }
 
 /* *********************************************** */
@@ -269,6 +486,60 @@ void hexdump(const uint8_t *buf, size_t len) {
 }
 
 
+/* *********************************************** */
+
+/** The n2n_transform_f API on top of the in-place transforms: the payload is
+ *  copied into a buffer with headroom and tailroom and back out. */
+int n2n_transop_fwd_shim(n2n_trans_op_t *arg, uint8_t *outbuf, size_t out_len,
+                         const uint8_t *inbuf, size_t in_len, const n2n_mac_t peer_mac) {
+  uint8_t assembly[N2N_TRANSFORM_HEADROOM + N2N_PKT_BUF_SIZE + N2N_TRANSFORM_TAILROOM];
+  uint8_t *buf = assembly + N2N_TRANSFORM_HEADROOM;
+  int len;
+
+  if(in_len > N2N_PKT_BUF_SIZE) {
+    traceEvent(TRACE_ERROR, "transop %u: inbuf too big to encode", arg->transform_id);
+    return(-1);
+  }
+
+  memcpy(buf, inbuf, in_len);
+  if((len = arg->fwd_inplace(arg, &buf, in_len, NULL, 0, peer_mac)) < 0)
+    return(-1);
+
+  if(len > out_len) {
+    traceEvent(TRACE_ERROR, "transop %u: outbuf too small", arg->transform_id);
+    return(-1);
+  }
+
+  memcpy(outbuf, buf, len);
+  return(len);
+}
+
+/* *********************************************** */
+
+int n2n_transop_rev_shim(n2n_trans_op_t *arg, uint8_t *outbuf, size_t out_len,
+                         const uint8_t *inbuf, size_t in_len, const n2n_mac_t peer_mac) {
+  uint8_t assembly[N2N_PKT_BUF_SIZE];
+  uint8_t *buf = assembly;
+  int len;
+
+  if(in_len > N2N_PKT_BUF_SIZE) {
+    traceEvent(TRACE_ERROR, "transop %u: inbuf too big to decode", arg->transform_id);
+    return(-1);
+  }
+
+  memcpy(buf, inbuf, in_len);
+  if((len = arg->rev_inplace(arg, &buf, in_len, NULL, 0, peer_mac)) < 0)
+    return(-1);
+
+  if(len > out_len) {
+    traceEvent(TRACE_ERROR, "transop %u: outbuf too small", arg->transform_id);
+    return(-1);
+  }
+
+  memcpy(outbuf, buf, len);
+  return(len);
+}
+
 /* *********************************************** */
 
 void print_n2n_version() {
@@ -437,20 +708,79 @@ int gettimeofday(struct timeval *tp, void *tzp) {
 }
 #endif
 
+/* *********************************************** */
+
+/* Coarse clock: the event loops refresh it once per iteration with
+ * n2n_clock_update(), the packet paths read the cached values. It is
+ * shared by all threads, each loop refreshing it keeps it current; until
+ * the first refresh the readers get the actual time. */
+static time_t clock_sec = 0;
+static uint64_t clock_usec = 0;
+
+#ifdef __GNUC__
+/* untorn on 32-bit platforms as well */
+#define CLOCK_LOAD(v)           __atomic_load_n(&(v), __ATOMIC_RELAXED)
+#define CLOCK_STORE(v, x)       __atomic_store_n(&(v), (x), __ATOMIC_RELAXED)
+#else
+#define CLOCK_LOAD(v)           (v)
+#define CLOCK_STORE(v, x)       ((v) = (x))
+#endif
+
+static uint64_t clock_read(void) {
+#ifdef CLOCK_REALTIME_COARSE
+  struct timespec ts;
+
+  /* served from the vDSO, at the resolution of the scheduler tick */
+  if(clock_gettime(CLOCK_REALTIME_COARSE, &ts) == 0)
+    return((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#endif
+  {
+    struct timeval tod;
+
+    gettimeofday(&tod, NULL);
+    return((uint64_t)tod.tv_sec * 1000000 + tod.tv_usec);
+  }
+}
+
+/** Refresh the cached time, returns its seconds. */
+time_t n2n_clock_update(void) {
+  uint64_t usec = clock_read();
+  time_t sec = usec / 1000000;
+
+  CLOCK_STORE(clock_usec, usec);
+  CLOCK_STORE(clock_sec, sec);
+
+  return(sec);
+}
+
+/** Seconds since 1970, as of the last refresh. */
+time_t n2n_now(void) {
+  time_t sec = CLOCK_LOAD(clock_sec);
+
+  return(sec ? sec : (time_t)(clock_read() / 1000000));
+}
+
+/** Microseconds since 1970, as of the last refresh. */
+uint64_t n2n_now_usec(void) {
+  uint64_t usec = CLOCK_LOAD(clock_usec);
+
+  return(usec ? usec : clock_read());
+}
+
+/* *********************************************** */
 
 // returns a time stamp for use with replay protection
 uint64_t time_stamp (void) {
 
-  struct timeval tod;
+  uint64_t now = n2n_now_usec();
   uint64_t micro_seconds;
 
-  gettimeofday (&tod, NULL);
   /* We will (roughly) calculate the microseconds since 1970 leftbound into the return value.
      The leading 32 bits are used for tv_sec. The following 20 bits (sufficent as microseconds
      fraction never exceeds 1,000,000,) encode the value tv_usec. The remaining lowest 12 bits
      are kept random for use in IV */
   micro_seconds = n2n_rand();
-  micro_seconds = ( (((uint64_t)(tod.tv_sec) << 32) + (tod.tv_usec << 12))
+  micro_seconds = ( (((now / 1000000) << 32) + ((now % 1000000) << 12))
                   |  (micro_seconds >> 52) );
   // more exact but more costly due to the multiplication:
   // micro_seconds = (tod.tv_sec * 1000000 + tod.tv_usec) << 12) | ...
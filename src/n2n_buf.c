@@ -0,0 +1,221 @@
+/**
+ * (C) 2007-20 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/* Packet buffer pool. The buffers are allocated in one block at start-up;
+ * each thread takes them from its own n2n_buf_cache_t, which exchanges
+ * half of its capacity with the pool when it runs empty or full. Only if
+ * the pool itself runs dry a buffer is allocated on demand, it is freed
+ * again when put and counted in heap_allocs. */
+
+#include "n2n.h"
+
+#ifdef N2N_HAVE_TAP_MQ
+#define POOL_LOCK(pool)         pthread_mutex_lock(&(pool)->lock)
+#define POOL_UNLOCK(pool)       pthread_mutex_unlock(&(pool)->lock)
+#else
+#define POOL_LOCK(pool)
+#define POOL_UNLOCK(pool)
+#endif
+
+#define BUF_ALIGN(mem)          ((n2n_buf_t*)(((uintptr_t)(mem) + N2N_CACHE_LINE_SIZE - 1) \
+                                              & ~(uintptr_t)(N2N_CACHE_LINE_SIZE - 1)))
+
+/* ********************************** */
+
+n2n_buf_pool_t* n2n_buf_pool_create(unsigned int num_bufs) {
+  n2n_buf_pool_t *pool;
+  n2n_buf_t *bufs;
+  unsigned int i;
+
+  if((pool = (n2n_buf_pool_t*)calloc(1, sizeof(n2n_buf_pool_t))) == NULL)
+    return(NULL);
+
+  if((pool->mem = malloc(num_bufs * sizeof(n2n_buf_t) + N2N_CACHE_LINE_SIZE)) == NULL) {
+    free(pool);
+    return(NULL);
+  }
+
+  bufs = BUF_ALIGN(pool->mem);
+  for(i = 0; i < num_bufs; i++) {
+    bufs[i].mem = NULL;
+    bufs[i].next = pool->free;
+    pool->free = &bufs[i];
+  }
+  pool->num_free = pool->num_bufs = num_bufs;
+
+#ifdef N2N_HAVE_TAP_MQ
+  pthread_mutex_init(&pool->lock, NULL);
+#endif
+
+  return(pool);
+}
+
+/* ********************************** */
+
+/** The buffers must have been put and the caches flushed. */
+void n2n_buf_pool_destroy(n2n_buf_pool_t *pool) {
+  if(!pool)
+    return;
+
+  if(pool->num_free != pool->num_bufs)
+    traceEvent(TRACE_DEBUG, "%u packet buffers still in use", pool->num_bufs - pool->num_free);
+
+#ifdef N2N_HAVE_TAP_MQ
+  pthread_mutex_destroy(&pool->lock);
+#endif
+  free(pool->mem);
+  free(pool);
+}
+
+/* ********************************** */
+
+void n2n_buf_cache_init(n2n_buf_cache_t *cache, n2n_buf_pool_t *pool) {
+  cache->pool = pool;
+  cache->free = NULL;
+  cache->num_free = 0;
+}
+
+/* ********************************** */
+
+/** Hand all but keep buffers of a cache back to the pool. */
+static void buf_cache_spill(n2n_buf_cache_t *cache, unsigned int keep) {
+  n2n_buf_t *first, *last;
+  unsigned int num;
+
+  if(cache->num_free <= keep)
+    return;
+
+  num = cache->num_free - keep;
+  first = last = cache->free;
+  while(--num > 0)
+    last = last->next;
+
+  cache->free = last->next;
+  num = cache->num_free - keep;
+  cache->num_free = keep;
+
+  POOL_LOCK(cache->pool);
+  last->next = cache->pool->free;
+  cache->pool->free = first;
+  cache->pool->num_free += num;
+  POOL_UNLOCK(cache->pool);
+}
+
+/* ********************************** */
+
+void n2n_buf_cache_flush(n2n_buf_cache_t *cache) {
+  if(cache->pool)
+    buf_cache_spill(cache, 0);
+}
+
+/* ********************************** */
+
+/** Take up to half of the cache capacity from the pool, or allocate a
+ *  single buffer if the pool is empty. */
+static n2n_buf_t* buf_cache_refill(n2n_buf_cache_t *cache) {
+  n2n_buf_pool_t *pool = cache->pool;
+  n2n_buf_t *buf;
+  void *mem;
+
+  POOL_LOCK(pool);
+  while((cache->num_free < N2N_BUF_CACHE_SIZE / 2) && ((buf = pool->free) != NULL)) {
+    pool->free = buf->next;
+    pool->num_free--;
+    buf->next = cache->free;
+    cache->free = buf;
+    cache->num_free++;
+  }
+  if(!cache->free)
+    pool->heap_allocs++;
+  POOL_UNLOCK(pool);
+
+  if(cache->free)
+    return(cache->free);
+
+  if((mem = malloc(sizeof(n2n_buf_t) + N2N_CACHE_LINE_SIZE)) == NULL)
+    return(NULL);
+
+  buf = BUF_ALIGN(mem);
+  buf->mem = mem;
+  buf->next = NULL;
+  cache->free = buf;
+  cache->num_free = 1;
+
+  return(buf);
+}
+
+/* ********************************** */
+
+/** Get a buffer with a single reference, NULL if out of memory. */
+n2n_buf_t* n2n_buf_get(n2n_buf_cache_t *cache) {
+  n2n_buf_t *buf = cache->free;
+
+  if(!buf && ((buf = buf_cache_refill(cache)) == NULL)) {
+    traceEvent(TRACE_ERROR, "Cannot allocate a packet buffer");
+    return(NULL);
+  }
+
+  cache->free = buf->next;
+  cache->num_free--;
+  buf->next = NULL;
+  buf->refcnt = 1;
+
+  return(buf);
+}
+
+/* ********************************** */
+
+/** Add a reference, e.g. when handing the buffer to another thread. */
+n2n_buf_t* n2n_buf_ref(n2n_buf_t *buf) {
+#ifdef N2N_HAVE_TAP_MQ
+  __atomic_add_fetch(&buf->refcnt, 1, __ATOMIC_RELAXED);
+#else
+  buf->refcnt++;
+#endif
+
+  return(buf);
+}
+
+/* ********************************** */
+
+/** Drop a reference, the last one returns the buffer to the cache of the
+ *  calling thread. */
+void n2n_buf_put(n2n_buf_cache_t *cache, n2n_buf_t *buf) {
+  if(!buf)
+    return;
+
+#ifdef N2N_HAVE_TAP_MQ
+  if(__atomic_sub_fetch(&buf->refcnt, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+#else
+  if(--buf->refcnt > 0)
+    return;
+#endif
+
+  if(buf->mem) {
+    free(buf->mem);
+    return;
+  }
+
+  buf->next = cache->free;
+  cache->free = buf;
+  cache->num_free++;
+
+  if(cache->num_free > N2N_BUF_CACHE_SIZE)
+    buf_cache_spill(cache, N2N_BUF_CACHE_SIZE / 2);
+}
@@ -0,0 +1,161 @@
+/**
+ * (C) 2007-20 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/* Destination cache of the edge. The entries live in buckets of one cache
+ * line; a MAC goes to its home bucket or, if that one is full, to the next
+ * one. A lookup always checks both, so an entry can simply be cleared on
+ * removal. If both are full an entry of the home bucket is replaced, the
+ * peer then takes the slow path through known_peers until it is inserted
+ * again. The last few hits are remembered in front of the table. */
+
+#include "n2n.h"
+
+#define CACHE_MASK              (N2N_PEER_CACHE_BUCKETS - 1)
+#define CACHE_ALIGN(mem)        ((n2n_peer_cache_entry_t*)(((uintptr_t)(mem) + N2N_CACHE_LINE_SIZE - 1) \
+                                                           & ~(uintptr_t)(N2N_CACHE_LINE_SIZE - 1)))
+
+/* ********************************** */
+
+static inline unsigned int peer_cache_bucket(const n2n_mac_t mac) {
+  uint32_t hi = ((uint32_t)mac[0] << 8) | mac[1];
+  uint32_t lo = ((uint32_t)mac[2] << 24) | ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | mac[5];
+
+  /* Fibonacci hashing, the upper bits are the well mixed ones */
+  return((((lo ^ (hi * 0x85ebca6bu)) * 0x9e3779b1u) >> 16) & CACHE_MASK);
+}
+
+/* ********************************** */
+
+static inline n2n_peer_cache_entry_t* peer_cache_lookup(n2n_peer_cache_t *cache, const n2n_mac_t mac,
+                                                         unsigned int bucket) {
+  n2n_peer_cache_entry_t *e;
+  unsigned int i, j;
+
+  for(i = 0; i < 2; i++) {
+    e = &cache->slots[((bucket + i) & CACHE_MASK) * N2N_PEER_CACHE_WAYS];
+    for(j = 0; j < N2N_PEER_CACHE_WAYS; j++, e++)
+      if(e->used && !memcmp(e->mac, mac, N2N_MAC_SIZE))
+        return(e);
+  }
+
+  return(NULL);
+}
+
+/* ********************************** */
+
+n2n_peer_cache_t* n2n_peer_cache_create(void) {
+  n2n_peer_cache_t *cache;
+  size_t size = N2N_PEER_CACHE_BUCKETS * N2N_CACHE_LINE_SIZE;
+
+  if((cache = (n2n_peer_cache_t*)calloc(1, sizeof(n2n_peer_cache_t))) == NULL)
+    return(NULL);
+
+  if((cache->mem = malloc(size + N2N_CACHE_LINE_SIZE)) == NULL) {
+    free(cache);
+    return(NULL);
+  }
+
+  cache->slots = CACHE_ALIGN(cache->mem);
+  memset(cache->slots, 0, size);
+
+  return(cache);
+}
+
+/* ********************************** */
+
+void n2n_peer_cache_destroy(n2n_peer_cache_t *cache) {
+  if(!cache)
+    return;
+
+  free(cache->mem);
+  free(cache);
+}
+
+/* ********************************** */
+
+void n2n_peer_cache_clear(n2n_peer_cache_t *cache) {
+  memset(cache->slots, 0, N2N_PEER_CACHE_BUCKETS * N2N_CACHE_LINE_SIZE);
+  memset(cache->front, 0, sizeof(cache->front));
+}
+
+/* ********************************** */
+
+/** The entry of mac, NULL if it is not cached. It is valid until the next
+ *  change of the cache. */
+const n2n_peer_cache_entry_t* n2n_peer_cache_find(n2n_peer_cache_t *cache, const n2n_mac_t mac) {
+  n2n_peer_cache_entry_t *e;
+  unsigned int i;
+
+  for(i = 0; i < N2N_PEER_CACHE_FRONT; i++) {
+    e = cache->front[i];
+    if(e && e->used && !memcmp(e->mac, mac, N2N_MAC_SIZE))
+      return(e);
+  }
+
+  if((e = peer_cache_lookup(cache, mac, peer_cache_bucket(mac))) != NULL) {
+    cache->front[cache->front_next] = e;
+    cache->front_next = (cache->front_next + 1) % N2N_PEER_CACHE_FRONT;
+  }
+
+  return(e);
+}
+
+/* ********************************** */
+
+/** Add or update the destination of a peer. */
+void n2n_peer_cache_set(n2n_peer_cache_t *cache, const n2n_mac_t mac, const n2n_sock_t *sock, uint32_t expires) {
+  unsigned int bucket = peer_cache_bucket(mac);
+  n2n_peer_cache_entry_t *e, *free_e = NULL;
+  unsigned int i, j;
+
+  if((e = peer_cache_lookup(cache, mac, bucket)) == NULL) {
+    for(i = 0; (i < 2) && !free_e; i++) {
+      e = &cache->slots[((bucket + i) & CACHE_MASK) * N2N_PEER_CACHE_WAYS];
+      for(j = 0; j < N2N_PEER_CACHE_WAYS; j++, e++)
+        if(!e->used) {
+          free_e = e;
+          break;
+        }
+    }
+
+    /* Both buckets are full: replace the entry of the home bucket that
+     * expires first */
+    if(!free_e) {
+      e = free_e = &cache->slots[bucket * N2N_PEER_CACHE_WAYS];
+      for(j = 1; j < N2N_PEER_CACHE_WAYS; j++)
+        if((int32_t)(e[j].expires - free_e->expires) < 0)
+          free_e = &e[j];
+    }
+
+    e = free_e;
+    memcpy(e->mac, mac, N2N_MAC_SIZE);
+    e->used = 1;
+  }
+
+  e->sock = *sock;
+  e->expires = expires;
+}
+
+/* ********************************** */
+
+void n2n_peer_cache_del(n2n_peer_cache_t *cache, const n2n_mac_t mac) {
+  n2n_peer_cache_entry_t *e;
+
+  if((e = peer_cache_lookup(cache, mac, peer_cache_bucket(mac))) != NULL)
+    e->used = 0;
+}
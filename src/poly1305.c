@@ -0,0 +1,527 @@
+/**
+ * (C) 2007-20 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+// poly1305 one-time authenticator (RFC 8439)
+// the scalar parts follow poly1305-donna by Andrew Moon (public domain)
+
+
+#include <string.h>
+
+#include "poly1305.h"
+
+
+static inline uint32_t load32_le (const uint8_t *p) {
+
+  return ((uint32_t)p[0]) | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static inline void store32_le (uint8_t *p, uint32_t v) {
+
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+
+#if defined (__SIZEOF_INT128__) // 64-bit --------------------------------------------------
+
+
+typedef unsigned __int128 uint128_t;
+
+#define M44    0xfffffffffffULL
+#define M42    0x3ffffffffffULL
+
+
+static inline uint64_t load64_le (const uint8_t *p) {
+
+  return ((uint64_t)load32_le(p)) | ((uint64_t)load32_le(p + 4) << 32);
+}
+
+
+static inline void store64_le (uint8_t *p, uint64_t v) {
+
+  store32_le(p, (uint32_t)v); store32_le(p + 4, (uint32_t)(v >> 32));
+}
+
+
+void poly1305_init (poly1305_context_t *ctx, const uint8_t *key) {
+
+  uint64_t t0 = load64_le(key), t1 = load64_le(key + 8);
+
+  // r &= 0xffffffc0ffffffc0ffffffc0fffffff
+  ctx->r[0] = ( t0                    ) & 0xffc0fffffffULL;
+  ctx->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+  ctx->r[2] = ((t1 >> 24)             ) & 0x00ffffffc0fULL;
+
+  ctx->h[0] = ctx->h[1] = ctx->h[2] = 0;
+
+  ctx->pad[0] = load64_le(key + 16);
+  ctx->pad[1] = load64_le(key + 24);
+
+#if defined (__AVX2__)
+  ctx->rn_ready = 0;
+#endif
+  ctx->leftover = 0;
+}
+
+
+static void poly1305_blocks_scalar (poly1305_context_t *ctx, const uint8_t *m, size_t len, uint64_t hibit) {
+
+  const uint64_t r0 = ctx->r[0], r1 = ctx->r[1], r2 = ctx->r[2];
+  const uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+  uint64_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2];
+  uint64_t t0, t1, c;
+  uint128_t d0, d1, d2;
+
+  while(len >= POLY1305_BLOCK_SIZE) {
+    t0 = load64_le(m);
+    t1 = load64_le(m + 8);
+
+    h0 += ( t0                    ) & M44;
+    h1 += ((t0 >> 44) | (t1 << 20)) & M44;
+    h2 += (((t1 >> 24)            ) & M42) | hibit;
+
+    // h *= r (mod 2^130 - 5), partially reduced
+    d0 = (uint128_t)h0 * r0 + (uint128_t)h1 * s2 + (uint128_t)h2 * s1;
+    d1 = (uint128_t)h0 * r1 + (uint128_t)h1 * r0 + (uint128_t)h2 * s2;
+    d2 = (uint128_t)h0 * r2 + (uint128_t)h1 * r1 + (uint128_t)h2 * r0;
+
+                      c = (uint64_t)(d0 >> 44); h0 = (uint64_t)d0 & M44;
+    d1 += c;          c = (uint64_t)(d1 >> 44); h1 = (uint64_t)d1 & M44;
+    d2 += c;          c = (uint64_t)(d2 >> 42); h2 = (uint64_t)d2 & M42;
+    h0 += c * 5;      c = h0 >> 44;             h0 &= M44;
+    h1 += c;
+
+    m += POLY1305_BLOCK_SIZE;
+    len -= POLY1305_BLOCK_SIZE;
+  }
+
+  ctx->h[0] = h0; ctx->h[1] = h1; ctx->h[2] = h2;
+}
+
+
+#if defined (__AVX2__) // --- AVX2
+
+
+// four lanes of 26-bit limbs: lane i takes every fourth block and is
+// multiplied by r^4 per step, the lanes finally by r^4, r^3, r^2, r^1
+// before being summed up
+
+#define M26               0x3ffffff
+#define POLY1305_AVX2_MIN 256           // below, the setup of r^2..r^4 does not pay off
+
+
+// out = a * b (mod 2^130 - 5), partially reduced
+static void poly1305_mul (uint64_t *out, const uint64_t *a, const uint64_t *b) {
+
+  const uint64_t s1 = b[1] * (5 << 2), s2 = b[2] * (5 << 2);
+  uint128_t d0, d1, d2;
+  uint64_t c;
+
+  d0 = (uint128_t)a[0] * b[0] + (uint128_t)a[1] * s2 + (uint128_t)a[2] * s1;
+  d1 = (uint128_t)a[0] * b[1] + (uint128_t)a[1] * b[0] + (uint128_t)a[2] * s2;
+  d2 = (uint128_t)a[0] * b[2] + (uint128_t)a[1] * b[1] + (uint128_t)a[2] * b[0];
+
+                        c = (uint64_t)(d0 >> 44); out[0] = (uint64_t)d0 & M44;
+  d1 += c;              c = (uint64_t)(d1 >> 44); out[1] = (uint64_t)d1 & M44;
+  d2 += c;              c = (uint64_t)(d2 >> 42); out[2] = (uint64_t)d2 & M42;
+  out[0] += c * 5;      c = out[0] >> 44;         out[0] &= M44;
+  out[1] += c;
+}
+
+
+
+// 44/44/42-bit limbs to 26-bit limbs, the top one may exceed 26 bits
+static void poly1305_to_26 (uint32_t *l, const uint64_t *h) {
+
+  uint64_t h0 = h[0], h1 = h[1], h2 = h[2], c;
+
+  c = h0 >> 44; h0 &= M44; h1 += c;
+  c = h1 >> 44; h1 &= M44; h2 += c;
+
+  l[0] = ( h0                    ) & M26;
+  l[1] = ((h0 >> 26) | (h1 << 18)) & M26;
+  l[2] = ( h1 >>  8              ) & M26;
+  l[3] = ((h1 >> 34) | (h2 << 10)) & M26;
+  l[4] = ( h2 >> 16              );
+}
+
+
+// 26-bit limbs back to 44/44/42-bit limbs, the top one may exceed 42 bits
+static void poly1305_from_26 (uint64_t *h, uint64_t *l) {
+
+  uint64_t c;
+
+  c = l[0] >> 26; l[0] &= M26; l[1] += c;
+  c = l[1] >> 26; l[1] &= M26; l[2] += c;
+  c = l[2] >> 26; l[2] &= M26; l[3] += c;
+  c = l[3] >> 26; l[3] &= M26; l[4] += c;
+  c = l[4] >> 26; l[4] &= M26; l[0] += c * 5;
+  c = l[0] >> 26; l[0] &= M26; l[1] += c;
+
+  h[0] = ( l[0]       | (l[1] << 26)                ) & M44;
+  h[1] = ((l[1] >> 18) | (l[2] << 8) | (l[3] << 34)) & M44;
+  h[2] = ( l[3] >> 10) | (l[4] << 16);
+}
+
+
+static void poly1305_setup_avx2 (poly1305_context_t *ctx) {
+
+  uint64_t r2[3], r3[3], r4[3];
+
+  poly1305_mul(r2, ctx->r, ctx->r);
+  poly1305_mul(r3, r2, ctx->r);
+  poly1305_mul(r4, r3, ctx->r);
+
+  poly1305_to_26(ctx->rn[0], r4);
+  poly1305_to_26(ctx->rn[1], r3);
+  poly1305_to_26(ctx->rn[2], r2);
+  poly1305_to_26(ctx->rn[3], ctx->r);
+
+  ctx->rn_ready = 1;
+}
+
+
+// h = h * r, r and s = 5 * r per lane
+static inline void poly1305_mul_avx2 (__m256i *h, const __m256i *r, const __m256i *s) {
+
+  const __m256i mask = _mm256_set1_epi64x(M26);
+  __m256i d0, d1, d2, d3, d4, c;
+
+#define MUL(a,b) _mm256_mul_epu32(a, b)
+  d0 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(MUL(h[0], r[0]), MUL(h[1], s[4])),
+                                         _mm256_add_epi64(MUL(h[2], s[3]), MUL(h[3], s[2]))), MUL(h[4], s[1]));
+  d1 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(MUL(h[0], r[1]), MUL(h[1], r[0])),
+                                         _mm256_add_epi64(MUL(h[2], s[4]), MUL(h[3], s[3]))), MUL(h[4], s[2]));
+  d2 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(MUL(h[0], r[2]), MUL(h[1], r[1])),
+                                         _mm256_add_epi64(MUL(h[2], r[0]), MUL(h[3], s[4]))), MUL(h[4], s[3]));
+  d3 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(MUL(h[0], r[3]), MUL(h[1], r[2])),
+                                         _mm256_add_epi64(MUL(h[2], r[1]), MUL(h[3], r[0]))), MUL(h[4], s[4]));
+  d4 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(MUL(h[0], r[4]), MUL(h[1], r[3])),
+                                         _mm256_add_epi64(MUL(h[2], r[2]), MUL(h[3], r[1]))), MUL(h[4], r[0]));
+#undef MUL
+
+  c = _mm256_srli_epi64(d0, 26); d0 = _mm256_and_si256(d0, mask); d1 = _mm256_add_epi64(d1, c);
+  c = _mm256_srli_epi64(d1, 26); d1 = _mm256_and_si256(d1, mask); d2 = _mm256_add_epi64(d2, c);
+  c = _mm256_srli_epi64(d2, 26); d2 = _mm256_and_si256(d2, mask); d3 = _mm256_add_epi64(d3, c);
+  c = _mm256_srli_epi64(d3, 26); d3 = _mm256_and_si256(d3, mask); d4 = _mm256_add_epi64(d4, c);
+  c = _mm256_srli_epi64(d4, 26); d4 = _mm256_and_si256(d4, mask);
+  d0 = _mm256_add_epi64(d0, _mm256_add_epi64(c, _mm256_slli_epi64(c, 2)));
+  c = _mm256_srli_epi64(d0, 26); d0 = _mm256_and_si256(d0, mask); d1 = _mm256_add_epi64(d1, c);
+
+  h[0] = d0; h[1] = d1; h[2] = d2; h[3] = d3; h[4] = d4;
+}
+
+
+// four blocks, one per lane, split into 26-bit limbs
+static inline void poly1305_load_avx2 (__m256i *t, const uint8_t *m) {
+
+  const __m256i mask = _mm256_set1_epi64x(M26);
+  const __m256i hibit = _mm256_set1_epi64x(1 << 24);
+  __m256i a = _mm256_loadu_si256((const __m256i*)m);
+  __m256i b = _mm256_loadu_si256((const __m256i*)(m + 32));
+  __m256i lo = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+  __m256i hi = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+
+  t[0] = _mm256_and_si256(lo, mask);
+  t[1] = _mm256_and_si256(_mm256_srli_epi64(lo, 26), mask);
+  t[2] = _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(lo, 52), _mm256_slli_epi64(hi, 12)), mask);
+  t[3] = _mm256_and_si256(_mm256_srli_epi64(hi, 14), mask);
+  t[4] = _mm256_or_si256(_mm256_srli_epi64(hi, 40), hibit);
+}
+
+
+// len is a multiple of 64
+static void poly1305_blocks_avx2 (poly1305_context_t *ctx, const uint8_t *m, size_t len) {
+
+  __m256i h[5], t[5], r[5], s[5];
+  uint32_t h26[5];
+  uint64_t l[5], lanes[4];
+  int i;
+
+  if(!ctx->rn_ready)
+    poly1305_setup_avx2(ctx);
+
+  for(i = 0; i < 5; i++) {
+    r[i] = _mm256_set1_epi64x(ctx->rn[0][i]);
+    s[i] = _mm256_set1_epi64x(ctx->rn[0][i] * 5);
+  }
+
+  // the current state joins the first lane
+  poly1305_to_26(h26, ctx->h);
+  poly1305_load_avx2(h, m);
+  for(i = 0; i < 5; i++)
+    h[i] = _mm256_add_epi64(h[i], _mm256_set_epi64x(0, 0, 0, h26[i]));
+  m += 64;
+  len -= 64;
+
+  while(len >= 64) {
+    poly1305_mul_avx2(h, r, s);
+    poly1305_load_avx2(t, m);
+    for(i = 0; i < 5; i++)
+      h[i] = _mm256_add_epi64(h[i], t[i]);
+    m += 64;
+    len -= 64;
+  }
+
+  for(i = 0; i < 5; i++) {
+    r[i] = _mm256_set_epi64x(ctx->rn[3][i], ctx->rn[2][i], ctx->rn[1][i], ctx->rn[0][i]);
+    s[i] = _mm256_set_epi64x(ctx->rn[3][i] * 5, ctx->rn[2][i] * 5, ctx->rn[1][i] * 5, ctx->rn[0][i] * 5);
+  }
+  poly1305_mul_avx2(h, r, s);
+
+  for(i = 0; i < 5; i++) {
+    _mm256_storeu_si256((__m256i*)lanes, h[i]);
+    l[i] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+  poly1305_from_26(ctx->h, l);
+}
+
+
+#endif // --- AVX2
+
+
+static void poly1305_blocks (poly1305_context_t *ctx, const uint8_t *m, size_t len) {
+
+#if defined (__AVX2__)
+  size_t n;
+
+  if(len >= POLY1305_AVX2_MIN) {
+    n = len & ~(size_t)63;
+    poly1305_blocks_avx2(ctx, m, n);
+    m += n;
+    len -= n;
+  }
+#endif
+
+  poly1305_blocks_scalar(ctx, m, len, (uint64_t)1 << 40);
+}
+
+
+void poly1305_finish (poly1305_context_t *ctx, uint8_t *tag) {
+
+  uint64_t h0, h1, h2, g0, g1, g2, c, t0, t1;
+
+  // the last, padded block
+  if(ctx->leftover) {
+    ctx->buffer[ctx->leftover++] = 1;
+    memset(ctx->buffer + ctx->leftover, 0, POLY1305_BLOCK_SIZE - ctx->leftover);
+    poly1305_blocks_scalar(ctx, ctx->buffer, POLY1305_BLOCK_SIZE, 0);
+  }
+
+  // fully carry h
+  h0 = ctx->h[0]; h1 = ctx->h[1]; h2 = ctx->h[2];
+
+               c = h1 >> 44; h1 &= M44;
+  h2 += c;     c = h2 >> 42; h2 &= M42;
+  h0 += c * 5; c = h0 >> 44; h0 &= M44;
+  h1 += c;     c = h1 >> 44; h1 &= M44;
+  h2 += c;     c = h2 >> 42; h2 &= M42;
+  h0 += c * 5; c = h0 >> 44; h0 &= M44;
+  h1 += c;
+
+  // g = h - p, taken if h >= p
+  g0 = h0 + 5; c = g0 >> 44; g0 &= M44;
+  g1 = h1 + c; c = g1 >> 44; g1 &= M44;
+  g2 = h2 + c - ((uint64_t)1 << 42);
+
+  c = (g2 >> 63) - 1;
+  g0 &= c; g1 &= c; g2 &= c;
+  c = ~c;
+  h0 = (h0 & c) | g0;
+  h1 = (h1 & c) | g1;
+  h2 = (h2 & c) | g2;
+
+  // tag = (h + pad) mod 2^128
+  t0 = ctx->pad[0];
+  t1 = ctx->pad[1];
+
+  h0 += ( t0                    ) & M44;     c = h0 >> 44; h0 &= M44;
+  h1 += (((t0 >> 44) | (t1 << 20)) & M44) + c; c = h1 >> 44; h1 &= M44;
+  h2 += (((t1 >> 24)             ) & M42) + c;               h2 &= M42;
+
+  store64_le(tag,     h0 | (h1 << 44));
+  store64_le(tag + 8, (h1 >> 20) | (h2 << 24));
+
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+
+#else // 32-bit ---------------------------------------------------------------------------
+
+
+#define M26    0x3ffffff
+
+
+void poly1305_init (poly1305_context_t *ctx, const uint8_t *key) {
+
+  // r &= 0xffffffc0ffffffc0ffffffc0fffffff
+  ctx->r[0] = (load32_le(key +  0)     ) & 0x3ffffff;
+  ctx->r[1] = (load32_le(key +  3) >> 2) & 0x3ffff03;
+  ctx->r[2] = (load32_le(key +  6) >> 4) & 0x3ffc0ff;
+  ctx->r[3] = (load32_le(key +  9) >> 6) & 0x3f03fff;
+  ctx->r[4] = (load32_le(key + 12) >> 8) & 0x00fffff;
+
+  ctx->h[0] = ctx->h[1] = ctx->h[2] = ctx->h[3] = ctx->h[4] = 0;
+
+  ctx->pad[0] = load32_le(key + 16);
+  ctx->pad[1] = load32_le(key + 20);
+  ctx->pad[2] = load32_le(key + 24);
+  ctx->pad[3] = load32_le(key + 28);
+
+  ctx->leftover = 0;
+}
+
+
+static void poly1305_blocks_scalar (poly1305_context_t *ctx, const uint8_t *m, size_t len, uint32_t hibit) {
+
+  const uint32_t r0 = ctx->r[0], r1 = ctx->r[1], r2 = ctx->r[2], r3 = ctx->r[3], r4 = ctx->r[4];
+  const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+  uint32_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2], h3 = ctx->h[3], h4 = ctx->h[4];
+  uint64_t d0, d1, d2, d3, d4;
+  uint32_t c;
+
+  while(len >= POLY1305_BLOCK_SIZE) {
+    h0 += (load32_le(m +  0)     ) & M26;
+    h1 += (load32_le(m +  3) >> 2) & M26;
+    h2 += (load32_le(m +  6) >> 4) & M26;
+    h3 += (load32_le(m +  9) >> 6) & M26;
+    h4 += (load32_le(m + 12) >> 8) | hibit;
+
+    // h *= r (mod 2^130 - 5), partially reduced
+    d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+    d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+    d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+    d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+    d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+                  c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & M26;
+    d1 += c;      c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & M26;
+    d2 += c;      c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & M26;
+    d3 += c;      c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & M26;
+    d4 += c;      c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & M26;
+    h0 += c * 5;  c = h0 >> 26;             h0 &= M26;
+    h1 += c;
+
+    m += POLY1305_BLOCK_SIZE;
+    len -= POLY1305_BLOCK_SIZE;
+  }
+
+  ctx->h[0] = h0; ctx->h[1] = h1; ctx->h[2] = h2; ctx->h[3] = h3; ctx->h[4] = h4;
+}
+
+
+static void poly1305_blocks (poly1305_context_t *ctx, const uint8_t *m, size_t len) {
+
+  poly1305_blocks_scalar(ctx, m, len, 1 << 24);
+}
+
+
+void poly1305_finish (poly1305_context_t *ctx, uint8_t *tag) {
+
+  uint32_t h0, h1, h2, h3, h4, g0, g1, g2, g3, g4, c, mask;
+  uint64_t f;
+
+  // the last, padded block
+  if(ctx->leftover) {
+    ctx->buffer[ctx->leftover++] = 1;
+    memset(ctx->buffer + ctx->leftover, 0, POLY1305_BLOCK_SIZE - ctx->leftover);
+    poly1305_blocks_scalar(ctx, ctx->buffer, POLY1305_BLOCK_SIZE, 0);
+  }
+
+  // fully carry h
+  h0 = ctx->h[0]; h1 = ctx->h[1]; h2 = ctx->h[2]; h3 = ctx->h[3]; h4 = ctx->h[4];
+
+               c = h1 >> 26; h1 &= M26;
+  h2 += c;     c = h2 >> 26; h2 &= M26;
+  h3 += c;     c = h3 >> 26; h3 &= M26;
+  h4 += c;     c = h4 >> 26; h4 &= M26;
+  h0 += c * 5; c = h0 >> 26; h0 &= M26;
+  h1 += c;
+
+  // g = h - p, taken if h >= p
+  g0 = h0 + 5; c = g0 >> 26; g0 &= M26;
+  g1 = h1 + c; c = g1 >> 26; g1 &= M26;
+  g2 = h2 + c; c = g2 >> 26; g2 &= M26;
+  g3 = h3 + c; c = g3 >> 26; g3 &= M26;
+  g4 = h4 + c - (1UL << 26);
+
+  mask = (g4 >> 31) - 1;
+  g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+  mask = ~mask;
+  h0 = (h0 & mask) | g0;
+  h1 = (h1 & mask) | g1;
+  h2 = (h2 & mask) | g2;
+  h3 = (h3 & mask) | g3;
+  h4 = (h4 & mask) | g4;
+
+  // h %= 2^128
+  h0 = ((h0      ) | (h1 << 26));
+  h1 = ((h1 >>  6) | (h2 << 20));
+  h2 = ((h2 >> 12) | (h3 << 14));
+  h3 = ((h3 >> 18) | (h4 <<  8));
+
+  // tag = (h + pad) mod 2^128
+  f = (uint64_t)h0 + ctx->pad[0];             h0 = (uint32_t)f;
+  f = (uint64_t)h1 + ctx->pad[1] + (f >> 32); h1 = (uint32_t)f;
+  f = (uint64_t)h2 + ctx->pad[2] + (f >> 32); h2 = (uint32_t)f;
+  f = (uint64_t)h3 + ctx->pad[3] + (f >> 32); h3 = (uint32_t)f;
+
+  store32_le(tag +  0, h0);
+  store32_le(tag +  4, h1);
+  store32_le(tag +  8, h2);
+  store32_le(tag + 12, h3);
+
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+
+#endif // 64-bit, 32-bit ------------------------------------------------------------------
+
+
+void poly1305_update (poly1305_context_t *ctx, const uint8_t *m, size_t len) {
+
+  size_t n;
+
+  // complete a pending block first
+  if(ctx->leftover) {
+    n = POLY1305_BLOCK_SIZE - ctx->leftover;
+    if(n > len)
+      n = len;
+    memcpy(ctx->buffer + ctx->leftover, m, n);
+    ctx->leftover += n;
+    m += n;
+    len -= n;
+    if(ctx->leftover < POLY1305_BLOCK_SIZE)
+      return;
+    poly1305_blocks(ctx, ctx->buffer, POLY1305_BLOCK_SIZE);
+    ctx->leftover = 0;
+  }
+
+  if(len >= POLY1305_BLOCK_SIZE) {
+    n = len & ~(size_t)(POLY1305_BLOCK_SIZE - 1);
+    poly1305_blocks(ctx, m, n);
+    m += n;
+    len -= n;
+  }
+
+  if(len) {
+    memcpy(ctx->buffer, m, len);
+    ctx->leftover = len;
+  }
+}
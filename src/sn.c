@@ -185,6 +185,9 @@ static void help() {
   printf("[-t <mgmt port>] ");
   printf("[-a <net-net/bit>] ");
   printf("[-v] ");
+#ifdef N2N_HAVE_ASYNC_LOG
+  printf("[-Y] ");
+#endif
   printf("\n\n");
 
   printf("-l <port>         | Set UDP main listen port to <port>\n");
@@ -200,6 +203,9 @@ static void help() {
   printf("-a <net-net/bit>  | Subnet range for auto ip address service, e.g.\n");
   printf("                  | -a 192.168.0.0-192.168.255.0/24, defaults to 10.128.255.0-10.255.255.0/24\n");
   printf("-v                | Increase verbosity. Can be used multiple times.\n");
+#ifdef N2N_HAVE_ASYNC_LOG
+  printf("-Y                | Write the log from a background thread.\n");
+#endif
   printf("-h                | This help message.\n");
   printf("\n");
 
@@ -288,6 +294,12 @@ static int setOption(int optkey, char *_optarg, n2n_sn_t *sss) {
     setTraceLevel(getTraceLevel() + 1);
     break;
 
+#ifdef N2N_HAVE_ASYNC_LOG
+  case 'Y': /* asynchronous logging */
+    sss->async_log = 1;
+    break;
+#endif
+
   default:
     traceEvent(TRACE_WARNING, "Unknown option -%c: Ignored.", (char) optkey);
     return (-1);
@@ -307,6 +319,9 @@ static const struct option long_options[] = {
 					     {"autoip",      required_argument, NULL, 'a'},
 					     {"help",        no_argument,       NULL, 'h'},
 					     {"verbose",     no_argument,       NULL, 'v'},
+#ifdef N2N_HAVE_ASYNC_LOG
+					     {"async-log",   no_argument,       NULL, 'Y'},
+#endif
 					     {NULL, 0,                          NULL, 0}
 };
 
@@ -316,7 +331,11 @@ static const struct option long_options[] = {
 static int loadFromCLI(int argc, char * const argv[], n2n_sn_t *sss) {
   u_char c;
 
-  while((c = getopt_long(argc, argv, "fl:u:g:t:a:c:vh",
+  while((c = getopt_long(argc, argv, "fl:u:g:t:a:c:vh"
+#ifdef N2N_HAVE_ASYNC_LOG
+			 "Y"
+#endif
+			 ,
 			 long_options, NULL)) != '?') {
     if(c == 255) break;
     setOption(c, optarg, sss);
@@ -508,6 +527,11 @@ int main(int argc, char * const argv[]) {
   }
 #endif /* #if defined(N2N_HAVE_DAEMON) */
 
+#ifdef N2N_HAVE_ASYNC_LOG
+  if(sss_node.async_log && (startTraceThread() != 0))
+    traceEvent(TRACE_WARNING, "Cannot start the log thread, logging synchronously");
+#endif
+
   traceEvent(TRACE_DEBUG, "traceLevel is %d", getTraceLevel());
 
   sss_node.sock = open_socket(sss_node.lport, 1 /*bind ANY*/);
@@ -558,7 +582,11 @@ int main(int argc, char * const argv[]) {
 #endif
 
   keep_running = 1;
-  return run_sn_loop(&sss_node, &keep_running);
+  rc = run_sn_loop(&sss_node, &keep_running);
+
+  closeTraceFile();
+
+  return(rc);
 }
 
 
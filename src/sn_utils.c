@@ -32,6 +32,15 @@ static ssize_t sendto_sock(n2n_sn_t *sss,
                            const uint8_t *pktbuf,
                            size_t pktsize);
 
+#ifdef N2N_HAVE_UDP_GSO
+static ssize_t sn_gso_queue(n2n_sn_t *sss,
+                            const struct sockaddr_in *dest,
+                            const uint8_t *pktbuf,
+                            size_t pktsize);
+
+static void sn_gso_flush(n2n_sn_t *sss);
+#endif
+
 static int sendto_mgmt(n2n_sn_t *sss,
                        const struct sockaddr_in *sender_sock,
                        const uint8_t *mgmt_buf,
@@ -144,6 +153,11 @@ static ssize_t sendto_sock(n2n_sn_t *sss,
 		 pktsize,
 		 sock_to_cstr(sockbuf, sock));
 
+#ifdef N2N_HAVE_UDP_GSO
+      if (sss->gso_queue && sss->gso_queue->enabled)
+	return sn_gso_queue(sss, &udpsock, pktbuf, pktsize);
+#endif
+
       return sendto(sss->sock, pktbuf, pktsize, 0,
 		    (const struct sockaddr *)&udpsock, sizeof(struct sockaddr_in));
     }
@@ -155,6 +169,128 @@ static ssize_t sendto_sock(n2n_sn_t *sss,
     }
 }
 
+#ifdef N2N_HAVE_UDP_GSO
+
+/** Append a datagram to the GSO queue. The queue is sent first if the
+ *  datagram cannot become one more segment of it.
+ *
+ *  @return the number of bytes queued
+ */
+static ssize_t sn_gso_queue(n2n_sn_t *sss,
+                            const struct sockaddr_in *dest,
+                            const uint8_t *pktbuf,
+                            size_t pktsize)
+{
+  n2n_udp_gso_queue_t *q = sss->gso_queue;
+
+  if ((q->num_segs > 0)
+      && ((q->dest.sin_addr.s_addr != dest->sin_addr.s_addr)
+	  || (q->dest.sin_port != dest->sin_port)
+	  || (pktsize > q->seg_size)
+	  || (q->len != (size_t)q->num_segs * q->seg_size) /* only the last segment may be shorter */
+	  || (q->num_segs == N2N_UDP_GSO_MAX_SEGS)
+	  || (q->len + pktsize > N2N_UDP_GSO_MAX_SIZE)))
+    sn_gso_flush(sss);
+
+  if (q->num_segs == 0)
+    {
+      q->dest = *dest;
+      q->seg_size = pktsize;
+    }
+
+  memcpy(q->buf + q->len, pktbuf, pktsize);
+  q->len += pktsize;
+  q->num_segs++;
+
+  return pktsize;
+}
+
+/** Send the queued datagrams with a single UDP_SEGMENT sendmsg(). Should the
+ *  kernel refuse that, they are sent one by one and GSO is given up. */
+static void sn_gso_flush(n2n_sn_t *sss)
+{
+  n2n_udp_gso_queue_t *q = sss->gso_queue;
+  n2n_udp_gso_cmsg_t cmsg;
+  struct msghdr msg;
+  struct iovec iov;
+  size_t off;
+
+  if (q->num_segs == 0)
+    return;
+
+  iov.iov_base = q->buf;
+  iov.iov_len = q->len;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = &q->dest;
+  msg.msg_namelen = sizeof(struct sockaddr_in);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (q->num_segs > 1)
+    udp_gso_set_cmsg(&msg, &cmsg, q->seg_size);
+
+  if (sendmsg(sss->sock, &msg, 0) < 0)
+    {
+      if ((q->num_segs > 1)
+	  && ((errno == EIO) || (errno == EINVAL) || (errno == EOPNOTSUPP) || (errno == ENOPROTOOPT)))
+        {
+	  traceEvent(TRACE_WARNING, "UDP GSO send failed (%d) %s, disabling it", errno, strerror(errno));
+	  q->failed = 1;
+
+	  for (off = 0; off < q->len; off += q->seg_size)
+	    if (sendto(sss->sock, q->buf + off, MIN(q->seg_size, q->len - off), 0,
+		       (const struct sockaddr *)&q->dest, sizeof(struct sockaddr_in)) < 0)
+	      ++(sss->stats.errors);
+        }
+      else
+        {
+	  traceEvent(TRACE_ERROR, "sendmsg failed (%d) %s", errno, strerror(errno));
+	  sss->stats.errors += q->num_segs;
+        }
+    }
+  else
+    traceEvent(TRACE_DEBUG, "sn_gso_flush %u datagrams of %u bytes", q->num_segs, q->seg_size);
+
+  q->num_segs = 0;
+  q->len = 0;
+}
+
+/** Process the datagrams which are already waiting on the socket, so that
+ *  the ones relayed to the same edge leave in as few sends as possible. */
+static void sn_gso_drain(n2n_sn_t *sss, uint8_t *pktbuf, time_t now)
+{
+  struct sockaddr_in sender_sock;
+  socklen_t i;
+  ssize_t bread;
+  int n;
+
+  for (n = 1; n < N2N_MMSG_BATCH_SIZE; n++)
+    {
+      i = sizeof(sender_sock);
+      bread = recvfrom(sss->sock, pktbuf, N2N_SN_PKTBUF_SIZE, MSG_DONTWAIT,
+		       (struct sockaddr *)&sender_sock, &i);
+
+      /* errors other than EAGAIN show up again at the next blocking recvfrom() */
+      if (bread < 0)
+	break;
+
+      if (bread > 0)
+	process_udp(sss, &sender_sock, pktbuf, bread, now);
+    }
+
+  sn_gso_flush(sss);
+  sss->gso_queue->enabled = 0;
+
+  if (sss->gso_queue->failed)
+    {
+      free(sss->gso_queue);
+      sss->gso_queue = NULL;
+    }
+}
+
+#endif /* N2N_HAVE_UDP_GSO */
+
 /** Try and broadcast a message to all edges in the community.
  *
  *  This will send the exact same datagram to zero or more edges registered to
@@ -227,6 +363,13 @@ int sn_init(n2n_sn_t *sss) {
 
   n2n_srand (n2n_seed());
 
+  if ((sss->buf_pool = n2n_buf_pool_create(N2N_BUF_POOL_SIZE)) == NULL)
+    {
+      traceEvent(TRACE_ERROR, "Cannot allocate packet buffers");
+      return -1;
+    }
+  n2n_buf_cache_init(&sss->buf_cache, sss->buf_pool);
+
   return 0; /* OK */
 }
 
@@ -249,6 +392,19 @@ void sn_term(n2n_sn_t *sss)
     }
   sss->mgmt_sock = -1;
 
+#ifdef N2N_HAVE_UDP_GSO
+  if (sss->gso_queue)
+    free(sss->gso_queue);
+  sss->gso_queue = NULL;
+#endif
+
+  if (sss->buf_pool)
+    {
+      n2n_buf_cache_flush(&sss->buf_cache);
+      n2n_buf_pool_destroy(sss->buf_pool);
+    }
+  sss->buf_pool = NULL;
+
   HASH_ITER(hh, sss->communities, community, tmp)
     {
       clear_peer_list(&community->edges);
@@ -607,6 +763,11 @@ static int process_mgmt(n2n_sn_t *sss,
   ressize += snprintf(resbuf + ressize, N2N_SN_PKTBUF_SIZE - ressize,
 		      "cur_cmnts %u\n", HASH_COUNT(sss->communities));
 
+  ressize += snprintf(resbuf + ressize, N2N_SN_PKTBUF_SIZE - ressize,
+		      "buffers %u | heap_allocs %u\n",
+		      sss->buf_pool->num_bufs,
+		      (unsigned int) sss->buf_pool->heap_allocs);
+
   ressize += snprintf(resbuf + ressize, N2N_SN_PKTBUF_SIZE - ressize,
 		      "last_fwd  %lu sec ago | ",
 		      (long unsigned int) (now - sss->stats.last_fwd));
@@ -639,6 +800,8 @@ static int sendto_mgmt(n2n_sn_t *sss,
 
 /** Examine a datagram and determine what to do with it.
  *
+ *  udp_buf is the payload of a packet buffer: a PACKET gets its re-encoded
+ *  header in the headroom in front of it.
  */
 static int process_udp(n2n_sn_t * sss,
 		       const struct sockaddr_in * sender_sock,
@@ -769,10 +932,10 @@ static int process_udp(n2n_sn_t * sss,
        * different size due to addition of the socket.*/
       n2n_PACKET_t                    pkt;
       n2n_common_t                    cmn2;
-      uint8_t                         encbuf[N2N_SN_PKTBUF_SIZE];
+      uint8_t                         encbuf[N2N_PKT_HEADROOM];
       size_t                          encx=0;
       int                             unicast; /* non-zero if unicast */
-      uint8_t *                       rec_buf; /* either udp_buf or encbuf */
+      uint8_t *                       rec_buf; /* udp_buf, or the new header in front of its payload */
 
       if(!comm) {
 	traceEvent(TRACE_DEBUG, "process_udp PACKET with unknown community %s", cmn.community);
@@ -808,14 +971,14 @@ static int process_udp(n2n_sn_t * sss,
 	pkt.sock.port = ntohs(sender_sock->sin_port);
 	memcpy(pkt.sock.addr.v4, &(sender_sock->sin_addr.s_addr), IPV4_SIZE);
 
-	rec_buf = encbuf;
-
-	/* Re-encode the header. */
+	/* Re-encode the header and put it in front of the original payload,
+	 * the headroom of the buffer takes what it grew by. */
 	encode_PACKET(encbuf, &encx, &cmn2, &pkt);
 	uint16_t oldEncx = encx;
 
-	/* Copy the original payload unchanged */
-	encode_buf(encbuf, &encx, (udp_buf + idx), (udp_size - idx));
+	rec_buf = udp_buf + idx - encx;
+	memcpy(rec_buf, encbuf, encx);
+	encx += udp_size - idx;
 
 	if (comm->header_encryption == HEADER_ENCRYPTION_ENABLED)
 	  packet_header_encrypt (rec_buf, oldEncx, comm->header_encryption_ctx,
@@ -1108,12 +1271,28 @@ static int process_udp(n2n_sn_t * sss,
  *  daemonisation on some platforms. */
 int run_sn_loop(n2n_sn_t *sss, int *keep_running)
 {
-  uint8_t pktbuf[N2N_SN_PKTBUF_SIZE];
+  n2n_buf_t *buf;
+  uint8_t *pktbuf;
   time_t last_purge_edges = 0;
   time_t last_sort_communities = 0;
 
+  /* one buffer for all datagrams, process_udp() is done with each before
+   * the next is received */
+  if (!sss->buf_pool || ((buf = n2n_buf_get(&sss->buf_cache)) == NULL))
+    return -1;
+  pktbuf = N2N_BUF_PAYLOAD(buf);
+
   sss->start_time = time(NULL);
 
+#ifdef N2N_HAVE_UDP_GSO
+  if (udp_gso_probe(sss->sock))
+    {
+      sss->gso_queue = (n2n_udp_gso_queue_t *)calloc(1, sizeof(n2n_udp_gso_queue_t));
+      if (sss->gso_queue)
+	traceEvent(TRACE_NORMAL, "Relaying with UDP GSO");
+    }
+#endif
+
   while (*keep_running)
     {
       int rc;
@@ -1133,7 +1312,7 @@ int run_sn_loop(n2n_sn_t *sss, int *keep_running)
       wait_time.tv_usec = 0;
       rc = select(max_sock + 1, &socket_mask, NULL, NULL, &wait_time);
 
-      now = time(NULL);
+      now = n2n_clock_update();
 
       if (rc > 0)
         {
@@ -1142,6 +1321,11 @@ int run_sn_loop(n2n_sn_t *sss, int *keep_running)
 	      struct sockaddr_in sender_sock;
 	      socklen_t i;
 
+#ifdef N2N_HAVE_UDP_GSO
+	      if (sss->gso_queue)
+		sss->gso_queue->enabled = 1;
+#endif
+
 	      i = sizeof(sender_sock);
 	      bread = recvfrom(sss->sock, pktbuf, N2N_SN_PKTBUF_SIZE, 0 /*flags*/,
 			       (struct sockaddr *)&sender_sock, (socklen_t *)&i);
@@ -1168,6 +1352,11 @@ int run_sn_loop(n2n_sn_t *sss, int *keep_running)
 		  /* And the datagram has data (not just a header) */
 		  process_udp(sss, &sender_sock, pktbuf, bread, now);
                 }
+
+#ifdef N2N_HAVE_UDP_GSO
+	      if (sss->gso_queue)
+		sn_gso_drain(sss, pktbuf, now);
+#endif
             }
 
 	  if (FD_ISSET(sss->mgmt_sock, &socket_mask))
@@ -1199,6 +1388,7 @@ int run_sn_loop(n2n_sn_t *sss, int *keep_running)
       sort_communities (sss, &last_sort_communities, now);
     } /* while */
 
+  n2n_buf_put(&sss->buf_cache, buf);
   sn_term(sss);
 
   return 0;
@@ -0,0 +1,181 @@
+/**
+ * (C) 2007-20 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#include "n2n.h"
+
+
+typedef struct transop_aes_gcm {
+  aes_gcm_context_t   *ctx;
+} transop_aes_gcm_t;
+
+/* ****************************************************** */
+
+static int transop_deinit_aes_gcm(n2n_trans_op_t *arg) {
+  transop_aes_gcm_t *priv = (transop_aes_gcm_t *)arg->priv;
+
+  if(priv) {
+    if(priv->ctx) aes_gcm_deinit(priv->ctx);
+    free(priv);
+  }
+
+  return 0;
+}
+
+/* ****************************************************** */
+
+// the aes-gcm packet format consists of
+//
+//  - a 96-bit nonce: the 64-bit time stamp (with its random lower bits)
+//    followed by 32 random bits
+//  - the encrypted payload
+//  - the 128-bit tag over the payload and the PACKET fields passed as aad
+//
+//  [NNN|DDDDDDDDDDDDDDDDDDDDD|TTTT]
+//      | <---- encrypted ---->|
+//
+// the nonce goes into the headroom in front of the plaintext, the tag into
+// the tailroom
+static int transop_encode_aes_gcm(n2n_trans_op_t * arg,
+                                  uint8_t ** buf,
+                                  size_t in_len,
+                                  const uint8_t * aad,
+                                  size_t aad_len,
+                                  const n2n_mac_t peer_mac) {
+
+  transop_aes_gcm_t * priv = (transop_aes_gcm_t *)arg->priv;
+  uint8_t * data = *buf - AES_GCM_NONCE_SIZE;
+  size_t idx = 0;
+
+  if(in_len > N2N_PKT_BUF_SIZE) {
+    traceEvent(TRACE_ERROR, "transop_encode_aes_gcm inbuf too big to encrypt");
+    return -1;
+  }
+
+  traceEvent(TRACE_DEBUG, "transop_encode_aes_gcm %lu bytes plaintext", in_len);
+
+  encode_uint64(data, &idx, time_stamp());
+  encode_uint32(data, &idx, (uint32_t)(n2n_rand() >> 32));
+
+  if(aes_gcm_encrypt(*buf, *buf, in_len, data, aad, aad_len, *buf + in_len, priv->ctx) < 0)
+    return -1;
+
+  *buf = data;
+
+  return AES_GCM_NONCE_SIZE + in_len + AES_GCM_TAG_SIZE;
+}
+
+/* ****************************************************** */
+
+// see transop_encode_aes_gcm for packet format
+static int transop_decode_aes_gcm(n2n_trans_op_t * arg,
+                                  uint8_t ** buf,
+                                  size_t in_len,
+                                  const uint8_t * aad,
+                                  size_t aad_len,
+                                  const n2n_mac_t peer_mac) {
+
+  transop_aes_gcm_t * priv = (transop_aes_gcm_t *)arg->priv;
+  uint8_t * data = *buf + AES_GCM_NONCE_SIZE;
+  size_t len;
+
+  if((in_len < AES_GCM_NONCE_SIZE + AES_GCM_TAG_SIZE)
+     || ((in_len - AES_GCM_NONCE_SIZE - AES_GCM_TAG_SIZE) > N2N_PKT_BUF_SIZE)) {
+    traceEvent(TRACE_ERROR, "transop_decode_aes_gcm inbuf wrong size (%ul) to decrypt", in_len);
+    return -1;
+  }
+
+  traceEvent(TRACE_DEBUG, "transop_decode_aes_gcm %lu bytes ciphertext", in_len);
+
+  len = in_len - AES_GCM_NONCE_SIZE - AES_GCM_TAG_SIZE;
+
+  if(aes_gcm_decrypt(data, data, len, *buf, aad, aad_len, data + len, priv->ctx) < 0) {
+    traceEvent(TRACE_WARNING, "transop_decode_aes_gcm authentication failed, dropping the packet");
+    return -1;
+  }
+
+  *buf = data;
+
+  return len;
+}
+
+/* ****************************************************** */
+
+static int setup_aes_gcm_key(transop_aes_gcm_t *priv, const uint8_t *password, ssize_t password_len) {
+
+  unsigned char   key_mat[32];     // maximum aes key length, equals hash length
+  unsigned char   *key;
+  size_t          key_size;
+
+  // same key derivation as for aes-cbc (transform_aes.c): the hashed password,
+  // with the key size chosen by the password length
+  pearson_hash_256(key_mat, password, password_len);
+
+  if(password_len >= 65) {
+    key_size = AES256_KEY_BYTES;       // 256 bit
+  } else if(password_len >= 44) {
+    key_size = AES192_KEY_BYTES;       // 192 bit
+  } else {
+    key_size = AES128_KEY_BYTES;       // 128 bit
+  }
+  key = key_mat + sizeof(key_mat) - key_size;
+
+  if(aes_gcm_init(key, key_size, &(priv->ctx))) {
+    traceEvent(TRACE_ERROR, "setup_aes_gcm_key %u-bit key setup unsuccessful",
+               key_size * 8);
+    return -1;
+  }
+
+  traceEvent(TRACE_DEBUG, "setup_aes_gcm_key %u-bit key setup completed",
+             key_size * 8);
+  return 0;
+}
+
+/* ****************************************************** */
+
+static void transop_tick_aes_gcm(n2n_trans_op_t * arg, time_t now) { ; }
+
+/* ****************************************************** */
+
+// AES-GCM initialization function
+int n2n_transop_aes_gcm_init(const n2n_edge_conf_t *conf, n2n_trans_op_t *ttt) {
+
+  transop_aes_gcm_t *priv;
+  const u_char *encrypt_key = (const u_char *)conf->encrypt_key;
+  size_t encrypt_key_len = strlen(conf->encrypt_key);
+
+  memset(ttt, 0, sizeof(*ttt));
+  ttt->transform_id = N2N_TRANSFORM_ID_AES_GCM;
+
+  ttt->tick = transop_tick_aes_gcm;
+  ttt->deinit = transop_deinit_aes_gcm;
+  ttt->fwd = n2n_transop_fwd_shim;
+  ttt->rev = n2n_transop_rev_shim;
+  ttt->fwd_inplace = transop_encode_aes_gcm;
+  ttt->rev_inplace = transop_decode_aes_gcm;
+
+  priv = (transop_aes_gcm_t*) calloc(1, sizeof(transop_aes_gcm_t));
+  if(!priv) {
+    traceEvent(TRACE_ERROR, "n2n_transop_aes_gcm_init cannot allocate transop_aes_gcm_t memory");
+    return(-1);
+  }
+  ttt->priv = priv;
+
+  // setup the cipher and key
+  return(setup_aes_gcm_key(priv, encrypt_key, encrypt_key_len));
+}
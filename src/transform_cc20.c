@@ -33,11 +33,11 @@ static int transop_deinit_cc20(n2n_trans_op_t *arg) {
 
   transop_cc20_t *priv = (transop_cc20_t *)arg->priv;
 
-  if(priv->ctx)
-    cc20_deinit(priv->ctx);
-
-  if(priv)
+  if(priv) {
+    if(priv->ctx)
+      cc20_deinit(priv->ctx);
     free(priv);
+  }
 
   return 0;
 }
@@ -51,78 +51,73 @@ static int transop_deinit_cc20(n2n_trans_op_t *arg) {
  *
  *  [IIII|DDDDDDDDDDDDDDDDDDDDD]
  *       |<---- encrypted ---->|
+ *
+ *  The IV goes into the headroom, the payload is encrypted in place.
  */
 static int transop_encode_cc20(n2n_trans_op_t * arg,
-			       uint8_t * outbuf,
-			       size_t out_len,
-			       const uint8_t * inbuf,
+			       uint8_t ** buf,
 			       size_t in_len,
-			       const uint8_t * peer_mac) {
+			       const uint8_t * aad,
+			       size_t aad_len,
+			       const n2n_mac_t peer_mac) {
 
-  int len=-1;
   transop_cc20_t * priv = (transop_cc20_t *)arg->priv;
-  uint8_t assembly[N2N_PKT_BUF_SIZE] = {0};
+  uint8_t * data = *buf - CC20_PREAMBLE_SIZE;
+  size_t idx=0;
 
-  if(in_len <= N2N_PKT_BUF_SIZE) {
-    if((in_len + CC20_PREAMBLE_SIZE) <= out_len) {
+  if(in_len > N2N_PKT_BUF_SIZE) {
+    traceEvent(TRACE_ERROR, "encode_cc20 inbuf too big to encrypt.");
+    return -1;
+  }
 
-      size_t idx=0;
+  traceEvent(TRACE_DEBUG, "encode_cc20 %lu bytes", in_len);
 
-      traceEvent(TRACE_DEBUG, "encode_cc20 %lu bytes", in_len);
+  // full IV sized random value (128 bit)
+  encode_uint64(data, &idx, n2n_rand());
+  encode_uint64(data, &idx, n2n_rand());
 
-      // full IV sized random value (128 bit)
-      encode_uint64(outbuf, &idx, n2n_rand());
-      encode_uint64(outbuf, &idx, n2n_rand());
+  cc20_crypt(data + CC20_PREAMBLE_SIZE,
+             data + CC20_PREAMBLE_SIZE,
+             in_len,
+             data,                         // IV
+             priv->ctx);
 
-      len = in_len;
-      cc20_crypt(outbuf + CC20_PREAMBLE_SIZE,
-                 inbuf,
-                 in_len,
-                 outbuf,                       // IV
-                 priv->ctx);
+  *buf = data;
 
-      len += CC20_PREAMBLE_SIZE; /* size of data carried in UDP. */
-    } else
-      traceEvent(TRACE_ERROR, "encode_cc20 outbuf too small.");
-  } else
-    traceEvent(TRACE_ERROR, "encode_cc20 inbuf too big to encrypt.");
-
-  return len;
+  return in_len + CC20_PREAMBLE_SIZE; /* size of data carried in UDP. */
 }
 
 /* ****************************************************** */
 
 /* See transop_encode_cc20 for packet format */
 static int transop_decode_cc20(n2n_trans_op_t * arg,
-			       uint8_t * outbuf,
-			       size_t out_len,
-			       const uint8_t * inbuf,
+			       uint8_t ** buf,
 			       size_t in_len,
-			       const uint8_t * peer_mac) {
+			       const uint8_t * aad,
+			       size_t aad_len,
+			       const n2n_mac_t peer_mac) {
 
-  int len=0;
   transop_cc20_t * priv = (transop_cc20_t *)arg->priv;
-  uint8_t assembly[N2N_PKT_BUF_SIZE];
+  uint8_t * data = *buf;
+  size_t len;
 
-  if(((in_len - CC20_PREAMBLE_SIZE) <= N2N_PKT_BUF_SIZE) /* Cipher text fits in assembly */
-     && (in_len >= CC20_PREAMBLE_SIZE) /* Has at least iv */
-  )
-  {
-    size_t rem=in_len;
-    size_t idx=0;
+  if((in_len < CC20_PREAMBLE_SIZE) /* Has at least iv */
+     || ((in_len - CC20_PREAMBLE_SIZE) > N2N_PKT_BUF_SIZE)) {
+    traceEvent(TRACE_ERROR, "decode_cc20 inbuf wrong size (%ul) to decrypt.", in_len);
+    return -1;
+  }
 
-    traceEvent(TRACE_DEBUG, "decode_cc20 %lu bytes", in_len);
+  traceEvent(TRACE_DEBUG, "decode_cc20 %lu bytes", in_len);
 
-    len = (in_len - CC20_PREAMBLE_SIZE);
+  len = in_len - CC20_PREAMBLE_SIZE;
 
-    cc20_crypt(outbuf,
-               inbuf + CC20_PREAMBLE_SIZE,
-               in_len,
-               inbuf,                         // IV
-               priv->ctx);
+  cc20_crypt(data + CC20_PREAMBLE_SIZE,
+             data + CC20_PREAMBLE_SIZE,
+             len,
+             data,                         // IV
+             priv->ctx);
 
-  } else
-    traceEvent(TRACE_ERROR, "decode_cc20 inbuf wrong size (%ul) to decrypt.", in_len);
+  *buf = data + CC20_PREAMBLE_SIZE;
 
   return len;
 }
@@ -164,8 +159,10 @@ int n2n_transop_cc20_init(const n2n_edge_conf_t *conf, n2n_trans_op_t *ttt) {
 
   ttt->tick = transop_tick_cc20;
   ttt->deinit = transop_deinit_cc20;
-  ttt->fwd = transop_encode_cc20;
-  ttt->rev = transop_decode_cc20;
+  ttt->fwd = n2n_transop_fwd_shim;
+  ttt->rev = n2n_transop_rev_shim;
+  ttt->fwd_inplace = transop_encode_cc20;
+  ttt->rev_inplace = transop_decode_cc20;
 
   priv = (transop_cc20_t*) calloc(1, sizeof(transop_cc20_t));
   if(!priv) {
@@ -0,0 +1,168 @@
+/**
+ * (C) 2007-20 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#include "n2n.h"
+
+
+typedef struct transop_cc20_poly1305 {
+  cc20_context_t      *ctx;
+} transop_cc20_poly1305_t;
+
+/* ****************************************************** */
+
+static int transop_deinit_cc20_poly1305(n2n_trans_op_t *arg) {
+  transop_cc20_poly1305_t *priv = (transop_cc20_poly1305_t *)arg->priv;
+
+  if(priv) {
+    if(priv->ctx) cc20_deinit(priv->ctx);
+    free(priv);
+  }
+
+  return 0;
+}
+
+/* ****************************************************** */
+
+// the chacha20-poly1305 packet format consists of
+//
+//  - a 96-bit nonce: the 64-bit time stamp (with its random lower bits)
+//    followed by 32 random bits
+//  - the encrypted payload
+//  - the 128-bit tag over the payload and the PACKET fields passed as aad
+//
+//  [NNN|DDDDDDDDDDDDDDDDDDDDD|TTTT]
+//      | <---- encrypted ---->|
+//
+// the nonce goes into the headroom in front of the plaintext, the tag into
+// the tailroom -- same as for aes-gcm (transform_aes_gcm.c)
+static int transop_encode_cc20_poly1305(n2n_trans_op_t * arg,
+                                        uint8_t ** buf,
+                                        size_t in_len,
+                                        const uint8_t * aad,
+                                        size_t aad_len,
+                                        const n2n_mac_t peer_mac) {
+
+  transop_cc20_poly1305_t * priv = (transop_cc20_poly1305_t *)arg->priv;
+  uint8_t * data = *buf - CC20_POLY1305_NONCE_SIZE;
+  size_t idx = 0;
+
+  if(in_len > N2N_PKT_BUF_SIZE) {
+    traceEvent(TRACE_ERROR, "transop_encode_cc20_poly1305 inbuf too big to encrypt");
+    return -1;
+  }
+
+  traceEvent(TRACE_DEBUG, "transop_encode_cc20_poly1305 %lu bytes plaintext", in_len);
+
+  encode_uint64(data, &idx, time_stamp());
+  encode_uint32(data, &idx, (uint32_t)(n2n_rand() >> 32));
+
+  if(cc20_poly1305_encrypt(*buf, *buf, in_len, data, aad, aad_len, *buf + in_len, priv->ctx) < 0)
+    return -1;
+
+  *buf = data;
+
+  return CC20_POLY1305_NONCE_SIZE + in_len + CC20_POLY1305_TAG_SIZE;
+}
+
+/* ****************************************************** */
+
+// see transop_encode_cc20_poly1305 for packet format
+static int transop_decode_cc20_poly1305(n2n_trans_op_t * arg,
+                                        uint8_t ** buf,
+                                        size_t in_len,
+                                        const uint8_t * aad,
+                                        size_t aad_len,
+                                        const n2n_mac_t peer_mac) {
+
+  transop_cc20_poly1305_t * priv = (transop_cc20_poly1305_t *)arg->priv;
+  uint8_t * data = *buf + CC20_POLY1305_NONCE_SIZE;
+  size_t len;
+
+  if((in_len < CC20_POLY1305_NONCE_SIZE + CC20_POLY1305_TAG_SIZE)
+     || ((in_len - CC20_POLY1305_NONCE_SIZE - CC20_POLY1305_TAG_SIZE) > N2N_PKT_BUF_SIZE)) {
+    traceEvent(TRACE_ERROR, "transop_decode_cc20_poly1305 inbuf wrong size (%ul) to decrypt", in_len);
+    return -1;
+  }
+
+  traceEvent(TRACE_DEBUG, "transop_decode_cc20_poly1305 %lu bytes ciphertext", in_len);
+
+  len = in_len - CC20_POLY1305_NONCE_SIZE - CC20_POLY1305_TAG_SIZE;
+
+  if(cc20_poly1305_decrypt(data, data, len, *buf, aad, aad_len, data + len, priv->ctx) < 0) {
+    traceEvent(TRACE_WARNING, "transop_decode_cc20_poly1305 authentication failed, dropping the packet");
+    return -1;
+  }
+
+  *buf = data;
+
+  return len;
+}
+
+/* ****************************************************** */
+
+static int setup_cc20_poly1305_key(transop_cc20_poly1305_t *priv, const uint8_t *password, ssize_t password_len) {
+
+  uint8_t key_mat[CC20_KEY_BYTES];
+
+  // same key derivation as for chacha20 (transform_cc20.c)
+  pearson_hash_256(key_mat, password, password_len);
+
+  if(cc20_init(key_mat, &(priv->ctx))) {
+    traceEvent(TRACE_ERROR, "setup_cc20_poly1305_key setup unsuccessful");
+    return -1;
+  }
+
+  traceEvent(TRACE_DEBUG, "setup_cc20_poly1305_key completed");
+
+  return 0;
+}
+
+/* ****************************************************** */
+
+static void transop_tick_cc20_poly1305(n2n_trans_op_t * arg, time_t now) { ; }
+
+/* ****************************************************** */
+
+// ChaCha20-Poly1305 initialization function
+int n2n_transop_cc20_poly1305_init(const n2n_edge_conf_t *conf, n2n_trans_op_t *ttt) {
+
+  transop_cc20_poly1305_t *priv;
+  const u_char *encrypt_key = (const u_char *)conf->encrypt_key;
+  size_t encrypt_key_len = strlen(conf->encrypt_key);
+
+  memset(ttt, 0, sizeof(*ttt));
+  ttt->transform_id = N2N_TRANSFORM_ID_CHACHA20_POLY1305;
+
+  ttt->tick = transop_tick_cc20_poly1305;
+  ttt->deinit = transop_deinit_cc20_poly1305;
+  ttt->fwd = n2n_transop_fwd_shim;
+  ttt->rev = n2n_transop_rev_shim;
+  ttt->fwd_inplace = transop_encode_cc20_poly1305;
+  ttt->rev_inplace = transop_decode_cc20_poly1305;
+
+  priv = (transop_cc20_poly1305_t*) calloc(1, sizeof(transop_cc20_poly1305_t));
+  if(!priv) {
+    traceEvent(TRACE_ERROR, "n2n_transop_cc20_poly1305_init cannot allocate transop_cc20_poly1305_t memory");
+    return(-1);
+  }
+  ttt->priv = priv;
+
+  // setup the cipher and key
+  return(setup_cc20_poly1305_key(priv, encrypt_key, encrypt_key_len));
+}
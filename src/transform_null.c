@@ -71,6 +71,19 @@ static int transop_decode_null( n2n_trans_op_t * arg,
     return retval;
 }
 
+/* The payload stays where and as it is */
+static int transop_inplace_null( n2n_trans_op_t * arg,
+                                 uint8_t ** buf,
+                                 size_t len,
+                                 const uint8_t * aad,
+                                 size_t aad_len,
+                                 const n2n_mac_t peer_mac)
+{
+    traceEvent( TRACE_DEBUG, "inplace_null %lu", len );
+
+    return len;
+}
+
 static void transop_tick_null(n2n_trans_op_t * arg, time_t now) {}
 
 int n2n_transop_null_init(const n2n_edge_conf_t *conf, n2n_trans_op_t *ttt) {
@@ -82,6 +95,8 @@ int n2n_transop_null_init(const n2n_edge_conf_t *conf, n2n_trans_op_t *ttt) {
     ttt->tick    = transop_tick_null;
     ttt->fwd     = transop_encode_null;
     ttt->rev     = transop_decode_null;
+    ttt->fwd_inplace = transop_inplace_null;
+    ttt->rev_inplace = transop_inplace_null;
 
     return(0);
 }
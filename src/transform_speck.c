@@ -49,81 +49,77 @@ static int transop_deinit_speck(n2n_trans_op_t *arg) {
  *
  *  [IIII|DDDDDDDDDDDDDDDDDDDDD]
  *       |<---- encrypted ---->|
+ *
+ *  The IV goes into the headroom, the payload is encrypted in place.
  */
 static int transop_encode_speck(n2n_trans_op_t * arg,
-			       uint8_t * outbuf,
-			       size_t out_len,
-			       const uint8_t * inbuf,
+			       uint8_t ** buf,
 			       size_t in_len,
-			       const uint8_t * peer_mac) {
+			       const uint8_t * aad,
+			       size_t aad_len,
+			       const n2n_mac_t peer_mac) {
 
-  int len=-1;
   transop_speck_t * priv = (transop_speck_t *)arg->priv;
+  uint8_t * data = *buf - TRANSOP_SPECK_PREAMBLE_SIZE;
+  size_t idx=0;
 
-  if(in_len <= N2N_PKT_BUF_SIZE) {
-    if((in_len + TRANSOP_SPECK_PREAMBLE_SIZE) <= out_len) {
-      size_t idx=0;
+  if(in_len > N2N_PKT_BUF_SIZE) {
+    traceEvent(TRACE_ERROR, "encode_speck inbuf too big to encrypt.");
+    return -1;
+  }
 
-      traceEvent(TRACE_DEBUG, "encode_speck %lu bytes", in_len);
+  traceEvent(TRACE_DEBUG, "encode_speck %lu bytes", in_len);
 
-      /* Generate and encode the IV. */
-        encode_uint64(outbuf, &idx, n2n_rand());
-        encode_uint64(outbuf, &idx, n2n_rand());
+  /* Generate and encode the IV. */
+  encode_uint64(data, &idx, n2n_rand());
+  encode_uint64(data, &idx, n2n_rand());
 
-      /* Encrypt the payload and write the ciphertext after the iv. */
-      /* len is set to the length of the cipher plain text to be encrpyted
-	 which is (in this case) identical to original packet lentgh */
-      len = in_len;
-      speck_ctr (outbuf + TRANSOP_SPECK_PREAMBLE_SIZE, // output starts right after the iv
-                 inbuf,       // input
-                 in_len,      // len
-                 outbuf,      // iv (already encoded in outbuf, speck does not change it)
-                 priv->ctx);  // ctx already setup with round keys
+  /* Encrypt the payload in place, right after the iv. */
+  speck_ctr (data + TRANSOP_SPECK_PREAMBLE_SIZE, // output
+             data + TRANSOP_SPECK_PREAMBLE_SIZE, // input
+             in_len,      // len
+             data,        // iv (speck does not change it)
+             priv->ctx);  // ctx already setup with round keys
 
-      traceEvent(TRACE_DEBUG, "encode_speck: encrypted %u bytes.\n", in_len);
+  traceEvent(TRACE_DEBUG, "encode_speck: encrypted %u bytes.\n", in_len);
 
-      len += TRANSOP_SPECK_PREAMBLE_SIZE; /* size of data carried in UDP. */
-    } else
-      traceEvent(TRACE_ERROR, "encode_speck outbuf too small.");
-  } else
-    traceEvent(TRACE_ERROR, "encode_speck inbuf too big to encrypt.");
+  *buf = data;
 
-  return len;
+  return in_len + TRANSOP_SPECK_PREAMBLE_SIZE; /* size of data carried in UDP. */
 }
 
 /* ****************************************************** */
 
 /* See transop_encode_speck for packet format */
 static int transop_decode_speck(n2n_trans_op_t * arg,
-			       uint8_t * outbuf,
-			       size_t out_len,
-			       const uint8_t * inbuf,
+			       uint8_t ** buf,
 			       size_t in_len,
-			       const uint8_t * peer_mac) {
+			       const uint8_t * aad,
+			       size_t aad_len,
+			       const n2n_mac_t peer_mac) {
 
-  int len=0;
   transop_speck_t * priv = (transop_speck_t *)arg->priv;
+  uint8_t * data = *buf;
+  size_t len;
 
-  if(((in_len - TRANSOP_SPECK_PREAMBLE_SIZE) <= N2N_PKT_BUF_SIZE) /* Cipher text fits in buffer */
-     && (in_len >= TRANSOP_SPECK_PREAMBLE_SIZE) /* Has at least iv */
-  )
-  {
-    size_t rem=in_len;
-    size_t idx=0;
+  if((in_len < TRANSOP_SPECK_PREAMBLE_SIZE) /* Has at least iv */
+     || ((in_len - TRANSOP_SPECK_PREAMBLE_SIZE) > N2N_PKT_BUF_SIZE)) {
+    traceEvent(TRACE_ERROR, "decode_speck inbuf wrong size (%ul) to decrypt.", in_len);
+    return -1;
+  }
 
-      traceEvent(TRACE_DEBUG, "decode_speck %lu bytes", in_len);
+  traceEvent(TRACE_DEBUG, "decode_speck %lu bytes", in_len);
 
-      len = (in_len - TRANSOP_SPECK_PREAMBLE_SIZE);
-      speck_ctr (outbuf,     // output
-                 inbuf + TRANSOP_SPECK_PREAMBLE_SIZE, // encrypted data starts right after preamble (IV)
-                 len,        // len
-                 inbuf,      // IV can be found at input's beginning
-                 priv->ctx); // ctx already setup with round keys
+  len = (in_len - TRANSOP_SPECK_PREAMBLE_SIZE);
+  speck_ctr (data + TRANSOP_SPECK_PREAMBLE_SIZE, // output
+             data + TRANSOP_SPECK_PREAMBLE_SIZE, // encrypted data starts right after preamble (IV)
+             len,        // len
+             data,       // IV can be found at input's beginning
+             priv->ctx); // ctx already setup with round keys
 
-      traceEvent(TRACE_DEBUG, "decode_speck decrypted %u bytes.\n", len);
+  traceEvent(TRACE_DEBUG, "decode_speck decrypted %u bytes.\n", len);
 
-  } else
-  traceEvent(TRACE_ERROR, "decode_speck inbuf wrong size (%ul) to decrypt.", in_len);
+  *buf = data + TRANSOP_SPECK_PREAMBLE_SIZE;
 
   return len;
 }
@@ -163,8 +159,10 @@ int n2n_transop_speck_init(const n2n_edge_conf_t *conf, n2n_trans_op_t *ttt) {
 
   ttt->tick = transop_tick_speck;
   ttt->deinit = transop_deinit_speck;
-  ttt->fwd = transop_encode_speck;
-  ttt->rev = transop_decode_speck;
+  ttt->fwd = n2n_transop_fwd_shim;
+  ttt->rev = n2n_transop_rev_shim;
+  ttt->fwd_inplace = transop_encode_speck;
+  ttt->rev_inplace = transop_decode_speck;
 
   priv = (transop_speck_t*) calloc(1, sizeof(transop_speck_t));
   if(!priv) {
@@ -58,56 +58,52 @@ static int transop_deinit_tf(n2n_trans_op_t *arg) {
 //  [VV|DDDDDDDDDDDDDDDDDDDDD]
 //  | <---- encrypted ---->  |
 //
+// the random value goes into the headroom in front of the plaintext, the
+// padding into the tailroom, all of it gets encrypted in place
 static int transop_encode_tf(n2n_trans_op_t * arg,
-			     uint8_t * outbuf,
-			     size_t out_len,
-			     const uint8_t * inbuf,
+			     uint8_t ** buf,
 			     size_t in_len,
-			     const uint8_t * peer_mac) {
+			     const uint8_t * aad,
+			     size_t aad_len,
+			     const n2n_mac_t peer_mac) {
 
   transop_tf_t * priv = (transop_tf_t *)arg->priv;
-
-  // the assembly buffer is a source for encrypting data
-  // the whole contents of assembly are encrypted
-  uint8_t assembly[N2N_PKT_BUF_SIZE];
+  uint8_t * data = *buf - TF_PREAMBLE_SIZE;
   size_t idx = 0;
   int padded_len;
   uint8_t padding;
-  uint8_t buf[TF_BLOCK_SIZE];
-
-  if(in_len <= N2N_PKT_BUF_SIZE) {
-    if((in_len + TF_PREAMBLE_SIZE + TF_BLOCK_SIZE) <= out_len) {
-
-        traceEvent(TRACE_DEBUG, "transop_encode_tf %lu bytes plaintext", in_len);
-
-        // full block sized random value (128 bit)
-	encode_uint64(assembly, &idx, n2n_rand());
-	encode_uint64(assembly, &idx, n2n_rand());
-
-        // adjust for maybe differently chosen TF_PREAMBLE_SIZE
-        idx = TF_PREAMBLE_SIZE;
-
-        // the plaintext data
-        encode_buf(assembly, &idx, inbuf, in_len);
-
-        // round up to next whole TF block size
-        padded_len = (((idx - 1) / TF_BLOCK_SIZE) + 1) * TF_BLOCK_SIZE;
-        padding = (padded_len-idx);
-        // pad the following bytes with zero, fixed length (TF_BLOCK_SIZE) seems to compile
-        // to slightly faster code than run-time dependant 'padding'
-        memset (assembly + idx, 0, TF_BLOCK_SIZE);
-        tf_cbc_encrypt(outbuf, assembly, padded_len, tf_null_iv, priv->ctx);
-
-        if(padding) {
-          // exchange last two cipher blocks
-          memcpy (buf, outbuf + padded_len - TF_BLOCK_SIZE, TF_BLOCK_SIZE);
-          memcpy (outbuf + padded_len - TF_BLOCK_SIZE, outbuf + padded_len - 2 * TF_BLOCK_SIZE, TF_BLOCK_SIZE);
-          memcpy (outbuf + padded_len - 2 * TF_BLOCK_SIZE, buf, TF_BLOCK_SIZE);
-        }
-    } else
-      traceEvent(TRACE_ERROR, "transop_encode_tf outbuf too small");
-  } else
+  uint8_t tmp[TF_BLOCK_SIZE];
+
+  if(in_len > N2N_PKT_BUF_SIZE) {
     traceEvent(TRACE_ERROR, "transop_encode_tf inbuf too big to encrypt");
+    return -1;
+  }
+
+  traceEvent(TRACE_DEBUG, "transop_encode_tf %lu bytes plaintext", in_len);
+
+  // full block sized random value (128 bit)
+  encode_uint64(data, &idx, n2n_rand());
+  encode_uint64(data, &idx, n2n_rand());
+  // adjust for maybe differently chosen TF_PREAMBLE_SIZE, followed by the plaintext
+  idx = TF_PREAMBLE_SIZE + in_len;
+
+  // round up to next whole TF block size
+  padded_len = (((idx - 1) / TF_BLOCK_SIZE) + 1) * TF_BLOCK_SIZE;
+  padding = (padded_len-idx);
+  // pad the following bytes with zero, fixed length (TF_BLOCK_SIZE) seems to compile
+  // to slightly faster code than run-time dependant 'padding'
+  memset (data + idx, 0, TF_BLOCK_SIZE);
+
+  tf_cbc_encrypt(data, data, padded_len, tf_null_iv, priv->ctx);
+
+  if(padding) {
+    // exchange last two cipher blocks
+    memcpy (tmp, data + padded_len - TF_BLOCK_SIZE, TF_BLOCK_SIZE);
+    memcpy (data + padded_len - TF_BLOCK_SIZE, data + padded_len - 2 * TF_BLOCK_SIZE, TF_BLOCK_SIZE);
+    memcpy (data + padded_len - 2 * TF_BLOCK_SIZE, tmp, TF_BLOCK_SIZE);
+  }
+
+  *buf = data;
 
   return idx;
 }
@@ -116,61 +112,64 @@ static int transop_encode_tf(n2n_trans_op_t * arg,
 
 // see transop_encode_tf for packet format
 static int transop_decode_tf(n2n_trans_op_t * arg,
-			     uint8_t * outbuf,
-			     size_t out_len,
-			     const uint8_t * inbuf,
+			     uint8_t ** buf,
 			     size_t in_len,
-			     const uint8_t * peer_mac) {
+			     const uint8_t * aad,
+			     size_t aad_len,
+			     const n2n_mac_t peer_mac) {
 
   transop_tf_t * priv = (transop_tf_t *)arg->priv;
-  uint8_t assembly[N2N_PKT_BUF_SIZE];
+  uint8_t * data = *buf;
 
   uint8_t rest;
   size_t penultimate_block;
-  uint8_t buf[TF_BLOCK_SIZE];
-  int len=-1;
+  uint8_t iv[TF_BLOCK_SIZE];
+  uint8_t tail[2 * TF_BLOCK_SIZE];
 
-  if( ((in_len - TF_PREAMBLE_SIZE) <= N2N_PKT_BUF_SIZE) // cipher text fits in assembly
-    && (in_len >= TF_PREAMBLE_SIZE) // has at least random number
-    && (in_len >= TF_BLOCK_SIZE)    // minimum size requirement for cipher text stealing
+  if( (in_len < TF_PREAMBLE_SIZE)                           // has at least random number
+    || (in_len < TF_BLOCK_SIZE)                            // minimum size requirement for cipher text stealing
+    || ((in_len - TF_PREAMBLE_SIZE) > N2N_PKT_BUF_SIZE)      // plaintext fits a packet
     ) {
+    traceEvent(TRACE_ERROR, "transop_decode_tf inbuf wrong size (%ul) to decrypt", in_len);
+    return -1;
+  }
 
-    traceEvent(TRACE_DEBUG, "transop_decode_tf %lu bytes ciphertext", in_len);
-
-    rest = in_len % TF_BLOCK_SIZE;
-    if(rest) {
-      // cipher text stealing
-      penultimate_block = ((in_len / TF_BLOCK_SIZE) - 1) * TF_BLOCK_SIZE;
-      // everything normal up to penultimate block
-      memcpy(assembly, inbuf, penultimate_block);
-      // prepare new penultimate block in buf
-      tf_ecb_decrypt(buf, inbuf + penultimate_block, priv->ctx);
-      memcpy(buf, inbuf + in_len - rest, rest);
-      // former penultimate block becomes new ultimate block
-      memcpy(assembly + penultimate_block + TF_BLOCK_SIZE, inbuf + penultimate_block, TF_BLOCK_SIZE);
-      //  write new penultimate block from buf
-      memcpy(assembly + penultimate_block, buf, TF_BLOCK_SIZE);
-      // regular cbc decryption on the re-arranged ciphertext
-
-      tf_cbc_decrypt(assembly, assembly, in_len + TF_BLOCK_SIZE - rest, tf_null_iv, priv->ctx);
-
-      // check for expected zero padding and give a warning otherwise
-      if(memcmp(assembly + in_len, tf_null_iv, TF_BLOCK_SIZE - rest)) {
-        traceEvent(TRACE_WARNING, "transop_decode_tf payload decryption failed with unexpected cipher text stealing padding");
-        return -1;
-      }
-    } else {
-      // regular cbc decryption on multiple block-sized payload
-      tf_cbc_decrypt(assembly, inbuf, in_len, tf_null_iv, priv->ctx);
+  traceEvent(TRACE_DEBUG, "transop_decode_tf %lu bytes ciphertext", in_len);
+
+  rest = in_len % TF_BLOCK_SIZE;
+  if(rest) {
+    // cipher text stealing: the last two blocks are re-arranged and decrypted
+    // aside as they would not fit the buffer
+    penultimate_block = ((in_len / TF_BLOCK_SIZE) - 1) * TF_BLOCK_SIZE;
+    // prepare new penultimate block
+    tf_ecb_decrypt(tail, data + penultimate_block, priv->ctx);
+    memcpy(tail, data + in_len - rest, rest);
+    // former penultimate block becomes new ultimate block
+    memcpy(tail + TF_BLOCK_SIZE, data + penultimate_block, TF_BLOCK_SIZE);
+    // both are chained to the cipher block in front of them
+    if(penultimate_block)
+      memcpy(iv, data + penultimate_block - TF_BLOCK_SIZE, TF_BLOCK_SIZE);
+    else
+      memcpy(iv, tf_null_iv, TF_BLOCK_SIZE);
+    // regular cbc decryption on everything up to penultimate block...
+    if(penultimate_block)
+      tf_cbc_decrypt(data, data, penultimate_block, tf_null_iv, priv->ctx);
+    // ... and on the re-arranged last two blocks
+    tf_cbc_decrypt(tail, tail, 2 * TF_BLOCK_SIZE, iv, priv->ctx);
+    // check for expected zero padding and give a warning otherwise
+    if(memcmp(tail + TF_BLOCK_SIZE + rest, tf_null_iv, TF_BLOCK_SIZE - rest)) {
+      traceEvent(TRACE_WARNING, "transop_decode_tf payload decryption failed with unexpected cipher text stealing padding");
+      return -1;
     }
-    len = in_len    - TF_PREAMBLE_SIZE;
-    memcpy(outbuf,
-           assembly + TF_PREAMBLE_SIZE,
-           len);
-  } else
-    traceEvent(TRACE_ERROR, "transop_decode_tf inbuf wrong size (%ul) to decrypt", in_len);
+    memcpy(data + penultimate_block, tail, TF_BLOCK_SIZE + rest);
+  } else {
+    // regular cbc decryption on multiple block-sized payload
+    tf_cbc_decrypt(data, data, in_len, tf_null_iv, priv->ctx);
+  }
+
+  *buf = data + TF_PREAMBLE_SIZE;
 
-  return len;
+  return in_len - TF_PREAMBLE_SIZE;
 }
 
 /* ****************************************************** */
@@ -216,8 +215,10 @@ int n2n_transop_tf_init(const n2n_edge_conf_t *conf, n2n_trans_op_t *ttt) {
 
   ttt->tick = transop_tick_tf;
   ttt->deinit = transop_deinit_tf;
-  ttt->fwd = transop_encode_tf;
-  ttt->rev = transop_decode_tf;
+  ttt->fwd = n2n_transop_fwd_shim;
+  ttt->rev = n2n_transop_rev_shim;
+  ttt->fwd_inplace = transop_encode_tf;
+  ttt->rev_inplace = transop_decode_tf;
 
   priv = (transop_tf_t*) calloc(1, sizeof(transop_tf_t));
   if(!priv) {
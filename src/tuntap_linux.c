@@ -93,21 +93,28 @@ static int setup_ifname(int fd, const char *ifname, const char *ipaddr,
  *  @param device_ip   - address of iface
  *  @param device_mask - netmask for device_ip
  *  @param mtu         - MTU for device_ip
+ *  @param num_queues  - number of queues of a multi-queue TAP, 1 for a
+ *                       regular TAP
+ *  @param offload     - enable the virtio-net header and TSO/checksum
+ *                       offloads, see tuntap_read_offload()
  *
  *  @return - negative value on error
- *          - non-negative file-descriptor on success
+ *          - non-negative file-descriptor (of queue 0) on success
  */
-int tuntap_open(tuntap_dev *device, 
-                char *dev, /* user-definable interface name, eg. edge0 */
-                const char *address_mode, /* static or dhcp */
-                char *device_ip, 
-                char *device_mask,
-                const char * device_mac,
-		int mtu) {
+int tuntap_open_ext(tuntap_dev *device,
+                    char *dev, /* user-definable interface name, eg. edge0 */
+                    const char *address_mode, /* static or dhcp */
+                    char *device_ip,
+                    char *device_mask,
+                    const char * device_mac,
+                    int mtu,
+                    int num_queues,
+                    int offload) {
   char *tuntap_device = "/dev/net/tun";
   int ioctl_fd;
   struct ifreq ifr;
-  int rc;
+  short tap_flags = IFF_TAP|IFF_NO_PI; /* Want a TAP device for layer 2 frames. */
+  int rc, q;
   int nl_fd;
   char nl_buf[8192]; /* >= 8192 to avoid truncation, see "man 7 netlink" */
   struct iovec iov;
@@ -115,14 +122,33 @@ int tuntap_open(tuntap_dev *device,
   int up_and_running = 0;
   struct msghdr msg;
 
+  if((num_queues < 1) || (num_queues > N2N_MAX_TAP_QUEUES)) {
+    traceEvent(TRACE_ERROR, "tuntap invalid number of queues %d (1..%d)", num_queues, N2N_MAX_TAP_QUEUES);
+    return -1;
+  }
+
+  device->num_queues = 1;
+  device->offload = 0;
+
+#ifdef IFF_MULTI_QUEUE
+  if(num_queues > 1)
+    tap_flags |= IFF_MULTI_QUEUE;
+#endif
+#ifdef N2N_HAVE_TAP_OFFLOAD
+  if(offload)
+    tap_flags |= IFF_VNET_HDR;
+#endif
+
   device->fd = open(tuntap_device, O_RDWR);
   if(device->fd < 0) {
     traceEvent(TRACE_ERROR, "tuntap open() error: %s[%d]. Is the tun kernel module loaded?\n", strerror(errno), errno);
     return -1;
   }
 
+  device->queue_fd[0] = device->fd;
+
   memset(&ifr, 0, sizeof(ifr));
-  ifr.ifr_flags = IFF_TAP|IFF_NO_PI; /* Want a TAP device for layer 2 frames. */
+  ifr.ifr_flags = tap_flags;
   strncpy(ifr.ifr_name, dev, IFNAMSIZ-1);
   ifr.ifr_name[IFNAMSIZ-1] = '\0';
   rc = ioctl(device->fd, TUNSETIFF, (void *)&ifr);
@@ -133,6 +159,17 @@ int tuntap_open(tuntap_dev *device,
     return -1;
   }
 
+#ifdef N2N_HAVE_TAP_OFFLOAD
+  if(offload) {
+    /* the kernel may now hand over TCP super-frames of up to 64 KB with
+     * partial checksums, the edge segments them (tuntap_offload_segment) */
+    if(ioctl(device->fd, TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6) < 0)
+      traceEvent(TRACE_WARNING, "tuntap ioctl(TUNSETOFFLOAD) error: %s[%d], offloads disabled", strerror(errno), errno);
+
+    device->offload = 1;
+  }
+#endif
+
   /* Store the device name for later reuse */
   strncpy(device->dev_name, ifr.ifr_name, MIN(IFNAMSIZ, N2N_IFNAMSIZ) );
 
@@ -228,24 +265,266 @@ int tuntap_open(tuntap_dev *device,
   device->device_mask = inet_addr(device_mask);
   device->if_idx = if_nametoindex(dev);
 
+#ifdef IFF_MULTI_QUEUE
+  /* Attach the further queues to the now configured interface */
+  for(q = 1; q < num_queues; q++) {
+    int fd = open(tuntap_device, O_RDWR);
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = tap_flags; /* all the queues need the same flags */
+    strncpy(ifr.ifr_name, device->dev_name, IFNAMSIZ-1);
+
+    if((fd < 0) || (ioctl(fd, TUNSETIFF, (void *)&ifr) < 0)) {
+      traceEvent(TRACE_ERROR, "tuntap cannot attach queue %d: %s[%d]", q, strerror(errno), errno);
+      if(fd >= 0)
+        close(fd);
+      tuntap_close(device);
+      return -1;
+    }
+
+    device->queue_fd[q] = fd;
+    device->num_queues++;
+  }
+
+  if(num_queues > 1)
+    traceEvent(TRACE_NORMAL, "Opened %u TAP queues on %s", device->num_queues, device->dev_name);
+#endif
+
   return(device->fd);
 }
 
 /* *************************************************** */
 
+int tuntap_open(tuntap_dev *device,
+                char *dev, /* user-definable interface name, eg. edge0 */
+                const char *address_mode, /* static or dhcp */
+                char *device_ip,
+                char *device_mask,
+                const char * device_mac,
+                int mtu) {
+  return(tuntap_open_ext(device, dev, address_mode, device_ip, device_mask, device_mac, mtu, 1, 0));
+}
+
+/* *************************************************** */
+
 int tuntap_read(struct tuntap_dev *tuntap, unsigned char *buf, int len) {
+#ifdef N2N_HAVE_TAP_OFFLOAD
+  if(tuntap->offload) {
+    struct virtio_net_hdr vnet_hdr;
+
+    return(tuntap_read_offload(tuntap, &vnet_hdr, buf, len));
+  }
+#endif
+
   return(read(tuntap->fd, buf, len));
 }
 
 /* *************************************************** */
 
 int tuntap_write(struct tuntap_dev *tuntap, unsigned char *buf, int len) {
+#ifdef N2N_HAVE_TAP_OFFLOAD
+  if(tuntap->offload) {
+    /* no offload requested: checksums are complete, no segmentation */
+    struct virtio_net_hdr vnet_hdr;
+    struct iovec iov[2];
+    int rc;
+
+    memset(&vnet_hdr, 0, sizeof(vnet_hdr));
+    iov[0].iov_base = &vnet_hdr;
+    iov[0].iov_len = sizeof(vnet_hdr);
+    iov[1].iov_base = buf;
+    iov[1].iov_len = len;
+
+    rc = writev(tuntap->fd, iov, 2);
+
+    return((rc < (int)sizeof(vnet_hdr)) ? rc : (rc - (int)sizeof(vnet_hdr)));
+  }
+#endif
+
   return(write(tuntap->fd, buf, len));
 }
 
 /* *************************************************** */
 
+#ifdef N2N_HAVE_TAP_OFFLOAD
+
+/** Read a frame along with its virtio-net header from a TAP opened with
+ *  offloads. The frame may be a TCP super-frame of up to 64 KB.
+ *
+ *  @return the frame length (without the header) or -1 on error
+ */
+int tuntap_read_offload(struct tuntap_dev *tuntap, struct virtio_net_hdr *vnet_hdr,
+                        unsigned char *buf, int len) {
+  struct iovec iov[2];
+  int rc;
+
+  iov[0].iov_base = vnet_hdr;
+  iov[0].iov_len = sizeof(*vnet_hdr);
+  iov[1].iov_base = buf;
+  iov[1].iov_len = len;
+
+  rc = readv(tuntap->fd, iov, 2);
+
+  if((rc >= 0) && (rc < (int)sizeof(*vnet_hdr))) {
+    errno = EINVAL;
+    return(-1);
+  }
+
+  return((rc < 0) ? rc : (rc - (int)sizeof(*vnet_hdr)));
+}
+
+/* *************************************************** */
+
+static uint32_t csum_add(uint32_t sum, const uint8_t *data, size_t len) {
+  while(len > 1) {
+    sum += (data[0] << 8) | data[1];
+    data += 2;
+    len -= 2;
+  }
+
+  if(len)
+    sum += data[0] << 8;
+
+  return(sum);
+}
+
+static uint16_t csum_fold(uint32_t sum) {
+  while(sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+
+  return((uint16_t)~sum);
+}
+
+static void put_uint16(uint8_t *p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v & 0xff;
+}
+
+static void put_uint32(uint8_t *p, uint32_t v) {
+  put_uint16(p, v >> 16);
+  put_uint16(p + 2, v & 0xffff);
+}
+
+/* *************************************************** */
+
+#define TCP_FLAG_FIN 0x01
+#define TCP_FLAG_PSH 0x08
+#define TCP_FLAG_CWR 0x80
+
+/** Turn a frame read with tuntap_read_offload() into regular frames and hand
+ *  them to cb():
+ *
+ *  - a frame with a partial checksum gets it completed in place
+ *  - a TCP (v4 or v6) super-frame is split into gso_size sized segments,
+ *    which get built in seg_buf with their own length, IP ID, sequence
+ *    number, flags and checksums
+ *
+ *  @return the number of frames passed to cb(), -1 for a frame which cannot
+ *          be handled
+ */
+int tuntap_offload_segment(const struct virtio_net_hdr *vnet_hdr,
+                           uint8_t *frame, size_t len,
+                           uint8_t *seg_buf, size_t seg_size,
+                           tuntap_frame_cb_f cb, void *arg) {
+  uint8_t gso_type = vnet_hdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+  size_t l3_off, l4_off, tcp_hlen, hdr_len, payload_len, off;
+  uint32_t seq, pseudo_sum;
+  uint16_t ip_id = 0;
+  int num_segs = 0;
+
+  if(gso_type == VIRTIO_NET_HDR_GSO_NONE) {
+    if(vnet_hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+      /* the checksum field holds the pseudo header sum */
+      size_t csum_off = vnet_hdr->csum_start + vnet_hdr->csum_offset;
+
+      if((vnet_hdr->csum_start >= len) || (csum_off + 2 > len))
+        return(-1);
+
+      put_uint16(&frame[csum_off], csum_fold(csum_add(0, &frame[vnet_hdr->csum_start], len - vnet_hdr->csum_start)));
+    }
+
+    cb(arg, frame, len);
+    return(1);
+  }
+
+  if((gso_type != VIRTIO_NET_HDR_GSO_TCPV4) && (gso_type != VIRTIO_NET_HDR_GSO_TCPV6))
+    return(-1);
+
+  l3_off = ((frame[12] == 0x81) && (frame[13] == 0x00)) ? 18 /* VLAN */ : 14;
+  l4_off = vnet_hdr->csum_start;
+
+  /* the TCP header follows the IPv4 (20) or IPv6 (40 bytes) header */
+  if((vnet_hdr->gso_size == 0) || (l4_off < l3_off + ((gso_type == VIRTIO_NET_HDR_GSO_TCPV4) ? 20 : 40))
+     || (l4_off + 20 > len))
+    return(-1);
+
+  tcp_hlen = (frame[l4_off + 12] >> 4) * 4;
+  hdr_len = l4_off + tcp_hlen;
+
+  if((tcp_hlen < 20) || (hdr_len > len))
+    return(-1);
+
+  payload_len = len - hdr_len;
+  seq = ((uint32_t)frame[l4_off + 4] << 24) | (frame[l4_off + 5] << 16) | (frame[l4_off + 6] << 8) | frame[l4_off + 7];
+
+  if(gso_type == VIRTIO_NET_HDR_GSO_TCPV4) {
+    ip_id = (frame[l3_off + 4] << 8) | frame[l3_off + 5];
+    pseudo_sum = csum_add(0, &frame[l3_off + 12], 8 /* addresses */);
+  } else
+    pseudo_sum = csum_add(0, &frame[l3_off + 8], 32 /* addresses */);
+
+  pseudo_sum += IPPROTO_TCP;
+
+  for(off = 0; off < payload_len; off += vnet_hdr->gso_size, num_segs++) {
+    size_t seg_payload = min(vnet_hdr->gso_size, payload_len - off);
+    size_t tcp_len = tcp_hlen + seg_payload;
+    uint8_t *ip = &seg_buf[l3_off];
+    uint8_t *tcp = &seg_buf[l4_off];
+
+    if(hdr_len + seg_payload > seg_size)
+      return(-1);
+
+    memcpy(seg_buf, frame, hdr_len);
+    memcpy(&seg_buf[hdr_len], &frame[hdr_len + off], seg_payload);
+
+    if(gso_type == VIRTIO_NET_HDR_GSO_TCPV4) {
+      size_t ihl = (ip[0] & 0x0f) * 4;
+
+      put_uint16(&ip[2], (l4_off - l3_off) + tcp_len);
+      put_uint16(&ip[4], ip_id + num_segs);
+      put_uint16(&ip[10], 0);
+      put_uint16(&ip[10], csum_fold(csum_add(0, ip, ihl)));
+    } else
+      /* payload length: extension headers and TCP */
+      put_uint16(&ip[4], (l4_off - l3_off - 40) + tcp_len);
+
+    put_uint32(&tcp[4], seq + off);
+
+    if(off + seg_payload < payload_len)
+      tcp[13] &= ~(TCP_FLAG_FIN | TCP_FLAG_PSH);
+    if(off > 0)
+      tcp[13] &= ~TCP_FLAG_CWR;
+
+    put_uint16(&tcp[16], 0);
+    put_uint16(&tcp[16], csum_fold(csum_add(pseudo_sum + tcp_len, tcp, tcp_len)));
+
+    cb(arg, seg_buf, hdr_len + seg_payload);
+  }
+
+  return(num_segs);
+}
+
+#endif /* N2N_HAVE_TAP_OFFLOAD */
+
+/* *************************************************** */
+
 void tuntap_close(struct tuntap_dev *tuntap) {
+  int i;
+
+  for(i = 1; i < tuntap->num_queues; i++)
+    close(tuntap->queue_fd[i]);
+
+  tuntap->num_queues = 1;
   close(tuntap->fd);
 }
 
@@ -0,0 +1,175 @@
+/**
+ * (C) 2007-20 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/* Minimal io_uring helpers on top of the raw system calls, just what the
+ * edge's io_uring main loop needs: set up and map a ring, prepare SQEs,
+ * submit them and reap the CQEs. */
+
+#include "n2n.h"
+
+#ifdef N2N_HAVE_IO_URING
+
+#include <sys/syscall.h>
+
+/* ********************************** */
+
+int uring_init(n2n_uring_t *ring, unsigned int entries) {
+  struct io_uring_params p;
+  uint8_t *sq_ptr, *cq_ptr;
+
+  memset(ring, 0, sizeof(*ring));
+  memset(&p, 0, sizeof(p));
+
+  ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if(ring->fd < 0) {
+    traceEvent(TRACE_WARNING, "io_uring_setup() failed [%d]: %s", errno, strerror(errno));
+    return(-1);
+  }
+
+  if(!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    traceEvent(TRACE_WARNING, "io_uring: kernel too old");
+    close(ring->fd);
+    return(-1);
+  }
+
+  /* the SQ and the CQ ring share one mapping */
+  ring->ring_size = max(p.sq_off.array + p.sq_entries * sizeof(uint32_t),
+			p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe));
+  ring->ring_ptr = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if(ring->ring_ptr == MAP_FAILED) {
+    close(ring->fd);
+    return(-1);
+  }
+
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if(ring->sqes == MAP_FAILED) {
+    munmap(ring->ring_ptr, ring->ring_size);
+    close(ring->fd);
+    return(-1);
+  }
+
+  sq_ptr = cq_ptr = (uint8_t*)ring->ring_ptr;
+  ring->sq_head = (unsigned int*)(sq_ptr + p.sq_off.head);
+  ring->sq_tail = (unsigned int*)(sq_ptr + p.sq_off.tail);
+  ring->sq_mask = *(unsigned int*)(sq_ptr + p.sq_off.ring_mask);
+  ring->sq_entries = p.sq_entries;
+  ring->sq_array = (unsigned int*)(sq_ptr + p.sq_off.array);
+  ring->cq_head = (unsigned int*)(cq_ptr + p.cq_off.head);
+  ring->cq_tail = (unsigned int*)(cq_ptr + p.cq_off.tail);
+  ring->cq_mask = *(unsigned int*)(cq_ptr + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)(cq_ptr + p.cq_off.cqes);
+  ring->sqe_tail = *ring->sq_tail;
+
+  return(0);
+}
+
+/* ********************************** */
+
+void uring_exit(n2n_uring_t *ring) {
+  if(ring->fd < 0)
+    return;
+
+  munmap(ring->sqes, ring->sqes_size);
+  munmap(ring->ring_ptr, ring->ring_size);
+  close(ring->fd);
+  ring->fd = -1;
+}
+
+/* ********************************** */
+
+/* Make the prepared SQEs visible to the kernel. */
+static unsigned int uring_flush_sq(n2n_uring_t *ring) {
+  unsigned int tail = *ring->sq_tail;
+  unsigned int to_submit = ring->sqe_tail - tail;
+
+  for(; tail != ring->sqe_tail; tail++)
+    ring->sq_array[tail & ring->sq_mask] = tail & ring->sq_mask;
+
+  __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+  return(to_submit);
+}
+
+/* ********************************** */
+
+/** Submit the prepared SQEs and wait for at least wait_nr completions, with
+ *  a single system call. */
+int uring_submit(n2n_uring_t *ring, unsigned int wait_nr) {
+  unsigned int to_submit = uring_flush_sq(ring);
+  int rc;
+
+  if((to_submit == 0) && (wait_nr == 0))
+    return(0);
+
+  rc = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr,
+	       wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+  return((rc < 0) ? -1 : rc);
+}
+
+/* ********************************** */
+
+/** Return a zeroed SQE to prepare. Should the SQ be full, what has been
+ *  prepared so far is submitted first. */
+struct io_uring_sqe* uring_get_sqe(n2n_uring_t *ring) {
+  struct io_uring_sqe *sqe;
+
+  if(ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+    if(uring_submit(ring, 0) < 0)
+      return(NULL);
+
+    if(ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+      return(NULL);
+  }
+
+  sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+  ring->sqe_tail++;
+  memset(sqe, 0, sizeof(*sqe));
+
+  return(sqe);
+}
+
+/* ********************************** */
+
+/** Return the next completion, or NULL if there is none. It has to be
+ *  released with uring_cqe_seen() once processed. */
+struct io_uring_cqe* uring_peek_cqe(n2n_uring_t *ring) {
+  unsigned int head = *ring->cq_head;
+
+  if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    return(NULL);
+
+  return(&ring->cqes[head & ring->cq_mask]);
+}
+
+/* ********************************** */
+
+void uring_cqe_seen(n2n_uring_t *ring) {
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/* ********************************** */
+
+int uring_register(n2n_uring_t *ring, unsigned int opcode, void *arg, unsigned int nr_args) {
+  return(syscall(__NR_io_uring_register, ring->fd, opcode, arg, nr_args));
+}
+
+#endif /* #ifdef N2N_HAVE_IO_URING */
@@ -288,6 +288,10 @@ int encode_REGISTER(uint8_t *base,
   }
   retval += encode_uint32(base, idx, reg->dev_addr.net_addr);
   retval += encode_uint8(base, idx, reg->dev_addr.net_bitlen);
+  /* trailing, ignored by older edges */
+  if (0 != reg->zstd_dict_id) {
+    retval += encode_uint32(base, idx, reg->zstd_dict_id);
+  }
 
   return retval;
 }
@@ -309,6 +313,9 @@ int decode_REGISTER(n2n_REGISTER_t *reg,
   }
   retval += decode_uint32(&(reg->dev_addr.net_addr), base, rem, idx);
   retval += decode_uint8(&(reg->dev_addr.net_bitlen), base, rem, idx);
+  if (*rem >= 4) {
+    retval += decode_uint32(&(reg->zstd_dict_id), base, rem, idx);
+  }
 
   return retval;
 }
@@ -365,6 +372,10 @@ int encode_REGISTER_ACK(uint8_t *base,
   if (0 != reg->sock.family) {
     retval += encode_sock(base, idx, &(reg->sock));
   }
+  /* trailing, ignored by older edges */
+  if (0 != reg->zstd_dict_id) {
+    retval += encode_uint32(base, idx, reg->zstd_dict_id);
+  }
 
   return retval;
 }
@@ -387,6 +398,9 @@ int decode_REGISTER_ACK(n2n_REGISTER_ACK_t *reg,
   if (cmn->flags & N2N_FLAGS_SOCKET) {
     retval += decode_sock(&(reg->sock), base, rem, idx);
   }
+  if (*rem >= 4) {
+    retval += decode_uint32(&(reg->zstd_dict_id), base, rem, idx);
+  }
 
   return retval;
 }
@@ -484,6 +498,20 @@ int encode_PACKET( uint8_t * base,
 }
 
 
+int encode_PACKET_aad( uint8_t * base,
+                       size_t * idx,
+                       const n2n_PACKET_t * pkt )
+{
+  int retval=0;
+  retval += encode_mac( base, idx, pkt->srcMac );
+  retval += encode_mac( base, idx, pkt->dstMac );
+  retval += encode_uint8( base, idx, pkt->compression );
+  retval += encode_uint8( base, idx, pkt->transform );
+
+  return retval;
+}
+
+
 int decode_PACKET( n2n_PACKET_t * pkt,
                    const n2n_common_t * cmn, /* info on how to interpret it */
                    const uint8_t * base,
@@ -65,6 +65,9 @@ int main(int argc, char * argv[]) {
   n2n_trans_op_t transop_null, transop_tf;
   n2n_trans_op_t transop_aes;
   n2n_trans_op_t transop_cc20;
+  n2n_trans_op_t transop_aes_gcm;
+  n2n_trans_op_t transop_cc20_poly1305;
+  n2n_trans_op_t transop_aes_ctr;
 
   n2n_trans_op_t transop_speck;
   n2n_edge_conf_t conf;
@@ -82,6 +85,9 @@ int main(int argc, char * argv[]) {
   n2n_transop_aes_init(&conf, &transop_aes);
   n2n_transop_cc20_init(&conf, &transop_cc20);
   n2n_transop_speck_init(&conf, &transop_speck);
+  n2n_transop_aes_gcm_init(&conf, &transop_aes_gcm);
+  n2n_transop_cc20_poly1305_init(&conf, &transop_cc20_poly1305);
+  n2n_transop_aes_ctr_init(&conf, &transop_aes_ctr);
   
   /* Run the tests */
   run_transop_benchmark("transop_null", &transop_null, &conf, pktbuf);
@@ -89,6 +95,9 @@ int main(int argc, char * argv[]) {
   run_transop_benchmark("transop_aes", &transop_aes, &conf, pktbuf);
   run_transop_benchmark("transop_cc20", &transop_cc20, &conf, pktbuf);
   run_transop_benchmark("transop_speck", &transop_speck, &conf, pktbuf);
+  run_transop_benchmark("transop_aes_gcm", &transop_aes_gcm, &conf, pktbuf);
+  run_transop_benchmark("transop_cc20_poly1305", &transop_cc20_poly1305, &conf, pktbuf);
+  run_transop_benchmark("transop_aes_ctr", &transop_aes_ctr, &conf, pktbuf);
 
   /* Cleanup */
   transop_null.deinit(&transop_null);
@@ -96,6 +105,9 @@ int main(int argc, char * argv[]) {
   transop_aes.deinit(&transop_aes);
   transop_cc20.deinit(&transop_cc20);
   transop_speck.deinit(&transop_speck);
+  transop_aes_gcm.deinit(&transop_aes_gcm);
+  transop_cc20_poly1305.deinit(&transop_cc20_poly1305);
+  transop_aes_ctr.deinit(&transop_aes_ctr);
 
   return 0;
 }
@@ -0,0 +1,136 @@
+/**
+ * (C) 2007-20 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/* Trains a zstd dictionary on the frames of a PCAP captured on the TAP
+ * interface of an edge, to be loaded by the edges of the community with -Z. */
+
+#include <pcap.h>
+#include <zdict.h>
+#include "n2n.h"
+
+#define DEFAULT_DICT_SIZE       (16 * 1024)
+#define MAX_SAMPLES             (128 * 1024)
+#define MAX_SAMPLES_SIZE        (64 * 1024 * 1024)
+
+/* *************************************************** */
+
+static void help() {
+  fprintf(stderr, "n2n-zstd-train -r pcap -o dictionary [-s size] [-v]\n");
+  fprintf(stderr, "-r <pcap>                | PCAP of the traffic on the TAP interface of an edge.\n");
+  fprintf(stderr, "-o <dictionary>          | Write the dictionary to this file, load it with edge -Z.\n");
+  fprintf(stderr, "-s <size>                | Dictionary size in bytes (default %u).\n", DEFAULT_DICT_SIZE);
+  fprintf(stderr, "-v                       | Increase verbosity level.\n");
+
+  exit(0);
+}
+
+/* *************************************************** */
+
+int main(int argc, char* argv[]) {
+  u_char c;
+  char *in_fname = NULL, *out_fname = NULL;
+  char errbuf[PCAP_ERRBUF_SIZE];
+  size_t dict_size = DEFAULT_DICT_SIZE, samples_len = 0, rv;
+  unsigned int num_samples = 0;
+  uint8_t *samples, *dict;
+  size_t *sample_sizes;
+  struct pcap_pkthdr *hdr;
+  const u_char *pkt;
+  pcap_t *handle;
+  FILE *outf;
+
+  while((c = getopt(argc, argv, "r:o:s:v")) != '?') {
+    if(c == 255) break;
+
+    switch(c) {
+    case 'r':
+      in_fname = strdup(optarg);
+      break;
+    case 'o':
+      out_fname = strdup(optarg);
+      break;
+    case 's':
+      dict_size = atoi(optarg);
+      break;
+    case 'v': /* verbose */
+      setTraceLevel(getTraceLevel() + 1);
+      break;
+    default:
+      help();
+    }
+  }
+
+  if((in_fname == NULL) || (out_fname == NULL) || (dict_size == 0))
+    help();
+
+  if((handle = pcap_open_offline(in_fname, errbuf)) == NULL) {
+    traceEvent(TRACE_ERROR, "Cannot open %s: %s", in_fname, errbuf);
+    return(1);
+  }
+
+  if(pcap_datalink(handle) != DLT_EN10MB) {
+    traceEvent(TRACE_ERROR, "%s doesn't contain Ethernet frames - not supported", in_fname);
+    return(2);
+  }
+
+  samples = (uint8_t*)malloc(MAX_SAMPLES_SIZE);
+  sample_sizes = (size_t*)malloc(MAX_SAMPLES * sizeof(size_t));
+  dict = (uint8_t*)malloc(dict_size);
+
+  if(!samples || !sample_sizes || !dict) {
+    traceEvent(TRACE_ERROR, "Cannot allocate memory");
+    return(3);
+  }
+
+  /* each frame is one sample, as the edge compresses them one by one */
+  while((num_samples < MAX_SAMPLES) && (pcap_next_ex(handle, &hdr, &pkt) == 1)) {
+    if((hdr->caplen > N2N_PKT_BUF_SIZE) || (samples_len + hdr->caplen > MAX_SAMPLES_SIZE))
+      continue;
+
+    memcpy(samples + samples_len, pkt, hdr->caplen);
+    samples_len += hdr->caplen;
+    sample_sizes[num_samples++] = hdr->caplen;
+  }
+
+  pcap_close(handle);
+
+  traceEvent(TRACE_NORMAL, "Training on %u frames [%lu bytes]", num_samples, (unsigned long)samples_len);
+
+  rv = ZDICT_trainFromBuffer(dict, dict_size, samples, sample_sizes, num_samples);
+
+  if(ZDICT_isError(rv)) {
+    traceEvent(TRACE_ERROR, "Training failed: %s", ZDICT_getErrorName(rv));
+    return(4);
+  }
+
+  if(((outf = fopen(out_fname, "wb")) == NULL) || (fwrite(dict, 1, rv, outf) != rv)) {
+    traceEvent(TRACE_ERROR, "Could not write %s: %s", out_fname, strerror(errno));
+    return(5);
+  }
+
+  fclose(outf);
+
+  traceEvent(TRACE_NORMAL, "Wrote dictionary %s [id %u, %lu bytes]", out_fname,
+             ZDICT_getDictID(dict, rv), (unsigned long)rv);
+
+  free(dict);
+  free(sample_sizes);
+  free(samples);
+
+  return(0);
+}